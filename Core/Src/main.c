@@ -259,6 +259,7 @@ void assert_failed(uint8_t *file, uint32_t line)
   /* USER CODE BEGIN 6 */
   /* User can add his own implementation to report the file name and line number,
      ex: printf("Wrong parameters value: file %s on line %d\r\n", file, line) */
+  main_app_assert_failed( (const char*)file, line );
   /* USER CODE END 6 */
 }
 #endif /* USE_FULL_ASSERT */
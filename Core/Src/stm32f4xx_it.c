@@ -22,6 +22,7 @@
 #include "stm32f4xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "main_app.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -84,7 +85,8 @@ void NMI_Handler(void)
 void HardFault_Handler(void)
 {
   /* USER CODE BEGIN HardFault_IRQn 0 */
-
+  /* LR is still EXC_RETURN, the CFA is the stack pointer before the prologue of this function */
+  main_app_hard_fault( (uint32_t)__builtin_return_address(0), (uint32_t*)__builtin_dwarf_cfa() );
   /* USER CODE END HardFault_IRQn 0 */
   while (1)
   {
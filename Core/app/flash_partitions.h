@@ -0,0 +1,30 @@
+/*
+ * Partitions of the flash, the single source of the FLASH_FS layout.
+ *
+ * The FLASH_FS region and the partition symbols of STM32F401RETX_FLASH.ld
+ * are generated from this table. After changing it, run
+ *
+ *   tools/partition_ld --update STM32F401RETX_FLASH.ld
+ *
+ * No HAL is included, so tools/partition_ld can include it too.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef APP_FLASH_PARTITIONS_H_
+#define APP_FLASH_PARTITIONS_H_
+
+#include <FlashPartitions.h>
+
+/*
+ * Sector 0 holds the vector table, sectors 5 and 6 the code,
+ * sector 7 is reserved for the crash records.
+ */
+static constexpr auto flash_partitions = stm32_internal_flash::make_partition_table<stm32_internal_flash::geometry::Device::F401xE>( {
+	{ "config",      0x08004000, 16*1024 },  // sector 1, FlashVars, see .flashfs_data
+	{ "calibration", 0x08008000, 16*1024 },  // sector 2
+	{ "kv",          0x0800C000, 16*1024 },  // sector 3
+	{ "log",         0x08010000, 64*1024 },  // sector 4
+} );
+
+#endif /* APP_FLASH_PARTITIONS_H_ */
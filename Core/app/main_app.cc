@@ -15,13 +15,33 @@
 #include <memory>
 
 #include <stm32_internal_flash_raw.h>
+#include <stm32_internal_flash_ramfunc.h>
 #include <GenericFlashDriver.h>
 #include <JBODGenericFlashDriver.h>
+#include <IncrementalWriter.h>
+#include <QueuedMemoryInterface.h>
+#include <AsyncFlashDriver.h>
+#include <CircularLog.h>
+#include <FlashCounter.h>
+#include <FlashVar.h>
+#include <SlotManager.h>
+#include <DeltaPatch.h>
+#include <CompressedMemoryInterface.h>
+#include <LzCodec.h>
+#include <Checkpoint.h>
+#include <FlashFs.h>
+#include <stm32_internal_flash_crash_recorder.h>
+#include <TracingMemoryInterface.h>
+#include <BulkReader.h>
+#include <stm32_internal_flash_dma_copy.h>
+#include <PartitionMemoryInterface.h>
+#include <PreErasePool.h>
 
 using namespace Tools;
 
-// pointer to flash space, automatically mapped by processor
-volatile uint8_t flashFsData[112*1024] __attribute__ ((section(".flashfs_data")));
+// generated into the linker script by tools/partition_ld, the address is the value
+extern "C" const std::byte _flash_partitions_start[], _flash_partitions_size[];
+extern "C" const std::byte _partition_kv_start[], _partition_kv_size[];
 
 static const char MESSAGE1_INIT_NO_HAL[] { "Message 1, written before HAL init." };
 static const char MESSAGE2[] { "Message 2, write accross sectors." };
@@ -33,10 +53,103 @@ static const unsigned MESSAGE3_OFFSET = 16*1024*3-10;
 static const char MESSAGE4[] { "Message 4, write accross sectors with external buffer." };
 static const unsigned MESSAGE4_OFFSET = 16*1024-10;
 
+static const char MESSAGE5[] { "Message 5, write accross sectors with different size, single driver." };
+static const unsigned MESSAGE5_OFFSET = 16*1024*3-20;
+
+static const char MESSAGE6[] { "Message 6, written in small steps from the superloop." };
+static const unsigned MESSAGE6_OFFSET = 16*1024*2-30;
+
+static const char MESSAGE7[] { "Message 7, queued and written by the worker." };
+static const unsigned MESSAGE7_OFFSET = 16*1024-40;
+
+static const char MESSAGE8[] { "Message 8, erased, written and verified by a coroutine." };
+static const unsigned MESSAGE8_OFFSET = 16*1024*2;
+
+static const char MESSAGE9[] { "Message 9, a FlashVar placed by the linker." };
+
+// FlashCounter pages, offsets of flash_fs_16k_sectors.
+// Later tests erase these sectors, so test_flash_counter() resets the MCU
+// and test_flash_counter_after_reset() reads the value back before them.
+static const unsigned COUNTER_PAGE_A_OFFSET = 16*1024;   // sector 2
+static const unsigned COUNTER_PAGE_B_OFFSET = 16*1024*2; // sector 3
+
+// the expected counter value, kept in .noinit over the software reset
+struct CounterResetCheck {
+	uint32_t magic;
+	uint32_t expected;
+	uint32_t expected_inv;
+};
+
+static const uint32_t COUNTER_RESET_CHECK_MAGIC = 0x52534554; // 'RSET'
+
+__attribute__((section(".noinit"))) static CounterResetCheck counter_reset_check;
+
+// set, if this boot already checked the counter after a reset
+static bool counter_reset_checked = false;
+
+// the FlashVars of .flashfs_data are in the config partition
+static_assert( flash_partitions.get_start_address() + COUNTER_PAGE_A_OFFSET >= flash_partitions.get( "config" ).get_end_address(),
+		"the counter must not share a sector with the FlashVars" );
+
+// SlotManager journal pages, offsets of flash_fs_16k_sectors
+static const unsigned SLOT_JOURNAL_A_OFFSET = 16*1024;   // sector 2
+static const unsigned SLOT_JOURNAL_B_OFFSET = 16*1024*2; // sector 3
+
+static_assert( flash_partitions.get_start_address() + SLOT_JOURNAL_A_OFFSET >= flash_partitions.get( "config" ).get_end_address(),
+		"the slot journal must not share a sector with the FlashVars" );
+
+static const char MESSAGE10[] { "Message 10, inserted by a delta patch." };
+static const unsigned MESSAGE10_OFFSET = 5000;
+
+struct FlashMessage {
+	char text[64];
+	uint32_t write_count;
+};
+
+// placed by the linker at the start of FLASH_FS
+STM32_INTERNAL_FLASH_FLASHFS_DATA static stm32_internal_flash::FlashStorage<FlashMessage> message9_storage;
+
 static std::array<std::byte,16*1024> external_buffer;
 static std::span<std::byte> span_external_buffer = std::span<std::byte>(external_buffer);
 
 namespace {
+	void enable_cycle_counter() {
+		if( !(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) ) {
+			CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+			DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+		}
+	}
+
+	/**
+	 * The cycle counter wraps around after 2^32 cycles, about 51s at 84MHz.
+	 * So only the difference of two raw values is valid.
+	 */
+	uint32_t get_cycles() {
+		enable_cycle_counter();
+		return DWT->CYCCNT;
+	}
+
+	/**
+	 * Microseconds, built from the differences of the cycle counter, so the
+	 * value wraps around at 2^32us and end - start is always valid. Also the
+	 * clock of the drivers in the tests. Has to be called at least every 51s.
+	 */
+	uint32_t get_microseconds() {
+		static uint32_t last_cycles = get_cycles();
+		static uint32_t microseconds = 0;
+		static uint64_t rest_cycles = 0;
+
+		const uint32_t now = get_cycles();
+		const uint32_t cycles_per_us = SystemCoreClock / 1000000;
+		const uint64_t cycles = static_cast<uint32_t>( now - last_cycles ) + rest_cycles;
+
+		microseconds += static_cast<uint32_t>( cycles / cycles_per_us );
+		rest_cycles = cycles % cycles_per_us;
+		last_cycles = now;
+
+		return microseconds;
+	}
+
 	std::span<const std::byte> to_span( const char* data ) {
 		return std::span<const std::byte>(reinterpret_cast<const std::byte*>(data), strlen(data)+1);
 	}
@@ -44,8 +157,45 @@ namespace {
 	std::string to_string( const std::span<std::byte> & data ) {
 		return reinterpret_cast<const char*>(data.data());
 	}
+
+	// sector 7 is reserved for it in the linker script
+	stm32_internal_flash::CrashRecorder crash_recorder( ADDRESS_FLASH_SECTOR_7, 128*1024 );
+
+	/**
+	 * keeps the last lines for the crash record
+	 */
+	class CrashRecordingOutDebug : public SimpleOutDebug
+	{
+	public:
+		using SimpleOutDebug::add;
+
+		void add( const char *file, unsigned line, const char *function, const std::string & s ) override {
+			crash_recorder.remember_line( s );
+			SimpleOutDebug::add( file, line, function, s );
+		}
+	};
 } // namespace
 
+void main_app_hard_fault( uint32_t exc_return, uint32_t *msp )
+{
+	crash_recorder.record_hard_fault( exc_return, msp );
+}
+
+void main_app_assert_failed( const char *file, uint32_t line )
+{
+	crash_recorder.record( stm32_internal_flash::CrashRecorder::Reason::Assert, file, line );
+}
+
+// failed assert() of the C library
+extern "C" void __assert_func( const char *file, int line, const char *function, const char *expression )
+{
+	main_app_assert_failed( file, line );
+
+	__disable_irq();
+
+	while( true ) {}
+}
+
 
 //////////// Test 1: Write to flash before HAL_Init //////////////
 
@@ -111,6 +261,44 @@ void test_generic()
 	CPPDEBUG( format("%s: \"%s\" => %s", __FUNCTION__, sread, sread == MESSAGE2 ? "Ok" : "ERROR" ));
 }
 
+/**
+ * The second erase of a sector finds it blank and skips it
+ */
+void test_skip_erase_of_blank_pages()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_16k_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+	GenericFlashDriver driver( raw_driver );
+
+	// the last 16k sector
+	const std::size_t offset = 2*16*1024;
+
+	bool ok = driver.write( offset, to_span( MESSAGE2 ) ) == sizeof(MESSAGE2);
+
+	uint32_t start = get_microseconds();
+	ok = ok && driver.erase( offset, 16*1024 );
+	const uint32_t erase_us = get_microseconds() - start;
+	const std::size_t skipped_before = driver.get_skipped_erases();
+
+	start = get_microseconds();
+	ok = ok && driver.erase( offset, 16*1024 );
+	const uint32_t skipped_erase_us = get_microseconds() - start;
+
+	ok = ok && skipped_before == 0 && driver.get_skipped_erases() == 1 &&
+			raw_driver.is_blank( offset, 16*1024 );
+
+	CPPDEBUG( format("%s: erase %dus, blank sector %dus, %d skipped => %s",
+			__FUNCTION__,
+			erase_us,
+			skipped_erase_us,
+			driver.get_skipped_erases(),
+			ok ? "Ok" : "ERROR" ));
+}
+
 void test_jbod()
 {
 	using namespace stm32_internal_flash;
@@ -136,7 +324,7 @@ void test_jbod()
 	// We have not enough RAM to allocate a buffer of 64k,
 	// so turn of restoring data. Now on write the whole page will be
 	// erased.
-	driver.properties.RestoreDataOnUnaligendWrites = false;
+	driver.MemoryInterface::properties.RestoreDataOnUnaligendWrites = false;
 	driver.write(MESSAGE3_OFFSET, to_span(MESSAGE3));
 
 	std::array<std::byte,100> buffer = {};
@@ -172,17 +360,1342 @@ void test_generic_external_buffer()
 	CPPDEBUG( format("%s: \"%s\" => %s", __FUNCTION__, sread, sread == MESSAGE4 ? "Ok" : "ERROR" ));
 }
 
+void test_mixed_sector_sizes()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+	GenericFlashDriver driver( raw_driver );
+
+	// Not enough RAM for restoring a 64k sector
+	driver.MemoryInterface::properties.RestoreDataOnUnaligendWrites = false;
+	driver.write(MESSAGE5_OFFSET, to_span(MESSAGE5));
+
+	std::array<std::byte,100> buffer = {};
+	std::span<std::byte> read_span(buffer);
+
+	driver.read(MESSAGE5_OFFSET,read_span);
+	std::string sread = to_string(read_span);
+
+	CPPDEBUG( format("%s: \"%s\" => %s", __FUNCTION__, sread, sread == MESSAGE5 ? "Ok" : "ERROR" ));
+}
+
+//////////// Interrupt latency while the flash is busy //////////////
+
+namespace {
+	volatile uint32_t timer_isr_last_cycle = 0;
+	volatile uint32_t timer_isr_max_cycles = 0;
+}
+
+/**
+ * Located in RAM, so it can run while the flash is erased.
+ * Measures the longest gap between two timer interrupts.
+ */
+static STM32_INTERNAL_FLASH_RAMFUNC void timer_isr_ram()
+{
+	TIM2->SR = ~TIM_SR_UIF;
+
+	const uint32_t now = DWT->CYCCNT;
+
+	if( timer_isr_last_cycle != 0 && now - timer_isr_last_cycle > timer_isr_max_cycles ) {
+		timer_isr_max_cycles = now - timer_isr_last_cycle;
+	}
+
+	timer_isr_last_cycle = now;
+}
+
+static uint32_t measure_max_isr_gap_us_while_erasing( bool execute_from_ram )
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_16k_sectors;
+	conf.execute_from_ram = execute_from_ram;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+
+	timer_isr_last_cycle = 0;
+	timer_isr_max_cycles = 0;
+
+	TIM2->CNT = 0;
+	TIM2->CR1 |= TIM_CR1_CEN;
+
+	raw_driver.erase_page( 0, 16*1024 );
+
+	TIM2->CR1 &= ~TIM_CR1_CEN;
+
+	return timer_isr_max_cycles / (SystemCoreClock / 1000000);
+}
+
+/**
+ * A 10kHz timer interrupt is running, while a sector is erased,
+ * once with the HAL functions and once with the functions located in RAM.
+ */
+void test_isr_latency_while_erasing()
+{
+	// the ISR measures with the cycle counter
+	enable_cycle_counter();
+
+	__HAL_RCC_TIM2_CLK_ENABLE();
+	TIM2->PSC = 0;
+	// APB1 is divided by 2, so the timer clock is HCLK
+	TIM2->ARR = SystemCoreClock / 10000 - 1;
+	TIM2->DIER = TIM_DIER_UIE;
+
+	if( !stm32_internal_flash::ramfunc::set_irq_handler( TIM2_IRQn, timer_isr_ram ) ) {
+		CPPDEBUG( format("%s: TIM2 is not in the vector table => ERROR", __FUNCTION__ ));
+		return;
+	}
+
+	// SysTick has priority 0 too and its handler is in flash, so a tick
+	// during the erase would stall and delay TIM2. No ticks while measuring.
+	NVIC_SetPriority( TIM2_IRQn, 0 );
+	NVIC_EnableIRQ( TIM2_IRQn );
+	HAL_SuspendTick();
+
+	const uint32_t gap_hal = measure_max_isr_gap_us_while_erasing( false );
+	const uint32_t gap_ram = measure_max_isr_gap_us_while_erasing( true );
+
+	HAL_ResumeTick();
+	NVIC_DisableIRQ( TIM2_IRQn );
+
+	CPPDEBUG( format("%s: max gap between interrupts: HAL: %dus RAM: %dus => %s",
+			__FUNCTION__, gap_hal, gap_ram, gap_ram < 1000 ? "Ok" : "ERROR" ));
+}
+
+void test_incremental_writer()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_16k_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+
+	IncrementalWriter writer( raw_driver, get_microseconds );
+
+	writer.start(MESSAGE6_OFFSET, to_span(MESSAGE6), &span_external_buffer);
+
+	unsigned steps = 0;
+
+	// this would be the superloop
+	while( !writer.done() ) {
+		writer.step_microseconds(200);
+		steps++;
+	}
+
+	GenericFlashDriver driver( raw_driver );
+
+	std::array<std::byte,100> buffer = {};
+	std::span<std::byte> read_span(buffer);
+
+	driver.read(MESSAGE6_OFFSET,read_span);
+	std::string sread = to_string(read_span);
+
+	CPPDEBUG( format("%s: \"%s\" in %d steps => %s", __FUNCTION__, sread, steps, sread == MESSAGE6 ? "Ok" : "ERROR" ));
+}
+
+void test_queued_memory_interface()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_16k_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+	GenericFlashDriver driver( raw_driver );
+	driver.properties.PageBuffer = &span_external_buffer;
+
+	QueuedMemoryInterface queue( driver );
+
+	QueuedMemoryInterface::Completion completion;
+	bool callback_called = false;
+
+	queue.write_async(MESSAGE7_OFFSET, to_span(MESSAGE7), &completion, [&callback_called]( std::size_t ) {
+		callback_called = true;
+	});
+
+	// no threads here, so the superloop is the worker
+	while( !completion.is_done() ) {
+		queue.process();
+	}
+
+	std::array<std::byte,100> buffer = {};
+	std::span<std::byte> read_span(buffer);
+
+	// served directly from the mapped flash, nothing is pending any more
+	queue.read_async(MESSAGE7_OFFSET, read_span, nullptr);
+	std::string sread = to_string(read_span);
+
+	CPPDEBUG( format("%s: \"%s\" => %s", __FUNCTION__, sread,
+			sread == MESSAGE7 && callback_called && completion.get_result() == sizeof(MESSAGE7) ? "Ok" : "ERROR" ));
+}
+
+static stm32_internal_flash::Task<bool> erase_write_verify( stm32_internal_flash::AsyncFlashDriver & flash,
+		std::size_t address, std::span<const std::byte> data )
+{
+	if( !co_await flash.erase( address, data.size() ) ) {
+		co_return false;
+	}
+
+	if( co_await flash.write( address, data ) != data.size() ) {
+		co_return false;
+	}
+
+	std::array<std::byte,100> buffer = {};
+	std::span<std::byte> read_span( buffer.data(), data.size() );
+
+	if( co_await flash.read( address, read_span ) != data.size() ) {
+		co_return false;
+	}
+
+	co_return memcmp( read_span.data(), data.data(), data.size() ) == 0;
+}
+
+static stm32_internal_flash::Task<void> coroutine_sequence( stm32_internal_flash::AsyncFlashDriver & flash, bool & result )
+{
+	result = co_await erase_write_verify( flash, MESSAGE8_OFFSET, to_span(MESSAGE8) );
+}
+
+void test_coroutines()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_16k_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+	Executor executor;
+
+	AsyncFlashDriver flash( raw_driver, executor, get_microseconds );
+
+	bool result = false;
+	executor.spawn( coroutine_sequence( flash, result ) );
+
+	unsigned loops = 0;
+
+	// this would be the superloop
+	while( executor.run_once() ) {
+		loops++;
+	}
+
+	std::array<std::byte,100> buffer = {};
+	std::span<std::byte> read_span(buffer);
+
+	raw_driver.read_page(MESSAGE8_OFFSET,read_span);
+	std::string sread = to_string(read_span);
+
+	CPPDEBUG( format("%s: \"%s\" in %d loops => %s", __FUNCTION__, sread, loops, result && sread == MESSAGE8 ? "Ok" : "ERROR" ));
+}
+
+void test_circular_log()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+	GenericFlashDriver driver( raw_driver );
+
+	// records are programmed into erased flash only
+	driver.MemoryInterface::properties.RestoreDataOnUnaligendWrites = false;
+
+	struct Telemetry {
+		uint32_t time;
+		uint32_t values[6];
+	};
+
+	CircularLog log( driver, sizeof(Telemetry) );
+
+	if( !log.format() ) {
+		CPPDEBUG( format("%s: format failed => ERROR", __FUNCTION__ ));
+		return;
+	}
+
+	// fill the whole 112K region, until the first sector is reused
+	unsigned appends = 0;
+	uint32_t append_time_us = 0;
+
+	while( true ) {
+		Telemetry telemetry { get_microseconds(), { appends, 1, 2, 3, 4, 5 } };
+
+		const uint32_t append_start = get_microseconds();
+		const bool appended = log.append( std::span<const std::byte>( reinterpret_cast<const std::byte*>(&telemetry), sizeof(telemetry) ) );
+		append_time_us += get_microseconds() - append_start;
+
+		if( !appended ) {
+			break;
+		}
+
+		appends++;
+
+		// not timed, begin() searches the oldest record
+		if( log.begin()->sequence > 0 ) {
+			break;
+		}
+	}
+
+	const uint32_t mount_start = get_microseconds();
+	CircularLog log2( driver, sizeof(Telemetry) );
+	const bool mounted = log2.mount();
+	const uint32_t mount_time_us = get_microseconds() - mount_start;
+
+	unsigned records = 0;
+	uint32_t last_sequence = 0;
+	bool in_order = true;
+
+	for( const auto & record : log2 ) {
+		if( records > 0 && record.sequence != last_sequence + 1 ) {
+			in_order = false;
+		}
+
+		last_sequence = record.sequence;
+		records++;
+	}
+
+	const bool ok = mounted && in_order && log2.get_next_sequence() == appends;
+
+	CPPDEBUG( format("%s: %d appends, %d appends/s (incl. one 16K erase), mount %dus with %d reads, %d records => %s",
+			__FUNCTION__,
+			appends,
+			static_cast<unsigned>(uint64_t(appends) * 1000000 / std::max<uint32_t>(append_time_us,1)),
+			mount_time_us,
+			log2.get_mount_reads(),
+			records,
+			ok ? "Ok" : "ERROR" ));
+}
+
+void test_flash_counter()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_16k_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+
+	FlashCounter counter( raw_driver, COUNTER_PAGE_A_OFFSET, COUNTER_PAGE_B_OFFSET );
+
+	if( !counter.init() ) {
+		CPPDEBUG( format("%s: init failed => ERROR", __FUNCTION__ ));
+		return;
+	}
+
+	const uint32_t start_value = counter.get();
+	const unsigned increments = 1000;
+	const uint32_t start = get_microseconds();
+
+	for( unsigned i = 0; i < increments; i++ ) {
+		counter.increment();
+	}
+
+	const uint32_t duration_us = get_microseconds() - start;
+
+	FlashCounter counter2( raw_driver, COUNTER_PAGE_A_OFFSET, COUNTER_PAGE_B_OFFSET );
+	counter2.init();
+
+	CPPDEBUG( format("%s: %d => %d, %dus per increment => %s",
+			__FUNCTION__,
+			start_value,
+			counter2.get(),
+			duration_us / increments,
+			counter2.get() == start_value + increments ? "Ok" : "ERROR" ));
+
+	if( counter_reset_checked ) {
+		return;
+	}
+
+	// once per boot, that was not caused by this reset
+	counter_reset_check.magic = COUNTER_RESET_CHECK_MAGIC;
+	counter_reset_check.expected = counter2.get();
+	counter_reset_check.expected_inv = ~counter2.get();
+
+	CPPDEBUG( format("%s: resetting, the value is checked after the reset", __FUNCTION__ ));
+
+	NVIC_SystemReset();
+}
+
+/**
+ * Runs first after a reset of test_flash_counter(), before any other
+ * test touches the counter sectors and checks the value survived.
+ */
+void test_flash_counter_after_reset()
+{
+	using namespace stm32_internal_flash;
+
+	const bool software_reset = __HAL_RCC_GET_FLAG( RCC_FLAG_SFTRST );
+	__HAL_RCC_CLEAR_RESET_FLAGS();
+
+	const CounterResetCheck check = counter_reset_check;
+	counter_reset_check.magic = 0;
+
+	if( !software_reset ||
+		check.magic != COUNTER_RESET_CHECK_MAGIC ||
+		check.expected != ~check.expected_inv ) {
+		return;
+	}
+
+	counter_reset_checked = true;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_16k_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+
+	FlashCounter counter( raw_driver, COUNTER_PAGE_A_OFFSET, COUNTER_PAGE_B_OFFSET );
+
+	const bool ok = counter.init() && counter.get() == check.expected;
+
+	CPPDEBUG( format("%s: expected %d, read %d => %s",
+			__FUNCTION__,
+			check.expected,
+			counter.get(),
+			ok ? "Ok" : "ERROR" ));
+}
+
+void test_flash_var()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+	GenericFlashDriver driver( raw_driver );
+	driver.properties.PageBuffer = &span_external_buffer;
+
+	FlashVar<FlashMessage> message( driver, message9_storage );
+
+	FlashMessage value = {};
+	strcpy( value.text, MESSAGE9 );
+	value.write_count = 0xFFFFFFFF;
+
+	const auto first = message.update( value );
+
+	// writing the same value again does nothing
+	const auto second = message.update( value );
+
+	// clearing bits only, programs just one word
+	value.write_count <<= 1;
+	const auto third = message.update( value );
+
+	const FlashMessage & stored = message.get();
+
+	const bool ok = first != FlashVarBase::Update::Failed &&
+			second == FlashVarBase::Update::Unchanged &&
+			third == FlashVarBase::Update::Programmed &&
+			stored.write_count == value.write_count;
+
+	CPPDEBUG( format("%s: \"%s\" at offset %d => %s", __FUNCTION__, stored.text, message.get_address(), ok ? "Ok" : "ERROR" ));
+}
+
+namespace {
+	// the "received" image of the slot manager tests, generated chunk by chunk
+	const std::size_t SLOT_TEST_IMAGE_SIZE = 12*1024 + 100;
+
+	void get_slot_test_image_chunk( std::size_t offset, std::span<std::byte> chunk ) {
+		for( std::size_t i = 0; i < chunk.size(); i++ ) {
+			chunk[i] = static_cast<std::byte>( (offset + i) * 7 + 3 );
+		}
+	}
+
+	stm32_internal_flash::Sha256::digest_t get_slot_test_image_hash() {
+		std::array<std::byte,stm32_internal_flash::SlotManager::DEFAULT_CHUNK_SIZE> chunk_buffer;
+		stm32_internal_flash::Sha256 sha;
+
+		for( std::size_t offset = 0; offset < SLOT_TEST_IMAGE_SIZE; offset += chunk_buffer.size() ) {
+			std::span<std::byte> chunk( chunk_buffer.data(), std::min<std::size_t>( chunk_buffer.size(), SLOT_TEST_IMAGE_SIZE - offset ) );
+			get_slot_test_image_chunk( offset, chunk );
+			sha.update( chunk );
+		}
+
+		return sha.finish();
+	}
+
+	/**
+	 * writes up to max_chunks chunks of the image, starting at offset
+	 */
+	bool transfer_slot_test_image( stm32_internal_flash::SlotManager & slots, std::size_t offset, std::size_t max_chunks ) {
+		std::array<std::byte,stm32_internal_flash::SlotManager::DEFAULT_CHUNK_SIZE> chunk_buffer;
+
+		for( ; offset < SLOT_TEST_IMAGE_SIZE && max_chunks > 0; offset += slots.get_chunk_size(), max_chunks-- ) {
+			std::span<std::byte> chunk( chunk_buffer.data(), std::min<std::size_t>( slots.get_chunk_size(), SLOT_TEST_IMAGE_SIZE - offset ) );
+			get_slot_test_image_chunk( offset, chunk );
+
+			if( !slots.write_chunk( offset, chunk ) ) {
+				return false;
+			}
+		}
+		return true;
+	}
+} // namespace
+
+void test_slot_manager()
+{
+	using namespace stm32_internal_flash;
+
+	// journal in sectors 2 and 3
+	Configuration conf_journal;
+	conf_journal.used_sectors = flash_fs_16k_sectors;
+	STM32InternalFlashHalRaw raw_journal( conf_journal );
+
+	// slot A in sector 4, slot B in sector 7
+	Configuration conf_slot_a;
+	conf_slot_a.used_sectors = flash_fs_64k_sectors;
+	STM32InternalFlashHalRaw raw_slot_a( conf_slot_a );
+	GenericFlashDriver slot_a( raw_slot_a );
+
+	Configuration conf_slot_b;
+	conf_slot_b.used_sectors = slot_b_sectors;
+	STM32InternalFlashHalRaw raw_slot_b( conf_slot_b );
+	GenericFlashDriver slot_b( raw_slot_b );
+
+	const std::size_t image_size = SLOT_TEST_IMAGE_SIZE;
+	const Sha256::digest_t hash = get_slot_test_image_hash();
+
+	std::size_t active_before = 0;
+	std::size_t resume_offset = 0;
+	bool ok = false;
+
+	{
+		SlotManager slots( raw_journal, SLOT_JOURNAL_A_OFFSET, SLOT_JOURNAL_B_OFFSET, slot_a, slot_b );
+
+		if( !slots.init() ) {
+			CPPDEBUG( format("%s: init failed => ERROR", __FUNCTION__ ));
+			return;
+		}
+
+		active_before = slots.get_active_slot();
+
+		std::size_t offset = 0;
+
+		// the connection breaks after 6 chunks
+		ok = slots.begin( image_size, hash, offset ) && transfer_slot_test_image( slots, offset, 6 );
+	}
+
+	const uint32_t start = get_microseconds();
+
+	// after the reset, the update continues
+	SlotManager slots( raw_journal, SLOT_JOURNAL_A_OFFSET, SLOT_JOURNAL_B_OFFSET, slot_a, slot_b );
+
+	ok = ok && slots.init() &&
+			slots.begin( image_size, hash, resume_offset ) &&
+			transfer_slot_test_image( slots, resume_offset, image_size ) &&
+			slots.finish();
+
+	const uint32_t duration_us = get_microseconds() - start;
+
+	ok = ok && resume_offset == 6 * slots.get_chunk_size() && slots.get_active_slot() != active_before;
+
+	CPPDEBUG( format("%s: resumed at %d of %d, slot %d => %d, %dus => %s",
+			__FUNCTION__,
+			resume_offset,
+			image_size,
+			active_before,
+			slots.get_active_slot(),
+			duration_us,
+			ok ? "Ok" : "ERROR" ));
+}
+
+void test_delta_patch()
+{
+	using namespace stm32_internal_flash;
+
+	// same layout as test_slot_manager()
+	Configuration conf_journal;
+	conf_journal.used_sectors = flash_fs_16k_sectors;
+	STM32InternalFlashHalRaw raw_journal( conf_journal );
+
+	Configuration conf_slot_a;
+	conf_slot_a.used_sectors = flash_fs_64k_sectors;
+	STM32InternalFlashHalRaw raw_slot_a( conf_slot_a );
+	GenericFlashDriver slot_a( raw_slot_a );
+
+	Configuration conf_slot_b;
+	conf_slot_b.used_sectors = slot_b_sectors;
+	STM32InternalFlashHalRaw raw_slot_b( conf_slot_b );
+	GenericFlashDriver slot_b( raw_slot_b );
+
+	SlotManager slots( raw_journal, SLOT_JOURNAL_A_OFFSET, SLOT_JOURNAL_B_OFFSET, slot_a, slot_b );
+
+	if( !slots.init() ) {
+		CPPDEBUG( format("%s: init failed => ERROR", __FUNCTION__ ));
+		return;
+	}
+
+	// the old image: the test image, installed with a complete update
+	const std::size_t old_size = SLOT_TEST_IMAGE_SIZE;
+	std::size_t offset = 0;
+
+	if( !slots.begin( old_size, get_slot_test_image_hash(), offset ) ||
+		!transfer_slot_test_image( slots, offset, old_size ) ||
+		!slots.finish() ) {
+		CPPDEBUG( format("%s: installing the old image failed => ERROR", __FUNCTION__ ));
+		return;
+	}
+
+	const std::size_t active = slots.get_active_slot();
+	const std::byte *old_data = slots.get_slot( active ).get_mapped_address( 0 );
+
+	if( !old_data ) {
+		CPPDEBUG( format("%s: slot not mapped => ERROR", __FUNCTION__ ));
+		return;
+	}
+
+	std::span<const std::byte> old_image( old_data, old_size );
+
+	// new image: MESSAGE10 inserted at MESSAGE10_OFFSET
+	const std::size_t new_size = old_size + sizeof(MESSAGE10);
+
+	Sha256 sha;
+	sha.update( old_image.first( MESSAGE10_OFFSET ) );
+	sha.update( to_span( MESSAGE10 ) );
+	sha.update( old_image.subspan( MESSAGE10_OFFSET ) );
+
+	// as generated by tools/make_delta_patch
+	std::array<std::byte,sizeof(delta_patch::Header) + 16 + sizeof(MESSAGE10)> patch;
+	std::size_t patch_size = 0;
+
+	auto put = [&]( const void *data, std::size_t len ) {
+		memcpy( patch.data() + patch_size, data, len );
+		patch_size += len;
+	};
+
+	auto put_varint = [&]( uint32_t value ) {
+		for( ; value >= 0x80; value >>= 7 ) {
+			const uint8_t b = (value & 0x7F) | 0x80;
+			put( &b, 1 );
+		}
+		const uint8_t b = value;
+		put( &b, 1 );
+	};
+
+	auto put_command = [&]( delta_patch::Command command, uint32_t length ) {
+		put( &command, 1 );
+		put_varint( length );
+	};
+
+	delta_patch::Header header {};
+	header.magic = delta_patch::MAGIC;
+	header.old_size = old_size;
+	header.new_size = new_size;
+	header.reserved = 0xFFFFFFFF;
+	header.old_hash = Sha256::hash( old_image );
+	header.new_hash = sha.finish();
+	put( &header, sizeof(header) );
+
+	put_command( delta_patch::Command::Copy, MESSAGE10_OFFSET );
+	put_varint( delta_patch::zigzag_encode( 0 ) );
+	put_command( delta_patch::Command::Literal, sizeof(MESSAGE10) );
+	put( MESSAGE10, sizeof(MESSAGE10) );
+	put_command( delta_patch::Command::Copy, old_size - MESSAGE10_OFFSET );
+	put_varint( delta_patch::zigzag_encode( 0 ) );
+
+	const std::size_t target = slots.get_inactive_slot();
+	MemoryInterface & target_slot = slots.get_slot( target );
+
+	const uint32_t start = get_microseconds();
+
+	bool ok = target_slot.erase( 0, target_slot.get_size() );
+
+	DeltaPatchApplier applier( old_image, target_slot, 0 );
+
+	// the patch arrives in small pieces
+	for( std::size_t pos = 0; ok && pos < patch_size; pos += 16 ) {
+		ok = applier.feed( std::span<const std::byte>( patch.data() + pos, std::min<std::size_t>( 16, patch_size - pos ) ) );
+	}
+
+	ok = ok && applier.finish() && slots.activate( target );
+
+	const uint32_t duration_us = get_microseconds() - start;
+
+	std::array<std::byte,100> buffer = {};
+	std::span<std::byte> read_span(buffer);
+
+	target_slot.read( MESSAGE10_OFFSET, read_span );
+	std::string sread = to_string(read_span);
+
+	ok = ok && sread == MESSAGE10;
+
+	CPPDEBUG( format("%s: \"%s\", %d bytes patch for %d bytes image, %dus => %s",
+			__FUNCTION__,
+			sread,
+			patch_size,
+			new_size,
+			duration_us,
+			ok ? "Ok" : "ERROR" ));
+}
+
+void test_compressed_memory_interface()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_16k_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+	GenericFlashDriver driver( raw_driver );
+
+	// 64K logical on 48K flash
+	CompressedMemoryInterface compressed( driver, 64*1024 );
+
+	if( !compressed.format() ) {
+		CPPDEBUG( format("%s: format failed => ERROR", __FUNCTION__ ));
+		return;
+	}
+
+	// 16 bit calibration tables, the same as tools/compression_benchmark.cpp generates
+	auto make_table = []( unsigned table, std::span<std::byte> data ) {
+		const unsigned used = 600 + table * 16;
+
+		for( unsigned i = 0; i < data.size() / 2; i++ ) {
+			const uint16_t value = i < used ? static_cast<uint16_t>( 1000 + table * 100 + (i * i / 2600) * 64 ) : 0xFFFF;
+			data[i*2] = static_cast<std::byte>( value & 0xFF );
+			data[i*2+1] = static_cast<std::byte>( value >> 8 );
+		}
+	};
+
+	const unsigned tables = 16;
+	std::array<std::byte,2048> table_buffer;
+	bool ok = true;
+
+	for( unsigned table = 0; table < tables && ok; table++ ) {
+		make_table( table, table_buffer );
+		ok = compressed.write( table * table_buffer.size(), table_buffer ) == table_buffer.size();
+	}
+
+	for( unsigned table = 0; table < tables && ok; table++ ) {
+		std::array<std::byte,2048> expected;
+		std::span<std::byte> read_span( table_buffer );
+
+		make_table( table, expected );
+		ok = compressed.read( table * table_buffer.size(), read_span ) == read_span.size() && table_buffer == expected;
+	}
+
+	const auto & statistic = compressed.get_statistic();
+
+	// cycles of the codec for one chunk
+	make_table( 3, table_buffer );
+
+	std::array<std::byte,CompressedMemoryInterface::CHUNK_SIZE> compressed_chunk;
+	std::array<std::byte,CompressedMemoryInterface::CHUNK_SIZE> decompressed_chunk;
+	auto chunk = std::span<const std::byte>( table_buffer.data(), CompressedMemoryInterface::CHUNK_SIZE );
+
+	uint32_t start = get_cycles();
+	const std::size_t compressed_len = lz_codec::compress( chunk, compressed_chunk );
+	const uint32_t compress_cycles = get_cycles() - start;
+
+	start = get_cycles();
+	lz_codec::decompress( std::span<const std::byte>( compressed_chunk.data(), compressed_len ), decompressed_chunk );
+	const uint32_t decompress_cycles = get_cycles() - start;
+
+	CPPDEBUG( format("%s: %d bytes stored in %d bytes, compress %d cycles/byte, decompress %d cycles/byte => %s",
+			__FUNCTION__,
+			statistic.bytes_in,
+			statistic.bytes_stored,
+			compress_cycles / chunk.size(),
+			decompress_cycles / chunk.size(),
+			ok ? "Ok" : "ERROR" ));
+}
+
+void test_checkpoint()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+	GenericFlashDriver driver( raw_driver );
+
+	// records are programmed into erased flash only
+	driver.MemoryInterface::properties.RestoreDataOnUnaligendWrites = false;
+
+	struct State {
+		uint32_t counters[64];
+		uint8_t history[7936];
+	};
+
+	static State state;
+	static State restored;
+
+	auto as_span = []( State & s ) {
+		return std::span<std::byte>( reinterpret_cast<std::byte*>(&s), sizeof(s) );
+	};
+
+	CircularLog log( driver, Checkpoint::RECORD_SIZE );
+
+	if( !log.format() ) {
+		CPPDEBUG( format("%s: format failed => ERROR", __FUNCTION__ ));
+		return;
+	}
+
+	for( unsigned i = 0; i < sizeof(state.history); i++ ) {
+		state.history[i] = static_cast<uint8_t>( i * 7 );
+	}
+
+	Checkpoint checkpoint( log, as_span( state ) );
+
+	uint32_t start = get_microseconds();
+	bool ok = checkpoint.save();
+	const uint32_t full_time_us = get_microseconds() - start;
+
+	// only the first two blocks change
+	state.counters[0]++;
+	state.history[10] = 42;
+
+	start = get_microseconds();
+	ok = ok && checkpoint.save();
+	const uint32_t diff_time_us = get_microseconds() - start;
+
+	CircularLog log2( driver, Checkpoint::RECORD_SIZE );
+	Checkpoint checkpoint2( log2, as_span( restored ) );
+
+	ok = ok && log2.mount() && checkpoint2.restore() && memcmp( &state, &restored, sizeof(state) ) == 0;
+
+	const auto & statistic = checkpoint.get_statistic();
+
+	CPPDEBUG( format("%s: %d blocks, full save %dus, save of 2 changed blocks %dus, %d blocks written, %d skipped => %s",
+			__FUNCTION__,
+			checkpoint.get_block_count(),
+			full_time_us,
+			diff_time_us,
+			statistic.blocks_written,
+			statistic.blocks_skipped,
+			ok ? "Ok" : "ERROR" ));
+
+	// A save is interrupted by a power loss after the block of counters[0]:
+	// the record is in the log, but there is no commit for it.
+	Checkpoint::BlockHeader header;
+	header.checkpoint = UINT32_MAX;
+
+	for( const CircularLog::Record & record : log2 ) {
+		Checkpoint::BlockHeader h;
+		memcpy( &h, record.data.data(), sizeof(h) );
+		header.checkpoint = header.checkpoint == UINT32_MAX ? h.checkpoint : std::max( header.checkpoint, h.checkpoint );
+	}
+
+	State interrupted = state;
+	interrupted.counters[0] = 0xDEAD;
+
+	std::array<std::byte,Checkpoint::RECORD_SIZE> record;
+	auto block = std::span<const std::byte>( reinterpret_cast<const std::byte*>(&interrupted), Checkpoint::BLOCK_SIZE );
+
+	header.checkpoint++;
+	header.block = 0;
+	header.type = Checkpoint::Type::Block;
+	header.hash = Checkpoint::calc_hash( block );
+
+	memcpy( record.data(), &header, sizeof(header) );
+	memcpy( record.data() + sizeof(header), block.data(), block.size() );
+
+	ok = log2.append( record );
+
+	// after the reset, a later save only writes the history block and is committed
+	state.history[4000] = 43;
+
+	CircularLog log3( driver, Checkpoint::RECORD_SIZE );
+	Checkpoint checkpoint3( log3, as_span( restored ) );
+
+	ok = ok && log3.mount() && checkpoint3.restore() && restored.counters[0] == state.counters[0];
+
+	restored.history[4000] = state.history[4000];
+	ok = ok && checkpoint3.save();
+
+	CircularLog log4( driver, Checkpoint::RECORD_SIZE );
+	Checkpoint checkpoint4( log4, as_span( restored ) );
+
+	ok = ok && log4.mount() && checkpoint4.restore() && memcmp( &state, &restored, sizeof(state) ) == 0;
+
+	CPPDEBUG( format("%s: blocks of an interrupted save, followed by a committed save, ignored => %s",
+			__FUNCTION__,
+			ok ? "Ok" : "ERROR" ));
+}
+
+void test_flash_fs()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf_16k;
+	conf_16k.used_sectors = flash_fs_16k_sectors;
+	STM32InternalFlashHalRaw raw_driver_16k( conf_16k );
+	GenericFlashDriver driver_16k( raw_driver_16k );
+
+	Configuration conf_64k;
+	conf_64k.used_sectors = flash_fs_64k_sectors;
+	STM32InternalFlashHalRaw raw_driver_64k( conf_64k );
+	GenericFlashDriver driver_64k( raw_driver_64k );
+
+	MemoryInterface* drivers_array[] = {
+		&driver_16k,
+		&driver_64k
+	};
+
+	JBODGenericFlashDriver driver( drivers_array );
+
+	static const char CONFIG1[] { "config version 1" };
+	static const char CONFIG2[] { "config version 2" };
+	static const char APPENDED[] { ", appended" };
+
+	bool ok = true;
+
+	{
+		FlashFs fs( driver );
+		ok = fs.format();
+
+		FlashFs::File file;
+
+		ok = ok && fs.open( file, "config", FlashFs::Write | FlashFs::Create | FlashFs::Truncate );
+		ok = ok && file.write( to_span( CONFIG1 ).first( sizeof(CONFIG1) - 1 ) ) == sizeof(CONFIG1) - 1;
+		ok = ok && file.close();
+
+		// replaces config atomically
+		ok = ok && fs.open( file, "config.tmp", FlashFs::Write | FlashFs::Create | FlashFs::Truncate );
+		ok = ok && file.write( to_span( CONFIG2 ).first( sizeof(CONFIG2) - 1 ) ) == sizeof(CONFIG2) - 1;
+		ok = ok && file.close();
+		ok = ok && fs.rename( "config.tmp", "config" );
+
+		ok = ok && fs.open( file, "config", FlashFs::Write | FlashFs::Append );
+		ok = ok && file.write( to_span( APPENDED ).first( sizeof(APPENDED) - 1 ) ) == sizeof(APPENDED) - 1;
+		ok = ok && file.close();
+	}
+
+	FlashFs fs( driver );
+
+	const uint32_t start = get_microseconds();
+	ok = ok && fs.mount();
+	const uint32_t mount_time_us = get_microseconds() - start;
+
+	std::array<std::byte,100> buffer = {};
+	std::span<std::byte> read_span( buffer );
+
+	FlashFs::File file;
+	ok = ok && fs.open( file, "config", FlashFs::Read ) && !fs.exists( "config.tmp" );
+
+	// without the terminating zeros, the buffer is zero filled
+	const std::size_t len = ok ? file.read( read_span ) : 0;
+	std::string sread = to_string( read_span );
+
+	ok = ok && len == sizeof(CONFIG2) - 1 + sizeof(APPENDED) - 1 && sread == std::string( CONFIG2 ) + APPENDED;
+
+	CPPDEBUG( format("%s: \"%s\", mount %dus, %d bytes free => %s",
+			__FUNCTION__,
+			sread,
+			mount_time_us,
+			fs.get_free_space(),
+			ok ? "Ok" : "ERROR" ));
+}
+
+namespace {
+	const char CRASH_TEST_LINE[] = "this line is part of the test record";
+	const unsigned CRASH_TEST_RECORDS = 4;
+}
+
+/**
+ * Runs first, before the slot manager tests use sector 7. Reports the
+ * records of the last run and checks, that they survived the reset.
+ */
+void test_crash_recorder_after_reset()
+{
+	using namespace stm32_internal_flash;
+
+	std::size_t reported = 0;
+	std::size_t test_records = 0;
+
+	crash_recorder.for_each_record( [&reported,&test_records]( const CrashRecorder::Record & record ) {
+		const auto & header = record.header;
+
+		CPPDEBUG( format("%s: record %d, reason %d at %dms, pc 0x%08X, lr 0x%08X, cfsr 0x%08X, hfsr 0x%08X, %s:%d",
+				__FUNCTION__,
+				reported,
+				static_cast<uint32_t>(header.reason),
+				header.tick,
+				header.frame.pc,
+				header.frame.lr,
+				header.cfsr,
+				header.hfsr,
+				std::string( header.file, strnlen( header.file, sizeof(header.file) ) ),
+				header.line ));
+
+		for( const auto & line : record.lines ) {
+			if( line[0] != 0 ) {
+				CPPDEBUG( format("%s:   %s", __FUNCTION__, std::string( line, strnlen( line, sizeof(line) ) ) ));
+			}
+		}
+
+		const std::string last_line( record.lines[CrashRecorder::DEBUG_LINES - 1], strnlen( record.lines[CrashRecorder::DEBUG_LINES - 1], sizeof(record.lines[0]) ) );
+
+		if( header.reason == CrashRecorder::Reason::Test && last_line.find( CRASH_TEST_LINE ) != std::string::npos ) {
+			test_records++;
+		}
+
+		reported++;
+	});
+
+	// a blank sector: the first run, nothing to check
+	if( reported == 0 && crash_recorder.get_free_slots() == crash_recorder.get_slot_count() ) {
+		CPPDEBUG( format("%s: no records of a last run", __FUNCTION__ ));
+		return;
+	}
+
+	// a crash record explains missing test records, the crash stopped
+	// the last run before test_crash_recorder()
+	const bool ok = test_records == CRASH_TEST_RECORDS || reported > test_records;
+
+	CPPDEBUG( format("%s: %d records of the last run, %d test records => %s",
+			__FUNCTION__,
+			reported,
+			test_records,
+			ok ? "Ok" : "ERROR" ));
+}
+
+void test_crash_recorder()
+{
+	using namespace stm32_internal_flash;
+
+	// the records of the last run are reported by test_crash_recorder_after_reset()
+	if( crash_recorder.get_free_slots() < crash_recorder.get_slot_count() ) {
+		Configuration conf;
+		conf.used_sectors = crash_record_sectors;
+
+		STM32InternalFlashHalRaw raw_driver( conf );
+
+		if( !raw_driver.erase_page( 0, raw_driver.get_size() ) ) {
+			CPPDEBUG( format("%s: erasing the crash records failed => ERROR", __FUNCTION__ ));
+			return;
+		}
+	}
+
+	// the same path as a failed assert, each writes a whole record.
+	// They survive the reset, see test_crash_recorder_after_reset()
+	uint32_t max_write_time_us = 0;
+	bool ok = true;
+
+	for( unsigned i = 0; i < CRASH_TEST_RECORDS; i++ ) {
+		CPPDEBUG( format("%s: %s", __FUNCTION__, CRASH_TEST_LINE ));
+
+		const uint32_t start = get_microseconds();
+		ok = crash_recorder.record( CrashRecorder::Reason::Test, __FILE__, __LINE__ ) && ok;
+		max_write_time_us = std::max( max_write_time_us, get_microseconds() - start );
+	}
+
+	std::size_t count = 0;
+	std::string last_line;
+
+	crash_recorder.for_each_record( [&count,&last_line]( const CrashRecorder::Record & record ) {
+		count++;
+		last_line = record.lines[CrashRecorder::DEBUG_LINES - 1];
+	});
+
+	ok = ok && count == CRASH_TEST_RECORDS && last_line.find( CRASH_TEST_LINE ) != std::string::npos;
+
+	CPPDEBUG( format("%s: %d records of %d bytes written, longest %dus, %d slots => %s",
+			__FUNCTION__,
+			CRASH_TEST_RECORDS,
+			sizeof(CrashRecorder::Record),
+			max_write_time_us,
+			crash_recorder.get_slot_count(),
+			ok ? "Ok" : "ERROR" ));
+}
+
+void test_tracing_memory_interface()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_16k_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+	GenericFlashDriver driver( raw_driver );
+
+	static std::array<TracingMemoryInterface::TraceRecord,64> ring;
+	TracingMemoryInterface tracing( driver, ring, get_microseconds );
+
+	std::array<std::byte,16> buffer;
+	std::span<std::byte> read_span( buffer );
+
+	// reads are the fastest accesses, so the overhead is the most visible
+	const unsigned count = 100;
+
+	uint32_t start = get_cycles();
+	for( unsigned i = 0; i < count; i++ ) {
+		driver.read( i * buffer.size(), read_span );
+	}
+	const uint32_t plain_cycles = get_cycles() - start;
+
+	start = get_cycles();
+	for( unsigned i = 0; i < count; i++ ) {
+		tracing.read( i * buffer.size(), read_span );
+	}
+	const uint32_t traced_cycles = get_cycles() - start;
+
+	bool ok = tracing.write( MESSAGE2_OFFSET, to_span( MESSAGE2 ) ) == sizeof(MESSAGE2);
+
+	// the newest record is the write
+	std::size_t idx = 0;
+	bool records_ok = false;
+
+	tracing.for_each_record( [&]( const TracingMemoryInterface::TraceRecord & record ) {
+		if( ++idx == tracing.get_record_count() ) {
+			records_ok = record.get_op() == TracingMemoryInterface::Op::Write &&
+					record.address == MESSAGE2_OFFSET &&
+					record.get_size() == sizeof(MESSAGE2) &&
+					!record.failed();
+		}
+	});
+
+	ok = ok && records_ok && tracing.get_record_count() == ring.size() && tracing.get_statistic().recorded == count + 1;
+
+	CPPDEBUG( format("%s: %d records, overhead %d cycles per access => %s",
+			__FUNCTION__,
+			tracing.get_statistic().recorded,
+			(traced_cycles - plain_cycles) / count,
+			ok ? "Ok" : "ERROR" ));
+}
+
+void test_verify_mode()
+{
+	using namespace stm32_internal_flash;
+
+	// the last 16k sector, a whole sector is programmed at once
+	const std::size_t offset = 2*16*1024;
+
+	for( std::size_t i = 0; i < external_buffer.size(); i++ ) {
+		external_buffer[i] = static_cast<std::byte>( i * 7 );
+	}
+
+	// erases and programs the sector, returns the durations
+	auto measure = [&]( bool verify, uint32_t & erase_us, uint32_t & program_us ) {
+		Configuration conf;
+		conf.used_sectors = flash_fs_16k_sectors;
+		conf.verify = verify;
+
+		STM32InternalFlashHalRaw raw_driver( conf );
+
+		uint32_t start = get_microseconds();
+		bool ok = raw_driver.erase_page( offset, external_buffer.size() );
+		erase_us = get_microseconds() - start;
+
+		start = get_microseconds();
+		ok = ok && raw_driver.write_page( offset, span_external_buffer ) == external_buffer.size();
+		program_us = get_microseconds() - start;
+
+		const auto & statistic = raw_driver.get_verify_statistic();
+
+		if( verify ) {
+			ok = ok && statistic.programmed_bytes == external_buffer.size() &&
+					statistic.erased_bytes == external_buffer.size() &&
+					statistic.program_retries == 0 &&
+					statistic.erase_retries == 0;
+		}
+
+		return ok && !raw_driver.get_error();
+	};
+
+	uint32_t erase_us = 0, program_us = 0;
+	uint32_t verified_erase_us = 0, verified_program_us = 0;
+
+	bool ok = measure( false, erase_us, program_us );
+	ok = measure( true, verified_erase_us, verified_program_us ) && ok;
+
+	ok = ok && memcmp( reinterpret_cast<const void*>( ADDRESS_FLASH_SECTOR_3 ), external_buffer.data(), external_buffer.size() ) == 0;
+
+	CPPDEBUG( format("%s: erase %dus + %dus verify, program %dus + %dus verify => %s",
+			__FUNCTION__,
+			erase_us,
+			verified_erase_us - erase_us,
+			program_us,
+			verified_program_us - program_us,
+			ok ? "Ok" : "ERROR" ));
+}
+
+void test_bulk_reader()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+	STM32DmaCopyEngine dma;
+	BulkReader reader( raw_driver, dma );
+
+	// a word aligned table and one at an odd address, that is copied byte wise
+	alignas(uint32_t) static std::array<std::byte,4*1024> table2;
+	std::span<std::byte> table1 = span_external_buffer;
+	const std::size_t table2_offset = 64*1024 + 3;
+
+	uint32_t start = get_microseconds();
+	memcpy( table1.data(), conf.data_ptr, table1.size() );
+	memcpy( table2.data(), conf.data_ptr + table2_offset, table2.size() );
+	const uint32_t memcpy_us = get_microseconds() - start;
+
+	table1[0] = ~table1[0];
+	table2[0] = ~table2[0];
+
+	bool done_ok = false;
+	std::size_t done_bytes = 0;
+
+	bool ok = reader.add( 0, table1 ) && reader.add( table2_offset, table2 );
+
+	start = get_microseconds();
+
+	ok = ok && reader.start( [&]( bool success, std::size_t bytes_done ) {
+		done_ok = success;
+		done_bytes = bytes_done;
+	});
+
+	// the control code of the superloop keeps running
+	unsigned loops = 0;
+
+	while( !reader.poll() ) {
+		loops++;
+	}
+
+	const uint32_t dma_us = get_microseconds() - start;
+
+	ok = ok && done_ok && done_bytes == table1.size() + table2.size() &&
+			memcmp( table1.data(), conf.data_ptr, table1.size() ) == 0 &&
+			memcmp( table2.data(), conf.data_ptr + table2_offset, table2.size() ) == 0;
+
+	CPPDEBUG( format("%s: %d bytes, memcpy %dus, dma %dus with %d superloop runs => %s",
+			__FUNCTION__,
+			done_bytes,
+			memcpy_us,
+			dma_us,
+			loops,
+			ok ? "Ok" : "ERROR" ));
+}
+
+void test_partitions()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+	GenericFlashDriver driver( raw_driver );
+
+	PartitionMemoryInterface kv( driver, flash_partitions.get_range( "kv" ) );
+	PartitionMemoryInterface log( driver, flash_partitions.get_range( "log" ) );
+
+	// the linker script has to be regenerated after changing the table
+	bool ok = reinterpret_cast<std::size_t>( _flash_partitions_start ) == flash_partitions.get_start_address() &&
+			reinterpret_cast<std::size_t>( _flash_partitions_size ) == flash_partitions.get_size() &&
+			reinterpret_cast<std::size_t>( _partition_kv_start ) == flash_partitions.get( "kv" ).start_address &&
+			reinterpret_cast<std::size_t>( _partition_kv_size ) == kv.get_size();
+
+	ok = ok && kv.get_page_size() == 16*1024 && log.get_page_size() == 64*1024;
+
+	// address 0 of the partition is its first sector
+	ok = ok && kv.write( 0, to_span( MESSAGE2 ) ) == sizeof(MESSAGE2) &&
+			memcmp( reinterpret_cast<const void*>( ADDRESS_FLASH_SECTOR_3 ), MESSAGE2, sizeof(MESSAGE2) ) == 0;
+
+	// crossing the end of the partition fails, instead of touching the log
+	ok = ok && kv.write( kv.get_size() - 10, to_span( MESSAGE2 ) ) == 0;
+
+	// erasing the log keeps the kv data
+	ok = ok && log.erase( 0, log.get_size() ) &&
+			memcmp( kv.get_mapped_address( 0 ), MESSAGE2, sizeof(MESSAGE2) ) == 0;
+
+	CPPDEBUG( format("%s: %d partitions, kv at 0x%X, log at 0x%X => %s",
+			__FUNCTION__,
+			flash_partitions.size(),
+			flash_partitions.get( "kv" ).start_address,
+			flash_partitions.get( "log" ).start_address,
+			ok ? "Ok" : "ERROR" ));
+}
+
+void test_pre_erase_pool()
+{
+	using namespace stm32_internal_flash;
+
+	Configuration conf;
+	conf.used_sectors = flash_fs_16k_sectors;
+
+	STM32InternalFlashHalRaw raw_driver( conf );
+	GenericFlashDriver driver( raw_driver );
+
+	PreErasePool pool( driver, 1, get_microseconds );
+	pool.ring_ahead = 1;
+
+	// records are programmed into erased flash only
+	pool.MemoryInterface::properties.RestoreDataOnUnaligendWrites = false;
+
+	CircularLog log( pool, 28 );
+
+	if( !log.format() ) {
+		CPPDEBUG( format("%s: format failed => ERROR", __FUNCTION__ ));
+		return;
+	}
+
+	pool.clear_statistic();
+
+	// wraps around the 3 sectors twice, the erases are done by the superloop
+	std::array<std::byte,28> record{};
+	uint32_t max_append_us = 0;
+	bool ok = true;
+
+	for( unsigned i = 0; ok && i < 3000; i++ ) {
+		record[0] = static_cast<std::byte>( i );
+
+		const uint32_t start = get_microseconds();
+		ok = log.append( record );
+		max_append_us = std::max( max_append_us, get_microseconds() - start );
+
+		pool.process();
+	}
+
+	const auto & statistic = pool.get_statistic();
+
+	ok = ok && statistic.misses == 0 && statistic.stall_us == 0 && statistic.hits > 0;
+
+	CPPDEBUG( format("%s: %d pages erased ahead, %dms stall avoided, longest append %dus => %s",
+			__FUNCTION__,
+			statistic.pre_erased,
+			static_cast<uint32_t>( statistic.avoided_stall_us / 1000 ),
+			max_append_us,
+			ok ? "Ok" : "ERROR" ));
+}
+
 void main_app()
 {
-	SimpleOutDebug out_debug;
+	CrashRecordingOutDebug out_debug;
 	Tools::x_debug = &out_debug;
 
 	CPPDEBUG( "start" );
 
+	test_flash_counter_after_reset();
+	test_crash_recorder_after_reset();
 	test_write_message_no_hal_init_no_clock_init_2();
 	test_generic();
+	test_skip_erase_of_blank_pages();
 	test_jbod();
 	test_generic_external_buffer();
+	test_mixed_sector_sizes();
+	test_isr_latency_while_erasing();
+	test_incremental_writer();
+	test_queued_memory_interface();
+	test_coroutines();
+	test_circular_log();
+	test_flash_counter();
+	test_flash_var();
+	test_slot_manager();
+	test_delta_patch();
+	test_compressed_memory_interface();
+	test_checkpoint();
+	test_flash_fs();
+	test_crash_recorder();
+	test_tracing_memory_interface();
+	test_verify_mode();
+	test_bulk_reader();
+	test_partitions();
+	test_pre_erase_pool();
 
 
 	while( true ) {}
@@ -13,9 +13,23 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
 void main_app();
 void test_write_message_no_hal_init_no_clock_init_1();
 
+/**
+ * called from the HardFault handler
+ * exc_return: LR on entry of the handler
+ * msp: the stack pointer on entry of the handler
+ */
+void main_app_hard_fault( uint32_t exc_return, uint32_t *msp );
+
+/**
+ * called by a failed assert of the HAL (USE_FULL_ASSERT) and of the C library
+ */
+void main_app_assert_failed( const char *file, uint32_t line );
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,6 +8,7 @@
 #define APP_STM32F401_FLASH_CONFIG_H_
 
 #include <stm32_internal_flash.h>
+#include "flash_partitions.h"
 
 /*
  * Sector 0 0x0800 0000 - 0x0800 3FFF 16 Kbyte
@@ -17,54 +18,50 @@
  * Sector 4 0x0801 0000 - 0x0801 FFFF 64 Kbyte
  * Sector 5 0x0802 0000 - 0x0803 FFFF 128 Kbyte
  * Sector 6 0x0804 0000 - 0x0805 FFFF 128 Kbyte
- * .
- * .
- * .
- * Sector 11 0x080E 0000 - 0x080F FFFF 128 Kbyte
+ * Sector 7 0x0806 0000 - 0x0807 FFFF 128 Kbyte
+ *
+ * The layout comes from the geometry database, see FlashGeometry.h
  */
-#define ADDRESS_FLASH_SECTOR_0   0x08000000
-#define ADDRESS_FLASH_SECTOR_1   (ADDRESS_FLASH_SECTOR_0  +  16*1024)
-#define ADDRESS_FLASH_SECTOR_2   (ADDRESS_FLASH_SECTOR_1  +  16*1024)
-#define ADDRESS_FLASH_SECTOR_3   (ADDRESS_FLASH_SECTOR_2  +  16*1024)
-#define ADDRESS_FLASH_SECTOR_4   (ADDRESS_FLASH_SECTOR_3  +  16*1024)
-#define ADDRESS_FLASH_SECTOR_5   (ADDRESS_FLASH_SECTOR_4  +  64*1024)
-#define ADDRESS_FLASH_SECTOR_6   (ADDRESS_FLASH_SECTOR_5  + 128*1024)
-#define ADDRESS_FLASH_SECTOR_7   (ADDRESS_FLASH_SECTOR_6  + 128*1024)
-#define ADDRESS_FLASH_SECTOR_8   (ADDRESS_FLASH_SECTOR_7  + 128*1024)
-#define ADDRESS_FLASH_SECTOR_9   (ADDRESS_FLASH_SECTOR_8  + 128*1024)
-#define ADDRESS_FLASH_SECTOR_10  (ADDRESS_FLASH_SECTOR_9  + 128*1024)
-#define ADDRESS_FLASH_SECTOR_11  (ADDRESS_FLASH_SECTOR_10 + 128*1024)
+static constexpr stm32_internal_flash::geometry::Device FLASH_DEVICE = flash_partitions.get_device();
+
+#define ADDRESS_FLASH_SECTOR(n)  (stm32_internal_flash::geometry::get_sector( FLASH_DEVICE, n )->start_address)
+#define ADDRESS_FLASH_SECTOR_0   ADDRESS_FLASH_SECTOR(0)
+#define ADDRESS_FLASH_SECTOR_1   ADDRESS_FLASH_SECTOR(1)
+#define ADDRESS_FLASH_SECTOR_2   ADDRESS_FLASH_SECTOR(2)
+#define ADDRESS_FLASH_SECTOR_3   ADDRESS_FLASH_SECTOR(3)
+#define ADDRESS_FLASH_SECTOR_4   ADDRESS_FLASH_SECTOR(4)
+#define ADDRESS_FLASH_SECTOR_5   ADDRESS_FLASH_SECTOR(5)
+#define ADDRESS_FLASH_SECTOR_6   ADDRESS_FLASH_SECTOR(6)
+#define ADDRESS_FLASH_SECTOR_7   ADDRESS_FLASH_SECTOR(7)
+
+// CRASH_RECORD in the linker script
+static_assert( ADDRESS_FLASH_SECTOR_7 == 0x08060000 );
 
 /**
- * The raw driver cannot handle different sections sizes at once
+ * At this example application sector 0 holds the vector table, so cannot be used
+ * for writing. So we are starting with sector 1.
  */
+static constexpr auto flash_fs_16k_sectors =
+		stm32_internal_flash::geometry::make_sectors<FLASH_DEVICE, ADDRESS_FLASH_SECTOR_1, 3*16*1024>();
+
+static constexpr auto flash_fs_64k_sectors =
+		stm32_internal_flash::geometry::make_sectors<FLASH_DEVICE, ADDRESS_FLASH_SECTOR_4, 64*1024>();
+
+// the raw driver can also handle sectors with different sizes at once,
+// covers all partitions, the FLASH_FS region of the linker script
+static constexpr auto flash_fs_sectors =
+		stm32_internal_flash::geometry::make_sectors<FLASH_DEVICE, flash_partitions.get_start_address(), flash_partitions.get_size()>();
+
+static_assert( flash_partitions.get_start_address() == ADDRESS_FLASH_SECTOR_1, "sector 0 holds the vector table" );
 
-// the raw driver can only sections with the same page size
-static constexpr const stm32_internal_flash::Configuration::Sector flash_fs_16k_sectors[] = {
-  {
-	FLASH_SECTOR_1,
-	16*1024,
-	ADDRESS_FLASH_SECTOR_1
-  },
-  {
-	FLASH_SECTOR_2,
-	16*1024,
-	ADDRESS_FLASH_SECTOR_2
-  },
-  {
-	FLASH_SECTOR_3,
-	16*1024,
-	ADDRESS_FLASH_SECTOR_3
-  },
-};
+// reserved for crash records, see CRASH_RECORD in the linker script
+static constexpr auto crash_record_sectors =
+		stm32_internal_flash::geometry::make_sectors<FLASH_DEVICE, ADDRESS_FLASH_SECTOR_7, 128*1024>();
 
-static constexpr const stm32_internal_flash::Configuration::Sector flash_fs_64k_sectors[] = {
-  {
-	FLASH_SECTOR_4,
-	64*1024,
-	ADDRESS_FLASH_SECTOR_4
-  }
-};
+// slot B of the slot manager tests, slot A is flash_fs_64k_sectors.
+// There is no other free sector, so it shares sector 7 with the crash records,
+// the crash recorder writes its records behind the image.
+static constexpr auto slot_b_sectors = crash_record_sectors;
 
 
 #endif /* APP_STM32F401_FLASH_CONFIG_H_ */
@@ -0,0 +1,46 @@
+/*
+ * Copies memory in the background, eg. with a DMA controller.
+ *
+ * Only one copy is running at a time. start() returns, how many bytes
+ * are copied by this transfer, an engine may copy less than requested,
+ * because of a maximum transfer size or the alignment. The caller
+ * starts the rest, after poll() returned Done.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_ASYNCCOPYENGINE_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_ASYNCCOPYENGINE_H_
+
+#include <cstddef>
+
+namespace stm32_internal_flash {
+
+class AsyncCopyEngine
+{
+public:
+	enum class Status
+	{
+		Busy,
+		Done,
+		Error
+	};
+
+	virtual ~AsyncCopyEngine() {}
+
+	/**
+	 * starts copying at most size bytes, returns the number of bytes
+	 * of this transfer, 0 if the copy couldn't be started.
+	 * Source and target have to stay valid until poll() returns Done or Error.
+	 */
+	virtual std::size_t start( std::byte *target, const std::byte *source, std::size_t size ) = 0;
+
+	/**
+	 * After Done or Error is returned once, the engine is ready for the next start().
+	 */
+	virtual Status poll() = 0;
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_ASYNCCOPYENGINE_H_ */
@@ -0,0 +1,68 @@
+/*
+ * Awaitable erase, write and read for C++20 coroutines.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "AsyncFlashDriver.h"
+
+namespace stm32_internal_flash {
+
+AsyncFlashDriver::WriteOperation::WriteOperation( AsyncFlashDriver & driver, std::size_t address,
+		const std::span<const std::byte> & data, std::span<std::byte> *page_buffer )
+: Operation( driver.executor ),
+  writer( driver.raw_driver, driver.get_microseconds ),
+  step_budget_us( driver.step_budget_us )
+{
+	writer.start( address, data, page_buffer );
+}
+
+bool AsyncFlashDriver::WriteOperation::poll()
+{
+	if( !writer.done() ) {
+		writer.step_microseconds( step_budget_us );
+	}
+
+	return writer.done();
+}
+
+AsyncFlashDriver::EraseOperation::EraseOperation( AsyncFlashDriver & driver, std::size_t address_, std::size_t size )
+: Operation( driver.executor ),
+  raw_driver( driver.raw_driver ),
+  address( address_ ),
+  end( address_ + size )
+{
+	if( address > raw_driver.get_size() || size > raw_driver.get_size() - address ) {
+		error = true;
+	}
+}
+
+bool AsyncFlashDriver::EraseOperation::poll()
+{
+	if( error || address >= end ) {
+		return true;
+	}
+
+	const std::size_t page_start = raw_driver.get_page_start_address( address );
+	const std::size_t page_size = raw_driver.get_page_size_at( address );
+
+	if( !raw_driver.is_blank( page_start, page_size ) ) {
+		if( !raw_driver.erase_page( page_start, page_size ) ) {
+			error = true;
+			return true;
+		}
+	}
+
+	address = page_start + page_size;
+
+	return address >= end;
+}
+
+AsyncFlashDriver::ReadOperation::ReadOperation( AsyncFlashDriver & driver, std::size_t address, std::span<std::byte> & data )
+: Operation( driver.executor )
+{
+	if( address <= driver.raw_driver.get_size() && data.size() <= driver.raw_driver.get_size() - address ) {
+		result = driver.raw_driver.read_page( address, data );
+	}
+}
+
+} // namespace stm32_internal_flash
@@ -0,0 +1,131 @@
+/*
+ * Awaitable erase, write and read for C++20 coroutines.
+ *
+ * Each operation is split into steps: one page erase, or programming
+ * for at most step_budget_us. Between the steps the coroutine is
+ * suspended and other tasks of the Executor and the superloop can run.
+ *
+ *   Task<void> update( AsyncFlashDriver & flash ) {
+ *       if( !co_await flash.erase( 0, 16*1024 ) ) co_return;
+ *       co_await flash.write( 0, data );
+ *   }
+ *
+ * A single step itself can't be interrupted, since the CPU stalls on
+ * flash access while the flash is busy.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_ASYNCFLASHDRIVER_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_ASYNCFLASHDRIVER_H_
+
+#include "Executor.h"
+#include "IncrementalWriter.h"
+
+namespace stm32_internal_flash {
+
+class AsyncFlashDriver
+{
+public:
+	class WriteOperation : public Operation
+	{
+		IncrementalWriter writer;
+		uint32_t step_budget_us;
+
+	public:
+		WriteOperation( AsyncFlashDriver & driver, std::size_t address,
+				const std::span<const std::byte> & data, std::span<std::byte> *page_buffer );
+
+		bool poll() override;
+
+		/**
+		 * bytes written, less than data.size() on error
+		 */
+		std::size_t await_resume() {
+			return writer.get_progress().bytes_done;
+		}
+	};
+
+	class EraseOperation : public Operation
+	{
+		RawDriverInterface & raw_driver;
+		std::size_t address;
+		std::size_t end;
+		bool error = false;
+
+	public:
+		EraseOperation( AsyncFlashDriver & driver, std::size_t address, std::size_t size );
+
+		bool poll() override;
+
+		bool await_resume() {
+			return !error;
+		}
+	};
+
+	class ReadOperation : public Operation
+	{
+		std::size_t result = 0;
+
+	public:
+		ReadOperation( AsyncFlashDriver & driver, std::size_t address, std::span<std::byte> & data );
+
+		// reading never has to wait
+		bool poll() override {
+			return true;
+		}
+
+		std::size_t await_resume() {
+			return result;
+		}
+	};
+
+	/**
+	 * Time for one write step. Programming a word takes about 16us on a STM32F4.
+	 */
+	uint32_t step_budget_us = 500;
+
+protected:
+	RawDriverInterface & raw_driver;
+	Executor & executor;
+	std::function<uint32_t()> get_microseconds;
+
+public:
+	/**
+	 * get_microseconds: free running microsecond counter, see IncrementalWriter
+	 */
+	AsyncFlashDriver( RawDriverInterface & raw_driver_, Executor & executor_, std::function<uint32_t()> get_microseconds_ )
+	: raw_driver( raw_driver_ ),
+	  executor( executor_ ),
+	  get_microseconds( get_microseconds_ )
+	{}
+
+	/**
+	 * Erases all pages touched by address and size.
+	 * Pages that are already blank are skipped.
+	 */
+	EraseOperation erase( std::size_t address, std::size_t size ) {
+		return EraseOperation( *this, address, size );
+	}
+
+	/**
+	 * data has to be valid until the write is done.
+	 * page_buffer: see IncrementalWriter::start(). Can't be shared
+	 *              between two writes running at the same time.
+	 */
+	WriteOperation write( std::size_t address, const std::span<const std::byte> & data, std::span<std::byte> *page_buffer = nullptr ) {
+		return WriteOperation( *this, address, data, page_buffer );
+	}
+
+	ReadOperation read( std::size_t address, std::span<std::byte> & data ) {
+		return ReadOperation( *this, address, data );
+	}
+
+	Executor & get_executor() {
+		return executor;
+	}
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_ASYNCFLASHDRIVER_H_ */
@@ -0,0 +1,132 @@
+/*
+ * Fast checks, if a flash memory range is erased
+ * or contains the expected data.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "BlankCheck.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+namespace stm32_internal_flash {
+
+std::size_t find_first_non_blank( const std::span<const std::byte> & data )
+{
+	const std::byte *start = data.data();
+	const std::byte *end = start + data.size();
+	const std::byte *p = start;
+
+	// unaligned head
+	while( p < end && reinterpret_cast<uintptr_t>(p) % sizeof(uint32_t) != 0 ) {
+		if( *p != ERASED_BYTE ) {
+			return p - start;
+		}
+		++p;
+	}
+
+	/*
+	 * The vector and word loops only skip blocks that are completely erased.
+	 * On the first dirty block they stop, and the following smaller loops
+	 * find the exact offset.
+	 */
+
+#if defined(__AVX2__)
+	const __m256i ones256 = _mm256_set1_epi32( -1 );
+
+	for( ; end - p >= 32; p += 32 ) {
+		const __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>(p) );
+
+		if( !_mm256_testc_si256( v, ones256 ) ) {
+			break;
+		}
+	}
+#endif
+
+#if defined(__SSE2__)
+	const __m128i ones128 = _mm_set1_epi32( -1 );
+
+	for( ; end - p >= 16; p += 16 ) {
+		const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>(p) );
+
+		if( _mm_movemask_epi8( _mm_cmpeq_epi8( v, ones128 ) ) != 0xFFFF ) {
+			break;
+		}
+	}
+#endif
+
+	// 4 words at once, keeps the loop overhead low on the M4
+	for( ; end - p >= 16; p += 16 ) {
+		const uint32_t *w = reinterpret_cast<const uint32_t*>(p);
+
+		if( (w[0] & w[1] & w[2] & w[3]) != 0xFFFFFFFF ) {
+			break;
+		}
+	}
+
+	for( ; end - p >= 4; p += 4 ) {
+		if( *reinterpret_cast<const uint32_t*>(p) != 0xFFFFFFFF ) {
+			break;
+		}
+	}
+
+	for( ; p < end; ++p ) {
+		if( *p != ERASED_BYTE ) {
+			break;
+		}
+	}
+
+	return p - start;
+}
+
+std::size_t find_first_mismatch( const std::byte *flash, const std::span<const std::byte> & data )
+{
+	const std::byte *source = data.data();
+	std::size_t offset = 0;
+
+	// unaligned head of the flash range
+	while( offset < data.size() && reinterpret_cast<uintptr_t>(flash + offset) % sizeof(uint32_t) != 0 ) {
+		if( flash[offset] != source[offset] ) {
+			return offset;
+		}
+		offset++;
+	}
+
+	// the flash side is aligned now, the source is loaded with memcpy, which is a plain LDR on the M4
+	for( ; data.size() - offset >= sizeof(uint32_t); offset += sizeof(uint32_t) ) {
+		uint32_t expected;
+		memcpy( &expected, source + offset, sizeof(expected) );
+
+		if( *reinterpret_cast<const uint32_t*>(flash + offset) != expected ) {
+			break;
+		}
+	}
+
+	for( ; offset < data.size(); offset++ ) {
+		if( flash[offset] != source[offset] ) {
+			break;
+		}
+	}
+
+	return offset;
+}
+
+bool is_reprogrammable( const std::byte *flash, const std::span<const std::byte> & data )
+{
+	for( std::size_t i = 0; i < data.size(); i++ ) {
+		// a bit, that is 0 in flash, but 1 in data, requires an erase
+		if( (~flash[i] & data[i]) != std::byte{0} ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+} // namespace stm32_internal_flash
+
@@ -0,0 +1,53 @@
+/*
+ * Fast checks, if a flash memory range is erased
+ * or contains the expected data.
+ *
+ * On the target the check is done word wide, on a host
+ * build SSE2 or AVX2 is used, if the compiler supports it.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_BLANKCHECK_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_BLANKCHECK_H_
+
+#include <cstddef>
+#include <span>
+
+namespace stm32_internal_flash {
+
+/**
+ * value of a byte after the flash has been erased
+ */
+static constexpr std::byte ERASED_BYTE { 0xFF };
+
+/**
+ * returns the offset of the first byte that is not erased.
+ * If the whole range is erased, data.size() is returned.
+ * Stops scanning at the first non erased word.
+ */
+std::size_t find_first_non_blank( const std::span<const std::byte> & data );
+
+/**
+ * returns true, if all bytes of the range are erased
+ */
+inline bool is_blank( const std::span<const std::byte> & data ) {
+	return find_first_non_blank( data ) == data.size();
+}
+
+/**
+ * returns the offset of the first byte of flash, that differs from data.
+ * If the whole range matches, data.size() is returned.
+ * Compares word wide, the word alignment of data does not matter.
+ */
+std::size_t find_first_mismatch( const std::byte *flash, const std::span<const std::byte> & data );
+
+/**
+ * returns true, if the mismatching bytes of flash can be fixed by programming
+ * data again, without an erase. Programming can only clear bits.
+ */
+bool is_reprogrammable( const std::byte *flash, const std::span<const std::byte> & data );
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_BLANKCHECK_H_ */
@@ -0,0 +1,137 @@
+/*
+ * Loads large blocks from memory mapped flash into RAM in the background.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "BulkReader.h"
+
+namespace stm32_internal_flash {
+
+bool BulkReader::add( std::size_t address, std::span<std::byte> target )
+{
+	if( running || read_count == reads.size() ) {
+		return false;
+	}
+
+	if( address > raw_driver.get_size() || target.size() > raw_driver.get_size() - address ) {
+		return false;
+	}
+
+	reads[read_count++] = Read{ address, target };
+
+	return true;
+}
+
+bool BulkReader::clear()
+{
+	if( running ) {
+		return false;
+	}
+
+	read_count = 0;
+
+	return true;
+}
+
+bool BulkReader::start( done_func_t on_done_ )
+{
+	if( running ) {
+		return false;
+	}
+
+	on_done = on_done_;
+	current = 0;
+	current_done = 0;
+	transfer_size = 0;
+	bytes_done = 0;
+	error = false;
+	running = true;
+
+	start_next_transfer();
+
+	return !error;
+}
+
+void BulkReader::start_next_transfer()
+{
+	while( current < read_count ) {
+		const Read & read = reads[current];
+
+		if( current_done == read.target.size() ) {
+			current++;
+			current_done = 0;
+			continue;
+		}
+
+		const std::size_t address = read.address + current_done;
+		const std::size_t size = read.target.size() - current_done;
+		std::byte *target = read.target.data() + current_done;
+		const std::byte *source = raw_driver.get_mapped_address( address );
+
+		if( !source ) {
+			std::span<std::byte> rest( target, size );
+			const std::size_t len = raw_driver.read_page( address, rest );
+
+			current_done += len;
+			bytes_done += len;
+
+			if( len != size ) {
+				finish( false );
+				return;
+			}
+
+			continue;
+		}
+
+		transfer_size = engine.start( target, source, size );
+
+		if( transfer_size == 0 ) {
+			finish( false );
+		}
+
+		return;
+	}
+
+	finish( true );
+}
+
+bool BulkReader::poll()
+{
+	if( !running ) {
+		return true;
+	}
+
+	if( transfer_size > 0 ) {
+		switch( engine.poll() ) {
+		case AsyncCopyEngine::Status::Busy:
+			return false;
+
+		case AsyncCopyEngine::Status::Error:
+			finish( false );
+			return true;
+
+		case AsyncCopyEngine::Status::Done:
+			current_done += transfer_size;
+			bytes_done += transfer_size;
+			transfer_size = 0;
+			break;
+		}
+	}
+
+	start_next_transfer();
+
+	return !running;
+}
+
+void BulkReader::finish( bool ok )
+{
+	running = false;
+	error = !ok;
+	transfer_size = 0;
+
+	if( on_done ) {
+		on_done( ok, bytes_done );
+	}
+}
+
+} // namespace stm32_internal_flash
@@ -0,0 +1,149 @@
+/*
+ * Loads large blocks from memory mapped flash into RAM in the background.
+ *
+ * Reads are chained with add() and copied one after the other by an
+ * AsyncCopyEngine: DMA2 on the target (stm32_internal_flash_dma_copy.h),
+ * a copy thread on the host (ThreadCopyEngine.h). poll() starts the next
+ * transfer, when the previous one is done, so it has to be called from
+ * the superloop, or the reader is awaited by a coroutine:
+ *
+ *   BulkReader reader( raw_driver, dma );
+ *   reader.add( TABLE1_OFFSET, table1 );
+ *   reader.add( TABLE2_OFFSET, table2 );
+ *   reader.start( []( bool ok, std::size_t bytes ) { ... } );
+ *
+ *   Task<void> load( BulkReader & reader, Executor & executor ) {
+ *       reader.start();
+ *       if( co_await reader.wait( executor ) ) { ... }
+ *   }
+ *
+ * Drivers, that are not memory mapped, are read synchronously by poll().
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_BULKREADER_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_BULKREADER_H_
+
+#include "RawDriverInterface.h"
+#include "AsyncCopyEngine.h"
+#include "Executor.h"
+#include <array>
+#include <functional>
+
+namespace stm32_internal_flash {
+
+class BulkReader
+{
+public:
+	static constexpr std::size_t MAX_READS = 8;
+
+	/**
+	 * called once by poll(), when all reads are done, or one failed
+	 */
+	using done_func_t = std::function<void( bool ok, std::size_t bytes_done )>;
+
+	class WaitOperation : public Operation
+	{
+		BulkReader & reader;
+
+	public:
+		WaitOperation( BulkReader & reader_, Executor & executor_ )
+		: Operation( executor_ ),
+		  reader( reader_ )
+		{}
+
+		bool poll() override {
+			return reader.poll();
+		}
+
+		/**
+		 * true, if all reads were successful
+		 */
+		bool await_resume() {
+			return !reader.failed();
+		}
+	};
+
+protected:
+	struct Read
+	{
+		std::size_t address;
+		std::span<std::byte> target;
+	};
+
+	RawDriverInterface & raw_driver;
+	AsyncCopyEngine & engine;
+
+	std::array<Read,MAX_READS> reads{};
+	std::size_t read_count = 0;
+
+	std::size_t current = 0;        // index of the read in progress
+	std::size_t current_done = 0;   // bytes of the current read, that are done
+	std::size_t transfer_size = 0;  // bytes of the running transfer, 0 if none is running
+	std::size_t bytes_done = 0;
+
+	bool running = false;
+	bool error = false;
+	done_func_t on_done;
+
+public:
+	BulkReader( RawDriverInterface & raw_driver_, AsyncCopyEngine & engine_ )
+	: raw_driver( raw_driver_ ),
+	  engine( engine_ )
+	{}
+
+	/**
+	 * chains a read of target.size() bytes from address.
+	 * target has to be valid until the reads are done.
+	 * returns false, if MAX_READS are chained, the range is invalid, or the reader is running.
+	 */
+	bool add( std::size_t address, std::span<std::byte> target );
+
+	/**
+	 * starts the chained reads, the first transfer is started immediately
+	 */
+	bool start( done_func_t on_done_ = {} );
+
+	/**
+	 * Starts the next transfer, if the previous one is done.
+	 * Returns true, if the reader is not running (any more).
+	 */
+	bool poll();
+
+	/**
+	 * awaitable, that polls the reader from the Executor
+	 */
+	WaitOperation wait( Executor & executor ) {
+		return WaitOperation( *this, executor );
+	}
+
+	bool is_running() const {
+		return running;
+	}
+
+	bool failed() const {
+		return error;
+	}
+
+	std::size_t get_bytes_done() const {
+		return bytes_done;
+	}
+
+	/**
+	 * removes the chained reads, for reusing the reader
+	 */
+	bool clear();
+
+protected:
+	/**
+	 * starts the transfer of the next part, or finishes the reader
+	 */
+	void start_next_transfer();
+
+	void finish( bool ok );
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_BULKREADER_H_ */
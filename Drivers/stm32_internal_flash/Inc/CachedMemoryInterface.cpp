@@ -0,0 +1,199 @@
+/*
+ * Block read cache for a slow MemoryInterface.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "CachedMemoryInterface.h"
+
+namespace stm32_internal_flash {
+
+CachedMemoryInterface::CachedMemoryInterface( MemoryInterface & driver_,
+		std::span<std::byte> cache_memory_,
+		std::size_t block_size_ )
+: driver( driver_ ),
+  cache_memory( cache_memory_ ),
+  block_size( std::max( block_size_, static_cast<std::size_t>(1) ) ),
+  block_count( std::min( cache_memory_.size() / block_size, MAX_BLOCKS ) )
+{
+	// take over the settings of the driver, properties_changed() passes them back
+	MemoryInterface::properties = driver.properties;
+}
+
+std::size_t CachedMemoryInterface::find_block( std::size_t block_address ) const
+{
+	for( std::size_t idx = 0; idx < block_count; idx++ ) {
+		if( blocks[idx].valid && blocks[idx].address == block_address ) {
+			return idx;
+		}
+	}
+
+	return block_count;
+}
+
+std::size_t CachedMemoryInterface::find_victim()
+{
+	// a referenced block gets a second chance, so this ends after two rounds
+	while( true ) {
+		Block & block = blocks[clock_hand];
+		const std::size_t idx = clock_hand;
+
+		clock_hand = (clock_hand + 1) % block_count;
+
+		if( !block.valid || !block.referenced ) {
+			return idx;
+		}
+
+		block.referenced = false;
+	}
+}
+
+std::size_t CachedMemoryInterface::load( std::size_t block_address, std::size_t count )
+{
+	const std::size_t first = find_victim();
+	std::size_t n = 1;
+
+	// the following blocks go into the following slots, so one read fills all of them
+	while( n < count &&
+		   first + n < block_count &&
+		   block_address + n * block_size < get_size() &&
+		   find_block( block_address + n * block_size ) == block_count ) {
+		n++;
+	}
+
+	for( std::size_t i = 0; i < n; i++ ) {
+		blocks[first + i].valid = false;
+	}
+
+	const std::size_t len = std::min( n * block_size, get_size() - block_address );
+	std::span<std::byte> target( get_block_data( first ), len );
+
+	statistic.backend_reads++;
+
+	if( driver.read( block_address, target ) != len ) {
+		return block_count;
+	}
+
+	for( std::size_t i = 0; i < n; i++ ) {
+		// blocks loaded ahead are replaced first, if they are never used
+		blocks[first + i] = Block{ block_address + i * block_size, true, i == 0 };
+	}
+
+	statistic.misses++;
+	statistic.read_ahead += n - 1;
+
+	clock_hand = (first + n) % block_count;
+
+	return first;
+}
+
+std::size_t CachedMemoryInterface::read( std::size_t address, std::span<std::byte> & data )
+{
+	if( address > get_size() ) {
+		return 0;
+	}
+
+	const std::size_t size = std::min( data.size(), get_size() - address );
+	const bool sequential = address == last_read_end;
+
+	last_read_end = address + size;
+
+	if( size > block_count * block_size ) {
+		statistic.bypassed++;
+		statistic.backend_reads++;
+		return driver.read( address, data );
+	}
+
+	std::size_t done = 0;
+
+	while( done < size ) {
+		const std::size_t pos = address + done;
+		const std::size_t block_address = pos - pos % block_size;
+		std::size_t idx = find_block( block_address );
+
+		if( idx < block_count ) {
+			statistic.hits++;
+			blocks[idx].referenced = true;
+		} else {
+			// the rest of this read, and the read ahead, if the access is sequential
+			const std::size_t blocks_needed = (address + size - block_address + block_size - 1) / block_size;
+			idx = load( block_address, blocks_needed + (sequential ? read_ahead : 0) );
+
+			if( idx == block_count ) {
+				break;
+			}
+		}
+
+		const std::size_t offset = pos - block_address;
+		const std::size_t len = std::min( size - done, block_size - offset );
+
+		memcpy( data.data() + done, get_block_data( idx ) + offset, len );
+		done += len;
+	}
+
+	return done;
+}
+
+void CachedMemoryInterface::invalidate()
+{
+	for( std::size_t idx = 0; idx < block_count; idx++ ) {
+		blocks[idx].valid = false;
+	}
+
+	last_read_end = SIZE_MAX;
+}
+
+void CachedMemoryInterface::invalidate( std::size_t address, std::size_t size )
+{
+	for( std::size_t idx = 0; idx < block_count; idx++ ) {
+		Block & block = blocks[idx];
+
+		if( block.valid && block.address < address + size && address < block.address + block_size ) {
+			block.valid = false;
+			statistic.invalidated++;
+		}
+	}
+}
+
+void CachedMemoryInterface::invalidate_pages( std::size_t address, std::size_t size )
+{
+	if( size == 0 ) {
+		return;
+	}
+
+	const std::size_t last = address + size - 1;
+	const std::size_t start = driver.get_page_start_address( address );
+	const std::size_t end = driver.get_page_start_address( last ) + driver.get_page_size_at( last );
+
+	invalidate( start, end - start );
+}
+
+std::size_t CachedMemoryInterface::write( std::size_t address, const std::span<const std::byte> & data )
+{
+	// restoring the rest of the pages rewrites them, even if the write fails
+	const std::size_t ret = driver.write( address, data );
+	invalidate_pages( address, data.size() );
+	return ret;
+}
+
+bool CachedMemoryInterface::erase( std::size_t address, std::size_t size )
+{
+	const bool ret = driver.erase( address, size );
+	invalidate_pages( address, size );
+	return ret;
+}
+
+std::size_t CachedMemoryInterface::program( std::size_t address, const std::span<const std::byte> & data )
+{
+	const std::size_t ret = driver.program( address, data );
+	invalidate( address, data.size() );
+	return ret;
+}
+
+bool CachedMemoryInterface::copy( std::size_t dst, std::size_t src, std::size_t len )
+{
+	const bool ret = driver.copy( dst, src, len );
+	invalidate_pages( dst, len );
+	return ret;
+}
+
+} // namespace stm32_internal_flash
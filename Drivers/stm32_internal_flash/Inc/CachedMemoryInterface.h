@@ -0,0 +1,165 @@
+/*
+ * Block read cache for a slow MemoryInterface, eg. an external
+ * flash, that is a member of a JBODGenericFlashDriver.
+ *
+ * The RAM given to the constructor is split into blocks of block_size.
+ * Blocks are replaced with the CLOCK algorithm, so a hit only sets the
+ * referenced flag of the block, no list has to be maintained.
+ *
+ * A miss, that continues the previous read, loads read_ahead more
+ * blocks with the same access to the backend. Reads larger than the
+ * cache bypass it.
+ *
+ * The cache is write through: write, program, erase and copy are passed
+ * to the backend and invalidate the blocks of the touched pages.
+ *
+ * Members, that are memory mapped, like the internal flash, don't
+ * gain anything. In a JBOD only the slow members are wrapped:
+ *
+ *   CachedMemoryInterface cached_external( external, cache_memory, 512 );
+ *   std::array<MemoryInterface*,2> members = { &internal, &cached_external };
+ *   JBODGenericFlashDriver jbod( members );
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_CACHEDMEMORYINTERFACE_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_CACHEDMEMORYINTERFACE_H_
+
+#include "MemoryInterface.h"
+#include <array>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+class CachedMemoryInterface : public MemoryInterface
+{
+public:
+	static constexpr std::size_t MAX_BLOCKS = 64;
+
+	struct Statistic
+	{
+		std::size_t hits = 0;           // blocks found in the cache
+		std::size_t misses = 0;         // blocks loaded on demand
+		std::size_t read_ahead = 0;     // blocks loaded ahead
+		std::size_t bypassed = 0;       // reads larger than the cache
+		std::size_t backend_reads = 0;  // calls of read() of the backend
+		std::size_t invalidated = 0;    // blocks dropped by write, program, erase or copy
+	};
+
+	/**
+	 * blocks loaded ahead by a sequential miss
+	 */
+	std::size_t read_ahead = 1;
+
+protected:
+	struct Block
+	{
+		std::size_t address = 0;
+		bool valid = false;
+		bool referenced = false;
+	};
+
+	MemoryInterface & driver;
+	std::span<std::byte> cache_memory;
+	std::size_t block_size;
+	std::size_t block_count;
+
+	std::array<Block,MAX_BLOCKS> blocks{};
+	std::size_t clock_hand = 0;
+
+	// end of the previous read, for detecting sequential access
+	std::size_t last_read_end = SIZE_MAX;
+
+	Statistic statistic;
+
+public:
+	/**
+	 * cache_memory: the RAM budget, block_count = cache_memory.size() / block_size,
+	 *               at most MAX_BLOCKS
+	 * block_size: the smallest unit read from the backend
+	 */
+	CachedMemoryInterface( MemoryInterface & driver_,
+			std::span<std::byte> cache_memory_,
+			std::size_t block_size_ );
+
+	std::size_t get_size() const override {
+		return driver.get_size();
+	}
+
+	std::size_t get_page_size() const override {
+		return driver.get_page_size();
+	}
+
+	std::size_t write( std::size_t address, const std::span<const std::byte> & data ) override;
+	std::size_t read( std::size_t address, std::span<std::byte> & data ) override;
+	bool erase( std::size_t address, std::size_t size ) override;
+	std::size_t program( std::size_t address, const std::span<const std::byte> & data ) override;
+	bool copy( std::size_t dst, std::size_t src, std::size_t len ) override;
+
+	std::size_t get_page_size_at( std::size_t address ) const override {
+		return driver.get_page_size_at( address );
+	}
+
+	std::size_t get_page_start_address( std::size_t address ) const override {
+		return driver.get_page_start_address( address );
+	}
+
+	const std::byte* get_mapped_address( std::size_t address ) const override {
+		return driver.get_mapped_address( address );
+	}
+
+	void properties_changed() override {
+		driver.properties = MemoryInterface::properties;
+	}
+
+	/**
+	 * drops all blocks, eg. after the backend has been changed directly
+	 */
+	void invalidate();
+
+	/**
+	 * drops the blocks overlapping the range
+	 */
+	void invalidate( std::size_t address, std::size_t size );
+
+	std::size_t get_block_count() const {
+		return block_count;
+	}
+
+	const Statistic & get_statistic() const {
+		return statistic;
+	}
+
+	void clear_statistic() {
+		statistic = Statistic();
+	}
+
+protected:
+	std::byte* get_block_data( std::size_t idx ) {
+		return cache_memory.data() + idx * block_size;
+	}
+
+	std::size_t find_block( std::size_t block_address ) const;
+
+	/**
+	 * selects the next slot with the CLOCK algorithm
+	 */
+	std::size_t find_victim();
+
+	/**
+	 * loads up to count blocks, starting with block_address, into
+	 * consecutive slots, with one read of the backend.
+	 * returns the slot of the first block, or block_count on error
+	 */
+	std::size_t load( std::size_t block_address, std::size_t count );
+
+	/**
+	 * invalidates all pages touched by the range
+	 */
+	void invalidate_pages( std::size_t address, std::size_t size );
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_CACHEDMEMORYINTERFACE_H_ */
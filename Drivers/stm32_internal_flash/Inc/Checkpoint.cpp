@@ -0,0 +1,238 @@
+/*
+ * Saves a RAM state into a CircularLog, writing only changed blocks.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "Checkpoint.h"
+#include <algorithm>
+#include <string.h>
+
+namespace stm32_internal_flash {
+
+Checkpoint::Checkpoint( CircularLog & log_, const std::span<std::byte> & state_ )
+: log( log_ ),
+  state( state_.first( std::min( state_.size(), MAX_BLOCKS * BLOCK_SIZE ) ) ),
+  block_count( (state.size() + BLOCK_SIZE - 1) / BLOCK_SIZE )
+{
+	saved_hashes.fill( 0 );
+}
+
+uint32_t Checkpoint::calc_hash( const std::span<const std::byte> & data )
+{
+	// FNV-1a, one word at a time
+	uint32_t hash = 0x811C9DC5;
+	std::size_t pos = 0;
+
+	for( ; pos + sizeof(uint32_t) <= data.size(); pos += sizeof(uint32_t) ) {
+		uint32_t word;
+		memcpy( &word, data.data() + pos, sizeof(word) );
+		hash = (hash ^ word) * 0x01000193;
+	}
+
+	for( ; pos < data.size(); pos++ ) {
+		hash = (hash ^ static_cast<uint32_t>( data[pos] )) * 0x01000193;
+	}
+
+	return hash;
+}
+
+bool Checkpoint::append( const BlockHeader & header, const std::span<const std::byte> & data )
+{
+	std::array<std::byte,RECORD_SIZE> record;
+
+	memcpy( record.data(), &header, sizeof(header) );
+	if( !data.empty() ) {
+		memcpy( record.data() + sizeof(header), data.data(), data.size() );
+	}
+
+	records_since_full++;
+
+	return log.append( std::span<const std::byte>( record.data(), sizeof(header) + data.size() ) );
+}
+
+bool Checkpoint::save()
+{
+	if( log.get_record_size() != RECORD_SIZE || block_count == 0 ) {
+		return false;
+	}
+
+	const std::size_t retained = log.get_retained_records();
+
+	// a full checkpoint has to fit, with its commit record
+	if( block_count + 1 > retained ) {
+		return false;
+	}
+
+	std::array<uint32_t,MAX_BLOCKS> hashes;
+	std::size_t changed = 0;
+
+	for( std::size_t block = 0; block < block_count; block++ ) {
+		hashes[block] = calc_hash( get_block( block ) );
+
+		if( hashes[block] != saved_hashes[block] ) {
+			changed++;
+		}
+	}
+
+	// the blocks of the last full checkpoint would be erased by the log
+	const bool full = !hashes_valid || records_since_full + changed + 1 > retained;
+
+	const uint32_t checkpoint = next_checkpoint++;
+
+	if( full ) {
+		records_since_full = 0;
+	}
+
+	// until the commit, the hashes don't match the log
+	hashes_valid = false;
+
+	for( std::size_t block = 0; block < block_count; block++ ) {
+		if( !full && hashes[block] == saved_hashes[block] ) {
+			statistic.blocks_skipped++;
+			continue;
+		}
+
+		BlockHeader header;
+		header.checkpoint = checkpoint;
+		header.block = static_cast<uint16_t>( block );
+		header.type = Type::Block;
+		header.hash = hashes[block];
+
+		if( !append( header, get_block( block ) ) ) {
+			return false;
+		}
+
+		saved_hashes[block] = hashes[block];
+		statistic.blocks_written++;
+	}
+
+	BlockHeader commit;
+	commit.checkpoint = checkpoint;
+	commit.block = static_cast<uint16_t>( block_count );
+	commit.type = full ? Type::CommitFull : Type::Commit;
+	commit.hash = 0;
+
+	if( !append( commit, {} ) ) {
+		return false;
+	}
+
+	hashes_valid = true;
+	statistic.saves++;
+
+	if( full ) {
+		statistic.full_saves++;
+	}
+
+	return true;
+}
+
+bool Checkpoint::restore()
+{
+	if( log.get_record_size() != RECORD_SIZE || block_count == 0 ) {
+		return false;
+	}
+
+	// find the newest commit, and the newest full commit before it
+	bool found_full = false;
+	uint32_t full_checkpoint = 0;
+	uint32_t last_commit = 0;
+	uint32_t max_checkpoint = 0;
+	bool any = false;
+
+	for( const CircularLog::Record & record : log ) {
+		BlockHeader header;
+		memcpy( &header, record.data.data(), sizeof(header) );
+
+		max_checkpoint = any ? std::max( max_checkpoint, header.checkpoint ) : header.checkpoint;
+		any = true;
+
+		if( header.type != Type::Commit && header.type != Type::CommitFull ) {
+			continue;
+		}
+
+		if( header.block != block_count ) {
+			// saved by a firmware with a different state
+			found_full = false;
+			continue;
+		}
+
+		last_commit = header.checkpoint;
+
+		if( header.type == Type::CommitFull ) {
+			found_full = true;
+			full_checkpoint = header.checkpoint;
+		}
+	}
+
+	if( !found_full ) {
+		return false;
+	}
+
+	// The records of a checkpoint are appended in one run, ending with its commit.
+	// Blocks of an interrupted save have none, a later commit doesn't make them valid.
+	auto is_committed = []( CircularLog::const_iterator it, const CircularLog::const_iterator & end, uint32_t checkpoint ) {
+		for( ; it != end; ++it ) {
+			BlockHeader header;
+			memcpy( &header, it->data.data(), sizeof(header) );
+
+			if( header.checkpoint != checkpoint ) {
+				return false;
+			}
+
+			if( header.type == Type::Commit || header.type == Type::CommitFull ) {
+				return true;
+			}
+		}
+
+		return false;
+	};
+
+	std::size_t records = 0;
+	bool committed = false;
+	uint32_t run_checkpoint = 0;
+
+	for( auto it = log.begin(); it != log.end(); ++it ) {
+		BlockHeader header;
+		memcpy( &header, it->data.data(), sizeof(header) );
+
+		if( header.checkpoint < full_checkpoint ) {
+			continue;
+		}
+
+		// also the ones of an interrupted save, they take space in the log
+		records++;
+
+		if( header.checkpoint > last_commit ) {
+			continue;
+		}
+
+		if( records == 1 || header.checkpoint != run_checkpoint ) {
+			run_checkpoint = header.checkpoint;
+			committed = is_committed( it, log.end(), run_checkpoint );
+		}
+
+		if( !committed || header.type != Type::Block || header.block >= block_count ) {
+			continue;
+		}
+
+		const CircularLog::Record & record = *it;
+
+		std::span<std::byte> block = get_block( header.block );
+		auto data = record.data.subspan( sizeof(header), block.size() );
+
+		if( calc_hash( data ) != header.hash ) {
+			return false;
+		}
+
+		memcpy( block.data(), data.data(), block.size() );
+		saved_hashes[header.block] = header.hash;
+	}
+
+	next_checkpoint = max_checkpoint + 1;
+	records_since_full = records;
+	hashes_valid = true;
+
+	return true;
+}
+
+} // namespace stm32_internal_flash
@@ -0,0 +1,131 @@
+/*
+ * Saves a RAM state into a CircularLog, writing only changed blocks.
+ *
+ * The state is divided into blocks of BLOCK_SIZE bytes. For each block
+ * the hash of the last saved version is kept in RAM. save() appends
+ * only the blocks, whose hash has changed, followed by a commit record.
+ * So the save time depends on how much has changed, not on the size
+ * of the state.
+ *
+ *   CircularLog log( driver, Checkpoint::RECORD_SIZE );
+ *   log.mount();
+ *
+ *   Checkpoint checkpoint( log, std::span<std::byte>( reinterpret_cast<std::byte*>(&state), sizeof(state) ) );
+ *   checkpoint.restore();  // after power up
+ *   ...
+ *   checkpoint.save();     // before power down
+ *
+ * restore() replays the blocks from the newest full checkpoint up to
+ * the newest commit record. Blocks of a save, that has been interrupted
+ * by a power loss, have no commit record of their own and are ignored,
+ * also when later saves are committed.
+ *
+ * The log erases its oldest sector when it wraps around. Before the
+ * newest full checkpoint could be erased, save() writes all blocks
+ * again, so there is always a complete state in the log.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_CHECKPOINT_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_CHECKPOINT_H_
+
+#include "CircularLog.h"
+#include <array>
+#include <span>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+class Checkpoint
+{
+public:
+	static constexpr std::size_t BLOCK_SIZE = 256;
+	static constexpr std::size_t MAX_BLOCKS = 256;
+
+	enum class Type : uint16_t
+	{
+		Block = 1,
+		Commit = 2,     // block is the number of blocks of the state
+		CommitFull = 3  // commit of a checkpoint with all blocks
+	};
+
+	struct BlockHeader
+	{
+		uint32_t checkpoint;
+		uint16_t block;
+		Type type;
+		uint32_t hash;   // of the block data
+	};
+
+	static constexpr std::size_t RECORD_SIZE = sizeof(BlockHeader) + BLOCK_SIZE;
+
+	struct Statistic
+	{
+		std::size_t saves = 0;
+		std::size_t full_saves = 0;
+		std::size_t blocks_written = 0;
+		std::size_t blocks_skipped = 0;
+	};
+
+protected:
+	CircularLog & log;
+	const std::span<std::byte> state;
+	const std::size_t block_count;
+
+	std::array<uint32_t,MAX_BLOCKS> saved_hashes;
+
+	// false: the saved hashes don't match the log, the next save writes all blocks
+	bool hashes_valid = false;
+	uint32_t next_checkpoint = 0;
+
+	// appended since the newest full checkpoint, including it
+	std::size_t records_since_full = 0;
+
+	Statistic statistic;
+
+public:
+	/**
+	 * log: record size has to be RECORD_SIZE
+	 * state: at most MAX_BLOCKS * BLOCK_SIZE bytes
+	 */
+	Checkpoint( CircularLog & log_, const std::span<std::byte> & state_ );
+
+	/**
+	 * Writes the changed blocks and a commit record.
+	 */
+	bool save();
+
+	/**
+	 * Restores the state of the newest committed checkpoint.
+	 * Returns false, if there is none, or it has a different size.
+	 * Then the state is not touched.
+	 */
+	bool restore();
+
+	std::size_t get_block_count() const {
+		return block_count;
+	}
+
+	const Statistic & get_statistic() const {
+		return statistic;
+	}
+
+	void clear_statistic() {
+		statistic = Statistic();
+	}
+
+	static uint32_t calc_hash( const std::span<const std::byte> & data );
+
+protected:
+	std::span<std::byte> get_block( std::size_t block ) const {
+		const std::size_t offset = block * BLOCK_SIZE;
+		return state.subspan( offset, std::min( BLOCK_SIZE, state.size() - offset ) );
+	}
+
+	bool append( const BlockHeader & header, const std::span<const std::byte> & data );
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_CHECKPOINT_H_ */
@@ -0,0 +1,390 @@
+/*
+ * Append only circular log over the pages of a MemoryInterface.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "CircularLog.h"
+#include "BlankCheck.h"
+#include <algorithm>
+#include <string.h>
+
+namespace stm32_internal_flash {
+
+CircularLog::CircularLog( MemoryInterface & memory_, std::size_t record_size_ )
+: memory( memory_ ),
+  record_size( record_size_ ),
+  slot_size( sizeof(RecordHeader) + ((record_size_ + 3) & ~std::size_t(3)) )
+{
+}
+
+bool CircularLog::init_geometry()
+{
+	sector_count = 0;
+
+	std::size_t address = 0;
+
+	while( address < memory.get_size() ) {
+		if( sector_count >= MAX_SECTORS ) {
+			return false;
+		}
+
+		sector_starts[sector_count++] = address;
+
+		const std::size_t sector_size = memory.get_page_size_at( address );
+
+		if( sector_size < sizeof(SectorHeader) + slot_size ) {
+			return false;
+		}
+
+		address += sector_size;
+	}
+
+	sector_starts[sector_count] = address;
+
+	// one sector is always erased, when wrapping around
+	return sector_count >= 2;
+}
+
+bool CircularLog::read_at( std::size_t address, void *data, std::size_t size ) const
+{
+	reads++;
+
+	const std::byte *mapped = memory.get_mapped_address( address );
+
+	if( mapped ) {
+		memcpy( data, mapped, size );
+		return true;
+	}
+
+	std::span<std::byte> buffer( static_cast<std::byte*>(data), size );
+
+	return memory.read( address, buffer ) == size;
+}
+
+bool CircularLog::read_sector_header( std::size_t sector, SectorHeader & header ) const
+{
+	return read_at( sector_starts[sector], &header, sizeof(header) ) && header.is_valid();
+}
+
+bool CircularLog::read_record_header( std::size_t sector, std::size_t slot, RecordHeader & header ) const
+{
+	return read_at( get_slot_address( sector, slot ), &header, sizeof(header) );
+}
+
+bool CircularLog::is_blank_at( std::size_t address, std::size_t size ) const
+{
+	std::array<std::byte,32> buffer;
+
+	while( size > 0 ) {
+		const std::size_t len = std::min( size, buffer.size() );
+
+		if( !read_at( address, buffer.data(), len ) ) {
+			return false;
+		}
+
+		if( !is_blank( std::span<const std::byte>( buffer.data(), len ) ) ) {
+			return false;
+		}
+
+		address += len;
+		size -= len;
+	}
+
+	return true;
+}
+
+bool CircularLog::mount()
+{
+	mounted = false;
+	reads = 0;
+
+	if( !init_geometry() ) {
+		return false;
+	}
+
+	SectorHeader first;
+	SectorHeader header;
+
+	if( read_sector_header( 0, first ) ) {
+		// All sectors from the start, up to the newest one have
+		// a sequence number >= the first one. Find the last of them.
+		std::size_t lo = 0;
+		std::size_t hi = sector_count - 1;
+
+		while( lo < hi ) {
+			const std::size_t mid = lo + (hi - lo + 1) / 2;
+
+			if( read_sector_header( mid, header ) && header.sector_sequence >= first.sector_sequence ) {
+				lo = mid;
+			} else {
+				hi = mid - 1;
+			}
+		}
+
+		head = lo;
+
+	} else if( read_sector_header( sector_count - 1, header ) ) {
+		// power loss after erasing the first sector, while wrapping around
+		head = sector_count - 1;
+
+	} else {
+		empty = true;
+		head = 0;
+		head_slots = 0;
+		oldest = 0;
+		head_sector_sequence = 0;
+		next_sequence = 0;
+		mounted = true;
+		mount_reads = reads;
+		return true;
+	}
+
+	if( !read_sector_header( head, header ) ) {
+		return false;
+	}
+
+	empty = false;
+	head_sector_sequence = header.sector_sequence;
+
+	// first free record slot
+	std::size_t lo = 0;
+	std::size_t hi = get_slots( head );
+
+	while( lo < hi ) {
+		const std::size_t mid = lo + (hi - lo) / 2;
+		RecordHeader record_header;
+
+		if( !read_record_header( head, mid, record_header ) ) {
+			return false;
+		}
+
+		if( record_header.is_blank() ) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	head_slots = lo;
+
+	// power loss after programming the payload, but before the header
+	if( head_slots < get_slots( head ) ) {
+		const std::size_t address = get_slot_address( head, head_slots ) + sizeof(RecordHeader);
+
+		if( !is_blank_at( address, record_size ) ) {
+			head_slots++;
+		}
+	}
+
+	next_sequence = header.first_record_sequence + head_slots;
+
+	// The sector after the newest one is the oldest one. It can be blank,
+	// if the power was lost after erasing it, then it's the next one.
+	// If both are not valid, the log has never wrapped around.
+	oldest = 0;
+
+	for( std::size_t i = 1; i <= 2 && i < sector_count; i++ ) {
+		const std::size_t sector = (head + i) % sector_count;
+
+		if( read_sector_header( sector, header ) ) {
+			oldest = sector;
+			break;
+		}
+	}
+
+	mounted = true;
+	mount_reads = reads;
+
+	return true;
+}
+
+bool CircularLog::format()
+{
+	mounted = false;
+
+	if( !init_geometry() ) {
+		return false;
+	}
+
+	for( std::size_t sector = 0; sector < sector_count; sector++ ) {
+		if( !memory.erase( sector_starts[sector], sector_starts[sector+1] - sector_starts[sector] ) ) {
+			return false;
+		}
+	}
+
+	empty = true;
+	head = 0;
+	head_slots = 0;
+	oldest = 0;
+	head_sector_sequence = 0;
+	next_sequence = 0;
+	mounted = true;
+
+	return true;
+}
+
+bool CircularLog::start_next_sector()
+{
+	const std::size_t next = empty ? 0 : (head + 1) % sector_count;
+
+	if( !memory.erase( sector_starts[next], sector_starts[next+1] - sector_starts[next] ) ) {
+		return false;
+	}
+
+	if( empty ) {
+		oldest = 0;
+	} else if( next == oldest ) {
+		oldest = (next + 1) % sector_count;
+	}
+
+	SectorHeader header;
+	header.magic = SECTOR_MAGIC;
+	header.sector_sequence = head_sector_sequence + 1;
+	header.first_record_sequence = next_sequence;
+	header.check = SectorHeader::calc_check( header.sector_sequence, header.first_record_sequence );
+
+	auto data = std::span<const std::byte>( reinterpret_cast<const std::byte*>(&header), sizeof(header) );
+
+	if( memory.write( sector_starts[next], data ) != data.size() ) {
+		return false;
+	}
+
+	head = next;
+	head_slots = 0;
+	head_sector_sequence = header.sector_sequence;
+	empty = false;
+
+	return true;
+}
+
+bool CircularLog::append( const std::span<const std::byte> & data )
+{
+	if( !mounted || data.size() > record_size ) {
+		return false;
+	}
+
+	if( empty || head_slots >= get_slots( head ) ) {
+		if( !start_next_sector() ) {
+			return false;
+		}
+	}
+
+	const std::size_t address = get_slot_address( head, head_slots );
+	const uint32_t sequence = next_sequence;
+
+	if( !data.empty() && memory.write( address + sizeof(RecordHeader), data ) != data.size() ) {
+		discard_slot( address );
+		return false;
+	}
+
+	RecordHeader header;
+	header.sequence = sequence;
+	header.check = ~sequence;
+
+	auto header_data = std::span<const std::byte>( reinterpret_cast<const std::byte*>(&header), sizeof(header) );
+
+	if( memory.write( address, header_data ) != header_data.size() ) {
+		discard_slot( address );
+		return false;
+	}
+
+	next_sequence++;
+	head_slots++;
+
+	return true;
+}
+
+void CircularLog::discard_slot( std::size_t address )
+{
+	// nothing has been programmed, the next append can use the slot
+	if( is_blank_at( address, slot_size ) ) {
+		return;
+	}
+
+	// Partly programmed. mount() expects the used slots without gaps,
+	// so the slot stays used, with a header that is neither blank nor valid.
+	const RecordHeader header = { 0, 0 };
+	auto header_data = std::span<const std::byte>( reinterpret_cast<const std::byte*>(&header), sizeof(header) );
+
+	if( memory.program( address, header_data ) != header_data.size() ) {
+		memory.write( address, header_data );
+	}
+
+	next_sequence++;
+	head_slots++;
+}
+
+std::size_t CircularLog::get_retained_records() const
+{
+	std::size_t total = 0;
+	std::size_t largest = 0;
+
+	for( std::size_t sector = 0; sector < sector_count; sector++ ) {
+		total += get_slots( sector );
+		largest = std::max( largest, get_slots( sector ) );
+	}
+
+	return total - largest;
+}
+
+CircularLog::const_iterator CircularLog::begin() const
+{
+	if( !mounted || empty ) {
+		return end();
+	}
+
+	return const_iterator( this, oldest );
+}
+
+void CircularLog::const_iterator::settle()
+{
+	while( log ) {
+		const bool is_head = sector == log->head;
+
+		if( is_head && slot >= log->head_slots ) {
+			*this = const_iterator();
+			return;
+		}
+
+		SectorHeader sector_header;
+
+		if( slot >= log->get_slots( sector ) ||
+			(slot == 0 && !log->read_sector_header( sector, sector_header )) ) {
+
+			if( is_head ) {
+				*this = const_iterator();
+				return;
+			}
+
+			sector = (sector + 1) % log->sector_count;
+			slot = 0;
+			continue;
+		}
+
+		RecordHeader header;
+
+		if( !log->read_record_header( sector, slot, header ) ) {
+			*this = const_iterator();
+			return;
+		}
+
+		// blank: the payload was written, but not the header
+		if( header.is_blank() || !header.is_valid() ) {
+			slot++;
+			continue;
+		}
+
+		const std::byte *mapped = log->memory.get_mapped_address( log->get_slot_address( sector, slot ) + sizeof(RecordHeader) );
+
+		if( !mapped ) {
+			*this = const_iterator();
+			return;
+		}
+
+		record.sequence = header.sequence;
+		record.data = std::span<const std::byte>( mapped, log->record_size );
+		return;
+	}
+}
+
+} // namespace stm32_internal_flash
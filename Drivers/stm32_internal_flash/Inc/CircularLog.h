@@ -0,0 +1,245 @@
+/*
+ * Append only circular log over the pages of a MemoryInterface.
+ *
+ * Records have a fixed size and a sequence number. They are appended
+ * with plain program operations into erased flash, so no page has to
+ * be read and restored. Only when the log wraps around, the oldest
+ * page is erased.
+ *
+ * Layout of each page (sector):
+ *
+ *   SectorHeader | RecordHeader payload | RecordHeader payload | ...
+ *
+ * The payload is programmed before the record header, so a record
+ * with a valid header is complete, even after a power loss.
+ *
+ * Sector sequence numbers are increasing around the ring and records
+ * are filled from the start of a sector, so mount() finds the newest
+ * sector and the first free record by binary search.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_CIRCULARLOG_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_CIRCULARLOG_H_
+
+#include "MemoryInterface.h"
+#include <array>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+class CircularLog
+{
+public:
+	static constexpr uint32_t SECTOR_MAGIC = 0x4C4F4731; // "LOG1"
+	static constexpr std::size_t MAX_SECTORS = 64;
+
+	struct SectorHeader
+	{
+		uint32_t magic;
+		uint32_t sector_sequence;
+		uint32_t first_record_sequence;
+		uint32_t check;
+
+		static uint32_t calc_check( uint32_t sector_sequence, uint32_t first_record_sequence ) {
+			return ~(sector_sequence ^ first_record_sequence);
+		}
+
+		bool is_valid() const {
+			return magic == SECTOR_MAGIC && check == calc_check( sector_sequence, first_record_sequence );
+		}
+	};
+
+	struct RecordHeader
+	{
+		uint32_t sequence;
+		uint32_t check;
+
+		bool is_valid() const {
+			return check == ~sequence;
+		}
+
+		bool is_blank() const {
+			return sequence == 0xFFFFFFFF && check == 0xFFFFFFFF;
+		}
+	};
+
+	struct Record
+	{
+		uint32_t sequence = 0;
+
+		// points into the mapped flash, always get_record_size() bytes
+		std::span<const std::byte> data;
+	};
+
+	/**
+	 * Iterates from the oldest to the newest record.
+	 * Requires memory mapped flash.
+	 */
+	class const_iterator
+	{
+		friend class CircularLog;
+
+		const CircularLog *log = nullptr;
+		std::size_t sector = 0;
+		std::size_t slot = 0;
+		Record record;
+
+		const_iterator( const CircularLog *log_, std::size_t sector_ )
+		: log( log_ ),
+		  sector( sector_ )
+		{
+			settle();
+		}
+
+		/**
+		 * moves forward to the next valid record
+		 */
+		void settle();
+
+	public:
+		const_iterator() = default;
+
+		const Record & operator*() const {
+			return record;
+		}
+
+		const Record * operator->() const {
+			return &record;
+		}
+
+		const_iterator & operator++() {
+			slot++;
+			settle();
+			return *this;
+		}
+
+		bool operator==( const const_iterator & other ) const {
+			if( log == nullptr || other.log == nullptr ) {
+				return log == other.log;
+			}
+
+			return sector == other.sector && slot == other.slot;
+		}
+
+		bool operator!=( const const_iterator & other ) const {
+			return !(*this == other);
+		}
+	};
+
+protected:
+	MemoryInterface & memory;
+	const std::size_t record_size;
+	const std::size_t slot_size;
+
+	std::array<std::size_t,MAX_SECTORS+1> sector_starts {};
+	std::size_t sector_count = 0;
+
+	bool mounted = false;
+	bool empty = true;
+
+	std::size_t head = 0;       // sector records are appended to
+	std::size_t head_slots = 0; // used record slots in the head sector
+	std::size_t oldest = 0;     // sector with the oldest records
+	uint32_t head_sector_sequence = 0;
+	uint32_t next_sequence = 0;
+
+	// flash reads, for proving the mount time
+	mutable std::size_t reads = 0;
+	std::size_t mount_reads = 0;
+
+public:
+	/**
+	 * record_size: payload size of each record
+	 */
+	CircularLog( MemoryInterface & memory_, std::size_t record_size_ );
+
+	/**
+	 * Finds the newest and the oldest record.
+	 * Returns false if the geometry is not usable.
+	 * An erased memory is mounted as an empty log.
+	 */
+	bool mount();
+
+	/**
+	 * erases all sectors and starts an empty log
+	 */
+	bool format();
+
+	/**
+	 * Appends a record. data can be shorter than the record size,
+	 * the rest of the record stays 0xFF. If it fails, the used slots
+	 * stay contiguous, so mount() finds the head anyway.
+	 */
+	bool append( const std::span<const std::byte> & data );
+
+	const_iterator begin() const;
+
+	const_iterator end() const {
+		return const_iterator();
+	}
+
+	std::size_t get_record_size() const {
+		return record_size;
+	}
+
+	/**
+	 * sequence number the next record will get
+	 */
+	uint32_t get_next_sequence() const {
+		return next_sequence;
+	}
+
+	bool is_empty() const {
+		return empty;
+	}
+
+	/**
+	 * Number of the newest records, that are always in the log. When it
+	 * wraps around, a whole sector is erased, so it's the capacity
+	 * without the largest sector. Valid after mount().
+	 */
+	std::size_t get_retained_records() const;
+
+	/**
+	 * flash reads done by the last mount()
+	 */
+	std::size_t get_mount_reads() const {
+		return mount_reads;
+	}
+
+protected:
+	bool init_geometry();
+
+	std::size_t get_slots( std::size_t sector ) const {
+		const std::size_t sector_size = sector_starts[sector+1] - sector_starts[sector];
+		return (sector_size - sizeof(SectorHeader)) / slot_size;
+	}
+
+	std::size_t get_slot_address( std::size_t sector, std::size_t slot ) const {
+		return sector_starts[sector] + sizeof(SectorHeader) + slot * slot_size;
+	}
+
+	bool read_at( std::size_t address, void *data, std::size_t size ) const;
+
+	bool read_sector_header( std::size_t sector, SectorHeader & header ) const;
+	bool read_record_header( std::size_t sector, std::size_t slot, RecordHeader & header ) const;
+
+	bool is_blank_at( std::size_t address, std::size_t size ) const;
+
+	/**
+	 * erases the next sector and writes its header
+	 */
+	bool start_next_sector();
+
+	/**
+	 * after a failed append: a blank slot is reused,
+	 * a partly programmed one is marked as invalid and skipped
+	 */
+	void discard_slot( std::size_t address );
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_CIRCULARLOG_H_ */
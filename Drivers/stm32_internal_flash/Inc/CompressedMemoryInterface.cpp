@@ -0,0 +1,680 @@
+/*
+ * Compressing front end for a MemoryInterface.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "CompressedMemoryInterface.h"
+#include "LzCodec.h"
+#include "BlankCheck.h"
+#include <algorithm>
+#include <cstddef>
+#include <string.h>
+
+namespace stm32_internal_flash {
+
+CompressedMemoryInterface::CompressedMemoryInterface( MemoryInterface & backing_, std::size_t size_ )
+: backing( backing_ ),
+  size( std::min( size_, MAX_CHUNKS * CHUNK_SIZE ) / CHUNK_SIZE * CHUNK_SIZE )
+{
+	for( std::size_t address = 0; address < backing.get_size() && segment_count < MAX_SEGMENTS; ) {
+		Segment & segment = segments[segment_count++];
+		segment.address = address;
+		segment.size = backing.get_page_size_at( address );
+		address += segment.size;
+	}
+
+	for( std::size_t segment = 0; segment < segment_count; segment++ ) {
+		reserve_size = std::max( reserve_size, get_payload( segment ) );
+	}
+
+	index.fill( NO_RECORD );
+}
+
+uint16_t CompressedMemoryInterface::calc_check( const RecordHeader & header, const std::span<const std::byte> & data )
+{
+	// FNV-1a over the fields before check and the data, folded to 16 bits
+	uint32_t hash = 0x811C9DC5;
+
+	auto add = [&hash]( const std::byte *p, std::size_t len ) {
+		for( std::size_t i = 0; i < len; i++ ) {
+			hash = (hash ^ static_cast<uint32_t>(p[i])) * 0x01000193;
+		}
+	};
+
+	add( reinterpret_cast<const std::byte*>(&header), offsetof( RecordHeader, check ) );
+	add( data.data(), data.size() );
+
+	return static_cast<uint16_t>( hash ^ (hash >> 16) );
+}
+
+bool CompressedMemoryInterface::read_backing( std::size_t address, std::span<std::byte> data ) const
+{
+	if( const std::byte *mapped = backing.get_mapped_address( address ); mapped ) {
+		memcpy( data.data(), mapped, data.size() );
+		return true;
+	}
+
+	return backing.read( address, data ) == data.size();
+}
+
+bool CompressedMemoryInterface::get_record_data( std::size_t address, const RecordHeader & header, std::span<std::byte> buffer, std::span<const std::byte> & data ) const
+{
+	const std::size_t data_address = address + sizeof(RecordHeader);
+
+	if( const std::byte *mapped = backing.get_mapped_address( data_address ); mapped ) {
+		data = std::span<const std::byte>( mapped, header.stored_len );
+		return true;
+	}
+
+	auto target = buffer.first( header.stored_len );
+
+	if( backing.read( data_address, target ) != target.size() ) {
+		return false;
+	}
+
+	data = target;
+	return true;
+}
+
+template<class FUNC> bool CompressedMemoryInterface::scan_segment( std::size_t segment, std::size_t & end_offset, FUNC func )
+{
+	const Segment & seg = segments[segment];
+	std::size_t offset = sizeof(SegmentHeader);
+
+	while( offset + sizeof(RecordHeader) <= seg.size ) {
+		const std::size_t address = seg.address + offset;
+		RecordHeader header;
+
+		if( !read_backing( address, std::span<std::byte>( reinterpret_cast<std::byte*>(&header), sizeof(header) ) ) ) {
+			return false;
+		}
+
+		if( is_blank( std::span<const std::byte>( reinterpret_cast<const std::byte*>(&header), sizeof(header) ) ) ) {
+			break;
+		}
+
+		const bool size_known = header.chunk < MAX_CHUNKS &&
+				header.stored_len <= CHUNK_SIZE &&
+				offset + get_record_size( header.stored_len ) <= seg.size;
+
+		if( !size_known ) {
+			// torn by a power loss, nothing is appended after it
+			end_offset = seg.size;
+			return true;
+		}
+
+		std::span<const std::byte> data;
+
+		const bool valid = header.encoding >= Encoding::Raw && header.encoding <= Encoding::Blank &&
+				get_record_data( address, header, compress_buffer, data ) &&
+				calc_check( header, data ) == header.check;
+
+		// a torn record is skipped, the next one follows it
+		if( valid && !func( address, header ) ) {
+			return false;
+		}
+
+		offset += get_record_size( header.stored_len );
+	}
+
+	end_offset = std::min( offset, seg.size );
+
+	return true;
+}
+
+bool CompressedMemoryInterface::start_segment( std::size_t segment )
+{
+	Segment & seg = segments[segment];
+
+	if( !backing.erase( seg.address, seg.size ) ) {
+		return false;
+	}
+
+	SegmentHeader header;
+	header.magic = MAGIC;
+	header.sequence = sequence + 1;
+	header.sequence_inv = ~header.sequence;
+	header.reserved = 0xFFFFFFFF;
+
+	auto data = std::span<const std::byte>( reinterpret_cast<const std::byte*>(&header), sizeof(header) );
+
+	if( backing.program( seg.address, data ) != data.size() ) {
+		return false;
+	}
+
+	sequence = header.sequence;
+	seg.sequence = sequence;
+	head = segment;
+	head_offset = sizeof(SegmentHeader);
+
+	return true;
+}
+
+bool CompressedMemoryInterface::mount()
+{
+	mounted = false;
+	index.fill( NO_RECORD );
+	buffered_chunk = MAX_CHUNKS;
+	sequence = 0;
+
+	if( segment_count < 2 ) {
+		return false;
+	}
+
+	std::array<std::size_t,MAX_SEGMENTS> order;
+	std::size_t used = 0;
+
+	for( std::size_t segment = 0; segment < segment_count; segment++ ) {
+		SegmentHeader header;
+
+		if( !read_backing( segments[segment].address, std::span<std::byte>( reinterpret_cast<std::byte*>(&header), sizeof(header) ) ) ) {
+			return false;
+		}
+
+		segments[segment].sequence = header.is_valid() ? header.sequence : 0;
+
+		if( segments[segment].sequence != 0 ) {
+			order[used++] = segment;
+		}
+	}
+
+	if( used == 0 ) {
+		if( !start_segment( 0 ) ) {
+			return false;
+		}
+
+		mounted = true;
+		return true;
+	}
+
+	std::sort( order.begin(), order.begin() + used, [this]( std::size_t a, std::size_t b ) {
+		return segments[a].sequence < segments[b].sequence;
+	});
+
+	// newer records replace older ones
+	for( std::size_t i = 0; i < used; i++ ) {
+		std::size_t end_offset = 0;
+
+		bool ok = scan_segment( order[i], end_offset, [this]( std::size_t address, const RecordHeader & header ) {
+			index[header.chunk] = address;
+			return true;
+		});
+
+		if( !ok ) {
+			return false;
+		}
+
+		head = order[i];
+		head_offset = end_offset;
+		sequence = segments[head].sequence;
+	}
+
+	// power was lost during a collect, or before it. If the live records
+	// don't fit any more, the log stays readable and write() fails.
+	if( !keep_reserve() ) {
+		return false;
+	}
+
+	mounted = true;
+
+	return true;
+}
+
+bool CompressedMemoryInterface::format()
+{
+	for( std::size_t segment = 0; segment < segment_count; segment++ ) {
+		if( !backing.erase( segments[segment].address, segments[segment].size ) ) {
+			return false;
+		}
+	}
+
+	return mount();
+}
+
+std::size_t CompressedMemoryInterface::get_reserved_space() const
+{
+	std::size_t space = 0;
+
+	for( std::size_t segment = next_segment( head ); segment != head && segments[segment].sequence == 0; segment = next_segment( segment ) ) {
+		space += get_payload( segment );
+	}
+
+	return space;
+}
+
+std::size_t CompressedMemoryInterface::get_oldest_segment() const
+{
+	std::size_t segment = next_segment( head );
+
+	while( segment != head && segments[segment].sequence == 0 ) {
+		segment = next_segment( segment );
+	}
+
+	return segment;
+}
+
+bool CompressedMemoryInterface::can_collect( std::size_t segment )
+{
+	std::size_t live = 0;
+	std::size_t largest_record = 0;
+	std::size_t end_offset = 0;
+
+	bool ok = scan_segment( segment, end_offset, [&]( std::size_t address, const RecordHeader & header ) {
+		if( index[header.chunk] == address ) {
+			live += get_record_size( header.stored_len );
+			largest_record = std::max( largest_record, get_record_size( header.stored_len ) );
+		}
+		return true;
+	});
+
+	if( !ok ) {
+		return false;
+	}
+
+	if( live == 0 ) {
+		return true;
+	}
+
+	// less than the largest record stays unused at the end of each segment
+	std::size_t space = 0;
+	std::size_t free = segments[head].size - head_offset;
+
+	for( std::size_t seg = head; ; ) {
+		space += free >= largest_record ? free - (largest_record - 1) : 0;
+		seg = next_segment( seg );
+
+		if( seg == segment || segments[seg].sequence != 0 ) {
+			break;
+		}
+
+		free = get_payload( seg );
+	}
+
+	return space >= live;
+}
+
+bool CompressedMemoryInterface::collect( std::size_t segment )
+{
+	std::size_t end_offset = 0;
+
+	bool ok = scan_segment( segment, end_offset, [this]( std::size_t address, const RecordHeader & header ) {
+		// replaced by a newer record
+		if( index[header.chunk] != address ) {
+			return true;
+		}
+
+		// continue in the next erased segment, never in the collected one
+		if( head_offset + get_record_size( header.stored_len ) > segments[head].size ) {
+			const std::size_t next = next_segment( head );
+
+			if( segments[next].sequence != 0 || !start_segment( next ) ) {
+				return false;
+			}
+		}
+
+		std::span<const std::byte> data;
+		buffered_chunk = MAX_CHUNKS;
+
+		if( !get_record_data( address, header, chunk_buffer, data ) ) {
+			return false;
+		}
+
+		statistic.collected_records++;
+
+		return append( header.chunk, header.encoding, data, false );
+	});
+
+	if( !ok ) {
+		return false;
+	}
+
+	if( !backing.erase( segments[segment].address, segments[segment].size ) ) {
+		return false;
+	}
+
+	segments[segment].sequence = 0;
+	statistic.erased_segments++;
+
+	return true;
+}
+
+bool CompressedMemoryInterface::keep_reserve()
+{
+	// each round erases a segment
+	for( std::size_t round = 0; round < segment_count && get_reserved_space() < reserve_size; round++ ) {
+		const std::size_t oldest = get_oldest_segment();
+
+		// nothing left to collect, or the log is full
+		if( oldest == head || !can_collect( oldest ) ) {
+			break;
+		}
+
+		if( !collect( oldest ) ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool CompressedMemoryInterface::advance_head()
+{
+	const std::size_t next = next_segment( head );
+
+	// the reserve is used up, only dead records can be dropped
+	if( segments[next].sequence != 0 && !(can_collect( next ) && collect( next )) ) {
+		return false;
+	}
+
+	if( !start_segment( next ) ) {
+		return false;
+	}
+
+	return keep_reserve();
+}
+
+bool CompressedMemoryInterface::append( uint16_t chunk, Encoding encoding, const std::span<const std::byte> & data, bool allow_advance )
+{
+	const std::size_t record_size = get_record_size( data.size() );
+
+	if( head_offset + record_size > segments[head].size ) {
+		if( !allow_advance || !advance_head() ) {
+			return false;
+		}
+
+		if( head_offset + record_size > segments[head].size ) {
+			return false;
+		}
+	}
+
+	RecordHeader header;
+	header.chunk = chunk;
+	header.stored_len = static_cast<uint16_t>( data.size() );
+	header.encoding = encoding;
+	header.check = calc_check( header, data );
+
+	const std::size_t address = segments[head].address + head_offset;
+
+	// whatever happens, this space is used now
+	head_offset += record_size;
+
+	// the header first, so a torn record is never overwritten
+	if( backing.program( address, std::span<const std::byte>( reinterpret_cast<const std::byte*>(&header), sizeof(header) ) ) != sizeof(header) ) {
+		return false;
+	}
+
+	const std::size_t aligned_len = data.size() & ~std::size_t(3);
+
+	if( aligned_len > 0 && backing.program( address + sizeof(header), data.first( aligned_len ) ) != aligned_len ) {
+		return false;
+	}
+
+	if( aligned_len < data.size() ) {
+		std::array<std::byte,4> tail;
+		tail.fill( std::byte(0xFF) );
+		memcpy( tail.data(), data.data() + aligned_len, data.size() - aligned_len );
+
+		if( backing.program( address + sizeof(header) + aligned_len, tail ) != tail.size() ) {
+			return false;
+		}
+	}
+
+	index[chunk] = address;
+
+	statistic.bytes_stored += record_size;
+
+	return true;
+}
+
+bool CompressedMemoryInterface::load_chunk( std::size_t chunk, const std::byte* & data )
+{
+	if( buffered_chunk == chunk ) {
+		data = chunk_buffer.data();
+		return true;
+	}
+
+	buffered_chunk = MAX_CHUNKS;
+
+	const uint32_t address = index[chunk];
+	RecordHeader header;
+
+	if( address != NO_RECORD ) {
+		if( !read_backing( address, std::span<std::byte>( reinterpret_cast<std::byte*>(&header), sizeof(header) ) ) ) {
+			return false;
+		}
+	} else {
+		header.encoding = Encoding::Blank;
+	}
+
+	std::span<const std::byte> stored;
+
+	switch( header.encoding )
+	{
+	case Encoding::Blank:
+		chunk_buffer.fill( std::byte(0xFF) );
+		break;
+
+	case Encoding::Raw:
+		if( !get_record_data( address, header, chunk_buffer, stored ) ) {
+			return false;
+		}
+
+		// zero copy
+		if( stored.data() != chunk_buffer.data() ) {
+			data = stored.data();
+			return true;
+		}
+		break;
+
+	case Encoding::Lz:
+		if( !get_record_data( address, header, compress_buffer, stored ) ) {
+			return false;
+		}
+
+		if( lz_codec::decompress( stored, chunk_buffer ) != CHUNK_SIZE ) {
+			return false;
+		}
+		break;
+
+	default:
+		return false;
+	}
+
+	buffered_chunk = chunk;
+	data = chunk_buffer.data();
+
+	return true;
+}
+
+bool CompressedMemoryInterface::store_chunk( std::size_t chunk, const std::span<const std::byte> & data )
+{
+	statistic.chunks_written++;
+	statistic.bytes_in += CHUNK_SIZE;
+
+	if( is_blank( data ) ) {
+		return append( chunk, Encoding::Blank, {}, false );
+	}
+
+	// it has to save at least one word, otherwise it's stored as it is
+	const std::size_t compressed_len = lz_codec::compress( data, std::span<std::byte>( compress_buffer.data(), CHUNK_SIZE - 4 ) );
+
+	if( compressed_len == 0 ) {
+		return append( chunk, Encoding::Raw, data, false );
+	}
+
+	return append( chunk, Encoding::Lz, std::span<const std::byte>( compress_buffer.data(), compressed_len ), false );
+}
+
+std::size_t CompressedMemoryInterface::read( std::size_t address, std::span<std::byte> & data )
+{
+	if( !mounted || address >= size ) {
+		return 0;
+	}
+
+	const std::size_t len = std::min( data.size(), size - address );
+
+	for( std::size_t pos = 0; pos < len; ) {
+		const std::size_t chunk = (address + pos) / CHUNK_SIZE;
+		const std::size_t offset = (address + pos) % CHUNK_SIZE;
+		const std::size_t n = std::min( len - pos, CHUNK_SIZE - offset );
+		const std::byte *chunk_data = nullptr;
+
+		if( !load_chunk( chunk, chunk_data ) ) {
+			return pos;
+		}
+
+		memcpy( data.data() + pos, chunk_data + offset, n );
+		pos += n;
+	}
+
+	return len;
+}
+
+std::size_t CompressedMemoryInterface::write( std::size_t address, const std::span<const std::byte> & data )
+{
+	if( !mounted || address >= size ) {
+		return 0;
+	}
+
+	const std::size_t len = std::min( data.size(), size - address );
+
+	for( std::size_t pos = 0; pos < len; ) {
+		const std::size_t chunk = (address + pos) / CHUNK_SIZE;
+		const std::size_t offset = (address + pos) % CHUNK_SIZE;
+		const std::size_t n = std::min( len - pos, CHUNK_SIZE - offset );
+
+		// Moving the head collects records through the buffers, so this is
+		// done before the chunk is prepared. Up to one record at the end of
+		// each segment stays unused.
+		if( head_offset + get_record_size( CHUNK_SIZE ) > segments[head].size ) {
+			if( !advance_head() ) {
+				return pos;
+			}
+		}
+
+		const std::byte *current = nullptr;
+
+		if( !load_chunk( chunk, current ) ) {
+			return pos;
+		}
+
+		if( memcmp( current + offset, data.data() + pos, n ) == 0 ) {
+			pos += n;
+			continue;
+		}
+
+		std::span<const std::byte> content;
+
+		if( n == CHUNK_SIZE ) {
+			content = data.subspan( pos, n );
+			buffered_chunk = MAX_CHUNKS;
+		} else {
+			if( current != chunk_buffer.data() ) {
+				memcpy( chunk_buffer.data(), current, CHUNK_SIZE );
+			}
+
+			memcpy( chunk_buffer.data() + offset, data.data() + pos, n );
+			buffered_chunk = chunk;
+			content = chunk_buffer;
+		}
+
+		if( !store_chunk( chunk, content ) ) {
+			buffered_chunk = MAX_CHUNKS;
+			return pos;
+		}
+
+		pos += n;
+	}
+
+	return len;
+}
+
+bool CompressedMemoryInterface::erase( std::size_t address, std::size_t erase_size )
+{
+	if( !mounted || address >= size || erase_size > size - address ) {
+		return false;
+	}
+
+	std::array<std::byte,64> blank;
+	blank.fill( std::byte(0xFF) );
+
+	for( std::size_t pos = 0; pos < erase_size; ) {
+		const std::size_t chunk = (address + pos) / CHUNK_SIZE;
+		const std::size_t offset = (address + pos) % CHUNK_SIZE;
+		const std::size_t n = std::min( erase_size - pos, CHUNK_SIZE - offset );
+
+		if( n == CHUNK_SIZE ) {
+			if( index[chunk] != NO_RECORD ) {
+				if( head_offset + get_record_size( 0 ) > segments[head].size && !advance_head() ) {
+					return false;
+				}
+
+				if( buffered_chunk == chunk ) {
+					buffered_chunk = MAX_CHUNKS;
+				}
+
+				statistic.chunks_written++;
+				statistic.bytes_in += CHUNK_SIZE;
+
+				if( !append( static_cast<uint16_t>( chunk ), Encoding::Blank, {}, false ) ) {
+					return false;
+				}
+			}
+		} else {
+			for( std::size_t done = 0; done < n; done += blank.size() ) {
+				auto part = std::span<const std::byte>( blank.data(), std::min( blank.size(), n - done ) );
+
+				if( write( address + pos + done, part ) != part.size() ) {
+					return false;
+				}
+			}
+		}
+
+		pos += n;
+	}
+
+	return true;
+}
+
+const std::byte* CompressedMemoryInterface::get_mapped_address( std::size_t address ) const
+{
+	if( !mounted || address >= size ) {
+		return nullptr;
+	}
+
+	const uint32_t record = index[address / CHUNK_SIZE];
+
+	if( record == NO_RECORD ) {
+		return nullptr;
+	}
+
+	const std::byte *mapped = backing.get_mapped_address( record );
+
+	if( !mapped ) {
+		return nullptr;
+	}
+
+	RecordHeader header;
+	memcpy( &header, mapped, sizeof(header) );
+
+	if( header.encoding != Encoding::Raw ) {
+		return nullptr;
+	}
+
+	return mapped + sizeof(RecordHeader) + address % CHUNK_SIZE;
+}
+
+std::size_t CompressedMemoryInterface::get_free_space() const
+{
+	std::size_t free = segments[head].size - head_offset;
+
+	for( std::size_t segment = 0; segment < segment_count; segment++ ) {
+		if( segment != head && segments[segment].sequence == 0 ) {
+			free += get_payload( segment );
+		}
+	}
+
+	return free > reserve_size ? free - reserve_size : 0;
+}
+
+} // namespace stm32_internal_flash
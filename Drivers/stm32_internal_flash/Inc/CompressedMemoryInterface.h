@@ -0,0 +1,239 @@
+/*
+ * Compressing front end for a MemoryInterface.
+ *
+ * The logical memory is divided into chunks of CHUNK_SIZE bytes. Each
+ * written chunk is compressed with lz_codec and appended as a record to
+ * a log in the pages of the underlying memory. A chunk index in RAM
+ * points to the newest record of each chunk; it is rebuilt by mount().
+ *
+ * Chunks, that don't compress, are stored as they are. Reading them
+ * is zero copy, get_mapped_address() points directly into the flash.
+ *
+ * Pages are used as segments of the log in a circular order. The
+ * erased segments after the head are kept large enough to take the live
+ * records of the largest segment. When the head moves on, the oldest
+ * segments are collected: their live records are copied to the head
+ * and they are erased. With pages of different sizes the reserve can be
+ * more than one page, eg. the 64K sector of 16K, 16K, 16K, 64K.
+ *
+ * A collect is only started, if the live records fit, so a full log
+ * fails write(), but stays consistent. After a power loss during a
+ * collect mount() finishes it.
+ *
+ * The logical size can be larger than the underlying memory. If the
+ * data doesn't compress well enough, write() fails, when the
+ * log is full.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_COMPRESSEDMEMORYINTERFACE_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_COMPRESSEDMEMORYINTERFACE_H_
+
+#include "MemoryInterface.h"
+#include <array>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+class CompressedMemoryInterface : public MemoryInterface
+{
+public:
+	static constexpr std::size_t CHUNK_SIZE = 1024;
+	static constexpr std::size_t MAX_CHUNKS = 256;
+	static constexpr std::size_t MAX_SEGMENTS = 16;
+	static constexpr uint32_t MAGIC = 0x31504D43; // "CMP1", little endian
+	static constexpr uint32_t NO_RECORD = 0xFFFFFFFF;
+
+	enum class Encoding : uint16_t
+	{
+		Raw = 1,
+		Lz = 2,
+		Blank = 3   // erased chunk, no data
+	};
+
+	struct SegmentHeader
+	{
+		uint32_t magic;
+		uint32_t sequence;
+		uint32_t sequence_inv;
+		uint32_t reserved;
+
+		bool is_valid() const {
+			return magic == MAGIC && sequence_inv == ~sequence;
+		}
+	};
+
+	struct RecordHeader
+	{
+		uint16_t chunk;
+		uint16_t stored_len;
+		Encoding encoding;
+		uint16_t check;  // over the header fields and the data
+	};
+
+	struct Statistic
+	{
+		std::size_t chunks_written = 0;
+		std::size_t bytes_in = 0;      // logical bytes of the written chunks
+		std::size_t bytes_stored = 0;  // including record headers
+		std::size_t collected_records = 0;
+		std::size_t erased_segments = 0;
+	};
+
+protected:
+	MemoryInterface & backing;
+	const std::size_t size;
+
+	struct Segment
+	{
+		std::size_t address = 0;
+		std::size_t size = 0;
+		uint32_t sequence = 0;  // 0: erased
+	};
+
+	std::array<Segment,MAX_SEGMENTS> segments;
+	std::size_t segment_count = 0;
+
+	// payload of the largest segment, has to stay erased after the head
+	std::size_t reserve_size = 0;
+
+	bool mounted = false;
+	std::size_t head = 0;        // segment, that is appended to
+	std::size_t head_offset = 0; // next free byte in the head segment
+	uint32_t sequence = 0;       // of the head segment
+
+	std::array<uint32_t,MAX_CHUNKS> index;
+
+	// last decompressed chunk
+	std::array<std::byte,CHUNK_SIZE> chunk_buffer;
+	std::size_t buffered_chunk = MAX_CHUNKS;
+
+	std::array<std::byte,CHUNK_SIZE> compress_buffer;
+
+	Statistic statistic;
+
+public:
+	/**
+	 * size: logical size, at most MAX_CHUNKS * CHUNK_SIZE
+	 */
+	CompressedMemoryInterface( MemoryInterface & backing_, std::size_t size_ );
+
+	/**
+	 * Scans the log and rebuilds the chunk index.
+	 * Has to be called before anything else.
+	 */
+	bool mount();
+
+	/**
+	 * erases the underlying memory
+	 */
+	bool format();
+
+	std::size_t get_size() const override {
+		return size;
+	}
+
+	std::size_t get_page_size() const override {
+		return CHUNK_SIZE;
+	}
+
+	std::size_t write( std::size_t address, const std::span<const std::byte> & data ) override;
+
+	std::size_t read( std::size_t address, std::span<std::byte> & data ) override;
+
+	bool erase( std::size_t address, std::size_t size ) override;
+
+	/**
+	 * Returns a pointer into the flash, if the chunk is stored uncompressed.
+	 * It is valid until the end of the chunk.
+	 */
+	const std::byte* get_mapped_address( std::size_t address ) const override;
+
+	const Statistic & get_statistic() const {
+		return statistic;
+	}
+
+	void clear_statistic() {
+		statistic = Statistic();
+	}
+
+	/**
+	 * free bytes in the log, without the reserve
+	 */
+	std::size_t get_free_space() const;
+
+protected:
+	static uint16_t calc_check( const RecordHeader & header, const std::span<const std::byte> & data );
+
+	static std::size_t get_record_size( std::size_t stored_len ) {
+		return sizeof(RecordHeader) + ((stored_len + 3) & ~std::size_t(3));
+	}
+
+	std::size_t next_segment( std::size_t segment ) const {
+		return (segment + 1) % segment_count;
+	}
+
+	bool read_backing( std::size_t address, std::span<std::byte> data ) const;
+
+	/**
+	 * Reads the data of the record. Points into the mapped flash,
+	 * or is read into buffer.
+	 */
+	bool get_record_data( std::size_t address, const RecordHeader & header, std::span<std::byte> buffer, std::span<const std::byte> & data ) const;
+
+	/**
+	 * calls func( address, header ) for each valid record of the segment,
+	 * returns the offset after the last one
+	 */
+	template<class FUNC> bool scan_segment( std::size_t segment, std::size_t & end_offset, FUNC func );
+
+	bool start_segment( std::size_t segment );
+
+	std::size_t get_payload( std::size_t segment ) const {
+		return segments[segment].size - sizeof(SegmentHeader);
+	}
+
+	/**
+	 * payload of the erased segments after the head
+	 */
+	std::size_t get_reserved_space() const;
+
+	/**
+	 * the first segment after the head, that is not erased,
+	 * or the head, if there is none
+	 */
+	std::size_t get_oldest_segment() const;
+
+	/**
+	 * true, if the live records of segment fit into the head
+	 * and the erased segments in front of it
+	 */
+	bool can_collect( std::size_t segment );
+
+	/**
+	 * copies the live records of segment to the head and erases it.
+	 * If the head is full, it continues in the next erased segment.
+	 */
+	bool collect( std::size_t segment );
+
+	/**
+	 * collects the oldest segments, until the reserve is large enough
+	 */
+	bool keep_reserve();
+
+	bool advance_head();
+
+	bool append( uint16_t chunk, Encoding encoding, const std::span<const std::byte> & data, bool allow_advance = true );
+
+	/**
+	 * current content of the chunk, in buffer or mapped flash
+	 */
+	bool load_chunk( std::size_t chunk, const std::byte* & data );
+
+	bool store_chunk( std::size_t chunk, const std::span<const std::byte> & data );
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_COMPRESSEDMEMORYINTERFACE_H_ */
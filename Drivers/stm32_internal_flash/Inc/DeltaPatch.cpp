@@ -0,0 +1,224 @@
+/*
+ * Applies a binary delta patch, that turns an old image into a new one.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "DeltaPatch.h"
+#include <algorithm>
+#include <string.h>
+
+namespace stm32_internal_flash {
+
+DeltaPatchApplier::DeltaPatchApplier( const std::span<const std::byte> & old_image_,
+		MemoryInterface & target_,
+		std::size_t target_address_,
+		bool check_old_hash_ )
+: old_image( old_image_ ),
+  target( target_ ),
+  target_address( target_address_ ),
+  check_old_hash( check_old_hash_ )
+{
+}
+
+bool DeltaPatchApplier::check_header()
+{
+	if( header.magic != delta_patch::MAGIC ) {
+		return false;
+	}
+
+	if( header.old_size > old_image.size() ) {
+		return false;
+	}
+
+	if( target_address > target.get_size() || header.new_size > target.get_size() - target_address ) {
+		return false;
+	}
+
+	// patching the wrong image would only be detected at the end
+	if( check_old_hash && Sha256::hash( old_image.first( header.old_size ) ) != header.old_hash ) {
+		return false;
+	}
+
+	return true;
+}
+
+bool DeltaPatchApplier::parse_varint( std::byte b )
+{
+	varint |= static_cast<uint32_t>( b & std::byte(0x7F) ) << varint_shift;
+	varint_shift += 7;
+
+	return (b & std::byte(0x80)) == std::byte(0);
+}
+
+bool DeltaPatchApplier::flush()
+{
+	if( output_len == 0 ) {
+		return true;
+	}
+
+	auto data = std::span<const std::byte>( output_buffer.data(), output_len );
+
+	if( target.program( target_address + programmed, data ) != data.size() ) {
+		return false;
+	}
+
+	programmed += output_len;
+	output_len = 0;
+
+	return true;
+}
+
+bool DeltaPatchApplier::output( std::span<const std::byte> data )
+{
+	sha.update( data );
+	produced += data.size();
+
+	while( !data.empty() ) {
+		// whole words straight from the mapped source, without copying
+		if( output_len == 0 && data.size() >= output_buffer.size() ) {
+			auto direct = data.first( data.size() & ~std::size_t(3) );
+
+			if( target.program( target_address + programmed, direct ) != direct.size() ) {
+				return false;
+			}
+
+			programmed += direct.size();
+			data = data.subspan( direct.size() );
+			continue;
+		}
+
+		const std::size_t len = std::min( data.size(), output_buffer.size() - output_len );
+		memcpy( output_buffer.data() + output_len, data.data(), len );
+		output_len += len;
+		data = data.subspan( len );
+
+		if( output_len == output_buffer.size() && !flush() ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool DeltaPatchApplier::feed( const std::span<const std::byte> & data )
+{
+	std::size_t pos = 0;
+
+	while( pos < data.size() ) {
+		switch( state )
+		{
+		case State::Header:
+		{
+			const std::size_t len = std::min( data.size() - pos, sizeof(header) - header_len );
+			memcpy( reinterpret_cast<std::byte*>(&header) + header_len, data.data() + pos, len );
+			header_len += len;
+			pos += len;
+
+			if( header_len == sizeof(header) ) {
+				if( !check_header() ) {
+					return fail();
+				}
+
+				state = header.new_size == 0 ? State::Done : State::Command;
+			}
+			break;
+		}
+
+		case State::Command:
+			command = static_cast<delta_patch::Command>( data[pos++] );
+
+			if( command != delta_patch::Command::Copy && command != delta_patch::Command::Literal ) {
+				return fail();
+			}
+
+			varint = 0;
+			varint_shift = 0;
+			state = State::Length;
+			break;
+
+		case State::Length:
+			if( varint_shift > 28 ) {
+				return fail();
+			}
+
+			if( !parse_varint( data[pos++] ) ) {
+				break;
+			}
+
+			length = varint;
+
+			if( length == 0 || length > header.new_size - produced ) {
+				return fail();
+			}
+
+			varint = 0;
+			varint_shift = 0;
+			state = command == delta_patch::Command::Copy ? State::Offset : State::Literal;
+			break;
+
+		case State::Offset:
+		{
+			if( varint_shift > 28 ) {
+				return fail();
+			}
+
+			if( !parse_varint( data[pos++] ) ) {
+				break;
+			}
+
+			const int64_t offset = static_cast<int64_t>(last_copy_end) + delta_patch::zigzag_decode( varint );
+
+			if( offset < 0 || static_cast<uint64_t>(offset) + length > header.old_size ) {
+				return fail();
+			}
+
+			if( !output( old_image.subspan( offset, length ) ) ) {
+				return fail();
+			}
+
+			last_copy_end = offset + length;
+			command_done();
+			break;
+		}
+
+		case State::Literal:
+		{
+			const std::size_t len = std::min( data.size() - pos, length );
+
+			if( !output( data.subspan( pos, len ) ) ) {
+				return fail();
+			}
+
+			pos += len;
+			length -= len;
+
+			if( length == 0 ) {
+				command_done();
+			}
+			break;
+		}
+
+		case State::Done:
+		case State::Failed:
+			// more data than the patch describes
+			return fail();
+		}
+	}
+
+	return true;
+}
+
+bool DeltaPatchApplier::finish()
+{
+	if( state != State::Done ) {
+		return false;
+	}
+
+	if( !flush() ) {
+		return fail();
+	}
+
+	return sha.finish() == header.new_hash;
+}
+
+} // namespace stm32_internal_flash
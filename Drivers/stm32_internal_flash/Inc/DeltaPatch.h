@@ -0,0 +1,174 @@
+/*
+ * Applies a binary delta patch, that turns an old image into a new one.
+ *
+ * The patch is generated on the host with tools/make_delta_patch.cpp.
+ * It consists of a header and a sequence of commands:
+ *
+ *   COPY    <length> <offset>  copies length bytes from the old image
+ *   LITERAL <length> <data>    data, that is not in the old image
+ *
+ * Numbers are LEB128 varints. The offset of COPY is relative to the end
+ * of the previous COPY, zigzag encoded. So code, that has only been moved
+ * a bit, costs only a few bytes.
+ *
+ * The old image is read directly from memory mapped flash, eg.
+ * Configuration::data_ptr. The patch can be fed in pieces of any size,
+ * as they arrive over UART. The output is collected in a small buffer
+ * and programmed into the erased target. So the RAM usage does not
+ * depend on the image size.
+ *
+ *   DeltaPatchApplier patch( old_image, target, 0 );
+ *   while( receive( data ) ) {
+ *     patch.feed( data );
+ *   }
+ *   patch.finish(); // true, if the new image has the expected hash
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_DELTAPATCH_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_DELTAPATCH_H_
+
+#include "MemoryInterface.h"
+#include "Sha256.h"
+#include <array>
+#include <span>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+namespace delta_patch {
+
+static constexpr uint32_t MAGIC = 0x31545044; // "DPT1", little endian
+
+struct Header
+{
+	uint32_t magic;
+	uint32_t old_size;
+	uint32_t new_size;
+	uint32_t reserved;
+	Sha256::digest_t old_hash;
+	Sha256::digest_t new_hash;
+};
+
+enum class Command : uint8_t
+{
+	Copy = 1,
+	Literal = 2
+};
+
+inline uint32_t zigzag_encode( int32_t value ) {
+	return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+inline int32_t zigzag_decode( uint32_t value ) {
+	return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+} // namespace delta_patch
+
+class DeltaPatchApplier
+{
+public:
+	static constexpr std::size_t OUTPUT_BUFFER_SIZE = 256;
+
+	enum class State
+	{
+		Header,
+		Command,
+		Length,
+		Offset,
+		Literal,
+		Done,
+		Failed
+	};
+
+protected:
+	const std::span<const std::byte> old_image;
+	MemoryInterface & target;
+	const std::size_t target_address;
+
+	State state = State::Header;
+	delta_patch::Header header {};
+	std::size_t header_len = 0;
+	delta_patch::Command command {};
+	uint32_t varint = 0;
+	unsigned varint_shift = 0;
+	std::size_t length = 0;
+	std::size_t last_copy_end = 0;
+	std::size_t produced = 0;  // bytes of the new image
+	std::size_t programmed = 0;
+
+	Sha256 sha;
+
+	std::array<std::byte,OUTPUT_BUFFER_SIZE> output_buffer;
+	std::size_t output_len = 0;
+
+	bool check_old_hash;
+
+public:
+	/**
+	 * old_image: memory mapped old image
+	 * target: the new image is programmed at target_address,
+	 *         which has to be erased and word aligned
+	 * check_old_hash: verify the old image, before anything is programmed
+	 */
+	DeltaPatchApplier( const std::span<const std::byte> & old_image_,
+			MemoryInterface & target_,
+			std::size_t target_address_,
+			bool check_old_hash_ = true );
+
+	/**
+	 * the next piece of the patch
+	 */
+	bool feed( const std::span<const std::byte> & data );
+
+	/**
+	 * Programs the rest of the output. Returns true, if the patch
+	 * was complete and the new image has the expected hash.
+	 */
+	bool finish();
+
+	State get_state() const {
+		return state;
+	}
+
+	/**
+	 * size of the new image, valid after the header has been fed
+	 */
+	std::size_t get_new_size() const {
+		return header.new_size;
+	}
+
+	std::size_t get_produced() const {
+		return produced;
+	}
+
+protected:
+	bool fail() {
+		state = State::Failed;
+		return false;
+	}
+
+	bool check_header();
+
+	/**
+	 * returns true, if the varint is complete
+	 */
+	bool parse_varint( std::byte b );
+
+	bool output( std::span<const std::byte> data );
+
+	bool flush();
+
+	/**
+	 * next state after a command has been completed
+	 */
+	void command_done() {
+		state = produced == header.new_size ? State::Done : State::Command;
+	}
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_DELTAPATCH_H_ */
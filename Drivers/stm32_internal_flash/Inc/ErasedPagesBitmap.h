@@ -0,0 +1,81 @@
+/*
+ * RAM bitmap that remembers which pages are known to be erased.
+ *
+ * Each page has three states: unknown, erased and dirty.
+ * Pages with an index >= MAX_PAGES are never tracked and
+ * always reported as unknown.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_ERASEDPAGESBITMAP_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_ERASEDPAGESBITMAP_H_
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+class ErasedPagesBitmap
+{
+public:
+	static constexpr std::size_t MAX_PAGES = 64;
+
+	enum class State
+	{
+		Unknown,
+		Erased,
+		Dirty
+	};
+
+private:
+	uint64_t known  = 0;
+	uint64_t erased = 0;
+
+public:
+	State get( std::size_t page_idx ) const {
+		if( page_idx >= MAX_PAGES || !(known & bit(page_idx)) ) {
+			return State::Unknown;
+		}
+
+		return (erased & bit(page_idx)) ? State::Erased : State::Dirty;
+	}
+
+	void set_erased( std::size_t page_idx ) {
+		if( page_idx < MAX_PAGES ) {
+			known  |= bit(page_idx);
+			erased |= bit(page_idx);
+		}
+	}
+
+	void set_dirty( std::size_t page_idx ) {
+		if( page_idx < MAX_PAGES ) {
+			known  |= bit(page_idx);
+			erased &= ~bit(page_idx);
+		}
+	}
+
+	void set_unknown( std::size_t page_idx ) {
+		if( page_idx < MAX_PAGES ) {
+			known  &= ~bit(page_idx);
+			erased &= ~bit(page_idx);
+		}
+	}
+
+	/**
+	 * forget everything, eg when someone else wrote to the flash
+	 */
+	void clear() {
+		known  = 0;
+		erased = 0;
+	}
+
+private:
+	static constexpr uint64_t bit( std::size_t page_idx ) {
+		return uint64_t(1) << page_idx;
+	}
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_ERASEDPAGESBITMAP_H_ */
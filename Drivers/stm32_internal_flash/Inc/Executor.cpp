@@ -0,0 +1,113 @@
+/*
+ * Minimal single threaded executor for C++20 coroutines.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "Executor.h"
+
+namespace stm32_internal_flash {
+
+bool Operation::await_ready()
+{
+	if( executor.is_resuming() ) {
+		return false;
+	}
+
+	return poll();
+}
+
+void Operation::await_suspend( std::coroutine_handle<> handle )
+{
+	waiting = handle;
+	executor.add_waiting( this );
+}
+
+Executor::~Executor()
+{
+	for( auto & task : tasks ) {
+		if( task ) {
+			task.destroy();
+		}
+	}
+}
+
+bool Executor::spawn( Task<void> && task )
+{
+	for( std::size_t i = 0; i < tasks.size(); i++ ) {
+		if( !tasks[i] ) {
+			tasks[i] = task.release();
+			started[i] = false;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void Executor::add_waiting( Operation *operation )
+{
+	operation->next = nullptr;
+
+	if( waiting_last ) {
+		waiting_last->next = operation;
+	} else {
+		waiting_first = operation;
+	}
+
+	waiting_last = operation;
+}
+
+bool Executor::run_once()
+{
+	// operations added while starting or resuming tasks
+	// have done their first step, they are polled the next time
+	Operation *operation = waiting_first;
+	waiting_first = nullptr;
+	waiting_last = nullptr;
+
+	for( std::size_t i = 0; i < tasks.size(); i++ ) {
+		if( tasks[i] && !started[i] ) {
+			started[i] = true;
+			tasks[i].resume();
+		}
+	}
+
+	while( operation ) {
+		// the operation is part of the coroutine frame and
+		// can be gone after resuming
+		Operation *next = operation->next;
+
+		if( operation->poll() ) {
+			std::coroutine_handle<> handle = std::exchange( operation->waiting, {} );
+			resuming = true;
+			handle.resume();
+			resuming = false;
+		} else {
+			add_waiting( operation );
+		}
+
+		operation = next;
+	}
+
+	for( auto & task : tasks ) {
+		if( task && task.done() ) {
+			task.destroy();
+			task = {};
+		}
+	}
+
+	return !empty();
+}
+
+bool Executor::empty() const
+{
+	for( auto & task : tasks ) {
+		if( task ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+} // namespace stm32_internal_flash
@@ -0,0 +1,266 @@
+/*
+ * Minimal single threaded executor for C++20 coroutines.
+ *
+ * Tasks are started with spawn() and run by calling run_once()
+ * from the superloop. A task waits for an Operation with co_await.
+ * The executor polls each waiting operation once per run_once() call
+ * and resumes the task when the operation is done.
+ *
+ * No RTOS and no threads are required.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_EXECUTOR_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_EXECUTOR_H_
+
+#include <coroutine>
+#include <array>
+#include <utility>
+#include <cstdlib>
+
+namespace stm32_internal_flash {
+
+namespace detail {
+
+struct TaskPromiseBase
+{
+	// the task waiting for this one
+	std::coroutine_handle<> continuation{};
+
+	struct FinalAwaiter
+	{
+		bool await_ready() noexcept {
+			return false;
+		}
+
+		template<class Promise>
+		std::coroutine_handle<> await_suspend( std::coroutine_handle<Promise> handle ) noexcept {
+			if( handle.promise().continuation ) {
+				return handle.promise().continuation;
+			}
+
+			// a spawned task, the executor destroys it
+			return std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	std::suspend_always initial_suspend() noexcept {
+		return {};
+	}
+
+	FinalAwaiter final_suspend() noexcept {
+		return {};
+	}
+
+	// The flash tasks report errors with their results and don't throw.
+	// An exception, that leaves a task anyway, is a bug: there is nobody
+	// in run_once() to deliver it to, so stop here.
+	void unhandled_exception() {
+		std::abort();
+	}
+};
+
+template<class T>
+struct TaskPromiseValue : public TaskPromiseBase
+{
+	T value{};
+
+	void return_value( T value_ ) {
+		value = std::move( value_ );
+	}
+
+	T get_value() {
+		return std::move( value );
+	}
+};
+
+template<>
+struct TaskPromiseValue<void> : public TaskPromiseBase
+{
+	void return_void() {}
+	void get_value() {}
+};
+
+} // namespace detail
+
+/**
+ * A lazily started coroutine. Can be awaited by another Task,
+ * or started with Executor::spawn().
+ */
+template<class T = void>
+class Task
+{
+public:
+	struct promise_type : public detail::TaskPromiseValue<T>
+	{
+		Task get_return_object() {
+			return Task( std::coroutine_handle<promise_type>::from_promise( *this ) );
+		}
+	};
+
+private:
+	std::coroutine_handle<promise_type> handle;
+
+public:
+	explicit Task( std::coroutine_handle<promise_type> handle_ )
+	: handle( handle_ )
+	{}
+
+	Task( Task && other )
+	: handle( std::exchange( other.handle, {} ) )
+	{}
+
+	Task( const Task & other ) = delete;
+	Task & operator=( const Task & other ) = delete;
+
+	~Task() {
+		if( handle ) {
+			handle.destroy();
+		}
+	}
+
+	bool await_ready() const {
+		return false;
+	}
+
+	std::coroutine_handle<> await_suspend( std::coroutine_handle<> caller ) {
+		handle.promise().continuation = caller;
+		return handle;
+	}
+
+	T await_resume() {
+		return handle.promise().get_value();
+	}
+
+	/**
+	 * the executor takes the ownership
+	 */
+	std::coroutine_handle<> release() {
+		return std::exchange( handle, {} );
+	}
+};
+
+class Executor;
+
+/**
+ * Base class of everything a task can wait for.
+ * poll() is called by the executor until it returns true.
+ */
+class Operation
+{
+	friend class Executor;
+
+	Operation *next = nullptr;
+	std::coroutine_handle<> waiting{};
+
+protected:
+	Executor & executor;
+
+public:
+	Operation( Executor & executor_ )
+	: executor( executor_ )
+	{}
+
+	virtual ~Operation() {}
+
+	/**
+	 * does the next step of the operation, returns true if it is done
+	 */
+	virtual bool poll() = 0;
+
+	/**
+	 * The first step is done at once, unless the task has just been
+	 * resumed after another operation. Then it has used its step of
+	 * this run_once() already, and the operation is polled the next time.
+	 */
+	bool await_ready();
+
+	void await_suspend( std::coroutine_handle<> handle );
+};
+
+class Executor
+{
+public:
+	static constexpr std::size_t MAX_TASKS = 8;
+
+private:
+	std::array<std::coroutine_handle<>,MAX_TASKS> tasks{};
+
+	// tasks spawned, but not started yet
+	std::array<bool,MAX_TASKS> started{};
+
+	// list of operations tasks are waiting for
+	Operation *waiting_first = nullptr;
+	Operation *waiting_last = nullptr;
+
+	// a task is resumed, after its operation has done a step
+	bool resuming = false;
+
+public:
+	Executor() = default;
+	Executor( const Executor & other ) = delete;
+	Executor & operator=( const Executor & other ) = delete;
+
+	~Executor();
+
+	/**
+	 * returns false if MAX_TASKS are already running
+	 */
+	bool spawn( Task<void> && task );
+
+	/**
+	 * Starts new tasks, polls each waiting operation once
+	 * and resumes the tasks of finished operations.
+	 * Returns false if there is nothing to do any more.
+	 */
+	bool run_once();
+
+	/**
+	 * runs until all tasks are done
+	 */
+	void run() {
+		while( run_once() ) {}
+	}
+
+	bool empty() const;
+
+	/**
+	 * called from Operation::await_suspend()
+	 */
+	void add_waiting( Operation *operation );
+
+	bool is_resuming() const {
+		return resuming;
+	}
+};
+
+/**
+ * co_await executor_yield( executor ) gives other tasks a chance to run
+ */
+class Yield : public Operation
+{
+public:
+	using Operation::Operation;
+
+	// always suspends, the task goes on with the next run_once()
+	bool await_ready() {
+		return false;
+	}
+
+	bool poll() override {
+		return true;
+	}
+
+	void await_resume() {}
+};
+
+inline Yield executor_yield( Executor & executor ) {
+	return Yield( executor );
+}
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_EXECUTOR_H_ */
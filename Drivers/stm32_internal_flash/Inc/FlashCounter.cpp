@@ -0,0 +1,209 @@
+/*
+ * Persistent counter, that increments without erasing.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "FlashCounter.h"
+#include <bit>
+#include <algorithm>
+#include <string.h>
+
+namespace stm32_internal_flash {
+
+FlashCounter::FlashCounter( RawDriverInterface & raw_driver_, std::size_t page_a_address, std::size_t page_b_address )
+: raw_driver( raw_driver_ ),
+  page_addresses{ page_a_address, page_b_address }
+{
+}
+
+std::size_t FlashCounter::get_capacity( std::size_t page ) const
+{
+	const std::size_t page_size = raw_driver.get_page_size_at( page_addresses[page] );
+
+	return (page_size - sizeof(Header)) / sizeof(uint32_t) * 32;
+}
+
+bool FlashCounter::read_word( std::size_t address, uint32_t & word )
+{
+	if( const std::byte *mapped = raw_driver.get_mapped_address( address ); mapped ) {
+		memcpy( &word, mapped, sizeof(word) );
+		return true;
+	}
+
+	std::span<std::byte> buffer( reinterpret_cast<std::byte*>(&word), sizeof(word) );
+
+	return raw_driver.read_page( address, buffer ) == sizeof(word);
+}
+
+bool FlashCounter::read_header( std::size_t page, Header & header )
+{
+	std::span<std::byte> buffer( reinterpret_cast<std::byte*>(&header), sizeof(header) );
+
+	if( raw_driver.read_page( page_addresses[page], buffer ) != sizeof(header) ) {
+		return false;
+	}
+
+	return header.is_valid();
+}
+
+bool FlashCounter::count_cleared_bits( std::size_t page, std::size_t & count )
+{
+	const std::size_t words = get_capacity( page ) / 32;
+	const std::size_t bits_address = get_bits_address( page );
+
+	// all words before the first one with bits left are 0
+	std::size_t lo = 0;
+	std::size_t hi = words;
+
+	while( lo < hi ) {
+		const std::size_t mid = lo + (hi - lo) / 2;
+		uint32_t word = 0;
+
+		if( !read_word( bits_address + mid * sizeof(uint32_t), word ) ) {
+			return false;
+		}
+
+		if( word == 0 ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if( lo == words ) {
+		count = words * 32;
+		return true;
+	}
+
+	uint32_t word = 0;
+
+	if( !read_word( bits_address + lo * sizeof(uint32_t), word ) ) {
+		return false;
+	}
+
+	// a single CLZ instruction on a Cortex-M4
+	count = lo * 32 + std::countl_zero( word );
+
+	return true;
+}
+
+bool FlashCounter::start_page( std::size_t page, uint32_t value )
+{
+	const std::size_t address = page_addresses[page];
+
+	if( !raw_driver.is_blank( address, raw_driver.get_page_size_at( address ) ) ) {
+		if( !raw_driver.erase_page( address, raw_driver.get_page_size_at( address ) ) ) {
+			return false;
+		}
+	}
+
+	Header header;
+	header.magic = MAGIC;
+	header.base = value;
+	header.base_inv = ~value;
+	header.reserved = 0xFFFFFFFF;
+
+	auto data = std::span<const std::byte>( reinterpret_cast<const std::byte*>(&header), sizeof(header) );
+
+	if( raw_driver.write_page( address, data ) != data.size() ) {
+		return false;
+	}
+
+	active = page;
+	base = value;
+	cleared_bits = 0;
+
+	return true;
+}
+
+bool FlashCounter::init()
+{
+	initialized = false;
+
+	std::array<Header,2> headers;
+	std::array<bool,2> valid;
+
+	for( std::size_t page = 0; page < 2; page++ ) {
+		valid[page] = read_header( page, headers[page] );
+	}
+
+	if( !valid[0] && !valid[1] ) {
+		if( !start_page( 0, 0 ) ) {
+			return false;
+		}
+
+		initialized = true;
+		return true;
+	}
+
+	// both are valid, after the power was lost while the old page was full
+	if( valid[0] && valid[1] ) {
+		active = headers[1].base > headers[0].base ? 1 : 0;
+	} else {
+		active = valid[0] ? 0 : 1;
+	}
+
+	base = headers[active].base;
+
+	if( !count_cleared_bits( active, cleared_bits ) ) {
+		return false;
+	}
+
+	initialized = true;
+
+	return true;
+}
+
+bool FlashCounter::clear_bits( std::size_t count )
+{
+	const std::size_t end = cleared_bits + count;
+	const std::size_t bits_address = get_bits_address( active );
+
+	while( cleared_bits < end ) {
+		const std::size_t word_idx = cleared_bits / 32;
+		const std::size_t bits_in_word = std::min<std::size_t>( end - word_idx * 32, 32 );
+
+		const uint32_t word = bits_in_word >= 32 ? 0 : 0xFFFFFFFF >> bits_in_word;
+
+		auto data = std::span<const std::byte>( reinterpret_cast<const std::byte*>(&word), sizeof(word) );
+
+		if( raw_driver.write_page( bits_address + word_idx * sizeof(uint32_t), data ) != data.size() ) {
+			return false;
+		}
+
+		cleared_bits = word_idx * 32 + bits_in_word;
+	}
+
+	return true;
+}
+
+bool FlashCounter::increment( uint32_t count )
+{
+	if( !initialized ) {
+		return false;
+	}
+
+	while( count > 0 ) {
+		const std::size_t capacity = get_capacity( active );
+
+		if( cleared_bits >= capacity ) {
+			if( !start_page( 1 - active, get() ) ) {
+				return false;
+			}
+
+			continue;
+		}
+
+		const std::size_t n = std::min<std::size_t>( count, capacity - cleared_bits );
+
+		if( !clear_bits( n ) ) {
+			return false;
+		}
+
+		count -= n;
+	}
+
+	return true;
+}
+
+} // namespace stm32_internal_flash
@@ -0,0 +1,101 @@
+/*
+ * Persistent counter, that increments without erasing.
+ *
+ * Each increment clears one more bit in the counter page, which is a
+ * plain program operation. Bits are cleared from the start of the page,
+ * and in each word from the most significant bit, so a word with k
+ * cleared bits is 0xFFFFFFFF >> k. Reading counts leading zeros (CLZ).
+ *
+ * A 16K page holds ~130000 increments. If a page is exhausted, the
+ * value is moved into the header of the second page, which is the only
+ * erase needed. So the value survives a power loss at any time.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHCOUNTER_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHCOUNTER_H_
+
+#include "RawDriverInterface.h"
+#include <array>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+class FlashCounter
+{
+public:
+	static constexpr uint32_t MAGIC = 0x434E5431; // "CNT1"
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t base;     // value of the counter, when the page was started
+		uint32_t base_inv;
+		uint32_t reserved;
+
+		bool is_valid() const {
+			return magic == MAGIC && base_inv == ~base;
+		}
+	};
+
+protected:
+	RawDriverInterface & raw_driver;
+	std::array<std::size_t,2> page_addresses;
+
+	bool initialized = false;
+	std::size_t active = 0;        // index into page_addresses
+	uint32_t base = 0;             // from the header of the active page
+	std::size_t cleared_bits = 0;  // in the active page
+
+public:
+	/**
+	 * page_a_address, page_b_address: start of two different pages of the raw driver
+	 */
+	FlashCounter( RawDriverInterface & raw_driver_, std::size_t page_a_address, std::size_t page_b_address );
+
+	/**
+	 * Reads the value from flash. If there is no counter yet,
+	 * the first page is erased and the counter starts at 0.
+	 */
+	bool init();
+
+	uint32_t get() const {
+		return base + static_cast<uint32_t>(cleared_bits);
+	}
+
+	bool increment( uint32_t count = 1 );
+
+	/**
+	 * number of increments, one page can hold
+	 */
+	std::size_t get_capacity( std::size_t page ) const;
+
+protected:
+	std::size_t get_bits_address( std::size_t page ) const {
+		return page_addresses[page] + sizeof(Header);
+	}
+
+	bool read_header( std::size_t page, Header & header );
+
+	bool read_word( std::size_t address, uint32_t & word );
+
+	/**
+	 * binary search for the first word with bits left and counting them
+	 */
+	bool count_cleared_bits( std::size_t page, std::size_t & count );
+
+	/**
+	 * clears bits [cleared_bits, cleared_bits+count) of the active page
+	 */
+	bool clear_bits( std::size_t count );
+
+	/**
+	 * erases the other page and starts it with the current value
+	 */
+	bool start_page( std::size_t page, uint32_t value );
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHCOUNTER_H_ */
@@ -0,0 +1,986 @@
+/*
+ * Tiny power safe file system on top of a MemoryInterface.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "FlashFs.h"
+#include "BlankCheck.h"
+#include <algorithm>
+#include <cstddef>
+#include <string.h>
+
+namespace stm32_internal_flash {
+
+FlashFs::FlashFs( MemoryInterface & backing_ )
+: backing( backing_ )
+{
+	for( std::size_t address = 0; address < backing.get_size() && segment_count < MAX_SEGMENTS; ) {
+		Segment & segment = segments[segment_count++];
+		segment.address = address;
+		segment.size = backing.get_page_size_at( address );
+		address += segment.size;
+		largest = std::max( largest, segment.size );
+	}
+}
+
+uint16_t FlashFs::calc_check( const RecordHeader & header, const std::span<const std::byte> & data )
+{
+	// FNV-1a over the header without check and the data, folded to 16 bits
+	uint32_t hash = 0x811C9DC5;
+
+	auto add = [&hash]( const std::byte *p, std::size_t len ) {
+		for( std::size_t i = 0; i < len; i++ ) {
+			hash = (hash ^ static_cast<uint32_t>(p[i])) * 0x01000193;
+		}
+	};
+
+	const std::byte *p = reinterpret_cast<const std::byte*>(&header);
+	const std::size_t after_check = offsetof( RecordHeader, check ) + sizeof(header.check);
+
+	add( p, offsetof( RecordHeader, check ) );
+	add( p + after_check, sizeof(header) - after_check );
+	add( data.data(), data.size() );
+
+	return static_cast<uint16_t>( hash ^ (hash >> 16) );
+}
+
+std::size_t FlashFs::find_segment( std::size_t address ) const
+{
+	std::size_t segment = 0;
+
+	while( segment + 1 < segment_count && segments[segment+1].address <= address ) {
+		segment++;
+	}
+
+	return segment;
+}
+
+void FlashFs::add_live( std::size_t address, std::size_t len )
+{
+	live_bytes += get_record_size( len );
+	segments[find_segment( address )].live += get_record_size( len );
+}
+
+void FlashFs::remove_live( std::size_t address, std::size_t len )
+{
+	live_bytes -= get_record_size( len );
+	segments[find_segment( address )].live -= get_record_size( len );
+}
+
+std::size_t FlashFs::find_file( const std::string_view & name ) const
+{
+	for( std::size_t file = 0; file < MAX_FILES; file++ ) {
+		if( files[file].used && name == files[file].name ) {
+			return file;
+		}
+	}
+
+	return MAX_FILES;
+}
+
+std::size_t FlashFs::lower_bound_page( uint16_t key ) const
+{
+	auto it = std::lower_bound( pages.begin(), pages.begin() + page_count, key, []( const PageEntry & entry, uint16_t k ) {
+		return entry.key < k;
+	});
+
+	return it - pages.begin();
+}
+
+const FlashFs::PageEntry * FlashFs::find_page( std::size_t file, std::size_t page ) const
+{
+	const uint16_t key = get_page_key( file, page );
+	const std::size_t idx = lower_bound_page( key );
+
+	if( idx < page_count && pages[idx].key == key ) {
+		return &pages[idx];
+	}
+
+	return nullptr;
+}
+
+bool FlashFs::set_page( std::size_t file, std::size_t page, uint32_t address, std::size_t len )
+{
+	const uint16_t key = get_page_key( file, page );
+	const std::size_t idx = lower_bound_page( key );
+
+	if( idx < page_count && pages[idx].key == key ) {
+		remove_live( pages[idx].address, pages[idx].len );
+	} else {
+		if( page_count >= MAX_PAGES ) {
+			return false;
+		}
+
+		std::copy_backward( pages.begin() + idx, pages.begin() + page_count, pages.begin() + page_count + 1 );
+		page_count++;
+	}
+
+	pages[idx].key = key;
+	pages[idx].len = static_cast<uint16_t>( len );
+	pages[idx].address = address;
+
+	add_live( address, len );
+
+	return true;
+}
+
+void FlashFs::drop_pages( std::size_t file, std::size_t first_page )
+{
+	const std::size_t begin = lower_bound_page( get_page_key( file, first_page ) );
+	const std::size_t end = file + 1 < MAX_FILES ? lower_bound_page( get_page_key( file + 1, 0 ) ) : page_count;
+
+	for( std::size_t idx = begin; idx < end; idx++ ) {
+		remove_live( pages[idx].address, pages[idx].len );
+	}
+
+	std::copy( pages.begin() + end, pages.begin() + page_count, pages.begin() + begin );
+	page_count -= end - begin;
+}
+
+void FlashFs::set_name( std::size_t file, const std::string_view & name, uint32_t address )
+{
+	FileEntry & entry = files[file];
+
+	if( entry.used ) {
+		remove_live( entry.name_address, sizeof(NameData) + strlen( entry.name ) );
+	}
+
+	entry.used = true;
+	memcpy( entry.name, name.data(), name.size() );
+	entry.name[name.size()] = '\0';
+	entry.name_address = address;
+
+	add_live( address, sizeof(NameData) + name.size() );
+}
+
+void FlashFs::drop_file( std::size_t file )
+{
+	FileEntry & entry = files[file];
+
+	drop_pages( file, 0 );
+
+	if( entry.used ) {
+		remove_live( entry.name_address, sizeof(NameData) + strlen( entry.name ) );
+	}
+
+	const uint32_t generation = entry.generation;
+	entry = FileEntry();
+	entry.generation = generation;
+}
+
+bool FlashFs::read_backing( std::size_t address, std::span<std::byte> data ) const
+{
+	if( const std::byte *mapped = backing.get_mapped_address( address ); mapped ) {
+		memcpy( data.data(), mapped, data.size() );
+		return true;
+	}
+
+	return backing.read( address, data ) == data.size();
+}
+
+template<class FUNC> bool FlashFs::scan_segment( std::size_t segment, std::size_t & end_offset, FUNC func )
+{
+	const Segment & seg = segments[segment];
+	std::size_t offset = sizeof(SegmentHeader);
+	std::array<std::byte,PAGE_SIZE> buffer;
+
+	while( offset + sizeof(RecordHeader) <= seg.size ) {
+		const std::size_t address = seg.address + offset;
+		RecordHeader header;
+
+		if( !read_backing( address, std::span<std::byte>( reinterpret_cast<std::byte*>(&header), sizeof(header) ) ) ) {
+			return false;
+		}
+
+		if( is_blank( std::span<const std::byte>( reinterpret_cast<const std::byte*>(&header), sizeof(header) ) ) ) {
+			break;
+		}
+
+		bool plausible = header.file < MAX_FILES && offset + get_record_size( header.len ) <= seg.size;
+
+		switch( header.type )
+		{
+		case Type::Name:
+			plausible = plausible && header.len > sizeof(NameData) && header.len <= sizeof(NameData) + NAME_LENGTH;
+			break;
+		case Type::Delete:
+			plausible = plausible && header.len == 0;
+			break;
+		case Type::Data:
+			plausible = plausible && header.len <= PAGE_SIZE && header.page < MAX_FILE_PAGES;
+			break;
+		default:
+			plausible = false;
+			break;
+		}
+
+		if( !plausible ) {
+			// the header was torn by a power loss, the rest can't be used
+			end_offset = seg.size;
+			return true;
+		}
+
+		auto data = std::span<std::byte>( buffer.data(), header.len );
+
+		if( !read_backing( address + sizeof(header), data ) ) {
+			return false;
+		}
+
+		if( calc_check( header, data ) != header.check ) {
+			// Torn by a power loss. The header is programmed first, so
+			// its length is known and appending goes on after it.
+			offset += get_record_size( header.len );
+			continue;
+		}
+
+		if( !func( address, header, std::span<const std::byte>( data ) ) ) {
+			return false;
+		}
+
+		offset += get_record_size( header.len );
+	}
+
+	end_offset = std::min( offset, seg.size );
+
+	return true;
+}
+
+void FlashFs::replay( std::size_t address, const RecordHeader & header, const std::span<const std::byte> & data )
+{
+	FileEntry & entry = files[header.file];
+
+	next_generation = std::max( next_generation, header.generation + 1 );
+
+	// a record of an older generation of the file
+	if( header.generation < entry.generation ) {
+		return;
+	}
+
+	if( header.generation > entry.generation ) {
+		drop_file( header.file );
+		entry.generation = header.generation;
+	}
+
+	switch( header.type )
+	{
+	case Type::Name: {
+		NameData name_data;
+		memcpy( &name_data, data.data(), sizeof(name_data) );
+
+		if( header.page < MAX_FILES && header.page != header.file &&
+			files[header.page].generation == name_data.replaced_generation ) {
+			drop_file( header.page );
+		}
+
+		set_name( header.file, std::string_view( reinterpret_cast<const char*>( data.data() + sizeof(name_data) ), data.size() - sizeof(name_data) ), address );
+		entry.size = header.file_size;
+		break;
+	}
+
+	case Type::Delete:
+		drop_file( header.file );
+		add_live( address, 0 );
+		break;
+
+	case Type::Data:
+		// fails only, if the page index is too small for the log
+		set_page( header.file, header.page, address, header.len );
+		entry.size = header.file_size;
+		break;
+	}
+}
+
+bool FlashFs::start_segment( std::size_t segment )
+{
+	Segment & seg = segments[segment];
+
+	if( !backing.erase( seg.address, seg.size ) ) {
+		return false;
+	}
+
+	SegmentHeader header;
+	header.magic = MAGIC;
+	header.sequence = sequence + 1;
+	header.sequence_inv = ~header.sequence;
+	header.reserved = 0xFFFFFFFF;
+
+	auto data = std::span<const std::byte>( reinterpret_cast<const std::byte*>(&header), sizeof(header) );
+
+	if( backing.program( seg.address, data ) != data.size() ) {
+		return false;
+	}
+
+	sequence = header.sequence;
+	seg.sequence = sequence;
+	seg.used = 0;
+	seg.live = 0;
+	head = segment;
+	head_offset = sizeof(SegmentHeader);
+
+	return true;
+}
+
+bool FlashFs::mount()
+{
+	mounted = false;
+	sequence = 0;
+	page_count = 0;
+	live_bytes = 0;
+	next_generation = 1;
+	files.fill( FileEntry() );
+
+	for( std::size_t segment = 0; segment < segment_count; segment++ ) {
+		segments[segment].used = 0;
+		segments[segment].live = 0;
+	}
+
+	if( segment_count < 2 ) {
+		return false;
+	}
+
+	std::array<std::size_t,MAX_SEGMENTS> order;
+	std::size_t used = 0;
+
+	for( std::size_t segment = 0; segment < segment_count; segment++ ) {
+		SegmentHeader header;
+
+		if( !read_backing( segments[segment].address, std::span<std::byte>( reinterpret_cast<std::byte*>(&header), sizeof(header) ) ) ) {
+			return false;
+		}
+
+		segments[segment].sequence = header.is_valid() ? header.sequence : 0;
+
+		if( segments[segment].sequence != 0 ) {
+			order[used++] = segment;
+		}
+	}
+
+	if( used == 0 ) {
+		if( !start_segment( 0 ) ) {
+			return false;
+		}
+
+		mounted = true;
+		return true;
+	}
+
+	std::sort( order.begin(), order.begin() + used, [this]( std::size_t a, std::size_t b ) {
+		return segments[a].sequence < segments[b].sequence;
+	});
+
+	// newer records replace older ones
+	for( std::size_t i = 0; i < used; i++ ) {
+		std::size_t end_offset = 0;
+
+		bool ok = scan_segment( order[i], end_offset, [this]( std::size_t address, const RecordHeader & header, const std::span<const std::byte> & data ) {
+			replay( address, header, data );
+			return true;
+		});
+
+		if( !ok ) {
+			return false;
+		}
+
+		segments[order[i]].used = end_offset - sizeof(SegmentHeader);
+		head = order[i];
+		head_offset = end_offset;
+		sequence = segments[head].sequence;
+	}
+
+	mounted = true;
+
+	return true;
+}
+
+bool FlashFs::format()
+{
+	for( std::size_t segment = 0; segment < segment_count; segment++ ) {
+		if( !backing.erase( segments[segment].address, segments[segment].size ) ) {
+			return false;
+		}
+	}
+
+	return mount();
+}
+
+std::size_t FlashFs::get_erased_space() const
+{
+	std::size_t free = segments[head].size - head_offset;
+
+	for( std::size_t segment = 0; segment < segment_count; segment++ ) {
+		if( segment != head && segments[segment].sequence == 0 ) {
+			free += segments[segment].size - sizeof(SegmentHeader);
+		}
+	}
+
+	return free;
+}
+
+std::size_t FlashFs::get_total_space() const
+{
+	std::size_t total = 0;
+
+	for( std::size_t segment = 0; segment < segment_count; segment++ ) {
+		total += segments[segment].size - sizeof(SegmentHeader);
+	}
+
+	return total;
+}
+
+std::size_t FlashFs::get_capacity() const
+{
+	// the largest segment has to be collected with the rest
+	const std::size_t kept = largest + 2 * get_waste();
+	const std::size_t total = get_total_space();
+
+	return total > kept ? total - kept : 0;
+}
+
+std::size_t FlashFs::get_free_space() const
+{
+	const std::size_t capacity = get_capacity();
+
+	if( !mounted || live_bytes >= capacity ) {
+		return 0;
+	}
+
+	return capacity - live_bytes;
+}
+
+bool FlashFs::advance_head()
+{
+	for( std::size_t segment = next_segment( head ); segment != head; segment = next_segment( segment ) ) {
+		if( segments[segment].sequence == 0 ) {
+			segments[head].used = head_offset - sizeof(SegmentHeader);
+			return start_segment( segment );
+		}
+	}
+
+	return false;
+}
+
+bool FlashFs::collect()
+{
+	const std::size_t erased = get_erased_space();
+
+	std::size_t oldest = segment_count;
+	std::size_t victim = segment_count;
+	std::size_t victim_gain = 0;
+
+	for( std::size_t segment = 0; segment < segment_count; segment++ ) {
+		const Segment & seg = segments[segment];
+
+		if( segment == head || seg.sequence == 0 ) {
+			continue;
+		}
+
+		if( oldest == segment_count || seg.sequence < segments[oldest].sequence ) {
+			oldest = segment;
+		}
+
+		// the live records have to fit into the erased space
+		if( seg.live + get_waste() > erased ) {
+			continue;
+		}
+
+		const std::size_t gain = seg.size - sizeof(SegmentHeader) - seg.live;
+
+		if( gain > victim_gain ) {
+			victim = segment;
+			victim_gain = gain;
+		}
+	}
+
+	// the oldest one, if it frees some space, for an even wear
+	if( oldest != segment_count &&
+		segments[oldest].live + get_waste() <= erased &&
+		segments[oldest].size - sizeof(SegmentHeader) - segments[oldest].live > get_waste() ) {
+		victim = oldest;
+	}
+
+	if( victim == segment_count || victim_gain <= get_waste() ) {
+		return false;
+	}
+
+	const bool is_oldest = victim == oldest;
+	std::size_t end_offset = 0;
+
+	bool ok = scan_segment( victim, end_offset, [this,is_oldest]( std::size_t address, const RecordHeader & header, const std::span<const std::byte> & data ) {
+		const FileEntry & entry = files[header.file];
+		RecordHeader copy = header;
+
+		switch( header.type )
+		{
+		case Type::Name:
+			if( !entry.used || entry.name_address != address ) {
+				return true;
+			}
+
+			copy.file_size = entry.size;
+			break;
+
+		case Type::Data:
+			if( const PageEntry *page = find_page( header.file, header.page ); !page || page->address != address ) {
+				return true;
+			}
+
+			copy.file_size = entry.size;
+			break;
+
+		case Type::Delete:
+			// no older records left, it can go
+			if( is_oldest ) {
+				return true;
+			}
+			break;
+		}
+
+		const uint32_t new_address = append( copy, data, true );
+
+		if( new_address == 0 ) {
+			return false;
+		}
+
+		statistic.collected_records++;
+
+		switch( header.type )
+		{
+		case Type::Name:
+			remove_live( address, header.len );
+			add_live( new_address, header.len );
+			files[header.file].name_address = new_address;
+			return true;
+
+		case Type::Data:
+			return set_page( header.file, header.page, new_address, header.len );
+
+		case Type::Delete:
+			add_live( new_address, 0 );
+			return true;
+		}
+
+		return true;
+	});
+
+	if( !ok ) {
+		return false;
+	}
+
+	// after a power loss during erasing, nothing of it is mounted again
+	const uint32_t retired = 0;
+
+	if( backing.program( segments[victim].address, std::span<const std::byte>( reinterpret_cast<const std::byte*>(&retired), sizeof(retired) ) ) != sizeof(retired) ) {
+		return false;
+	}
+
+	if( !backing.erase( segments[victim].address, segments[victim].size ) ) {
+		return false;
+	}
+
+	// the delete records, that are gone
+	live_bytes -= segments[victim].live;
+
+	segments[victim].sequence = 0;
+	segments[victim].used = 0;
+	segments[victim].live = 0;
+	statistic.erased_segments++;
+
+	return true;
+}
+
+bool FlashFs::make_room( std::size_t record_size )
+{
+	for( std::size_t i = 0; i < 2 * segment_count; i++ ) {
+		std::size_t max_live = 0;
+
+		for( std::size_t segment = 0; segment < segment_count; segment++ ) {
+			if( segments[segment].sequence != 0 ) {
+				max_live = std::max( max_live, segments[segment].live );
+			}
+		}
+
+		// also the head has to be collected later
+		if( get_erased_space() >= record_size + max_live + get_waste() ) {
+			return true;
+		}
+
+		if( !collect() ) {
+			return false;
+		}
+	}
+
+	return false;
+}
+
+uint32_t FlashFs::append( RecordHeader header, const std::span<const std::byte> & data, bool collecting )
+{
+	const std::size_t record_size = get_record_size( data.size() );
+
+	if( !collecting ) {
+		// a delete record frees space, it's always allowed
+		if( header.type != Type::Delete && live_bytes + record_size > get_capacity() ) {
+			// full
+			return 0;
+		}
+
+		if( !make_room( record_size ) ) {
+			return 0;
+		}
+	}
+
+	if( head_offset + record_size > segments[head].size ) {
+		if( !advance_head() ) {
+			return 0;
+		}
+	}
+
+	header.len = static_cast<uint16_t>( data.size() );
+	header.check = calc_check( header, data );
+
+	const std::size_t address = segments[head].address + head_offset;
+
+	// whatever happens, this space is used now
+	head_offset += record_size;
+
+	// the header first, so a torn record is never overwritten
+	if( backing.program( address, std::span<const std::byte>( reinterpret_cast<const std::byte*>(&header), sizeof(header) ) ) != sizeof(header) ) {
+		return 0;
+	}
+
+	const std::size_t aligned_len = data.size() & ~std::size_t(3);
+
+	if( aligned_len > 0 && backing.program( address + sizeof(header), data.first( aligned_len ) ) != aligned_len ) {
+		return 0;
+	}
+
+	if( aligned_len < data.size() ) {
+		std::array<std::byte,4> tail;
+		tail.fill( std::byte(0xFF) );
+		memcpy( tail.data(), data.data() + aligned_len, data.size() - aligned_len );
+
+		if( backing.program( address + sizeof(header) + aligned_len, tail ) != tail.size() ) {
+			return 0;
+		}
+	}
+
+	statistic.bytes_stored += record_size;
+
+	return static_cast<uint32_t>( address );
+}
+
+bool FlashFs::append_name( std::size_t file, uint32_t generation, const std::string_view & name, std::size_t replaced )
+{
+	FileEntry & entry = files[file];
+
+	RecordHeader header;
+	header.type = Type::Name;
+	header.file = static_cast<uint8_t>( file );
+	header.page = replaced < MAX_FILES ? static_cast<uint16_t>( replaced ) : NO_FILE;
+	header.generation = generation;
+	header.file_size = generation == entry.generation ? entry.size : 0;
+
+	NameData name_data;
+	name_data.replaced_generation = replaced < MAX_FILES ? files[replaced].generation : 0;
+
+	std::array<std::byte,sizeof(NameData) + NAME_LENGTH> data;
+	memcpy( data.data(), &name_data, sizeof(name_data) );
+	memcpy( data.data() + sizeof(name_data), name.data(), name.size() );
+
+	const uint32_t address = append( header, std::span<const std::byte>( data.data(), sizeof(name_data) + name.size() ) );
+
+	if( address == 0 ) {
+		return false;
+	}
+
+	if( replaced < MAX_FILES ) {
+		drop_file( replaced );
+	}
+
+	if( generation != entry.generation ) {
+		drop_file( file );
+		entry.generation = generation;
+	}
+
+	set_name( file, name, address );
+
+	return true;
+}
+
+bool FlashFs::read_page( std::size_t file, std::size_t page, std::size_t offset, std::span<std::byte> data ) const
+{
+	const PageEntry *entry = find_page( file, page );
+	std::size_t stored = 0;
+
+	if( entry && offset < entry->len ) {
+		stored = std::min<std::size_t>( data.size(), entry->len - offset );
+
+		if( !read_backing( entry->address + sizeof(RecordHeader) + offset, data.first( stored ) ) ) {
+			return false;
+		}
+	}
+
+	std::fill( data.begin() + stored, data.end(), std::byte(0) );
+
+	return true;
+}
+
+bool FlashFs::write_page( std::size_t file, std::size_t page, const std::span<const std::byte> & data )
+{
+	if( page >= MAX_FILE_PAGES || (!find_page( file, page ) && page_count >= MAX_PAGES) ) {
+		return false;
+	}
+
+	FileEntry & entry = files[file];
+
+	RecordHeader header;
+	header.type = Type::Data;
+	header.file = static_cast<uint8_t>( file );
+	header.page = static_cast<uint16_t>( page );
+	header.generation = entry.generation;
+	header.file_size = static_cast<uint32_t>( std::max<std::size_t>( entry.size, page * PAGE_SIZE + data.size() ) );
+
+	const uint32_t address = append( header, data );
+
+	if( address == 0 ) {
+		return false;
+	}
+
+	entry.size = header.file_size;
+	statistic.bytes_written += data.size();
+
+	return set_page( file, page, address, data.size() );
+}
+
+bool FlashFs::open( File & file, const std::string_view & name, unsigned flags )
+{
+	file.close();
+
+	if( !mounted || name.empty() || name.size() > NAME_LENGTH || name.find( '\0' ) != std::string_view::npos ) {
+		return false;
+	}
+
+	std::size_t id = find_file( name );
+
+	if( id >= MAX_FILES ) {
+		if( !(flags & Create) ) {
+			return false;
+		}
+
+		for( id = 0; id < MAX_FILES && files[id].used; id++ ) {}
+
+		if( id >= MAX_FILES || !append_name( id, next_generation, name, MAX_FILES ) ) {
+			return false;
+		}
+
+		next_generation++;
+
+	} else if( (flags & Truncate) && files[id].size > 0 ) {
+		// a new generation, without the pages of the old one
+		if( !append_name( id, next_generation, name, MAX_FILES ) ) {
+			return false;
+		}
+
+		next_generation++;
+	}
+
+	file.fs = this;
+	file.id = static_cast<uint8_t>( id );
+	file.flags = flags;
+	file.position = 0;
+	file.buffered_page = NO_PAGE;
+	file.buffered_len = 0;
+	file.dirty = false;
+
+	return true;
+}
+
+bool FlashFs::remove( const std::string_view & name )
+{
+	const std::size_t id = find_file( name );
+
+	if( !mounted || id >= MAX_FILES ) {
+		return false;
+	}
+
+	RecordHeader header;
+	header.type = Type::Delete;
+	header.file = static_cast<uint8_t>( id );
+	header.page = 0;
+	header.generation = files[id].generation;
+	header.file_size = 0;
+
+	const uint32_t address = append( header, {} );
+
+	if( address == 0 ) {
+		return false;
+	}
+
+	drop_file( id );
+	add_live( address, 0 );
+
+	return true;
+}
+
+bool FlashFs::rename( const std::string_view & from, const std::string_view & to )
+{
+	const std::size_t id = find_file( from );
+
+	if( !mounted || id >= MAX_FILES || to.empty() || to.size() > NAME_LENGTH || to.find( '\0' ) != std::string_view::npos ) {
+		return false;
+	}
+
+	if( from == to ) {
+		return true;
+	}
+
+	return append_name( id, files[id].generation, to, find_file( to ) );
+}
+
+std::size_t FlashFs::File::size() const
+{
+	if( !fs ) {
+		return 0;
+	}
+
+	std::size_t file_size = fs->files[id].size;
+
+	if( dirty ) {
+		file_size = std::max( file_size, buffered_page * PAGE_SIZE + buffered_len );
+	}
+
+	return file_size;
+}
+
+bool FlashFs::File::load_page( std::size_t page )
+{
+	if( buffered_page == page ) {
+		return true;
+	}
+
+	if( !sync() ) {
+		return false;
+	}
+
+	const std::size_t file_size = fs->files[id].size;
+	const std::size_t page_start = page * PAGE_SIZE;
+
+	buffered_len = file_size > page_start ? std::min( PAGE_SIZE, file_size - page_start ) : 0;
+	buffered_page = NO_PAGE;
+
+	if( !fs->read_page( id, page, 0, buffer ) ) {
+		return false;
+	}
+
+	buffered_page = page;
+
+	return true;
+}
+
+std::size_t FlashFs::File::read( std::span<std::byte> data )
+{
+	if( !fs || !(flags & Read) ) {
+		return 0;
+	}
+
+	const std::size_t file_size = size();
+
+	if( position >= file_size ) {
+		return 0;
+	}
+
+	const std::size_t len = std::min( data.size(), file_size - position );
+
+	for( std::size_t pos = 0; pos < len; ) {
+		const std::size_t page = position / PAGE_SIZE;
+		const std::size_t offset = position % PAGE_SIZE;
+		const std::size_t n = std::min( len - pos, PAGE_SIZE - offset );
+
+		if( page == buffered_page ) {
+			memcpy( data.data() + pos, buffer.data() + offset, n );
+		} else if( !fs->read_page( id, page, offset, data.subspan( pos, n ) ) ) {
+			return pos;
+		}
+
+		pos += n;
+		position += n;
+	}
+
+	return len;
+}
+
+std::size_t FlashFs::File::write( const std::span<const std::byte> & data )
+{
+	if( !fs || !(flags & Write) ) {
+		return 0;
+	}
+
+	if( flags & Append ) {
+		position = size();
+	}
+
+	for( std::size_t pos = 0; pos < data.size(); ) {
+		const std::size_t page = position / PAGE_SIZE;
+		const std::size_t offset = position % PAGE_SIZE;
+		const std::size_t n = std::min( data.size() - pos, PAGE_SIZE - offset );
+
+		if( page >= MAX_FILE_PAGES || !load_page( page ) ) {
+			return pos;
+		}
+
+		memcpy( buffer.data() + offset, data.data() + pos, n );
+		buffered_len = std::max( buffered_len, offset + n );
+		dirty = true;
+
+		pos += n;
+		position += n;
+	}
+
+	return data.size();
+}
+
+bool FlashFs::File::seek( std::size_t position_ )
+{
+	if( !fs ) {
+		return false;
+	}
+
+	position = position_;
+
+	return true;
+}
+
+bool FlashFs::File::sync()
+{
+	if( !fs ) {
+		return false;
+	}
+
+	if( !dirty ) {
+		return true;
+	}
+
+	if( !fs->write_page( id, buffered_page, std::span<const std::byte>( buffer.data(), buffered_len ) ) ) {
+		return false;
+	}
+
+	dirty = false;
+
+	return true;
+}
+
+bool FlashFs::File::close()
+{
+	if( !fs ) {
+		return true;
+	}
+
+	const bool ok = sync();
+
+	fs = nullptr;
+	buffered_page = NO_PAGE;
+	dirty = false;
+
+	return ok;
+}
+
+} // namespace stm32_internal_flash
@@ -0,0 +1,415 @@
+/*
+ * Tiny power safe file system on top of a MemoryInterface.
+ *
+ * Files are stored as records in a log, like in CompressedMemoryInterface:
+ * the pages of the underlying memory are the segments of the log, so it
+ * also works with mixed page sizes, eg. a JBODGenericFlashDriver over
+ * the 16K and the 64K sectors.
+ *
+ * There are records for the name of a file (create and rename), for
+ * deleting it and for one page of its data. Records are never changed
+ * in place. A check over each record detects a record, that was torn by
+ * a power loss, and mount() ignores it. So after a power loss the file
+ * system contains every operation up to the last finished record.
+ *
+ * Each record has the generation of its file. Creating and truncating
+ * a file starts a new generation, and records of older generations are
+ * ignored. So collecting can copy records to the head of the log,
+ * without changing what they mean.
+ *
+ *   FlashFs fs( driver );
+ *
+ *   if( !fs.mount() ) {
+ *     fs.format();
+ *   }
+ *
+ *   FlashFs::File file;
+ *   fs.open( file, "config", FlashFs::Write | FlashFs::Create | FlashFs::Truncate );
+ *   file.write( data );
+ *   file.close();
+ *
+ * RAM is bounded: a table of the files, and an index to the newest
+ * record of each data page. Each open File buffers one page.
+ *
+ * Garbage collection moves the live records of a segment to the head of
+ * the log and erases it. It prefers the oldest segment, so all segments
+ * are erased in turn (dynamic wear distribution). Only if that doesn't
+ * free enough space, the one with the least live data is taken. There is
+ * always enough erased space kept, to collect any segment except the
+ * head. So the size of the largest segment can't be used for files.
+ *
+ * A rename() to an existing name replaces that file with a single
+ * record. So writing a temporary file and renaming it, updates a file
+ * atomically.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHFS_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHFS_H_
+
+#include "MemoryInterface.h"
+#include <array>
+#include <string_view>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+class FlashFs
+{
+public:
+	static constexpr std::size_t PAGE_SIZE = 256;
+	static constexpr std::size_t MAX_FILES = 16;
+	static constexpr std::size_t MAX_PAGES = 512;
+	static constexpr std::size_t MAX_SEGMENTS = 16;
+	static constexpr std::size_t NAME_LENGTH = 23;
+	static constexpr std::size_t MAX_FILE_PAGES = 4096;
+	static constexpr uint32_t MAGIC = 0x31534654; // "TFS1", little endian
+	static constexpr uint16_t NO_FILE = 0xFFFF;
+	static constexpr std::size_t NO_PAGE = SIZE_MAX;
+
+	enum OpenFlags : unsigned
+	{
+		Read     = 1,
+		Write    = 2,
+		Create   = 4,  // create it, if it doesn't exist
+		Truncate = 8,  // set the size to 0
+		Append   = 16  // each write goes to the end of the file
+	};
+
+	enum class Type : uint8_t
+	{
+		Name = 1,   // create or rename, page is the replaced file or NO_FILE
+		Delete = 2,
+		Data = 3
+	};
+
+	struct SegmentHeader
+	{
+		uint32_t magic;     // programmed to 0, before the segment is erased
+		uint32_t sequence;
+		uint32_t sequence_inv;
+		uint32_t reserved;
+
+		bool is_valid() const {
+			return magic == MAGIC && sequence_inv == ~sequence;
+		}
+	};
+
+	struct RecordHeader
+	{
+		Type type;
+		uint8_t file;
+		uint16_t len;        // of the data following the header
+		uint16_t page;
+		uint16_t check;      // over the header fields and the data
+		uint32_t file_size;  // after this record
+		uint32_t generation;
+	};
+
+	/**
+	 * data of a name record, followed by the name
+	 */
+	struct NameData
+	{
+		uint32_t replaced_generation;
+	};
+
+	struct Statistic
+	{
+		std::size_t bytes_written = 0;  // by the application
+		std::size_t bytes_stored = 0;   // including record headers and collecting
+		std::size_t collected_records = 0;
+		std::size_t erased_segments = 0;
+	};
+
+	/**
+	 * An open file. Can be used again, after it is closed.
+	 * Open a file only once for writing.
+	 */
+	class File
+	{
+		friend class FlashFs;
+
+		FlashFs *fs = nullptr;
+		uint8_t id = 0;
+		unsigned flags = 0;
+		std::size_t position = 0;
+
+		std::array<std::byte,PAGE_SIZE> buffer;
+		std::size_t buffered_page = NO_PAGE;
+		std::size_t buffered_len = 0;
+		bool dirty = false;
+
+	public:
+		File() = default;
+		File( const File & other ) = delete;
+		File & operator=( const File & other ) = delete;
+
+		~File() {
+			close();
+		}
+
+		bool is_open() const {
+			return fs != nullptr;
+		}
+
+		/**
+		 * Reads from the current position, returns the number of bytes read.
+		 * Less than requested at the end of the file.
+		 */
+		std::size_t read( std::span<std::byte> data );
+
+		/**
+		 * Writes at the current position, returns the number of bytes written.
+		 * Writing after the end of the file fills the gap with zeros.
+		 */
+		std::size_t write( const std::span<const std::byte> & data );
+
+		/**
+		 * position can be after the end of the file
+		 */
+		bool seek( std::size_t position_ );
+
+		std::size_t tell() const {
+			return position;
+		}
+
+		std::size_t size() const;
+
+		/**
+		 * writes the buffered page
+		 */
+		bool sync();
+
+		bool close();
+
+	protected:
+		bool load_page( std::size_t page );
+	};
+
+protected:
+	MemoryInterface & backing;
+
+	struct Segment
+	{
+		std::size_t address = 0;
+		std::size_t size = 0;
+		uint32_t sequence = 0;  // 0: erased
+		std::size_t used = 0;   // bytes of records
+		std::size_t live = 0;   // bytes of records, that are still needed
+	};
+
+	std::array<Segment,MAX_SEGMENTS> segments;
+	std::size_t segment_count = 0;
+
+	std::size_t largest = 0;  // segment size
+
+	bool mounted = false;
+	std::size_t head = 0;        // segment, that is appended to
+	std::size_t head_offset = 0; // next free byte in the head segment
+	uint32_t sequence = 0;       // of the head segment
+
+	struct FileEntry
+	{
+		bool used = false;
+		char name[NAME_LENGTH+1] = {};
+		uint32_t generation = 0;    // stays, after the file is deleted
+		uint32_t size = 0;
+		uint32_t name_address = 0;  // of the newest name record
+	};
+
+	std::array<FileEntry,MAX_FILES> files;
+
+	// sorted by key, the newest record of each page of the files
+	struct PageEntry
+	{
+		uint16_t key;      // file << 12 | page
+		uint16_t len;
+		uint32_t address;
+	};
+
+	std::array<PageEntry,MAX_PAGES> pages;
+	std::size_t page_count = 0;
+
+	// Sum of the size of all records, that are still needed. Delete
+	// records are counted, until the oldest segment is collected.
+	std::size_t live_bytes = 0;
+
+	uint32_t next_generation = 1;
+
+	Statistic statistic;
+
+public:
+	FlashFs( MemoryInterface & backing_ );
+
+	/**
+	 * Scans the log and rebuilds the tables in RAM.
+	 * An empty memory is mounted as an empty file system.
+	 */
+	bool mount();
+
+	/**
+	 * erases the underlying memory
+	 */
+	bool format();
+
+	/**
+	 * flags: OpenFlags
+	 */
+	bool open( File & file, const std::string_view & name, unsigned flags );
+
+	bool remove( const std::string_view & name );
+
+	/**
+	 * If to exists, it is replaced.
+	 */
+	bool rename( const std::string_view & from, const std::string_view & to );
+
+	bool exists( const std::string_view & name ) const {
+		return find_file( name ) < MAX_FILES;
+	}
+
+	/**
+	 * calls func( std::string_view name, std::size_t size ) for each file
+	 */
+	template<class FUNC> void for_each_file( FUNC func ) const {
+		for( const FileEntry & entry : files ) {
+			if( entry.used ) {
+				func( std::string_view( entry.name ), static_cast<std::size_t>( entry.size ) );
+			}
+		}
+	}
+
+	/**
+	 * free bytes for records, without the space kept for collecting
+	 */
+	std::size_t get_free_space() const;
+
+	const Statistic & get_statistic() const {
+		return statistic;
+	}
+
+	void clear_statistic() {
+		statistic = Statistic();
+	}
+
+protected:
+	static uint16_t calc_check( const RecordHeader & header, const std::span<const std::byte> & data );
+
+	static std::size_t get_record_size( std::size_t len ) {
+		return sizeof(RecordHeader) + ((len + 3) & ~std::size_t(3));
+	}
+
+	static uint16_t get_page_key( std::size_t file, std::size_t page ) {
+		return static_cast<uint16_t>( (file << 12) | page );
+	}
+
+	/**
+	 * unused space at the ends of the segments, up to one record each
+	 */
+	std::size_t get_waste() const {
+		return segment_count * get_record_size( PAGE_SIZE );
+	}
+
+	std::size_t next_segment( std::size_t segment ) const {
+		return (segment + 1) % segment_count;
+	}
+
+	std::size_t find_segment( std::size_t address ) const;
+
+	void add_live( std::size_t address, std::size_t len );
+	void remove_live( std::size_t address, std::size_t len );
+
+	std::size_t find_file( const std::string_view & name ) const;
+
+	/**
+	 * index of the first entry with a key >= key
+	 */
+	std::size_t lower_bound_page( uint16_t key ) const;
+
+	/**
+	 * the newest record of the page, or nullptr
+	 */
+	const PageEntry * find_page( std::size_t file, std::size_t page ) const;
+
+	bool set_page( std::size_t file, std::size_t page, uint32_t address, std::size_t len );
+
+	void set_name( std::size_t file, const std::string_view & name, uint32_t address );
+
+	/**
+	 * removes the pages of the file starting with first_page
+	 */
+	void drop_pages( std::size_t file, std::size_t first_page );
+
+	/**
+	 * removes the file from the tables, its generation stays
+	 */
+	void drop_file( std::size_t file );
+
+	bool read_backing( std::size_t address, std::span<std::byte> data ) const;
+
+	/**
+	 * calls func( address, header, data ) for each valid record of the segment,
+	 * returns the offset after the last one
+	 */
+	template<class FUNC> bool scan_segment( std::size_t segment, std::size_t & end_offset, FUNC func );
+
+	void replay( std::size_t address, const RecordHeader & header, const std::span<const std::byte> & data );
+
+	bool start_segment( std::size_t segment );
+
+	/**
+	 * free bytes in the head and the erased segments
+	 */
+	std::size_t get_erased_space() const;
+
+	/**
+	 * bytes for records in all segments
+	 */
+	std::size_t get_total_space() const;
+
+	bool advance_head();
+
+	/**
+	 * bytes for the records of the files, without the space kept for collecting
+	 */
+	std::size_t get_capacity() const;
+
+	/**
+	 * Copies the live records of a segment to the head and erases it.
+	 * Delete records are copied too, unless it's the oldest segment.
+	 * They could still hide older records in older segments.
+	 */
+	bool collect();
+
+	/**
+	 * collects segments, until a record of record_size can be appended,
+	 * and still each segment can be collected
+	 */
+	bool make_room( std::size_t record_size );
+
+	/**
+	 * Appends a record. When it is not a copy of collect(), segments
+	 * are collected first, if necessary.
+	 * Returns the address of the record, or 0.
+	 */
+	uint32_t append( RecordHeader header, const std::span<const std::byte> & data, bool collecting = false );
+
+	/**
+	 * appends a name record and updates the file table
+	 * replaced: the file, that is replaced by a rename, or MAX_FILES
+	 */
+	bool append_name( std::size_t file, uint32_t generation, const std::string_view & name, std::size_t replaced );
+
+	/**
+	 * data of a page, bytes after the record are 0
+	 */
+	bool read_page( std::size_t file, std::size_t page, std::size_t offset, std::span<std::byte> data ) const;
+
+	bool write_page( std::size_t file, std::size_t page, const std::span<const std::byte> & data );
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHFS_H_ */
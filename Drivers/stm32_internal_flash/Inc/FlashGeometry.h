@@ -0,0 +1,282 @@
+/*
+ * Flash geometry of STM32F2 and STM32F4 devices, usable at compile time.
+ *
+ * For each device the sector numbers, addresses and sizes are known,
+ * so the sector tables of a configuration are generated from an address
+ * range, instead of being written by hand:
+ *
+ *   static constexpr auto flash_fs_sectors =
+ *       geometry::make_sectors<geometry::Device::F401xE, 0x08004000, 112*1024>();
+ *
+ *   conf.used_sectors = flash_fs_sectors;
+ *
+ * A range, that doesn't start and end at sector boundaries, fails to compile.
+ *
+ * Program width and erase times depend on the voltage range, the values are
+ * the ones of the reference manuals and datasheets, which are the same for
+ * all F2 and F4 devices. Voltage ranges are the values of the HAL,
+ * FLASH_VOLTAGE_RANGE_1 (0) ... FLASH_VOLTAGE_RANGE_4 (3).
+ *
+ * No HAL is required, so host tools can use it too.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHGEOMETRY_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHGEOMETRY_H_
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+namespace geometry {
+
+/**
+ * a sector of the flash, the entry of Configuration::used_sectors
+ */
+struct Sector
+{
+	uint32_t sector{};               // number, as FLASH_SECTOR_x of the HAL
+	uint32_t size{};
+	std::size_t start_address = 0;
+};
+
+enum class Device
+{
+	F207xE,  // F205, F207, F215, F217 with 512K
+	F207xG,  // F205, F207, F215, F217 with 1M
+	F401xC,  // 256K
+	F401xE,  // 512K
+	F407xE,  // F405, F407, F415, F417 with 512K
+	F407xG,  // F405, F407, F415, F417 with 1M
+	F411xE,  // 512K
+	F429xI,  // F427, F429, F437, F439 with 2M, dual bank
+	F446xE   // 512K
+};
+
+/**
+ * sectors of the same size, following each other
+ */
+struct SectorRun
+{
+	uint32_t first_sector = 0;
+	uint32_t count = 0;
+	uint32_t size = 0;
+};
+
+struct DeviceGeometry
+{
+	static constexpr std::size_t MAX_RUNS = 6;
+
+	Device device;
+	const char *name;
+	std::size_t base_address;
+	std::array<SectorRun,MAX_RUNS> runs;  // unused runs have a count of 0
+};
+
+namespace detail {
+
+	constexpr std::size_t KB = 1024;
+
+	// 4 x 16K, 64K, and 128K sectors up to the size
+	constexpr std::array<SectorRun,DeviceGeometry::MAX_RUNS> single_bank( uint32_t sectors_128k ) {
+		return { SectorRun{ 0, 4, 16*KB }, SectorRun{ 4, 1, 64*KB }, SectorRun{ 5, sectors_128k, 128*KB } };
+	}
+
+	// the second bank starts with sector 12, directly after the first one
+	constexpr std::array<SectorRun,DeviceGeometry::MAX_RUNS> dual_bank() {
+		return { SectorRun{ 0, 4, 16*KB }, SectorRun{ 4, 1, 64*KB }, SectorRun{ 5, 7, 128*KB },
+			     SectorRun{ 12, 4, 16*KB }, SectorRun{ 16, 1, 64*KB }, SectorRun{ 17, 7, 128*KB } };
+	}
+
+	constexpr std::size_t FLASH_BASE_ADDRESS = 0x08000000;
+
+} // namespace detail
+
+constexpr DeviceGeometry DEVICES[] = {
+	{ Device::F207xE, "STM32F207xE", detail::FLASH_BASE_ADDRESS, detail::single_bank( 3 ) },
+	{ Device::F207xG, "STM32F207xG", detail::FLASH_BASE_ADDRESS, detail::single_bank( 7 ) },
+	{ Device::F401xC, "STM32F401xC", detail::FLASH_BASE_ADDRESS, detail::single_bank( 1 ) },
+	{ Device::F401xE, "STM32F401xE", detail::FLASH_BASE_ADDRESS, detail::single_bank( 3 ) },
+	{ Device::F407xE, "STM32F407xE", detail::FLASH_BASE_ADDRESS, detail::single_bank( 3 ) },
+	{ Device::F407xG, "STM32F407xG", detail::FLASH_BASE_ADDRESS, detail::single_bank( 7 ) },
+	{ Device::F411xE, "STM32F411xE", detail::FLASH_BASE_ADDRESS, detail::single_bank( 3 ) },
+	{ Device::F429xI, "STM32F429xI", detail::FLASH_BASE_ADDRESS, detail::dual_bank() },
+	{ Device::F446xE, "STM32F446xE", detail::FLASH_BASE_ADDRESS, detail::single_bank( 3 ) },
+};
+
+/**
+ * the device this is compiled for, the HAL defines don't tell the
+ * flash size, so the largest variant is assumed
+ */
+#if defined(STM32F401xE)
+constexpr Device CURRENT_DEVICE = Device::F401xE;
+#elif defined(STM32F401xC)
+constexpr Device CURRENT_DEVICE = Device::F401xC;
+#elif defined(STM32F405xx) || defined(STM32F407xx) || defined(STM32F415xx) || defined(STM32F417xx)
+constexpr Device CURRENT_DEVICE = Device::F407xG;
+#elif defined(STM32F411xE)
+constexpr Device CURRENT_DEVICE = Device::F411xE;
+#elif defined(STM32F427xx) || defined(STM32F429xx) || defined(STM32F437xx) || defined(STM32F439xx)
+constexpr Device CURRENT_DEVICE = Device::F429xI;
+#elif defined(STM32F446xx)
+constexpr Device CURRENT_DEVICE = Device::F446xE;
+#elif defined(STM32F205xx) || defined(STM32F207xx) || defined(STM32F215xx) || defined(STM32F217xx)
+constexpr Device CURRENT_DEVICE = Device::F207xG;
+#endif
+
+constexpr const DeviceGeometry & get_device( Device device ) {
+	for( const DeviceGeometry & geometry : DEVICES ) {
+		if( geometry.device == device ) {
+			return geometry;
+		}
+	}
+
+	// not reachable, all devices are listed
+	return DEVICES[0];
+}
+
+constexpr std::size_t get_sector_count( Device device ) {
+	std::size_t count = 0;
+
+	for( const SectorRun & run : get_device( device ).runs ) {
+		count += run.count;
+	}
+
+	return count;
+}
+
+constexpr std::size_t get_flash_size( Device device ) {
+	std::size_t size = 0;
+
+	for( const SectorRun & run : get_device( device ).runs ) {
+		size += run.count * run.size;
+	}
+
+	return size;
+}
+
+/**
+ * idx counts all sectors of the device, on dual bank devices
+ * it differs from the sector number
+ */
+constexpr std::optional<Sector> get_sector( Device device, std::size_t idx ) {
+	const DeviceGeometry & geometry = get_device( device );
+	std::size_t address = geometry.base_address;
+
+	for( const SectorRun & run : geometry.runs ) {
+		if( idx < run.count ) {
+			return Sector{ static_cast<uint32_t>( run.first_sector + idx ),
+						   run.size,
+						   address + idx * run.size };
+		}
+
+		idx -= run.count;
+		address += run.count * run.size;
+	}
+
+	return {};
+}
+
+/**
+ * returns the sector containing the address
+ */
+constexpr std::optional<Sector> find_sector( Device device, std::size_t address ) {
+	for( std::size_t idx = 0; idx < get_sector_count( device ); idx++ ) {
+		const Sector sector = *get_sector( device, idx );
+
+		if( address >= sector.start_address && address < sector.start_address + sector.size ) {
+			return sector;
+		}
+	}
+
+	return {};
+}
+
+/**
+ * number of sectors covering exactly the range,
+ * 0 if the range doesn't start and end at sector boundaries
+ */
+constexpr std::size_t count_sectors( Device device, std::size_t start_address, std::size_t size ) {
+	std::size_t count = 0;
+	std::size_t address = start_address;
+
+	while( address < start_address + size ) {
+		const std::optional<Sector> sector = find_sector( device, address );
+
+		if( !sector || sector->start_address != address ) {
+			return 0;
+		}
+
+		address += sector->size;
+		count++;
+	}
+
+	return address == start_address + size ? count : 0;
+}
+
+/**
+ * the sector table of a range, for Configuration::used_sectors
+ */
+template<Device DEVICE, std::size_t START_ADDRESS, std::size_t SIZE>
+constexpr auto make_sectors() {
+	constexpr std::size_t COUNT = count_sectors( DEVICE, START_ADDRESS, SIZE );
+	static_assert( COUNT > 0, "the range has to start and end at sector boundaries" );
+
+	std::array<Sector,COUNT> sectors{};
+	std::size_t address = START_ADDRESS;
+
+	for( Sector & sector : sectors ) {
+		sector = *find_sector( DEVICE, address );
+		address += sector.size;
+	}
+
+	return sectors;
+}
+
+/**
+ * Bytes programmed at once: x8 at 1.8V-2.1V, x16 at 2.1V-2.7V,
+ * x32 at 2.7V-3.6V and x64 with external Vpp.
+ */
+constexpr std::size_t get_program_width( uint32_t voltage_range ) {
+	return voltage_range < 4 ? static_cast<std::size_t>( 1 ) << voltage_range : 1;
+}
+
+struct Duration
+{
+	uint32_t typical;
+	uint32_t max;
+};
+
+/**
+ * time of programming one item of get_program_width(), independent of the width,
+ * so programming is faster the wider it is
+ */
+constexpr Duration PROGRAM_TIME_US = { 16, 100 };
+
+/**
+ * Time of erasing a sector of 16K, 64K or 128K. The erase parallelism
+ * follows the program width, with external Vpp it's the one of x32.
+ */
+constexpr Duration get_erase_time_ms( std::size_t sector_size, uint32_t voltage_range ) {
+	constexpr Duration TIMES[3][3] = {
+		//  x8            x16           x32
+		{ {  400,  800 }, {  300,  600 }, {  250,  500 } },  // 16K
+		{ { 1200, 2400 }, {  700, 1400 }, {  550, 1100 } },  // 64K
+		{ { 2000, 4000 }, { 1300, 2600 }, { 1000, 2000 } },  // 128K
+	};
+
+	const std::size_t column = voltage_range < 2 ? voltage_range : 2;
+	const std::size_t row = sector_size <= 16*detail::KB ? 0 : sector_size <= 64*detail::KB ? 1 : 2;
+
+	return TIMES[row][column];
+}
+
+} // namespace geometry
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHGEOMETRY_H_ */
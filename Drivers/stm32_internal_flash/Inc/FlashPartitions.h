@@ -0,0 +1,177 @@
+/*
+ * Named flash partitions, declared once at compile time.
+ *
+ * The table is the single source of the flash layout. It is checked
+ * while compiling: partitions have to be sorted, must not overlap, and
+ * have to start and end at sector boundaries, so erasing one partition
+ * never touches another one. Names are made of letters, digits and '_',
+ * since they are part of the linker symbols.
+ *
+ *   static constexpr auto flash_partitions = make_partition_table<geometry::Device::F401xE>( {
+ *       { "config", 0x08004000, 16*1024 },
+ *       { "log",    0x08010000, 64*1024 },
+ *   } );
+ *
+ * Lookups by name are consteval, an unknown name fails to compile
+ * and nothing is left for the runtime:
+ *
+ *   PartitionMemoryInterface log( fs_driver, flash_partitions.get_range( "log" ) );
+ *
+ * The linker script gets its FLASH_FS region and the _partition_<name>_start
+ * and _partition_<name>_size symbols from the same table, written by
+ * tools/partition_ld.
+ *
+ * No HAL is required, so host tools can use it too.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHPARTITIONS_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHPARTITIONS_H_
+
+#include "FlashGeometry.h"
+#include <array>
+#include <string_view>
+
+namespace stm32_internal_flash {
+
+struct Partition
+{
+	const char *name = "";
+	std::size_t start_address = 0;
+	std::size_t size = 0;
+
+	constexpr std::size_t get_end_address() const {
+		return start_address + size;
+	}
+};
+
+/**
+ * a partition, relative to the start of the table,
+ * which is address 0 of the driver covering the whole table
+ */
+struct PartitionRange
+{
+	std::size_t offset = 0;
+	std::size_t size = 0;
+};
+
+namespace detail {
+
+	// the name is part of the linker symbols
+	constexpr bool is_symbol_name( std::string_view name ) {
+		for( char c : name ) {
+			if( !( (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' ) ) {
+				return false;
+			}
+		}
+
+		return !name.empty();
+	}
+
+	// Not defined. Called by the consteval functions on invalid input,
+	// so the name of the function shows up in the compiler error.
+	void partition_has_no_name();
+	void partition_name_is_not_a_linker_symbol();
+	void partition_name_is_not_unique();
+	void partitions_are_not_sorted_or_overlap();
+	void partition_does_not_start_and_end_at_sector_boundaries();
+	void partition_not_found();
+
+} // namespace detail
+
+template<geometry::Device DEVICE, std::size_t COUNT>
+class PartitionTable
+{
+	std::array<Partition,COUNT> partitions;
+
+public:
+	consteval PartitionTable( const Partition (&partitions_)[COUNT] )
+	: partitions()
+	{
+		for( std::size_t i = 0; i < COUNT; i++ ) {
+			partitions[i] = partitions_[i];
+
+			const Partition & partition = partitions[i];
+
+			if( std::string_view( partition.name ).empty() ) {
+				detail::partition_has_no_name();
+			}
+
+			if( !detail::is_symbol_name( partition.name ) ) {
+				detail::partition_name_is_not_a_linker_symbol();
+			}
+
+			for( std::size_t j = 0; j < i; j++ ) {
+				if( std::string_view( partitions[j].name ) == partition.name ) {
+					detail::partition_name_is_not_unique();
+				}
+			}
+
+			if( i > 0 && partition.start_address < partitions[i-1].get_end_address() ) {
+				detail::partitions_are_not_sorted_or_overlap();
+			}
+
+			if( geometry::count_sectors( DEVICE, partition.start_address, partition.size ) == 0 ) {
+				detail::partition_does_not_start_and_end_at_sector_boundaries();
+			}
+		}
+	}
+
+	/**
+	 * the first address of the first partition
+	 */
+	constexpr std::size_t get_start_address() const {
+		return partitions.front().start_address;
+	}
+
+	/**
+	 * from the start of the first partition up to the end of the last one,
+	 * including the gaps between them
+	 */
+	constexpr std::size_t get_size() const {
+		return partitions.back().get_end_address() - get_start_address();
+	}
+
+	consteval Partition get( std::string_view name ) const {
+		for( const Partition & partition : partitions ) {
+			if( name == partition.name ) {
+				return partition;
+			}
+		}
+
+		detail::partition_not_found();
+		return {};
+	}
+
+	consteval PartitionRange get_range( std::string_view name ) const {
+		const Partition partition = get( name );
+		return { partition.start_address - get_start_address(), partition.size };
+	}
+
+	static constexpr geometry::Device get_device() {
+		return DEVICE;
+	}
+
+	static constexpr std::size_t size() {
+		return COUNT;
+	}
+
+	constexpr auto begin() const {
+		return partitions.begin();
+	}
+
+	constexpr auto end() const {
+		return partitions.end();
+	}
+};
+
+template<geometry::Device DEVICE, std::size_t COUNT>
+consteval PartitionTable<DEVICE,COUNT> make_partition_table( const Partition (&partitions)[COUNT] )
+{
+	return PartitionTable<DEVICE,COUNT>( partitions );
+}
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHPARTITIONS_H_ */
@@ -0,0 +1,168 @@
+/*
+ * Typed variables and arrays, that live in memory mapped flash.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "FlashVar.h"
+#include "BlankCheck.h"
+#include <algorithm>
+#include <string.h>
+
+namespace stm32_internal_flash {
+
+namespace {
+
+constexpr std::size_t WORD_SIZE = 4;
+
+/**
+ * reads current flash content, from mapped memory if possible
+ */
+bool read_current( MemoryInterface & memory, std::size_t address, std::span<std::byte> buffer )
+{
+	if( const std::byte *mapped = memory.get_mapped_address( address ); mapped ) {
+		memcpy( buffer.data(), mapped, buffer.size() );
+		return true;
+	}
+
+	return memory.read( address, buffer ) == buffer.size();
+}
+
+/**
+ * Calls func( address, current, data ) for each word of the range.
+ * The first and the last one can be partial words.
+ */
+template<class FUNC>
+bool for_each_word( MemoryInterface & memory, std::size_t address, const std::span<const std::byte> & data, FUNC func )
+{
+	std::size_t pos = 0;
+
+	while( pos < data.size() ) {
+		const std::size_t word_address = address + pos;
+		const std::size_t len = std::min( WORD_SIZE - word_address % WORD_SIZE, data.size() - pos );
+
+		std::array<std::byte,WORD_SIZE> current;
+		std::span<std::byte> current_span( current.data(), len );
+
+		if( !read_current( memory, word_address, current_span ) ) {
+			return false;
+		}
+
+		if( !func( word_address, current_span, data.subspan( pos, len ) ) ) {
+			return false;
+		}
+
+		pos += len;
+	}
+
+	return true;
+}
+
+} // namespace
+
+std::size_t FlashVarBase::get_address_of( MemoryInterface & memory, const void *storage )
+{
+	return static_cast<const std::byte*>(storage) - memory.get_mapped_address( 0 );
+}
+
+bool FlashVarBase::is_blank() const
+{
+	if( const std::byte *mapped = get_mapped(); mapped ) {
+		return stm32_internal_flash::is_blank( std::span<const std::byte>( mapped, size ) );
+	}
+
+	std::array<std::byte,32> buffer;
+
+	for( std::size_t pos = 0; pos < size; pos += buffer.size() ) {
+		std::span<std::byte> chunk( buffer.data(), std::min( buffer.size(), size - pos ) );
+
+		if( !read_current( memory, address + pos, chunk ) ) {
+			return false;
+		}
+
+		if( !stm32_internal_flash::is_blank( chunk ) ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+FlashVarBase::Update FlashVarBase::update( std::size_t offset, const std::span<const std::byte> & data )
+{
+	if( offset > size || data.size() > size - offset ) {
+		return Update::Failed;
+	}
+
+	const std::size_t start = address + offset;
+
+	bool changed = false;
+	bool set_bits = false;
+
+	bool ok = for_each_word( memory, start, data, [&changed,&set_bits]( std::size_t, const std::span<std::byte> & current, const std::span<const std::byte> & value ) {
+		for( std::size_t i = 0; i < value.size(); i++ ) {
+			if( current[i] != value[i] ) {
+				changed = true;
+			}
+
+			// a bit that is 0 in flash, but 1 in the new value
+			if( (current[i] & value[i]) != value[i] ) {
+				set_bits = true;
+			}
+		}
+		return true;
+	});
+
+	if( !ok ) {
+		return Update::Failed;
+	}
+
+	if( !changed ) {
+		return Update::Unchanged;
+	}
+
+	if( !set_bits ) {
+		// program runs of changed words
+		std::size_t run_start = 0;
+		std::size_t run_end = 0;
+		bool programmed = true;
+
+		auto flush = [&]() {
+			if( run_end > run_start ) {
+				auto run = data.subspan( run_start - start, run_end - run_start );
+				programmed = memory.program( run_start, run ) == run.size();
+			}
+			run_start = run_end = 0;
+			return programmed;
+		};
+
+		ok = for_each_word( memory, start, data, [&]( std::size_t word_address, const std::span<std::byte> & current, const std::span<const std::byte> & value ) {
+			if( memcmp( current.data(), value.data(), value.size() ) == 0 ) {
+				return flush();
+			}
+
+			if( run_end != word_address ) {
+				if( !flush() ) {
+					return false;
+				}
+				run_start = word_address;
+			}
+
+			run_end = word_address + value.size();
+			return true;
+		});
+
+		if( ok && flush() ) {
+			return Update::Programmed;
+		}
+
+		// not supported by the memory, or failed
+	}
+
+	if( memory.write( start, data ) != data.size() ) {
+		return Update::Failed;
+	}
+
+	return Update::Rewritten;
+}
+
+} // namespace stm32_internal_flash
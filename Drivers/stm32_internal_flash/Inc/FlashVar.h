@@ -0,0 +1,168 @@
+/*
+ * Typed variables and arrays, that live in memory mapped flash.
+ *
+ * The storage is placed by the linker into the .flashfs_data section:
+ *
+ *   STM32_INTERNAL_FLASH_FLASHFS_DATA FlashStorage<Config> config_storage;
+ *
+ *   FlashVar<Config> config( driver, config_storage );
+ *   const Config & c = config.get();  // no copy, points into flash
+ *   config.set( new_config );
+ *
+ * set() compares the new value with the flash content. Unchanged words
+ * are not touched. If bits are only cleared, the changed words are
+ * programmed directly. Only if a bit has to be set, the value is
+ * written with MemoryInterface::write(), which erases the page and
+ * restores the other data of the page.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHVAR_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHVAR_H_
+
+#include "MemoryInterface.h"
+#include <array>
+#include <type_traits>
+
+/**
+ * places the storage into the flash region reserved by the linker script
+ */
+#define STM32_INTERNAL_FLASH_FLASHFS_DATA __attribute__((section(".flashfs_data"), used))
+
+namespace stm32_internal_flash {
+
+/**
+ * Raw storage of a FlashVar, padded to whole words, so two
+ * variables never share a flash word.
+ */
+template<class T>
+struct alignas(alignof(T) > 4 ? alignof(T) : 4) FlashStorage
+{
+	std::byte data[(sizeof(T) + 3) & ~std::size_t(3)];
+};
+
+class FlashVarBase
+{
+public:
+	enum class Update
+	{
+		Unchanged,
+		Programmed, // only changed words have been programmed
+		Rewritten,  // bits had to be set, so the page has been erased
+		Failed
+	};
+
+protected:
+	MemoryInterface & memory;
+	std::size_t address;
+	std::size_t size;
+
+protected:
+	FlashVarBase( MemoryInterface & memory_, std::size_t address_, std::size_t size_ )
+	: memory( memory_ ),
+	  address( address_ ),
+	  size( size_ )
+	{}
+
+	/**
+	 * address of storage, relative to the start of the memory
+	 */
+	static std::size_t get_address_of( MemoryInterface & memory, const void *storage );
+
+	const std::byte* get_mapped() const {
+		return memory.get_mapped_address( address );
+	}
+
+	/**
+	 * writes data at offset of the variable with as few program
+	 * operations as possible
+	 */
+	Update update( std::size_t offset, const std::span<const std::byte> & data );
+
+public:
+	std::size_t get_address() const {
+		return address;
+	}
+
+	/**
+	 * true if the variable has never been written
+	 */
+	bool is_blank() const;
+};
+
+template<class T>
+class FlashVar : public FlashVarBase
+{
+	static_assert( std::is_trivially_copyable_v<T>, "T is stored as raw bytes" );
+
+public:
+	/**
+	 * address: relative to the start of the memory
+	 */
+	FlashVar( MemoryInterface & memory_, std::size_t address_ )
+	: FlashVarBase( memory_, address_, sizeof(T) )
+	{}
+
+	/**
+	 * storage placed with STM32_INTERNAL_FLASH_FLASHFS_DATA,
+	 * memory has to be mapped at the start of this region
+	 */
+	FlashVar( MemoryInterface & memory_, const FlashStorage<T> & storage )
+	: FlashVarBase( memory_, get_address_of( memory_, &storage ), sizeof(T) )
+	{}
+
+	/**
+	 * Reference into the mapped flash. It's content
+	 * changes after set(). Requires mapped memory.
+	 */
+	const T & get() const {
+		return *reinterpret_cast<const T*>( get_mapped() );
+	}
+
+	bool set( const T & value ) {
+		return update( value ) != Update::Failed;
+	}
+
+	Update update( const T & value ) {
+		return FlashVarBase::update( 0, std::span<const std::byte>( reinterpret_cast<const std::byte*>(&value), sizeof(T) ) );
+	}
+};
+
+template<class T, std::size_t N>
+class FlashArray : public FlashVar<std::array<T,N>>
+{
+	using base_t = FlashVar<std::array<T,N>>;
+
+public:
+	using base_t::base_t;
+	using base_t::set;
+	using base_t::update;
+
+	const T & operator[]( std::size_t idx ) const {
+		return base_t::get()[idx];
+	}
+
+	static constexpr std::size_t size() {
+		return N;
+	}
+
+	/**
+	 * updates a single element
+	 */
+	bool set( std::size_t idx, const T & value ) {
+		return update( idx, value ) != FlashVarBase::Update::Failed;
+	}
+
+	FlashVarBase::Update update( std::size_t idx, const T & value ) {
+		if( idx >= N ) {
+			return FlashVarBase::Update::Failed;
+		}
+
+		return FlashVarBase::update( idx * sizeof(T), std::span<const std::byte>( reinterpret_cast<const std::byte*>(&value), sizeof(T) ) );
+	}
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_FLASHVAR_H_ */
@@ -6,8 +6,11 @@
  * @author Copyright (c) 2024 Martin Oberzalek
  */
 #include "GenericFlashDriver.h"
+#include "BlankCheck.h"
 #include <alloca.h>
 #include <string.h>
+#include <algorithm>
+#include <array>
 
 namespace stm32_internal_flash {
 
@@ -34,12 +37,16 @@ std::size_t GenericFlashDriver::get_page_size() const
 std::size_t GenericFlashDriver::write( std::size_t address, const std::span<const std::byte> & data )
 {
 	auto data_int = data;
-	const std::size_t page_size = get_page_size();
 	std::size_t len_written = 0;
 
+	if( address > get_size() || data.size() > get_size() - address ) {
+		return 0;
+	}
+
 	// address is not page aligned
-	if( const std::size_t first_slice_len = address % page_size; first_slice_len != 0 ) {
-		const std::size_t data_left_on_first_page = page_size - first_slice_len;
+	if( const std::size_t page_start_address = raw_driver.get_page_start_address( address ); page_start_address != address ) {
+		const std::size_t page_end_address = page_start_address + raw_driver.get_page_size_at( address );
+		const std::size_t data_left_on_first_page = std::min( page_end_address - address, data_int.size() );
 
 		std::size_t len = 0;
 
@@ -55,21 +62,31 @@ std::size_t GenericFlashDriver::write( std::size_t address, const std::span<cons
 
 		len_written += len;
 
-		data_int = data_int.subspan( len_written );
+		data_int = data_int.subspan( len );
 	}
 
-	std::size_t page_aligned_data_len = data_int.size() - len_written;
-	page_aligned_data_len -= page_aligned_data_len % page_size;
+	// pages can have different sizes, so the aligned part ends
+	// at the start of the page, where the data ends
+	const std::size_t data_end_address = address + data.size();
+	std::size_t page_aligned_data_len = 0;
+
+	if( !data_int.empty() ) {
+		if( data_end_address == get_size() ) {
+			page_aligned_data_len = data_int.size();
+		} else {
+			page_aligned_data_len = raw_driver.get_page_start_address( data_end_address ) - (address + len_written);
+		}
+	}
 
 	if( page_aligned_data_len > 0 ) {
 		if(  MemoryInterface::properties.AutoErasePage ) {
-			if( !raw_driver.erase_page(address + len_written, page_aligned_data_len ) ) {
+			if( !erase_pages(address + len_written, page_aligned_data_len ) ) {
 				return len_written;
 			}
 		}
 
 		auto data_to_write = data_int.subspan(0, page_aligned_data_len);
-		std::size_t len = raw_driver.write_page(address + len_written, data_to_write);
+		std::size_t len = program(address + len_written, data_to_write);
 		len_written += len;
 
 		if( len != data_to_write.size() ) {
@@ -94,9 +111,13 @@ std::size_t GenericFlashDriver::write( std::size_t address, const std::span<cons
 
 std::size_t GenericFlashDriver::write_unaligned_first_page( std::size_t address, const std::span<const std::byte> & data )
 {
-	const std::size_t page_size = get_page_size();
-	const std::size_t size_to_read_from_page = address % page_size;
-	const std::size_t page_start_address = address - size_to_read_from_page;
+	if( can_write_without_erase( address, data.size() ) ) {
+		return program( address, data ) == data.size() ? data.size() : 0;
+	}
+
+	const std::size_t page_size = raw_driver.get_page_size_at( address );
+	const std::size_t page_start_address = raw_driver.get_page_start_address( address );
+	const std::size_t size_to_read_from_page = address - page_start_address;
 
 	std::byte *buffer = nullptr;
 	auto page_buffer =  properties.PageBuffer.get();
@@ -115,34 +136,33 @@ std::size_t GenericFlashDriver::write_unaligned_first_page( std::size_t address,
 	}
 
 	std::span<std::byte> span_buffer( buffer, page_size );
-	auto span_to_read = span_buffer.subspan(0, size_to_read_from_page);
 
-	// read first part of the page into memory
-	std::size_t len = read( page_start_address, span_to_read );
+	// read the whole page into memory, data can end before the end of the page
+	std::size_t len = read( page_start_address, span_buffer );
 
-	if( len != span_to_read.size() ) {
+	if( len != span_buffer.size() ) {
 		return 0;
 	}
 
-	// copy rest of first page into buffer
+	// copy new data into buffer
 	auto rest_of_data = span_buffer.subspan( size_to_read_from_page );
 	memcpy( rest_of_data.data(), data.data(), data.size() );
 
 	if( MemoryInterface::properties.AutoErasePage ) {
 		// now we can erase the page and write it
-		if( !raw_driver.erase_page(page_start_address, page_size) ) {
+		if( !erase_pages(page_start_address, page_size) ) {
 			return 0;
 		}
 	}
 
 	// now write it
-	len = raw_driver.write_page(page_start_address, span_buffer);
+	len = program(page_start_address, span_buffer);
 
 	if( len != span_buffer.size() ) {
 		return 0;
 	}
 
-	len -= size_to_read_from_page;
+	len = data.size();
 
 	// amount of new data written to flash
 	// must be data.size()
@@ -155,7 +175,11 @@ std::size_t GenericFlashDriver::write_unaligned_first_page( std::size_t address,
 
 std::size_t GenericFlashDriver::write_unaligned_last_page( std::size_t address, const std::span<const std::byte> & data )
 {
-	const std::size_t page_size = get_page_size();
+	if( can_write_without_erase( address, data.size() ) ) {
+		return program( address, data ) == data.size() ? data.size() : 0;
+	}
+
+	const std::size_t page_size = raw_driver.get_page_size_at( address );
 
 	std::byte *buffer = nullptr;
 	auto page_buffer = properties.PageBuffer.get();
@@ -188,13 +212,13 @@ std::size_t GenericFlashDriver::write_unaligned_last_page( std::size_t address,
 
 	if( MemoryInterface::properties.AutoErasePage ) {
 		// now we can erase the page and write it
-		if( !raw_driver.erase_page(address, page_size) ) {
+		if( !erase_pages(address, page_size) ) {
 			return 0;
 		}
 	}
 
 	// now write it
-	len = raw_driver.write_page(address, span_buffer);
+	len = program(address, span_buffer);
 
 	if( len != span_buffer.size() ) {
 		return 0;
@@ -222,24 +246,148 @@ std::size_t GenericFlashDriver::read( std::size_t address, std::span<std::byte>
 
 bool GenericFlashDriver::erase( std::size_t address, std::size_t size )
 {
-	return raw_driver.erase_page(address, size);
+	return erase_pages(address, size);
+}
+
+bool GenericFlashDriver::is_page_erased( std::size_t page_start_address )
+{
+	if( !properties.SkipEraseOfBlankPages ) {
+		return false;
+	}
+
+	const std::size_t page_idx = raw_driver.get_page_index( page_start_address );
+
+	switch( erased_pages.get( page_idx ) )
+	{
+	case ErasedPagesBitmap::State::Erased:
+		return true;
+
+	case ErasedPagesBitmap::State::Dirty:
+		return false;
+
+	case ErasedPagesBitmap::State::Unknown:
+		break;
+	}
+
+	if( raw_driver.is_blank( page_start_address, raw_driver.get_page_size_at( page_start_address ) ) ) {
+		erased_pages.set_erased( page_idx );
+		return true;
+	}
+
+	erased_pages.set_dirty( page_idx );
+	return false;
+}
+
+bool GenericFlashDriver::erase_pages( std::size_t address, std::size_t size )
+{
+	if( address >= get_size() || raw_driver.get_page_start_address( address ) != address ) {
+		// let the raw driver report the error
+		return raw_driver.erase_page(address, size);
+	}
+
+	/*
+	 * Like the raw driver: at least one page is erased, and only pages
+	 * that are completely inside the range. Pages can have different sizes.
+	 */
+	const std::size_t end_address = address + std::max( size, raw_driver.get_page_size_at( address ) );
+
+	std::size_t run_start = address;
+	std::size_t run_size = 0;
+
+	auto erase_run = [&]() {
+		if( run_size == 0 ) {
+			return true;
+		}
+
+		const bool ok = raw_driver.erase_page( run_start, run_size );
+
+		for( std::size_t page = run_start; page < run_start + run_size; page += raw_driver.get_page_size_at( page ) ) {
+			if( ok ) {
+				erased_pages.set_erased( raw_driver.get_page_index( page ) );
+			} else {
+				erased_pages.set_unknown( raw_driver.get_page_index( page ) );
+			}
+		}
+
+		run_size = 0;
+		return ok;
+	};
+
+	for( std::size_t page = address; page < get_size(); ) {
+		const std::size_t page_size = raw_driver.get_page_size_at( page );
+
+		if( page + page_size > end_address ) {
+			break;
+		}
+
+		if( is_page_erased( page ) ) {
+			skipped_erases++;
+
+			if( !erase_run() ) {
+				return false;
+			}
+		} else {
+			if( run_size == 0 ) {
+				run_start = page;
+			}
+
+			run_size += page_size;
+		}
+
+		page += page_size;
+	}
+
+	return erase_run();
+}
+
+bool GenericFlashDriver::can_write_without_erase( std::size_t address, std::size_t size )
+{
+	if( !properties.SkipEraseOfBlankPages ) {
+		return false;
+	}
+
+	if( erased_pages.get( raw_driver.get_page_index( address ) ) == ErasedPagesBitmap::State::Erased ) {
+		return true;
+	}
+
+	return raw_driver.is_blank( address, size );
+}
+
+std::size_t GenericFlashDriver::program( std::size_t address, const std::span<const std::byte> & data )
+{
+	if( address > get_size() || data.size() > get_size() - address ) {
+		return 0;
+	}
+
+	const std::size_t len = raw_driver.write_page( address, data );
+
+	for( std::size_t page = raw_driver.get_page_start_address( address );
+		 page < address + data.size() && page < get_size();
+		 page += raw_driver.get_page_size_at( page ) ) {
+		erased_pages.set_dirty( raw_driver.get_page_index( page ) );
+	}
+
+	return len;
 }
 
 std::size_t GenericFlashDriver::write_unaligned_first_page_no_buffer( std::size_t address, const std::span<const std::byte> & data )
 {
-	const std::size_t page_size = get_page_size();
-	const std::size_t size_to_read_from_page = address % page_size;
-	const std::size_t page_start_address = address - size_to_read_from_page;
+	if( can_write_without_erase( address, data.size() ) ) {
+		return program( address, data ) == data.size() ? data.size() : 0;
+	}
+
+	const std::size_t page_size = raw_driver.get_page_size_at( address );
+	const std::size_t page_start_address = raw_driver.get_page_start_address( address );
 
 	if( MemoryInterface::properties.AutoErasePage ) {
 		// now we can erase the page and write it
-		if( !raw_driver.erase_page(page_start_address, page_size) ) {
+		if( !erase_pages(page_start_address, page_size) ) {
 			return 0;
 		}
 	}
 
 	// now write it
-	std::size_t len = raw_driver.write_page(address, data);
+	std::size_t len = program(address, data);
 
 	if( len != data.size() ) {
 		return 0;
@@ -250,17 +398,21 @@ std::size_t GenericFlashDriver::write_unaligned_first_page_no_buffer( std::size_
 
 std::size_t GenericFlashDriver::write_unaligned_last_page_no_buffer( std::size_t address, const std::span<const std::byte> & data )
 {
-	const std::size_t page_size = get_page_size();
+	if( can_write_without_erase( address, data.size() ) ) {
+		return program( address, data ) == data.size() ? data.size() : 0;
+	}
+
+	const std::size_t page_size = raw_driver.get_page_size_at( address );
 
 	if( MemoryInterface::properties.AutoErasePage ) {
 		// now we can erase the page and write it
-		if( !raw_driver.erase_page(address, page_size) ) {
+		if( !erase_pages(address, page_size) ) {
 			return 0;
 		}
 	}
 
 	// now write it
-	std::size_t len = raw_driver.write_page(address, data);
+	std::size_t len = program(address, data);
 
 	if( len != data.size() ) {
 		return 0;
@@ -269,4 +421,179 @@ std::size_t GenericFlashDriver::write_unaligned_last_page_no_buffer( std::size_t
 	return len;
 }
 
+bool GenericFlashDriver::program_non_blank( std::size_t address, const std::span<const std::byte> & data )
+{
+	constexpr std::size_t WORD_SIZE = 4;
+	std::size_t pos = 0;
+
+	while( pos < data.size() ) {
+		pos += find_first_non_blank( data.subspan( pos ) );
+
+		if( pos >= data.size() ) {
+			break;
+		}
+
+		// start at the beginning of the target word, these bytes are blank anyway
+		const std::size_t run_start = pos - std::min( pos, (address + pos) % WORD_SIZE );
+		std::size_t run_end = run_start;
+
+		// the run ends at the first blank word
+		while( run_end < data.size() ) {
+			const std::size_t word_end = std::min( data.size(), run_end + WORD_SIZE - (address + run_end) % WORD_SIZE );
+
+			if( is_blank( data.subspan( run_end, word_end - run_end ) ) ) {
+				break;
+			}
+
+			run_end = word_end;
+		}
+
+		auto run = data.subspan( run_start, run_end - run_start );
+
+		if( program( address + run_start, run ) != run.size() ) {
+			return false;
+		}
+
+		pos = run_end;
+	}
+
+	return true;
+}
+
+bool GenericFlashDriver::copy_stream( std::size_t dst, std::size_t src, std::size_t len )
+{
+	// program directly from the source
+	if( const std::byte *mapped = raw_driver.get_mapped_address( src );
+		mapped && raw_driver.get_mapped_address( src + len - 1 ) == mapped + len - 1 ) {
+		return program_non_blank( dst, std::span<const std::byte>( mapped, len ) );
+	}
+
+	std::array<std::byte,COPY_CHUNK_SIZE> buffer;
+
+	for( std::size_t pos = 0; pos < len; pos += buffer.size() ) {
+		std::span<std::byte> chunk( buffer.data(), std::min( buffer.size(), len - pos ) );
+
+		if( raw_driver.read_page( src + pos, chunk ) != chunk.size() ) {
+			return false;
+		}
+
+		if( !program_non_blank( dst + pos, chunk ) ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool GenericFlashDriver::copy_into_page( std::size_t page_start, std::size_t page_size, std::size_t begin, std::size_t end, std::size_t src )
+{
+	const std::size_t len = end - begin;
+	const std::size_t page_end = page_start + page_size;
+	const bool overlapping = src < page_end && page_start < src + len;
+
+	if( !overlapping ) {
+		if( can_write_without_erase( begin, len ) ) {
+			return copy_stream( begin, src, len );
+		}
+
+		const bool rest_is_blank = raw_driver.is_blank( page_start, begin - page_start ) &&
+								   raw_driver.is_blank( end, page_end - end );
+
+		if( rest_is_blank || !MemoryInterface::properties.RestoreDataOnUnaligendWrites ) {
+			if( MemoryInterface::properties.AutoErasePage ) {
+				if( !erase_pages( page_start, page_size ) ) {
+					return false;
+				}
+			}
+
+			return copy_stream( begin, src, len );
+		}
+	} else if( !MemoryInterface::properties.RestoreDataOnUnaligendWrites ) {
+		// the source would be erased, before it's copied
+		return false;
+	}
+
+	// build the new page in RAM
+	std::byte *buffer = nullptr;
+	auto page_buffer = properties.PageBuffer.get();
+
+	if( page_buffer ) {
+
+		if( page_buffer->size() < page_size ) {
+			return false;
+		}
+
+		buffer = page_buffer->data();
+
+	} else {
+		// allocate space on stack
+		buffer = reinterpret_cast<std::byte*>( alloca( page_size ) );
+	}
+
+	std::span<std::byte> span_buffer( buffer, page_size );
+
+	if( raw_driver.read_page( page_start, span_buffer ) != span_buffer.size() ) {
+		return false;
+	}
+
+	// reads from flash, so src may overlap with the page
+	auto target = span_buffer.subspan( begin - page_start, len );
+
+	if( raw_driver.read_page( src, target ) != target.size() ) {
+		return false;
+	}
+
+	if( !erase_pages( page_start, page_size ) ) {
+		return false;
+	}
+
+	return program_non_blank( page_start, span_buffer );
+}
+
+bool GenericFlashDriver::copy( std::size_t dst, std::size_t src, std::size_t len )
+{
+	if( dst > get_size() || len > get_size() - dst ||
+		src > get_size() || len > get_size() - src ) {
+		return false;
+	}
+
+	if( len == 0 || dst == src ) {
+		return true;
+	}
+
+	// like memmove(): when moving up, start with the last page,
+	// so no source data is overwritten before it's copied
+	const bool backward = dst > src;
+	const std::size_t dst_end = dst + len;
+
+	std::size_t page = raw_driver.get_page_start_address( backward ? dst_end - 1 : dst );
+
+	while( true ) {
+		const std::size_t page_size = raw_driver.get_page_size_at( page );
+		const std::size_t begin = std::max( page, dst );
+		const std::size_t end = std::min( page + page_size, dst_end );
+
+		if( !copy_into_page( page, page_size, begin, end, src + (begin - dst) ) ) {
+			return false;
+		}
+
+		if( backward ) {
+			if( page <= dst ) {
+				break;
+			}
+
+			page = raw_driver.get_page_start_address( page - 1 );
+
+		} else {
+			page += page_size;
+
+			if( page >= dst_end ) {
+				break;
+			}
+		}
+	}
+
+	return true;
+}
+
 } // namespace smt32_internal_flash
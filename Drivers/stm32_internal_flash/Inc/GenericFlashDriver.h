@@ -11,12 +11,18 @@
 
 #include "RawDriverInterface.h"
 #include "MemoryInterface.h"
+#include "ErasedPagesBitmap.h"
 
 namespace stm32_internal_flash {
 
 class GenericFlashDriver : public MemoryInterface
 {
 public:
+	/**
+	 * buffer size for copy(), if the source is not memory mapped
+	 */
+	static constexpr std::size_t COPY_CHUNK_SIZE = 64;
+
 	struct properties_storage_t
 	{
 		// buffer that has to be at least PAGE_SIZE size, will be used on unaligned writes,
@@ -24,8 +30,19 @@ public:
 		// GenericFlashDriver::set( GenericFlashDriver::Property::CanRestoreDataOnUnaligendWrites( false ) );
 		PropertyTypes::PropertyValue<std::span<std::byte>*> PageBuffer{};
 
+		/**
+		 * Pages that are already blank are not erased again.
+		 * The driver remembers in RAM which pages are erased. This information
+		 * is collected lazily by blank checks and updated on every erase and write.
+		 *
+		 * The driver expects to be the only one writing to its pages. If someone
+		 * else writes there, call forget_erased_pages().
+		 */
+		PropertyTypes::PropertyValueBooleanDefaultTrue SkipEraseOfBlankPages{};
+
 		void set_property_changed_func( std::function<void()> property_changed_func_ ) {
 			PageBuffer.set_property_changed_func(property_changed_func_);
+			SkipEraseOfBlankPages.set_property_changed_func(property_changed_func_);
 		}
 	};
 
@@ -33,15 +50,24 @@ public:
 
 protected:
 	RawDriverInterface & raw_driver;
+	ErasedPagesBitmap erased_pages;
+
+	// pages erase_pages() didn't erase, because they were blank already
+	std::size_t skipped_erases = 0;
 
 public:
 	/**
-	 * page_buffer: span that has to be PAGE_SIZE large. If null alloca is used
+	 * page_buffer: span that has to be PAGE_SIZE (largest page) large. If null alloca is used
 	 *              to get the buffer on stack. Be careful, this can be a large value.
 	 */
 	GenericFlashDriver( RawDriverInterface & raw_driver_ );
 
 	std::size_t get_size() const override;
+
+	/**
+	 * if the raw driver has pages with different sizes,
+	 * this is the size of the largest page.
+	 */
 	std::size_t get_page_size() const override;
 
 	/**
@@ -52,7 +78,81 @@ public:
 
 	bool erase( std::size_t address, std::size_t size ) override;
 
+	/**
+	 * writes via the raw driver and marks the pages as dirty
+	 */
+	std::size_t program( std::size_t address, const std::span<const std::byte> & data ) override;
+
+	/**
+	 * Copies inside the flash, page by page. Source words that are blank
+	 * are not programmed. If the source is memory mapped, it's programmed
+	 * directly from there, otherwise through a COPY_CHUNK_SIZE buffer.
+	 *
+	 * The page buffer is only required, if data outside of dst has to be
+	 * restored, or src and dst overlap in the same page.
+	 */
+	bool copy( std::size_t dst, std::size_t src, std::size_t len ) override;
+
+	const std::byte* get_mapped_address( std::size_t address ) const override {
+		return raw_driver.get_mapped_address( address );
+	}
+
+	std::size_t get_page_size_at( std::size_t address ) const override {
+		return raw_driver.get_page_size_at( address );
+	}
+
+	std::size_t get_page_start_address( std::size_t address ) const override {
+		return raw_driver.get_page_start_address( address );
+	}
+
+	/**
+	 * forget which pages are known to be erased
+	 */
+	void forget_erased_pages() {
+		erased_pages.clear();
+	}
+
+	/**
+	 * pages not erased, since they were blank already, see SkipEraseOfBlankPages
+	 */
+	std::size_t get_skipped_erases() const {
+		return skipped_erases;
+	}
+
 protected:
+	/**
+	 * erases all pages of the range, that are not blank already.
+	 * Consecutive dirty pages are erased with one call to the raw driver.
+	 */
+	bool erase_pages( std::size_t address, std::size_t size );
+
+	/**
+	 * returns true if the page is erased. If the state is unknown
+	 * a blank check is done and the result is remembered.
+	 */
+	bool is_page_erased( std::size_t page_start_address );
+
+	/**
+	 * true if the range can be written without erasing or restoring anything
+	 */
+	bool can_write_without_erase( std::size_t address, std::size_t size );
+
+	/**
+	 * programs only the words of data, that are not blank.
+	 * The target has to be blank.
+	 */
+	bool program_non_blank( std::size_t address, const std::span<const std::byte> & data );
+
+	/**
+	 * copies src to [begin,end), which is inside of one page
+	 */
+	bool copy_into_page( std::size_t page_start, std::size_t page_size, std::size_t begin, std::size_t end, std::size_t src );
+
+	/**
+	 * copies to a blank target, without any page buffer
+	 */
+	bool copy_stream( std::size_t dst, std::size_t src, std::size_t len );
+
 	/**
 	 * writes an unaligned amount of data, by reading the required page data before
 	 * data.size() has to be <= PAGE_SIZE
@@ -0,0 +1,241 @@
+/*
+ * Writes a large block of data in small steps.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "IncrementalWriter.h"
+#include <string.h>
+
+namespace stm32_internal_flash {
+
+IncrementalWriter::IncrementalWriter( RawDriverInterface & raw_driver_, std::function<uint32_t()> get_microseconds_ )
+: raw_driver( raw_driver_ ),
+  get_microseconds( get_microseconds_ )
+{
+}
+
+bool IncrementalWriter::start( std::size_t address_, const std::span<const std::byte> & data_, std::span<std::byte> *page_buffer_ )
+{
+	address = address_;
+	data = data_;
+	page_buffer = page_buffer_;
+	phase = Phase::Prepare;
+
+	progress = {};
+	progress.bytes_total = data.size();
+
+	if( address > raw_driver.get_size() || data.size() > raw_driver.get_size() - address ) {
+		progress.status = Status::Error;
+		return false;
+	}
+
+	progress.status = data.empty() ? Status::Done : Status::Running;
+
+	return true;
+}
+
+IncrementalWriter::Progress IncrementalWriter::set_error()
+{
+	progress.status = Status::Error;
+	return progress;
+}
+
+bool IncrementalWriter::prepare_page()
+{
+	const std::size_t pos = address + progress.bytes_done;
+
+	page_start = raw_driver.get_page_start_address( pos );
+	page_size = raw_driver.get_page_size_at( pos );
+
+	const std::size_t chunk_end = std::min( page_start + page_size, address + data.size() );
+	auto chunk = data.subspan( progress.bytes_done, chunk_end - pos );
+
+	bytes_done_after_page = chunk_end - address;
+	program_address = pos;
+	program_data = chunk;
+
+	// nothing to erase, just program it
+	if( raw_driver.is_blank( pos, chunk.size() ) ) {
+		phase = Phase::Program;
+		return true;
+	}
+
+	const bool whole_page = pos == page_start && chunk_end == page_start + page_size;
+
+	if( whole_page || page_buffer == nullptr ) {
+		phase = Phase::Erase;
+		return true;
+	}
+
+	// restore the rest of the page from the page buffer
+	if( page_buffer->size() < page_size ) {
+		return false;
+	}
+
+	auto buffer = page_buffer->subspan( 0, page_size );
+
+	if( raw_driver.read_page( page_start, buffer ) != buffer.size() ) {
+		return false;
+	}
+
+	memcpy( buffer.data() + (pos - page_start), chunk.data(), chunk.size() );
+
+	program_address = page_start;
+	program_data = buffer;
+	phase = Phase::Erase;
+
+	return true;
+}
+
+bool IncrementalWriter::erase()
+{
+	if( !raw_driver.erase_page( page_start, page_size ) ) {
+		return false;
+	}
+
+	phase = Phase::Program;
+	return true;
+}
+
+bool IncrementalWriter::program( std::size_t max_bytes )
+{
+	std::size_t len = std::min( max_bytes, program_data.size() );
+
+	// stop at a word boundary, so the next chunk can be programmed word wise
+	if( len < program_data.size() ) {
+		len -= (program_address + len) % sizeof(uint32_t);
+
+		if( len == 0 ) {
+			len = std::min( program_data.size(), sizeof(uint32_t) - program_address % sizeof(uint32_t) );
+		}
+	}
+
+	if( raw_driver.write_page( program_address, program_data.subspan( 0, len ) ) != len ) {
+		return false;
+	}
+
+	// when restoring a page from the buffer, progress is reported when the page is done
+	if( program_data.data() >= data.data() && program_data.data() < data.data() + data.size() ) {
+		progress.bytes_done += len;
+	}
+
+	program_address += len;
+	program_data = program_data.subspan( len );
+
+	if( program_data.empty() ) {
+		progress.bytes_done = bytes_done_after_page;
+		phase = Phase::Prepare;
+
+		if( progress.bytes_done == progress.bytes_total ) {
+			progress.status = Status::Done;
+		}
+	}
+
+	return true;
+}
+
+IncrementalWriter::Progress IncrementalWriter::step_words( std::size_t max_words )
+{
+	progress.erased = false;
+
+	std::size_t budget = std::max( max_words, std::size_t(1) ) * sizeof(uint32_t);
+	bool did_something = false;
+
+	while( progress.status == Status::Running && budget > 0 ) {
+
+		if( phase == Phase::Prepare && !prepare_page() ) {
+			return set_error();
+		}
+
+		if( phase == Phase::Erase ) {
+			if( did_something ) {
+				break;
+			}
+
+			if( !erase() ) {
+				return set_error();
+			}
+
+			progress.erased = true;
+			break;
+		}
+
+		const std::size_t address_before = program_address;
+
+		if( !program( budget ) ) {
+			return set_error();
+		}
+
+		budget -= std::min( budget, program_address - address_before );
+		did_something = true;
+	}
+
+	return progress;
+}
+
+IncrementalWriter::Progress IncrementalWriter::step_microseconds( uint32_t max_microseconds )
+{
+	if( !get_microseconds ) {
+		return step_words( max_microseconds / word_program_time_us );
+	}
+
+	progress.erased = false;
+
+	const uint32_t start_us = get_microseconds();
+	bool did_something = false;
+
+	while( progress.status == Status::Running ) {
+
+		const uint32_t elapsed_us = get_microseconds() - start_us;
+
+		if( elapsed_us >= max_microseconds && did_something ) {
+			break;
+		}
+
+		std::size_t words = std::min<std::size_t>( CHUNK_WORDS, (max_microseconds - std::min( elapsed_us, max_microseconds )) / word_program_time_us );
+
+		if( words == 0 ) {
+			if( did_something ) {
+				break;
+			}
+
+			words = 1;
+		}
+
+		if( phase == Phase::Prepare && !prepare_page() ) {
+			return set_error();
+		}
+
+		if( phase == Phase::Erase ) {
+			if( did_something ) {
+				break;
+			}
+
+			if( !erase() ) {
+				return set_error();
+			}
+
+			progress.erased = true;
+			break;
+		}
+
+		const uint32_t chunk_start_us = get_microseconds();
+		const std::size_t address_before = program_address;
+
+		if( !program( words * sizeof(uint32_t) ) ) {
+			return set_error();
+		}
+
+		// learn how long programming a word takes
+		const std::size_t words_programmed = (program_address - address_before + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+		const uint32_t measured_us = (get_microseconds() - chunk_start_us) / words_programmed;
+
+		word_program_time_us = std::max( uint32_t(1), (3 * word_program_time_us + measured_us) / 4 );
+		did_something = true;
+	}
+
+	return progress;
+}
+
+} // namespace stm32_internal_flash
+
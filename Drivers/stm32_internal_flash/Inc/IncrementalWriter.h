@@ -0,0 +1,137 @@
+/*
+ * Writes a large block of data in small steps, so a superloop
+ * can keep running while the data is persisted.
+ *
+ * Each call of step_words() or step_microseconds() programs as much
+ * as fits into the budget and returns. An erase can't be interrupted,
+ * so it's always done in its own step.
+ *
+ * Pages that are only partially covered are restored from the
+ * page buffer, if one is given. Without page buffer, the rest of the
+ * page is lost, like with RestoreDataOnUnaligendWrites = false.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_INCREMENTALWRITER_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_INCREMENTALWRITER_H_
+
+#include "RawDriverInterface.h"
+#include <functional>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+class IncrementalWriter
+{
+public:
+	enum class Status
+	{
+		Idle,
+		Running,
+		Done,
+		Error
+	};
+
+	struct Progress
+	{
+		Status status = Status::Idle;
+		std::size_t bytes_done  = 0;
+		std::size_t bytes_total = 0;
+		bool erased = false; // the last step was an erase
+	};
+
+	/**
+	 * typical time for programming one word on a STM32F4,
+	 * used as long as no time has been measured
+	 */
+	static constexpr uint32_t TYPICAL_WORD_PROGRAM_TIME_US = 16;
+
+	/**
+	 * amount of words programmed at once, before the time budget is checked again
+	 */
+	static constexpr std::size_t CHUNK_WORDS = 8;
+
+private:
+	enum class Phase
+	{
+		Prepare,
+		Erase,
+		Program
+	};
+
+	RawDriverInterface & raw_driver;
+	std::function<uint32_t()> get_microseconds;
+
+	std::size_t address = 0;
+	std::span<const std::byte> data;
+	std::span<std::byte> *page_buffer = nullptr;
+
+	Phase phase = Phase::Prepare;
+	Progress progress;
+
+	// current page
+	std::size_t page_start = 0;
+	std::size_t page_size = 0;
+
+	// what is programmed in the current page
+	std::size_t program_address = 0;
+	std::span<const std::byte> program_data;
+
+	// amount of data done, after the current page is completed
+	std::size_t bytes_done_after_page = 0;
+
+	uint32_t word_program_time_us = TYPICAL_WORD_PROGRAM_TIME_US;
+
+public:
+	/**
+	 * get_microseconds: free running microsecond counter, required by step_microseconds()
+	 *                   On the host, SimulatedRawDriver::get_microseconds() can be used.
+	 */
+	IncrementalWriter( RawDriverInterface & raw_driver, std::function<uint32_t()> get_microseconds = {} );
+
+	/**
+	 * Starts writing data to address. data has to be valid until the write is done.
+	 * page_buffer: optional, at least get_page_size() large. Used for
+	 *              restoring data of partially written pages.
+	 */
+	bool start( std::size_t address, const std::span<const std::byte> & data, std::span<std::byte> *page_buffer = nullptr );
+
+	/**
+	 * programs at most max_words words, or does one erase
+	 */
+	Progress step_words( std::size_t max_words );
+
+	/**
+	 * programs as much as fits into max_microseconds, or does one erase.
+	 * If the budget is too small, at least one chunk of words is programmed.
+	 */
+	Progress step_microseconds( uint32_t max_microseconds );
+
+	const Progress & get_progress() const {
+		return progress;
+	}
+
+	bool done() const {
+		return progress.status == Status::Done || progress.status == Status::Error;
+	}
+
+private:
+	/**
+	 * decides how the next page is written
+	 */
+	bool prepare_page();
+
+	bool erase();
+
+	/**
+	 * programs at most max_bytes of the current page
+	 */
+	bool program( std::size_t max_bytes );
+
+	Progress set_error();
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_INCREMENTALWRITER_H_ */
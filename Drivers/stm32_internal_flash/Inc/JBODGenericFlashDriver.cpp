@@ -2,6 +2,8 @@
  * @author Copyright (c) 2024 Martin Oberzalek
  */
 #include "JBODGenericFlashDriver.h"
+#include "BlankCheck.h"
+#include <array>
 
 namespace stm32_internal_flash {
 
@@ -40,7 +42,7 @@ bool JBODGenericFlashDriver::erase( std::size_t address, std::size_t size )
 	for( unsigned idx = info.driver_idx; idx < drivers.size(); idx++ ) {
 		MemoryInterface *driver = drivers[idx];
 
-		std::size_t local_size = std::min( driver->get_size(), size );
+		std::size_t local_size = std::min( driver->get_size() - address, size );
 
 		if( !driver->erase( address, local_size ) ) {
 			return false;
@@ -48,14 +50,50 @@ bool JBODGenericFlashDriver::erase( std::size_t address, std::size_t size )
 
 		size -= local_size;
 
-		if( driver->get_size() > size ) {
+		if( size == 0 ) {
 			return true;
 		}
+
+		// after first run address is aligned and always 0 to the local driver
+		address = 0;
 	}
 
 	return false;
 }
 
+const std::byte* JBODGenericFlashDriver::get_mapped_address( std::size_t address ) const
+{
+	DriverInfo info = get_driver_idx_by_address( address );
+
+	if( !info ) {
+		return nullptr;
+	}
+
+	return info.driver->get_mapped_address( address - info.address_offset );
+}
+
+std::size_t JBODGenericFlashDriver::get_page_size_at( std::size_t address ) const
+{
+	DriverInfo info = get_driver_idx_by_address( address );
+
+	if( !info ) {
+		return get_page_size();
+	}
+
+	return info.driver->get_page_size_at( address - info.address_offset );
+}
+
+std::size_t JBODGenericFlashDriver::get_page_start_address( std::size_t address ) const
+{
+	DriverInfo info = get_driver_idx_by_address( address );
+
+	if( !info ) {
+		return MemoryInterface::get_page_start_address( address );
+	}
+
+	return info.driver->get_page_start_address( address - info.address_offset ) + info.address_offset;
+}
+
 MemoryInterface* JBODGenericFlashDriver::get_driver_by_address( std::size_t address ) const
 {
 	for( MemoryInterface* driver : drivers ) {
@@ -78,7 +116,7 @@ JBODGenericFlashDriver::DriverInfo JBODGenericFlashDriver::get_driver_idx_by_add
 
 		const std::size_t junk_size = drivers[i]->get_size();
 
-		if( junk_size > address ) {
+		if( junk_size > current_address ) {
 			info.driver = drivers[i];
 			info.driver_idx = i;
 			info.address_offset = address_offset;
@@ -140,6 +178,206 @@ std::size_t JBODGenericFlashDriver::write( std::size_t address, const std::span<
 	return read_write( address, data, write_func );
 }
 
+std::size_t JBODGenericFlashDriver::program( std::size_t address, const std::span<const std::byte> & data )
+{
+	auto program_func=[]( MemoryInterface *driver, std::size_t address, const std::span<const std::byte> & data ) {
+		return driver->program( address, data );
+	};
+
+	return read_write( address, data, program_func );
+}
+
+const std::byte* JBODGenericFlashDriver::get_mapped_range( std::size_t address, std::size_t len ) const
+{
+	const std::byte *mapped = get_mapped_address( address );
+
+	if( !mapped || get_mapped_address( address + len - 1 ) != mapped + len - 1 ) {
+		return nullptr;
+	}
+
+	return mapped;
+}
+
+bool JBODGenericFlashDriver::is_blank( std::size_t address, std::size_t len )
+{
+	if( len == 0 ) {
+		return true;
+	}
+
+	if( const std::byte *mapped = get_mapped_range( address, len ) ) {
+		return stm32_internal_flash::is_blank( std::span<const std::byte>( mapped, len ) );
+	}
+
+	std::array<std::byte,COPY_CHUNK_SIZE> buffer;
+
+	for( std::size_t pos = 0; pos < len; pos += buffer.size() ) {
+		std::span<std::byte> chunk( buffer.data(), std::min( buffer.size(), len - pos ) );
+
+		if( read( address + pos, chunk ) != chunk.size() || !stm32_internal_flash::is_blank( chunk ) ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool JBODGenericFlashDriver::copy_stream( std::size_t dst, std::size_t src, std::size_t len )
+{
+	// program directly from the source
+	if( const std::byte *mapped = get_mapped_range( src, len ) ) {
+		return program( dst, std::span<const std::byte>( mapped, len ) ) == len;
+	}
+
+	std::array<std::byte,COPY_CHUNK_SIZE> buffer;
+
+	for( std::size_t pos = 0; pos < len; pos += buffer.size() ) {
+		std::span<std::byte> chunk( buffer.data(), std::min( buffer.size(), len - pos ) );
+
+		if( read( src + pos, chunk ) != chunk.size() ) {
+			return false;
+		}
+
+		if( program( dst + pos, chunk ) != chunk.size() ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool JBODGenericFlashDriver::copy_into_page( std::size_t page_start, std::size_t page_size, std::size_t begin, std::size_t end, std::size_t src )
+{
+	const std::size_t len = end - begin;
+	const std::size_t page_end = page_start + page_size;
+
+	if( is_blank( begin, len ) ) {
+		return copy_stream( begin, src, len );
+	}
+
+	const bool rest_is_blank = is_blank( page_start, begin - page_start ) &&
+							   is_blank( end, page_end - end );
+
+	if( rest_is_blank || !MemoryInterface::properties.RestoreDataOnUnaligendWrites ) {
+		if( MemoryInterface::properties.AutoErasePage ) {
+			if( !erase( page_start, page_size ) ) {
+				return false;
+			}
+		}
+
+		return copy_stream( begin, src, len );
+	}
+
+	// the target disc restores the rest of the page, with its page buffer
+	if( const std::byte *mapped = get_mapped_range( src, len ) ) {
+		return write( begin, std::span<const std::byte>( mapped, len ) ) == len;
+	}
+
+	auto page_buffer = properties.PageBuffer.get();
+
+	if( !page_buffer || page_buffer->size() < page_size ) {
+		return MemoryInterface::copy( begin, src, len );
+	}
+
+	// the source is not mapped: build the new page in the page buffer,
+	// like GenericFlashDriver does for unaligned writes, and program it at once
+	std::span<std::byte> page_data( page_buffer->subspan( 0, page_size ) );
+	std::span<std::byte> old_data( page_data );
+
+	if( read( page_start, old_data ) != page_size ) {
+		return false;
+	}
+
+	std::span<std::byte> new_data( page_data.subspan( begin - page_start, len ) );
+
+	if( read( src, new_data ) != len ) {
+		return false;
+	}
+
+	if( !erase( page_start, page_size ) ) {
+		return false;
+	}
+
+	return program( page_start, page_data ) == page_size;
+}
+
+bool JBODGenericFlashDriver::copy( std::size_t dst, std::size_t src, std::size_t len )
+{
+	if( dst > get_size() || len > get_size() - dst ||
+		src > get_size() || len > get_size() - src ) {
+		return false;
+	}
+
+	if( len == 0 || dst == src ) {
+		return true;
+	}
+
+	DriverInfo dst_info = get_driver_idx_by_address( dst );
+	DriverInfo src_info = get_driver_idx_by_address( src );
+
+	if( dst_info.driver_idx == src_info.driver_idx ) {
+		const std::size_t local_dst = dst - dst_info.address_offset;
+		const std::size_t local_src = src - src_info.address_offset;
+		const std::size_t size = dst_info.driver->get_size();
+
+		if( len <= size - local_dst && len <= size - local_src ) {
+			return dst_info.driver->copy( local_dst, local_src, len );
+		}
+	}
+
+	// like memmove(): when moving up, start with the last page,
+	// so no source data is overwritten before it's copied
+	const bool backward = dst > src;
+	const std::size_t dst_end = dst + len;
+
+	std::size_t page = get_page_start_address( backward ? dst_end - 1 : dst );
+
+	while( true ) {
+		const std::size_t page_size = get_page_size_at( page );
+		const std::size_t begin = std::max( page, dst );
+		const std::size_t end = std::min( page + page_size, dst_end );
+		const std::size_t page_src = src + (begin - dst);
+
+		DriverInfo page_info = get_driver_idx_by_address( page );
+		DriverInfo src_first = get_driver_idx_by_address( page_src );
+		DriverInfo src_last = get_driver_idx_by_address( page_src + (end - begin) - 1 );
+
+		bool ok = false;
+
+		if( src_first.driver_idx == page_info.driver_idx && src_last.driver_idx == page_info.driver_idx ) {
+			// this part is on one disc
+			ok = page_info.driver->copy( begin - page_info.address_offset, page_src - page_info.address_offset, end - begin );
+
+		} else if( page_src < page + page_size && page < page_src + (end - begin) ) {
+			// the source spans two discs and overlaps the page
+			ok = MemoryInterface::copy( begin, page_src, end - begin );
+
+		} else {
+			ok = copy_into_page( page, page_size, begin, end, page_src );
+		}
+
+		if( !ok ) {
+			return false;
+		}
+
+		if( backward ) {
+			if( page <= dst ) {
+				break;
+			}
+
+			page = get_page_start_address( page - 1 );
+
+		} else {
+			page += page_size;
+
+			if( page >= dst_end ) {
+				break;
+			}
+		}
+	}
+
+	return true;
+}
+
 std::size_t JBODGenericFlashDriver::read( std::size_t address, std::span<std::byte> & data )
 {
 	auto read_func=[]( MemoryInterface *driver, std::size_t address, std::span<std::byte> & data ) {
@@ -27,9 +27,19 @@ class JBODGenericFlashDriver : public MemoryInterface
 	};
 
 protected:
-	const std::span<MemoryInterface*> & drivers;
+	const std::span<MemoryInterface*> drivers;
 
 public:
+	struct properties_storage_t
+	{
+		// buffer that has to be at least the largest page size. Used by copy() between the discs
+		// to restore a partly written page, if the source is not memory mapped.
+		// Without it, such a page is copied chunk wise with write() of the target disc.
+		PropertyTypes::PropertyValue<std::span<std::byte>*> PageBuffer{};
+	};
+
+	properties_storage_t properties;
+
 
 	JBODGenericFlashDriver( const std::span<MemoryInterface*> & drivers_ )
 	: drivers( drivers_ )
@@ -50,6 +60,30 @@ public:
 
 	bool erase( std::size_t address, std::size_t size ) override;
 
+	std::size_t program( std::size_t address, const std::span<const std::byte> & data ) override;
+
+	/**
+	 * buffer size for copies between discs, if the source is not memory mapped
+	 */
+	static constexpr std::size_t COPY_CHUNK_SIZE = 64;
+
+	/**
+	 * If src and dst are on the same disc, the disc copies it.
+	 * Otherwise it's copied page by page of the target: each page is
+	 * erased once, if required, and the data is programmed from the
+	 * mapped source, or streamed through a COPY_CHUNK_SIZE buffer.
+	 * A page, that is partly written and has to be restored, is written
+	 * with write() of the target disc. If the source is not mapped, it's
+	 * built in properties.PageBuffer once, or without a buffer copied
+	 * chunk wise with write(), which erases the page for every chunk.
+	 */
+	bool copy( std::size_t dst, std::size_t src, std::size_t len ) override;
+
+	const std::byte* get_mapped_address( std::size_t address ) const override;
+
+	std::size_t get_page_size_at( std::size_t address ) const override;
+	std::size_t get_page_start_address( std::size_t address ) const override;
+
 private:
 	MemoryInterface* get_driver_by_address( std::size_t address ) const;
 
@@ -62,6 +96,23 @@ private:
 	template<class SPAN, class FUNC>
 	std::size_t read_write( std::size_t address, SPAN & data, FUNC func );
 
+	/**
+	 * returns the mapped address, if the whole range is mapped in one piece
+	 */
+	const std::byte* get_mapped_range( std::size_t address, std::size_t len ) const;
+
+	bool is_blank( std::size_t address, std::size_t len );
+
+	/**
+	 * programs len bytes from src to dst, the target has to be erased
+	 */
+	bool copy_stream( std::size_t dst, std::size_t src, std::size_t len );
+
+	/**
+	 * copies [begin,end) of the target page from src, which is on another disc
+	 */
+	bool copy_into_page( std::size_t page_start, std::size_t page_size, std::size_t begin, std::size_t end, std::size_t src );
+
 	void properties_changed() override;
 };
 
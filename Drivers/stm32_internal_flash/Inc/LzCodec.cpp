@@ -0,0 +1,216 @@
+/*
+ * Small LZ77 codec in the style of LZ4, for compressing flash data.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "LzCodec.h"
+#include <algorithm>
+#include <array>
+#include <string.h>
+
+namespace stm32_internal_flash {
+
+namespace lz_codec {
+
+namespace {
+
+uint32_t read32( const std::byte *p )
+{
+	uint32_t value;
+	memcpy( &value, p, sizeof(value) );
+	return value;
+}
+
+std::size_t hash( uint32_t value )
+{
+	// Knuth's multiplicative hash
+	return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+class Output
+{
+	std::span<std::byte> dst;
+	std::size_t pos = 0;
+
+public:
+	bool overflow = false;
+
+	Output( std::span<std::byte> dst_ )
+	: dst( dst_ )
+	{}
+
+	std::size_t size() const {
+		return pos;
+	}
+
+	void put( std::byte b ) {
+		if( pos >= dst.size() ) {
+			overflow = true;
+			return;
+		}
+		dst[pos++] = b;
+	}
+
+	void put( const std::byte *data, std::size_t len ) {
+		if( len > dst.size() - pos ) {
+			overflow = true;
+			return;
+		}
+		memcpy( dst.data() + pos, data, len );
+		pos += len;
+	}
+
+	/**
+	 * the part of a length, that doesn't fit into the nibble of the token
+	 */
+	void put_length( std::size_t len ) {
+		for( ; len >= 255; len -= 255 ) {
+			put( std::byte(255) );
+		}
+		put( static_cast<std::byte>( len ) );
+	}
+
+	void put_sequence( const std::byte *literals, std::size_t literal_len, std::size_t match_len, std::size_t offset ) {
+		const std::size_t match_code = match_len ? match_len - MIN_MATCH : 0;
+
+		put( static_cast<std::byte>( (std::min<std::size_t>( literal_len, 15 ) << 4) | std::min<std::size_t>( match_code, 15 ) ) );
+
+		if( literal_len >= 15 ) {
+			put_length( literal_len - 15 );
+		}
+
+		put( literals, literal_len );
+
+		if( match_len == 0 ) {
+			return;
+		}
+
+		put( static_cast<std::byte>( offset & 0xFF ) );
+		put( static_cast<std::byte>( offset >> 8 ) );
+
+		if( match_code >= 15 ) {
+			put_length( match_code - 15 );
+		}
+	}
+};
+
+} // namespace
+
+std::size_t compress( const std::span<const std::byte> & src, std::span<std::byte> dst )
+{
+	std::array<uint16_t,1 << HASH_BITS> table;
+	table.fill( 0xFFFF );
+
+	Output out( dst );
+
+	const std::byte *data = src.data();
+	const std::size_t size = src.size();
+
+	std::size_t literal_start = 0;
+	std::size_t pos = 0;
+
+	while( pos + MIN_MATCH <= size ) {
+		const uint32_t value = read32( data + pos );
+		const std::size_t h = hash( value );
+		const std::size_t candidate = table[h];
+
+		table[h] = static_cast<uint16_t>( pos );
+
+		if( candidate == 0xFFFF || candidate >= pos || pos - candidate > MAX_OFFSET || read32( data + candidate ) != value ) {
+			pos++;
+			continue;
+		}
+
+		std::size_t match_len = MIN_MATCH;
+
+		while( pos + match_len < size && data[candidate + match_len] == data[pos + match_len] ) {
+			match_len++;
+		}
+
+		out.put_sequence( data + literal_start, pos - literal_start, match_len, pos - candidate );
+
+		if( out.overflow ) {
+			return 0;
+		}
+
+		pos += match_len;
+		literal_start = pos;
+	}
+
+	out.put_sequence( data + literal_start, size - literal_start, 0, 0 );
+
+	return out.overflow ? 0 : out.size();
+}
+
+std::size_t decompress( const std::span<const std::byte> & src, std::span<std::byte> dst )
+{
+	std::size_t in = 0;
+	std::size_t out = 0;
+
+	auto get_length = [&]( std::size_t len ) -> std::size_t {
+		if( len != 15 ) {
+			return len;
+		}
+
+		while( in < src.size() ) {
+			const std::size_t b = static_cast<std::size_t>( src[in++] );
+			len += b;
+
+			if( b != 255 ) {
+				return len;
+			}
+		}
+
+		// truncated
+		return SIZE_MAX;
+	};
+
+	while( in < src.size() ) {
+		const std::size_t token = static_cast<std::size_t>( src[in++] );
+
+		const std::size_t literal_len = get_length( token >> 4 );
+
+		if( literal_len > src.size() - in || literal_len > dst.size() - out ) {
+			return 0;
+		}
+
+		memcpy( dst.data() + out, src.data() + in, literal_len );
+		in += literal_len;
+		out += literal_len;
+
+		// the last sequence
+		if( in == src.size() ) {
+			break;
+		}
+
+		if( src.size() - in < 2 ) {
+			return 0;
+		}
+
+		const std::size_t offset = static_cast<std::size_t>( src[in] ) | (static_cast<std::size_t>( src[in+1] ) << 8);
+		in += 2;
+
+		const std::size_t match_code = get_length( token & 0x0F );
+
+		if( match_code == SIZE_MAX || offset == 0 || offset > out ) {
+			return 0;
+		}
+
+		const std::size_t match_len = match_code + MIN_MATCH;
+
+		if( match_len > dst.size() - out ) {
+			return 0;
+		}
+
+		// byte by byte, because the match can overlap the output
+		for( std::size_t i = 0; i < match_len; i++, out++ ) {
+			dst[out] = dst[out - offset];
+		}
+	}
+
+	return out;
+}
+
+} // namespace lz_codec
+
+} // namespace stm32_internal_flash
@@ -0,0 +1,49 @@
+/*
+ * Small LZ77 codec in the style of LZ4, for compressing flash data.
+ *
+ * The compressed data is a sequence of:
+ *   token:    high nibble literal length, low nibble match length - 4
+ *             (15: the length continues in the following bytes,
+ *              each 255 adds to it, until a byte < 255)
+ *   literals
+ *   offset:   2 bytes little endian, back into the output
+ * The last sequence consists only of literals.
+ *
+ * Compressing needs a hash table of 2K on the stack,
+ * decompressing needs no RAM besides the output.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_LZCODEC_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_LZCODEC_H_
+
+#include <span>
+#include <cstddef>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+namespace lz_codec {
+
+static constexpr std::size_t HASH_BITS = 10;
+static constexpr std::size_t MIN_MATCH = 4;
+static constexpr std::size_t MAX_OFFSET = 0xFFFF;
+
+/**
+ * Returns the size of the compressed data, or 0 if it doesn't fit into dst.
+ * src can be at most 64K.
+ */
+std::size_t compress( const std::span<const std::byte> & src, std::span<std::byte> dst );
+
+/**
+ * Returns the size of the decompressed data, or 0 if src is invalid
+ * or the data doesn't fit into dst.
+ */
+std::size_t decompress( const std::span<const std::byte> & src, std::span<std::byte> dst );
+
+} // namespace lz_codec
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_LZCODEC_H_ */
@@ -14,6 +14,7 @@
 #include <functional>
 #include <string.h>
 #include <concepts>
+#include <algorithm>
 
 namespace stm32_internal_flash {
 
@@ -128,6 +129,65 @@ public:
 
 	virtual bool erase( std::size_t address, std::size_t size ) = 0;
 
+	/**
+	 * Programs data without erasing or restoring anything. Flash bits can
+	 * only be cleared, so this is for blank ranges, or for updates which
+	 * only clear bits. Returns 0 if the memory does not support it.
+	 */
+	virtual std::size_t program( std::size_t /* address */, const std::span<const std::byte> & /* data */ ) {
+		return 0;
+	}
+
+	/**
+	 * Copies len bytes from src to dst inside the memory. The ranges can overlap.
+	 *
+	 * This default streams small chunks through read() and write(), in the
+	 * direction memmove() would use. Drivers can do better.
+	 */
+	virtual bool copy( std::size_t dst, std::size_t src, std::size_t len ) {
+		std::byte buffer[64];
+		const bool backward = dst > src && dst < src + len;
+
+		for( std::size_t done = 0; done < len; ) {
+			const std::size_t chunk_size = std::min( len - done, sizeof(buffer) );
+			const std::size_t offset = backward ? len - done - chunk_size : done;
+			std::span<std::byte> chunk( buffer, chunk_size );
+
+			if( read( src + offset, chunk ) != chunk_size ) {
+				return false;
+			}
+
+			if( write( dst + offset, chunk ) != chunk_size ) {
+				return false;
+			}
+
+			done += chunk_size;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Size of the page at address. Pages can have different sizes,
+	 * get_page_size() returns the largest one.
+	 */
+	virtual std::size_t get_page_size_at( std::size_t /* address */ ) const {
+		return get_page_size();
+	}
+
+	virtual std::size_t get_page_start_address( std::size_t address ) const {
+		return address - address % get_page_size_at( address );
+	}
+
+	/**
+	 * If the memory is mapped into the address space, like the internal flash,
+	 * a pointer to the data at address is returned. So it can be read without copying.
+	 * Returns nullptr if the memory is not mapped.
+	 */
+	virtual const std::byte* get_mapped_address( std::size_t /* address */ ) const {
+		return nullptr;
+	}
+
 
 	virtual void properties_changed() {}
 };
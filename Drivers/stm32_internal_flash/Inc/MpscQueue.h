@@ -0,0 +1,112 @@
+/*
+ * Bounded lock free queue for multiple producers and a single consumer.
+ *
+ * Each cell has a sequence number, that tells producers and the consumer
+ * if the cell is free or filled. Only 32 bit atomics are used, which are
+ * lock free on a Cortex-M3/M4 too.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_MPSCQUEUE_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_MPSCQUEUE_H_
+
+#include <atomic>
+#include <array>
+#include <optional>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+template<class T, std::size_t SIZE>
+class MpscQueue
+{
+	static_assert( SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "SIZE has to be a power of two" );
+
+	struct Cell
+	{
+		std::atomic<uint32_t> sequence;
+		T data;
+	};
+
+	std::array<Cell,SIZE> cells;
+	std::atomic<uint32_t> enqueue_pos;
+	std::atomic<uint32_t> dequeue_pos; // only changed by the consumer
+
+public:
+	MpscQueue()
+	: cells(),
+	  enqueue_pos( 0 ),
+	  dequeue_pos( 0 )
+	{
+		for( uint32_t i = 0; i < SIZE; i++ ) {
+			cells[i].sequence.store( i, std::memory_order_relaxed );
+		}
+	}
+
+	/**
+	 * can be called from any thread
+	 * returns false if the queue is full
+	 */
+	bool push( const T & data ) {
+		uint32_t pos = enqueue_pos.load( std::memory_order_relaxed );
+
+		while( true ) {
+			Cell & cell = cells[pos & (SIZE - 1)];
+			const uint32_t seq = cell.sequence.load( std::memory_order_acquire );
+			const int32_t diff = static_cast<int32_t>(seq - pos);
+
+			if( diff == 0 ) {
+				// cell is free, try to claim it
+				if( enqueue_pos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+					cell.data = data;
+					cell.sequence.store( pos + 1, std::memory_order_release );
+					return true;
+				}
+			} else if( diff < 0 ) {
+				// full
+				return false;
+			} else {
+				// another producer was faster
+				pos = enqueue_pos.load( std::memory_order_relaxed );
+			}
+		}
+	}
+
+	/**
+	 * has to be called from the consumer thread only
+	 */
+	std::optional<T> pop() {
+		const uint32_t pos = dequeue_pos.load( std::memory_order_relaxed );
+		Cell & cell = cells[pos & (SIZE - 1)];
+		const uint32_t seq = cell.sequence.load( std::memory_order_acquire );
+
+		if( static_cast<int32_t>(seq - (pos + 1)) < 0 ) {
+			// empty
+			return {};
+		}
+
+		std::optional<T> data( std::move( cell.data ) );
+		cell.data = T();
+
+		cell.sequence.store( pos + SIZE, std::memory_order_release );
+		dequeue_pos.store( pos + 1, std::memory_order_relaxed );
+
+		return data;
+	}
+
+	/**
+	 * approximately, since other threads can change the queue at the same time
+	 */
+	std::size_t size() const {
+		return enqueue_pos.load( std::memory_order_relaxed ) - dequeue_pos.load( std::memory_order_relaxed );
+	}
+
+	static constexpr std::size_t capacity() {
+		return SIZE;
+	}
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_MPSCQUEUE_H_ */
@@ -0,0 +1,84 @@
+/*
+ * A partition of a MemoryInterface.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "PartitionMemoryInterface.h"
+
+namespace stm32_internal_flash {
+
+PartitionMemoryInterface::PartitionMemoryInterface( MemoryInterface & driver_, const PartitionRange & range )
+: driver( driver_ ),
+  offset( range.offset ),
+  size( range.size )
+{
+	for( std::size_t address = 0; address < size; ) {
+		const std::size_t page = get_page_size_at( address );
+
+		if( page == 0 ) {
+			break;
+		}
+
+		page_size = std::max( page_size, page );
+		address = get_page_start_address( address ) + page;
+	}
+
+	// take over the settings of the driver, properties_changed() passes them back
+	MemoryInterface::properties = driver.properties;
+}
+
+std::size_t PartitionMemoryInterface::write( std::size_t address, const std::span<const std::byte> & data )
+{
+	if( !is_inside( address, data.size() ) ) {
+		return 0;
+	}
+
+	return driver.write( offset + address, data );
+}
+
+std::size_t PartitionMemoryInterface::read( std::size_t address, std::span<std::byte> & data )
+{
+	if( !is_inside( address, data.size() ) ) {
+		return 0;
+	}
+
+	return driver.read( offset + address, data );
+}
+
+bool PartitionMemoryInterface::erase( std::size_t address, std::size_t len )
+{
+	if( !is_inside( address, len ) ) {
+		return false;
+	}
+
+	return driver.erase( offset + address, len );
+}
+
+std::size_t PartitionMemoryInterface::program( std::size_t address, const std::span<const std::byte> & data )
+{
+	if( !is_inside( address, data.size() ) ) {
+		return 0;
+	}
+
+	return driver.program( offset + address, data );
+}
+
+bool PartitionMemoryInterface::copy( std::size_t dst, std::size_t src, std::size_t len )
+{
+	if( !is_inside( dst, len ) || !is_inside( src, len ) ) {
+		return false;
+	}
+
+	return driver.copy( offset + dst, offset + src, len );
+}
+
+const std::byte* PartitionMemoryInterface::get_mapped_address( std::size_t address ) const
+{
+	if( address >= size ) {
+		return nullptr;
+	}
+
+	return driver.get_mapped_address( offset + address );
+}
+
+} // namespace stm32_internal_flash
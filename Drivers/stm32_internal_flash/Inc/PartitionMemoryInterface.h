@@ -0,0 +1,84 @@
+/*
+ * A partition of a MemoryInterface, as a MemoryInterface of its own.
+ *
+ * Address 0 of the view is the start of the partition, accesses
+ * beyond its end fail, so a user of the partition can't touch
+ * the data of its neighbours:
+ *
+ *   GenericFlashDriver fs_driver( raw_driver );  // covers the whole table
+ *   PartitionMemoryInterface config( fs_driver, flash_partitions.get_range( "config" ) );
+ *   PartitionMemoryInterface log( fs_driver, flash_partitions.get_range( "log" ) );
+ *
+ * Page sizes and page boundaries are the ones of the driver. Since partitions
+ * start and end at sector boundaries, see FlashPartitions.h, pages never
+ * cross the border of the view.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_PARTITIONMEMORYINTERFACE_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_PARTITIONMEMORYINTERFACE_H_
+
+#include "MemoryInterface.h"
+#include "FlashPartitions.h"
+
+namespace stm32_internal_flash {
+
+class PartitionMemoryInterface : public MemoryInterface
+{
+protected:
+	MemoryInterface & driver;
+	const std::size_t offset;
+	const std::size_t size;
+	std::size_t page_size = 0;
+
+public:
+	PartitionMemoryInterface( MemoryInterface & driver_, const PartitionRange & range );
+
+	std::size_t get_size() const override {
+		return size;
+	}
+
+	/**
+	 * the largest page inside the partition
+	 */
+	std::size_t get_page_size() const override {
+		return page_size;
+	}
+
+	std::size_t write( std::size_t address, const std::span<const std::byte> & data ) override;
+	std::size_t read( std::size_t address, std::span<std::byte> & data ) override;
+	bool erase( std::size_t address, std::size_t len ) override;
+	std::size_t program( std::size_t address, const std::span<const std::byte> & data ) override;
+	bool copy( std::size_t dst, std::size_t src, std::size_t len ) override;
+
+	std::size_t get_page_size_at( std::size_t address ) const override {
+		return driver.get_page_size_at( offset + address );
+	}
+
+	std::size_t get_page_start_address( std::size_t address ) const override {
+		return driver.get_page_start_address( offset + address ) - offset;
+	}
+
+	const std::byte* get_mapped_address( std::size_t address ) const override;
+
+	void properties_changed() override {
+		driver.properties = MemoryInterface::properties;
+	}
+
+	/**
+	 * the address of the partition start at the driver
+	 */
+	std::size_t get_offset() const {
+		return offset;
+	}
+
+protected:
+	bool is_inside( std::size_t address, std::size_t len ) const {
+		return address <= size && len <= size - address;
+	}
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_PARTITIONMEMORYINTERFACE_H_ */
@@ -0,0 +1,263 @@
+/*
+ * Keeps spare pages of a MemoryInterface erased ahead of time.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "PreErasePool.h"
+#include "BlankCheck.h"
+
+namespace stm32_internal_flash {
+
+PreErasePool::PreErasePool( MemoryInterface & driver_,
+		std::size_t spare_pages_,
+		get_time_us_func_t get_time_us_ )
+: driver( driver_ ),
+  spare_pages( spare_pages_ ),
+  get_time_us( get_time_us_ )
+{
+	std::size_t address = 0;
+
+	// pages after MAX_PAGES are not tracked, they are passed through
+	while( address < driver.get_size() && page_count < MAX_PAGES ) {
+		const std::size_t page_size = driver.get_page_size_at( address );
+
+		if( page_size == 0 ) {
+			break;
+		}
+
+		page_starts[page_count++] = address;
+		address += page_size;
+	}
+
+	page_starts[page_count] = address;
+
+	// take over the settings of the driver, properties_changed() passes them back
+	MemoryInterface::properties = driver.properties;
+}
+
+std::size_t PreErasePool::find_page( std::size_t address ) const
+{
+	for( std::size_t page_idx = 0; page_idx < page_count; page_idx++ ) {
+		if( address < page_starts[page_idx+1] ) {
+			return page_idx;
+		}
+	}
+
+	return page_count;
+}
+
+void PreErasePool::consume( std::size_t page_idx )
+{
+	released &= ~bit(page_idx);
+	pre_erased &= ~bit(page_idx);
+}
+
+void PreErasePool::set_dirty( std::size_t address, std::size_t size )
+{
+	if( size == 0 ) {
+		return;
+	}
+
+	const std::size_t first = find_page( address );
+	std::size_t page_idx = first;
+
+	for( ; page_idx < page_count && page_starts[page_idx] < address + size; page_idx++ ) {
+		erased_pages.set_dirty( page_idx );
+		consume( page_idx );
+	}
+
+	if( page_idx == first ) {
+		return;
+	}
+
+	last_written_page = page_idx - 1;
+
+	for( std::size_t i = 1; i <= ring_ahead && i < page_count; i++ ) {
+		const std::size_t ahead = (last_written_page + i) % page_count;
+
+		// don't release what has just been written, if the range wraps around
+		if( ahead < first || ahead > last_written_page ) {
+			released |= bit(ahead);
+		}
+	}
+}
+
+void PreErasePool::invalidate( std::size_t address, std::size_t size )
+{
+	for( std::size_t page_idx = find_page( address );
+		 page_idx < page_count && page_starts[page_idx] < address + size;
+		 page_idx++ ) {
+		erased_pages.set_unknown( page_idx );
+		consume( page_idx );
+	}
+}
+
+void PreErasePool::release( std::size_t address, std::size_t size )
+{
+	for( std::size_t page_idx = find_page( address );
+		 page_idx < page_count && page_starts[page_idx+1] <= address + size;
+		 page_idx++ ) {
+		if( page_starts[page_idx] >= address ) {
+			released |= bit(page_idx);
+		}
+	}
+}
+
+bool PreErasePool::erase_page( std::size_t page_idx, uint32_t & duration_us )
+{
+	const uint32_t start = now_us();
+	const bool ok = driver.erase( page_starts[page_idx], page_starts[page_idx+1] - page_starts[page_idx] );
+
+	duration_us = now_us() - start;
+
+	if( ok ) {
+		erased_pages.set_erased( page_idx );
+	} else {
+		erased_pages.set_unknown( page_idx );
+	}
+
+	return ok;
+}
+
+std::size_t PreErasePool::write( std::size_t address, const std::span<const std::byte> & data )
+{
+	const std::size_t len = driver.write( address, data );
+	set_dirty( address, data.size() );
+	return len;
+}
+
+std::size_t PreErasePool::read( std::size_t address, std::span<std::byte> & data )
+{
+	return driver.read( address, data );
+}
+
+std::size_t PreErasePool::program( std::size_t address, const std::span<const std::byte> & data )
+{
+	const std::size_t len = driver.program( address, data );
+	set_dirty( address, data.size() );
+	return len;
+}
+
+bool PreErasePool::copy( std::size_t dst, std::size_t src, std::size_t len )
+{
+	const bool ok = driver.copy( dst, src, len );
+	set_dirty( dst, len );
+	return ok;
+}
+
+bool PreErasePool::erase( std::size_t address, std::size_t size )
+{
+	std::size_t page_idx = find_page( address );
+
+	// not a tracked page, or not starting at one
+	if( page_idx == page_count || page_starts[page_idx] != address ) {
+		const bool ok = driver.erase( address, size );
+		invalidate( address, size );
+		return ok;
+	}
+
+	uint32_t stall_us = 0;
+	bool ok = true;
+
+	for( ; ok && page_idx < page_count && page_starts[page_idx] < address + size; page_idx++ ) {
+		if( is_pooled( page_idx ) ) {
+			statistic.hits++;
+			statistic.avoided_stall_us += erase_us[page_idx];
+		} else if( erased_pages.get( page_idx ) != ErasedPagesBitmap::State::Erased ) {
+			uint32_t duration_us = 0;
+
+			ok = erase_page( page_idx, duration_us );
+			stall_us += duration_us;
+			statistic.misses++;
+		}
+
+		consume( page_idx );
+	}
+
+	// the rest is beyond the tracked pages
+	if( ok && page_idx == page_count && page_starts[page_count] < address + size ) {
+		const uint32_t start = now_us();
+		ok = driver.erase( page_starts[page_count], address + size - page_starts[page_count] );
+		stall_us += now_us() - start;
+	}
+
+	statistic.stall_us += stall_us;
+	statistic.max_stall_us = std::max( statistic.max_stall_us, stall_us );
+
+	return ok;
+}
+
+bool PreErasePool::process()
+{
+	if( get_available_pages() >= spare_pages ) {
+		return false;
+	}
+
+	const std::size_t page_idx = find_next( [this]( std::size_t idx ) {
+		return (released & bit(idx)) && !is_pooled( idx );
+	});
+
+	if( page_idx == page_count ) {
+		return false;
+	}
+
+	const std::size_t page_size = page_starts[page_idx+1] - page_starts[page_idx];
+	const std::byte *mapped = driver.get_mapped_address( page_starts[page_idx] );
+
+	erase_us[page_idx] = 0;
+
+	if( erased_pages.get( page_idx ) == ErasedPagesBitmap::State::Erased ) {
+		// erased by someone before, there was never anything to wait for
+
+	} else if( erased_pages.get( page_idx ) == ErasedPagesBitmap::State::Unknown &&
+			   mapped && is_blank( std::span<const std::byte>( mapped, page_size ) ) ) {
+		erased_pages.set_erased( page_idx );
+		statistic.blank_checked++;
+
+	} else {
+		if( !erase_page( page_idx, erase_us[page_idx] ) ) {
+			// don't try again and again
+			released &= ~bit(page_idx);
+			return true;
+		}
+
+		statistic.pre_erased++;
+	}
+
+	pre_erased |= bit(page_idx);
+
+	return true;
+}
+
+std::size_t PreErasePool::acquire()
+{
+	const std::size_t page_idx = find_next( [this]( std::size_t idx ) {
+		return is_pooled( idx );
+	});
+
+	if( page_idx == page_count ) {
+		return NO_PAGE;
+	}
+
+	statistic.hits++;
+	statistic.avoided_stall_us += erase_us[page_idx];
+
+	consume( page_idx );
+
+	return page_starts[page_idx];
+}
+
+std::size_t PreErasePool::get_available_pages() const
+{
+	std::size_t count = 0;
+
+	for( std::size_t page_idx = 0; page_idx < page_count; page_idx++ ) {
+		if( is_pooled( page_idx ) ) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+} // namespace stm32_internal_flash
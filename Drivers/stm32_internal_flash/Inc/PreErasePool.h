@@ -0,0 +1,222 @@
+/*
+ * Keeps spare pages of a MemoryInterface erased ahead of time.
+ *
+ * Erasing a sector of the internal flash takes 0.25s up to 2s and
+ * stalls the CPU. Appenders, like a log or a key value store, hit
+ * this whenever they move to the next sector. The pool moves these
+ * erases into idle time:
+ *
+ * - pages, whose data isn't needed any more, are given to the pool
+ *   with release(), or automatically with ring_ahead
+ * - process(), called from the superloop or an Executor task, erases
+ *   one released page per call, until spare_pages pages are erased
+ * - erase() of a page, the pool has erased ahead, returns at once,
+ *   acquire() hands out such a page to appenders, that can choose
+ *
+ *   PreErasePool pool( driver, 1, get_microseconds );
+ *   pool.ring_ahead = 1;            // the sector after the head of the log
+ *   CircularLog log( pool, 32 );
+ *
+ *   while( true ) {
+ *       log.append( record );       // never waits for an erase
+ *       pool.process();             // idle time
+ *   }
+ *
+ * The erase state of each page is tracked in RAM. After a reset it's
+ * unknown, a released page is then blank checked first, if the memory
+ * is mapped. Writes, that don't go through the pool, have to be
+ * reported with invalidate().
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_PREERASEPOOL_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_PREERASEPOOL_H_
+
+#include "MemoryInterface.h"
+#include "ErasedPagesBitmap.h"
+#include <array>
+#include <functional>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+class PreErasePool : public MemoryInterface
+{
+public:
+	static constexpr std::size_t MAX_PAGES = ErasedPagesBitmap::MAX_PAGES;
+	static constexpr std::size_t NO_PAGE = SIZE_MAX;
+
+	using get_time_us_func_t = std::function<uint32_t()>;
+
+	struct Statistic
+	{
+		std::size_t pre_erased = 0;         // pages erased by process()
+		std::size_t blank_checked = 0;      // released pages found blank, without erasing
+		std::size_t hits = 0;               // erases served by the pool, or pages acquired
+		std::size_t misses = 0;             // erases the caller had to wait for
+		uint64_t stall_us = 0;              // time the callers of erase() waited
+		uint32_t max_stall_us = 0;
+		uint64_t avoided_stall_us = 0;      // erase time of the hits, spent in process() before
+	};
+
+	/**
+	 * The number of pages following the last written one, that are
+	 * released automatically. For append only rings, like CircularLog,
+	 * which always continue with the next page. Their oldest data is
+	 * erased that much earlier. CircularLog::mount() accepts one erased
+	 * sector after the newest one, so 1 for a CircularLog.
+	 */
+	std::size_t ring_ahead = 0;
+
+protected:
+	MemoryInterface & driver;
+	std::size_t spare_pages;
+	get_time_us_func_t get_time_us;
+
+	std::array<std::size_t,MAX_PAGES+1> page_starts {};
+	std::size_t page_count = 0;
+
+	ErasedPagesBitmap erased_pages;
+	uint64_t released = 0;     // data not needed, may be erased ahead
+	uint64_t pre_erased = 0;   // erased by process(), not consumed yet
+	std::array<uint32_t,MAX_PAGES> erase_us {};
+
+	// process() and acquire() continue from here, so pages are used in turn
+	std::size_t last_written_page = NO_PAGE;
+
+	Statistic statistic;
+
+public:
+	/**
+	 * spare_pages: erased pages process() keeps in the pool
+	 * get_time_us: clock for the stall times, may wrap around
+	 */
+	PreErasePool( MemoryInterface & driver_,
+			std::size_t spare_pages_,
+			get_time_us_func_t get_time_us_ = {} );
+
+	std::size_t get_size() const override {
+		return driver.get_size();
+	}
+
+	std::size_t get_page_size() const override {
+		return driver.get_page_size();
+	}
+
+	std::size_t write( std::size_t address, const std::span<const std::byte> & data ) override;
+	std::size_t read( std::size_t address, std::span<std::byte> & data ) override;
+
+	/**
+	 * pages known to be erased are skipped, the others are erased page by page
+	 */
+	bool erase( std::size_t address, std::size_t size ) override;
+
+	std::size_t program( std::size_t address, const std::span<const std::byte> & data ) override;
+	bool copy( std::size_t dst, std::size_t src, std::size_t len ) override;
+
+	std::size_t get_page_size_at( std::size_t address ) const override {
+		return driver.get_page_size_at( address );
+	}
+
+	std::size_t get_page_start_address( std::size_t address ) const override {
+		return driver.get_page_start_address( address );
+	}
+
+	const std::byte* get_mapped_address( std::size_t address ) const override {
+		return driver.get_mapped_address( address );
+	}
+
+	void properties_changed() override {
+		driver.properties = MemoryInterface::properties;
+	}
+
+	/**
+	 * The data of the pages inside the range isn't needed any more,
+	 * they may be erased by process(). Partly covered pages are kept.
+	 */
+	void release( std::size_t address, std::size_t size );
+
+	/**
+	 * Erases, or blank checks, one released page, if less than spare_pages
+	 * pages are erased ahead. Returns true if a page has been handled,
+	 * so the caller can go on, while there is idle time.
+	 */
+	bool process();
+
+	/**
+	 * Hands out an erased page of the pool, the next one after the last
+	 * written page. Returns NO_PAGE, if the pool is empty.
+	 */
+	std::size_t acquire();
+
+	/**
+	 * erased pages waiting in the pool
+	 */
+	std::size_t get_available_pages() const;
+
+	/**
+	 * forgets the erase state of the range, after it has been
+	 * changed without the pool
+	 */
+	void invalidate( std::size_t address, std::size_t size );
+
+	const Statistic & get_statistic() const {
+		return statistic;
+	}
+
+	void clear_statistic() {
+		statistic = Statistic();
+	}
+
+protected:
+	static constexpr uint64_t bit( std::size_t page_idx ) {
+		return uint64_t(1) << page_idx;
+	}
+
+	uint32_t now_us() const {
+		return get_time_us ? get_time_us() : 0;
+	}
+
+	/**
+	 * index of the page containing address, page_count if not tracked
+	 */
+	std::size_t find_page( std::size_t address ) const;
+
+	bool is_pooled( std::size_t page_idx ) const {
+		return (pre_erased & bit(page_idx)) && erased_pages.get( page_idx ) == ErasedPagesBitmap::State::Erased;
+	}
+
+	/**
+	 * the page is erased and used by an appender now
+	 */
+	void consume( std::size_t page_idx );
+
+	/**
+	 * the pages of the range are written
+	 */
+	void set_dirty( std::size_t address, std::size_t size );
+
+	bool erase_page( std::size_t page_idx, uint32_t & duration_us );
+
+	/**
+	 * returns the first page after the last written one, for which pred is true
+	 */
+	template<class Pred> std::size_t find_next( Pred pred ) const {
+		const std::size_t start = last_written_page == NO_PAGE ? 0 : last_written_page + 1;
+
+		for( std::size_t i = 0; i < page_count; i++ ) {
+			const std::size_t page_idx = (start + i) % page_count;
+
+			if( pred( page_idx ) ) {
+				return page_idx;
+			}
+		}
+
+		return page_count;
+	}
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_PREERASEPOOL_H_ */
@@ -0,0 +1,327 @@
+/*
+ * Thread safe front end for a MemoryInterface.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "QueuedMemoryInterface.h"
+#include <string.h>
+#include <algorithm>
+
+namespace stm32_internal_flash {
+
+QueuedMemoryInterface::QueuedMemoryInterface( MemoryInterface & driver_ )
+: driver( driver_ )
+{
+}
+
+int QueuedMemoryInterface::claim_pending_range( std::size_t begin, std::size_t end )
+{
+	uint32_t used = pending_ranges_used.load( std::memory_order_relaxed );
+
+	while( true ) {
+		if( used == 0xFFFFFFFF ) {
+			return -1;
+		}
+
+		int idx = 0;
+
+		while( used & (uint32_t(1) << idx) ) {
+			idx++;
+		}
+
+		if( pending_ranges_used.compare_exchange_weak( used, used | (uint32_t(1) << idx), std::memory_order_acquire ) ) {
+			pending_ranges[idx].begin.store( begin, std::memory_order_relaxed );
+			pending_ranges[idx].end.store( end, std::memory_order_release );
+			return idx;
+		}
+	}
+}
+
+void QueuedMemoryInterface::release_pending_range( int idx )
+{
+	if( idx < 0 ) {
+		return;
+	}
+
+	pending_ranges[idx].begin.store( 0, std::memory_order_relaxed );
+	pending_ranges[idx].end.store( 0, std::memory_order_relaxed );
+	pending_ranges_used.fetch_and( ~(uint32_t(1) << idx), std::memory_order_release );
+}
+
+bool QueuedMemoryInterface::is_write_pending( std::size_t begin, std::size_t end ) const
+{
+	const uint32_t used = pending_ranges_used.load( std::memory_order_acquire );
+
+	for( std::size_t idx = 0; idx < MAX_PENDING_RANGES; idx++ ) {
+		if( !(used & (uint32_t(1) << idx)) ) {
+			continue;
+		}
+
+		const std::size_t pending_end = pending_ranges[idx].end.load( std::memory_order_acquire );
+		const std::size_t pending_begin = pending_ranges[idx].begin.load( std::memory_order_relaxed );
+
+		if( pending_begin < end && begin < pending_end ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool QueuedMemoryInterface::enqueue( Request & request )
+{
+	if( request.type != Request::Type::Read ) {
+		// an unaligned write erases and restores whole pages, so
+		// the neighbour bytes are also not readable until it's done.
+		const std::size_t page_size = get_page_size();
+		const std::size_t begin = request.address - std::min( request.address, page_size );
+		const std::size_t end = request.address + request.size + page_size;
+
+		request.pending_range_idx = claim_pending_range( begin, end );
+
+		if( request.pending_range_idx < 0 ) {
+			return false;
+		}
+	}
+
+	if( !queue.push( request ) ) {
+		release_pending_range( request.pending_range_idx );
+		request.pending_range_idx = -1;
+		return false;
+	}
+
+	return true;
+}
+
+void QueuedMemoryInterface::wait( const Completion & completion )
+{
+	while( !completion.is_done() ) {
+		if( wait_func ) {
+			wait_func();
+		}
+	}
+}
+
+bool QueuedMemoryInterface::read_mapped( std::size_t address, const std::span<std::byte> & data )
+{
+	if( data.empty() || address > get_size() || data.size() > get_size() - address ) {
+		return false;
+	}
+
+	const std::byte *mapped = driver.get_mapped_address( address );
+
+	// the whole range has to be mapped in one piece
+	if( !mapped || driver.get_mapped_address( address + data.size() - 1 ) != mapped + data.size() - 1 ) {
+		return false;
+	}
+
+	const uint32_t sequence = modify_sequence.load( std::memory_order_acquire );
+
+	// the worker is modifying the flash right now
+	if( sequence & 1 ) {
+		return false;
+	}
+
+	if( is_write_pending( address, address + data.size() ) ) {
+		return false;
+	}
+
+	memcpy( data.data(), mapped, data.size() );
+
+	// a write or erase, that has been queued after the check above,
+	// may have been started while copying. The data can be torn then.
+	std::atomic_thread_fence( std::memory_order_acquire );
+
+	if( modify_sequence.load( std::memory_order_relaxed ) != sequence ) {
+		return false;
+	}
+
+	return true;
+}
+
+std::size_t QueuedMemoryInterface::write_driver( std::size_t address, const std::span<const std::byte> & data )
+{
+	modify_sequence.fetch_add( 1, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_release );
+
+	const std::size_t result = driver.write( address, data );
+
+	modify_sequence.fetch_add( 1, std::memory_order_release );
+
+	return result;
+}
+
+bool QueuedMemoryInterface::erase_driver( std::size_t address, std::size_t size )
+{
+	modify_sequence.fetch_add( 1, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_release );
+
+	const bool ok = driver.erase( address, size );
+
+	modify_sequence.fetch_add( 1, std::memory_order_release );
+
+	return ok;
+}
+
+std::size_t QueuedMemoryInterface::write( std::size_t address, const std::span<const std::byte> & data )
+{
+	Completion completion;
+
+	while( !write_async( address, data, &completion ) ) {
+		if( wait_func ) {
+			wait_func();
+		}
+	}
+
+	wait( completion );
+
+	return completion.get_result();
+}
+
+std::size_t QueuedMemoryInterface::read( std::size_t address, std::span<std::byte> & data )
+{
+	Completion completion;
+
+	while( !read_async( address, data, &completion ) ) {
+		if( wait_func ) {
+			wait_func();
+		}
+	}
+
+	wait( completion );
+
+	return completion.get_result();
+}
+
+bool QueuedMemoryInterface::erase( std::size_t address, std::size_t size )
+{
+	Completion completion;
+
+	while( !erase_async( address, size, &completion ) ) {
+		if( wait_func ) {
+			wait_func();
+		}
+	}
+
+	wait( completion );
+
+	return completion.get_result() == size;
+}
+
+bool QueuedMemoryInterface::write_async( std::size_t address, const std::span<const std::byte> & data, Completion *completion, callback_t callback )
+{
+	Request request;
+	request.type = Request::Type::Write;
+	request.address = address;
+	request.size = data.size();
+	request.write_data = data.data();
+	request.completion = completion;
+	request.callback = callback;
+
+	return enqueue( request );
+}
+
+bool QueuedMemoryInterface::read_async( std::size_t address, const std::span<std::byte> & data, Completion *completion, callback_t callback )
+{
+	// bypass the queue
+	if( read_mapped( address, data ) ) {
+		if( callback ) {
+			callback( data.size() );
+		}
+
+		if( completion ) {
+			completion->result = data.size();
+			completion->done.store( true, std::memory_order_release );
+		}
+
+		return true;
+	}
+
+	Request request;
+	request.type = Request::Type::Read;
+	request.address = address;
+	request.size = data.size();
+	request.read_data = data.data();
+	request.completion = completion;
+	request.callback = callback;
+
+	return enqueue( request );
+}
+
+bool QueuedMemoryInterface::erase_async( std::size_t address, std::size_t size, Completion *completion, callback_t callback )
+{
+	Request request;
+	request.type = Request::Type::Erase;
+	request.address = address;
+	request.size = size;
+	request.completion = completion;
+	request.callback = callback;
+
+	return enqueue( request );
+}
+
+void QueuedMemoryInterface::execute( Request & request )
+{
+	std::size_t result = 0;
+
+	switch( request.type )
+	{
+	case Request::Type::Write:
+		result = write_driver( request.address, std::span<const std::byte>( request.write_data, request.size ) );
+		break;
+
+	case Request::Type::Read:
+	{
+		std::span<std::byte> data( request.read_data, request.size );
+		result = driver.read( request.address, data );
+		break;
+	}
+
+	case Request::Type::Erase:
+		result = erase_driver( request.address, request.size ) ? request.size : 0;
+		break;
+	}
+
+	complete( request, result );
+}
+
+void QueuedMemoryInterface::complete( Request & request, std::size_t result )
+{
+	release_pending_range( request.pending_range_idx );
+	request.pending_range_idx = -1;
+
+	if( request.callback ) {
+		request.callback( result );
+	}
+
+	if( request.completion ) {
+		request.completion->result = result;
+		request.completion->done.store( true, std::memory_order_release );
+	}
+}
+
+std::size_t QueuedMemoryInterface::process( std::size_t max_requests )
+{
+	std::size_t count = 0;
+
+	while( count < max_requests ) {
+		auto request = queue.pop();
+
+		if( !request ) {
+			break;
+		}
+
+		execute( *request );
+		count++;
+	}
+
+	return count;
+}
+
+void QueuedMemoryInterface::properties_changed()
+{
+	driver.properties = MemoryInterface::properties;
+}
+
+} // namespace stm32_internal_flash
+
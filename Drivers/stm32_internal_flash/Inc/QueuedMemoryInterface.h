@@ -0,0 +1,206 @@
+/*
+ * Thread safe front end for a MemoryInterface.
+ *
+ * Any thread can add read, write and erase requests to a bounded
+ * lock free queue. A single worker executes them against the
+ * underlying driver, so the page buffers of the driver are
+ * never used by two threads at once.
+ *
+ * Reads of memory mapped flash are done directly by the calling thread,
+ * as long as no write or erase for that range is pending. If the worker
+ * has modified the flash while the data was copied, the read is queued.
+ *
+ * The worker has to call process(). On an RTOS this is a task,
+ * on the host a std::thread, see tools/queue_load_test.cpp.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_QUEUEDMEMORYINTERFACE_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_QUEUEDMEMORYINTERFACE_H_
+
+#include "MemoryInterface.h"
+#include "MpscQueue.h"
+#include <limits>
+
+namespace stm32_internal_flash {
+
+class QueuedMemoryInterface : public MemoryInterface
+{
+public:
+	static constexpr std::size_t QUEUE_SIZE = 16;
+
+	/**
+	 * Signals that a request is done. Has to be valid until then.
+	 */
+	class Completion
+	{
+		friend class QueuedMemoryInterface;
+
+		std::atomic<bool> done { false };
+		std::size_t result = 0;
+
+	public:
+		bool is_done() const {
+			return done.load( std::memory_order_acquire );
+		}
+
+		/**
+		 * bytes read or written. For erase the size, if erasing was successful.
+		 * Only valid if is_done() returns true.
+		 */
+		std::size_t get_result() const {
+			return result;
+		}
+	};
+
+	/**
+	 * called from the worker thread, with the same result as Completion::get_result()
+	 */
+	using callback_t = std::function<void(std::size_t result)>;
+
+	struct Request
+	{
+		enum class Type
+		{
+			Read,
+			Write,
+			Erase
+		};
+
+		Type type = Type::Read;
+		std::size_t address = 0;
+		std::size_t size = 0;
+		const std::byte *write_data = nullptr;
+		std::byte *read_data = nullptr;
+		Completion *completion = nullptr;
+		callback_t callback{};
+		int pending_range_idx = -1;
+		uint32_t enqueue_time_us = 0;
+	};
+
+	/**
+	 * Called while waiting for the worker, eg. for yielding the task.
+	 * If not set, the caller is busy waiting.
+	 */
+	std::function<void()> wait_func{};
+
+protected:
+	/**
+	 * Ranges of all writes and erases, that are not done yet.
+	 * There can be more of them than queue entries, since the
+	 * worker has already taken one from the queue.
+	 */
+	static constexpr std::size_t MAX_PENDING_RANGES = 32;
+
+	struct PendingRange
+	{
+		std::atomic<std::size_t> begin { 0 };
+		std::atomic<std::size_t> end { 0 };
+	};
+
+	MemoryInterface & driver;
+	MpscQueue<Request,QUEUE_SIZE> queue;
+
+	std::array<PendingRange,MAX_PENDING_RANGES> pending_ranges;
+	std::atomic<uint32_t> pending_ranges_used { 0 };
+
+	/**
+	 * incremented before and after each write or erase of the worker,
+	 * so it's odd while the flash is modified
+	 */
+	std::atomic<uint32_t> modify_sequence { 0 };
+
+public:
+	QueuedMemoryInterface( MemoryInterface & driver_ );
+	virtual ~QueuedMemoryInterface() {}
+
+	std::size_t get_size() const override {
+		return driver.get_size();
+	}
+
+	std::size_t get_page_size() const override {
+		return driver.get_page_size();
+	}
+
+	/**
+	 * synchronous calls, waiting until the worker has done the request.
+	 * Must not be called from the worker thread.
+	 */
+	std::size_t write( std::size_t address, const std::span<const std::byte> & data ) override;
+	std::size_t read( std::size_t address, std::span<std::byte> & data ) override;
+	bool erase( std::size_t address, std::size_t size ) override;
+
+	/**
+	 * Asynchronous calls, return false if the queue is full.
+	 * The data has to be valid until the request is done.
+	 * completion and callback are optional.
+	 */
+	bool write_async( std::size_t address, const std::span<const std::byte> & data, Completion *completion, callback_t callback = {} );
+	bool read_async( std::size_t address, const std::span<std::byte> & data, Completion *completion, callback_t callback = {} );
+	bool erase_async( std::size_t address, std::size_t size, Completion *completion, callback_t callback = {} );
+
+	const std::byte* get_mapped_address( std::size_t address ) const override {
+		return driver.get_mapped_address( address );
+	}
+
+	std::size_t get_page_size_at( std::size_t address ) const override {
+		return driver.get_page_size_at( address );
+	}
+
+	std::size_t get_page_start_address( std::size_t address ) const override {
+		return driver.get_page_start_address( address );
+	}
+
+	/**
+	 * Executes up to max_requests requests. Has to be called
+	 * by one worker thread only. Returns the number of executed requests.
+	 */
+	virtual std::size_t process( std::size_t max_requests = std::numeric_limits<std::size_t>::max() );
+
+	/**
+	 * approximately number of queued requests
+	 */
+	std::size_t get_queue_size() const {
+		return queue.size();
+	}
+
+	void properties_changed() override;
+
+protected:
+	/**
+	 * returns false if the queue is full
+	 */
+	virtual bool enqueue( Request & request );
+
+	void wait( const Completion & completion );
+
+	/**
+	 * reads directly from memory mapped flash, if possible
+	 */
+	virtual bool read_mapped( std::size_t address, const std::span<std::byte> & data );
+
+	bool is_write_pending( std::size_t begin, std::size_t end ) const;
+
+	/**
+	 * write and erase of the driver, for the worker only.
+	 * They update modify_sequence, so read_mapped() can detect a
+	 * modification, that was running while it copied the data.
+	 */
+	std::size_t write_driver( std::size_t address, const std::span<const std::byte> & data );
+	bool erase_driver( std::size_t address, std::size_t size );
+
+	int claim_pending_range( std::size_t begin, std::size_t end );
+	void release_pending_range( int idx );
+
+	void execute( Request & request );
+
+	/**
+	 * releases the pending range and informs the caller
+	 */
+	virtual void complete( Request & request, std::size_t result );
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_QUEUEDMEMORYINTERFACE_H_ */
@@ -10,6 +10,8 @@
 
 #include <cstddef>
 #include <span>
+#include <algorithm>
+#include "BlankCheck.h"
 
 namespace stm32_internal_flash {
 
@@ -20,13 +22,74 @@ public:
 
 	virtual std::size_t get_size() = 0;
 
+	/**
+	 * If the pages have different sizes, this is the size of the largest page.
+	 * So this is the buffer size required for holding any page.
+	 */
 	virtual std::size_t get_page_size() = 0;
 
+	/**
+	 * size of the page containing the address.
+	 * Drivers with pages of different sizes have to overload this
+	 * and the other page geometry functions.
+	 */
+	virtual std::size_t get_page_size_at( std::size_t /* address */ ) {
+		return get_page_size();
+	}
+
+	/**
+	 * returns the start address of the page containing the address
+	 */
+	virtual std::size_t get_page_start_address( std::size_t address ) {
+		return address - address % get_page_size();
+	}
+
+	/**
+	 * returns the index of the page containing the address
+	 */
+	virtual std::size_t get_page_index( std::size_t address ) {
+		return address / get_page_size();
+	}
+
 	virtual bool erase_page( std::size_t address, std::size_t size ) = 0;
 
 	virtual std::size_t write_page( std::size_t address, const std::span<const std::byte> & buffer ) = 0;
 
 	virtual std::size_t read_page( std::size_t address, std::span<std::byte> & buffer ) = 0;
+
+	/**
+	 * returns a pointer to the data at address, if the flash is memory mapped,
+	 * otherwise nullptr.
+	 */
+	virtual const std::byte* get_mapped_address( std::size_t /* address */ ) {
+		return nullptr;
+	}
+
+	/**
+	 * returns true, if the whole range is erased.
+	 * The default implementation reads the data in small chunks,
+	 * drivers with memory mapped flash should check the memory directly.
+	 */
+	virtual bool is_blank( std::size_t address, std::size_t size ) {
+		std::byte buffer[64];
+
+		while( size > 0 ) {
+			std::span<std::byte> chunk( buffer, std::min( size, sizeof(buffer) ) );
+
+			if( read_page( address, chunk ) != chunk.size() ) {
+				return false;
+			}
+
+			if( !stm32_internal_flash::is_blank( chunk ) ) {
+				return false;
+			}
+
+			address += chunk.size();
+			size -= chunk.size();
+		}
+
+		return true;
+	}
 };
 
 } // namespace smt32_internal_flash
@@ -0,0 +1,349 @@
+/*
+ * I/O scheduler on top of the QueuedMemoryInterface.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "ScheduledMemoryInterface.h"
+#include <algorithm>
+#include <string.h>
+
+namespace stm32_internal_flash {
+
+namespace {
+
+bool overlaps( std::size_t begin_a, std::size_t end_a, std::size_t begin_b, std::size_t end_b )
+{
+	return begin_a < end_b && begin_b < end_a;
+}
+
+void update_max( std::atomic<uint32_t> & max, uint32_t value )
+{
+	uint32_t current = max.load( std::memory_order_relaxed );
+
+	while( current < value && !max.compare_exchange_weak( current, value, std::memory_order_relaxed ) ) {
+	}
+}
+
+} // namespace
+
+ScheduledMemoryInterface::ScheduledMemoryInterface( MemoryInterface & driver_,
+		std::span<std::byte> merge_buffer_,
+		get_time_us_func_t get_time_us_ )
+: QueuedMemoryInterface( driver_ ),
+  get_time_us( get_time_us_ ),
+  merge_buffer( merge_buffer_ )
+{
+}
+
+ScheduledMemoryInterface::ClassMetric & ScheduledMemoryInterface::get_class_metric( Request::Type type )
+{
+	switch( type )
+	{
+	case Request::Type::Write: return metrics.write;
+	case Request::Type::Erase: return metrics.erase;
+	case Request::Type::Read:  break;
+	}
+
+	return metrics.read;
+}
+
+void ScheduledMemoryInterface::clear_metrics()
+{
+	for( ClassMetric *m : { &metrics.read, &metrics.write, &metrics.erase } ) {
+		m->max_depth.store( m->depth.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+		m->completed.store( 0, std::memory_order_relaxed );
+		m->latency_sum_us.store( 0, std::memory_order_relaxed );
+		m->max_latency_us.store( 0, std::memory_order_relaxed );
+	}
+
+	metrics.mapped_reads.store( 0, std::memory_order_relaxed );
+	metrics.merged_writes.store( 0, std::memory_order_relaxed );
+	metrics.dropped_erases.store( 0, std::memory_order_relaxed );
+}
+
+bool ScheduledMemoryInterface::enqueue( Request & request )
+{
+	ClassMetric & metric = get_class_metric( request.type );
+
+	request.enqueue_time_us = now_us();
+
+	// count it before, the worker can be done, before push() returns
+	const uint32_t depth = metric.depth.fetch_add( 1, std::memory_order_relaxed ) + 1;
+
+	if( !QueuedMemoryInterface::enqueue( request ) ) {
+		metric.depth.fetch_sub( 1, std::memory_order_relaxed );
+		return false;
+	}
+
+	update_max( metric.max_depth, depth );
+
+	return true;
+}
+
+bool ScheduledMemoryInterface::read_mapped( std::size_t address, const std::span<std::byte> & data )
+{
+	if( !QueuedMemoryInterface::read_mapped( address, data ) ) {
+		return false;
+	}
+
+	metrics.mapped_reads.fetch_add( 1, std::memory_order_relaxed );
+	return true;
+}
+
+void ScheduledMemoryInterface::complete( Request & request, std::size_t result )
+{
+	ClassMetric & metric = get_class_metric( request.type );
+
+	const uint32_t latency = now_us() - request.enqueue_time_us;
+
+	metric.completed.fetch_add( 1, std::memory_order_relaxed );
+	metric.latency_sum_us.fetch_add( latency, std::memory_order_relaxed );
+	update_max( metric.max_latency_us, latency );
+	metric.depth.fetch_sub( 1, std::memory_order_relaxed );
+
+	QueuedMemoryInterface::complete( request, result );
+}
+
+void ScheduledMemoryInterface::fill_backlog()
+{
+	while( backlog_size < backlog.size() ) {
+		auto request = queue.pop();
+
+		if( !request ) {
+			break;
+		}
+
+		backlog[backlog_size++] = std::move( *request );
+	}
+}
+
+void ScheduledMemoryInterface::remove_from_backlog( std::size_t idx )
+{
+	for( std::size_t i = idx; i + 1 < backlog_size; i++ ) {
+		backlog[i] = std::move( backlog[i+1] );
+	}
+
+	backlog_size--;
+	backlog[backlog_size] = Request();
+}
+
+bool ScheduledMemoryInterface::is_modified_before( std::size_t end_idx, std::size_t begin, std::size_t end ) const
+{
+	for( std::size_t i = 0; i < end_idx; i++ ) {
+		const Request & request = backlog[i];
+
+		if( request.type != Request::Type::Read &&
+			overlaps( request.address, request.address + request.size, begin, end ) ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool ScheduledMemoryInterface::is_overlapped_between( std::size_t first_idx, std::size_t end_idx,
+		const std::array<bool,BACKLOG_SIZE> & group,
+		std::size_t begin, std::size_t end, bool writes_only ) const
+{
+	for( std::size_t i = first_idx + 1; i < end_idx; i++ ) {
+		const Request & request = backlog[i];
+
+		if( group[i] ) {
+			continue;
+		}
+
+		if( writes_only && request.type != Request::Type::Write ) {
+			continue;
+		}
+
+		if( overlaps( request.address, request.address + request.size, begin, end ) ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::size_t ScheduledMemoryInterface::execute_read( std::size_t idx )
+{
+	Request & request = backlog[idx];
+
+	std::span<std::byte> data( request.read_data, request.size );
+	complete( request, driver.read( request.address, data ) );
+
+	remove_from_backlog( idx );
+
+	return 1;
+}
+
+std::size_t ScheduledMemoryInterface::execute_write( std::size_t idx )
+{
+	std::array<bool,BACKLOG_SIZE> group = {};
+	group[idx] = true;
+
+	std::size_t begin = backlog[idx].address;
+	std::size_t end = begin + backlog[idx].size;
+	std::size_t group_size = 1;
+
+	if( backlog[idx].size <= merge_buffer.size() ) {
+		for( std::size_t i = idx + 1; i < backlog_size; i++ ) {
+			const Request & request = backlog[i];
+			const std::size_t request_end = request.address + request.size;
+
+			if( request.type != Request::Type::Write ) {
+				continue;
+			}
+
+			// overlapping or adjacent
+			if( request.address > end || request_end < begin ) {
+				continue;
+			}
+
+			const std::size_t new_begin = std::min( begin, request.address );
+			const std::size_t new_end = std::max( end, request_end );
+
+			if( new_end - new_begin > merge_buffer.size() ) {
+				continue;
+			}
+
+			// the request is moved before all entries in between,
+			// so none of them may touch its range
+			if( is_overlapped_between( idx, i, group, request.address, request_end, false ) ) {
+				continue;
+			}
+
+			group[i] = true;
+			group_size++;
+			begin = new_begin;
+			end = new_end;
+		}
+	}
+
+	if( group_size == 1 ) {
+		Request & request = backlog[idx];
+		complete( request, write_driver( request.address, std::span<const std::byte>( request.write_data, request.size ) ) );
+		remove_from_backlog( idx );
+		return 1;
+	}
+
+	// later writes overwrite earlier ones
+	for( std::size_t i = idx; i < backlog_size; i++ ) {
+		if( group[i] ) {
+			memcpy( merge_buffer.data() + backlog[i].address - begin, backlog[i].write_data, backlog[i].size );
+		}
+	}
+
+	const std::size_t written = write_driver( begin, std::span<const std::byte>( merge_buffer.data(), end - begin ) );
+
+	metrics.merged_writes.fetch_add( group_size - 1, std::memory_order_relaxed );
+
+	for( std::size_t i = idx; i < backlog_size; i++ ) {
+		if( group[i] ) {
+			Request & request = backlog[i];
+			const std::size_t written_end = begin + written;
+			std::size_t result = 0;
+
+			if( written_end > request.address ) {
+				result = std::min( request.size, written_end - request.address );
+			}
+
+			complete( request, result );
+		}
+	}
+
+	for( std::size_t i = backlog_size; i > idx; i-- ) {
+		if( group[i-1] ) {
+			remove_from_backlog( i-1 );
+		}
+	}
+
+	return group_size;
+}
+
+std::size_t ScheduledMemoryInterface::execute_erase( std::size_t idx )
+{
+	std::array<bool,BACKLOG_SIZE> group = {};
+	group[idx] = true;
+	std::size_t group_size = 1;
+
+	const std::size_t begin = backlog[idx].address;
+	const std::size_t end = begin + backlog[idx].size;
+
+	const bool ok = erase_driver( begin, backlog[idx].size );
+
+	complete( backlog[idx], ok ? backlog[idx].size : 0 );
+
+	if( ok ) {
+		for( std::size_t i = idx + 1; i < backlog_size; i++ ) {
+			Request & request = backlog[i];
+
+			if( request.type != Request::Type::Erase ) {
+				continue;
+			}
+
+			if( request.address < begin || request.address + request.size > end ) {
+				continue;
+			}
+
+			// nothing has been written in between, so it's still erased
+			if( is_overlapped_between( idx, i, group, request.address, request.address + request.size, true ) ) {
+				continue;
+			}
+
+			group[i] = true;
+			group_size++;
+			metrics.dropped_erases.fetch_add( 1, std::memory_order_relaxed );
+			complete( request, request.size );
+		}
+	}
+
+	for( std::size_t i = backlog_size; i > idx; i-- ) {
+		if( group[i-1] ) {
+			remove_from_backlog( i-1 );
+		}
+	}
+
+	return group_size;
+}
+
+std::size_t ScheduledMemoryInterface::process( std::size_t max_requests )
+{
+	std::size_t count = 0;
+
+	while( count < max_requests ) {
+
+		fill_backlog();
+
+		if( backlog_size == 0 ) {
+			break;
+		}
+
+		bool read_done = false;
+
+		for( std::size_t i = 0; i < backlog_size; i++ ) {
+			const Request & request = backlog[i];
+
+			if( request.type == Request::Type::Read &&
+				!is_modified_before( i, request.address, request.address + request.size ) ) {
+				count += execute_read( i );
+				read_done = true;
+				break;
+			}
+		}
+
+		if( read_done ) {
+			continue;
+		}
+
+		// the oldest entry can't be a read here
+		if( backlog[0].type == Request::Type::Write ) {
+			count += execute_write( 0 );
+		} else {
+			count += execute_erase( 0 );
+		}
+	}
+
+	return count;
+}
+
+} // namespace stm32_internal_flash
@@ -0,0 +1,138 @@
+/*
+ * I/O scheduler on top of the QueuedMemoryInterface.
+ *
+ * The worker collects the queued requests in a backlog and does not
+ * execute them strictly in order:
+ *
+ * - reads first, as long as they do not overlap an older write or erase.
+ *   (reads of memory mapped flash are not queued at all)
+ * - overlapping or adjacent writes are merged into one write,
+ *   so the driver has to read, erase and restore the page only once.
+ * - an erase, that is covered by an older pending erase is dropped.
+ *
+ * Requests are only reordered, if nobody can see a difference.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_SCHEDULEDMEMORYINTERFACE_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_SCHEDULEDMEMORYINTERFACE_H_
+
+#include "QueuedMemoryInterface.h"
+
+namespace stm32_internal_flash {
+
+class ScheduledMemoryInterface : public QueuedMemoryInterface
+{
+public:
+	static constexpr std::size_t BACKLOG_SIZE = QUEUE_SIZE * 2;
+
+	using get_time_us_func_t = std::function<uint32_t()>;
+
+	struct ClassMetric
+	{
+		std::atomic<uint32_t> depth { 0 };          // queued, but not done
+		std::atomic<uint32_t> max_depth { 0 };
+		std::atomic<uint32_t> completed { 0 };
+		std::atomic<uint32_t> latency_sum_us { 0 }; // enqueue until done, wraps after ~71 minutes
+		std::atomic<uint32_t> max_latency_us { 0 };
+
+		uint32_t get_average_latency_us() const {
+			const uint32_t count = completed.load( std::memory_order_relaxed );
+			return count ? latency_sum_us.load( std::memory_order_relaxed ) / count : 0;
+		}
+	};
+
+	struct Metrics
+	{
+		ClassMetric read;
+		ClassMetric write;
+		ClassMetric erase;
+
+		std::atomic<uint32_t> mapped_reads { 0 };   // served without the queue
+		std::atomic<uint32_t> merged_writes { 0 };  // writes that have been merged into another one
+		std::atomic<uint32_t> dropped_erases { 0 };
+	};
+
+protected:
+	get_time_us_func_t get_time_us;
+
+	// write merging is disabled, if empty
+	std::span<std::byte> merge_buffer;
+
+	// only used by the worker
+	std::array<Request,BACKLOG_SIZE> backlog;
+	std::size_t backlog_size = 0;
+
+	Metrics metrics;
+
+public:
+	/**
+	 * get_time_us: clock for the latency metrics, may wrap around
+	 * merge_buffer: largest size of a merged write, eg. one page
+	 */
+	ScheduledMemoryInterface( MemoryInterface & driver_,
+			std::span<std::byte> merge_buffer_ = {},
+			get_time_us_func_t get_time_us_ = {} );
+
+	/**
+	 * Returns the number of completed requests, merged writes and
+	 * dropped erases included. Since a merged group is completed at
+	 * once, this can be a few more than max_requests.
+	 */
+	std::size_t process( std::size_t max_requests = std::numeric_limits<std::size_t>::max() ) override;
+
+	const Metrics & get_metrics() const {
+		return metrics;
+	}
+
+	/**
+	 * Resets the counters and maximums, current queue depths are kept.
+	 */
+	void clear_metrics();
+
+protected:
+	bool enqueue( Request & request ) override;
+
+	bool read_mapped( std::size_t address, const std::span<std::byte> & data ) override;
+
+	void complete( Request & request, std::size_t result ) override;
+
+	ClassMetric & get_class_metric( Request::Type type );
+
+	uint32_t now_us() const {
+		return get_time_us ? get_time_us() : 0;
+	}
+
+	/**
+	 * moves requests from the queue into the backlog
+	 */
+	void fill_backlog();
+
+	void remove_from_backlog( std::size_t idx );
+
+	/**
+	 * true if one of the entries [0,end_idx) is a write or erase
+	 * overlapping [begin,end)
+	 */
+	bool is_modified_before( std::size_t end_idx, std::size_t begin, std::size_t end ) const;
+
+	/**
+	 * true if one of the entries (first_idx,end_idx) that is not part
+	 * of the group, overlaps [begin,end)
+	 */
+	bool is_overlapped_between( std::size_t first_idx, std::size_t end_idx,
+			const std::array<bool,BACKLOG_SIZE> & group,
+			std::size_t begin, std::size_t end, bool writes_only ) const;
+
+	/**
+	 * return the number of completed requests
+	 */
+	std::size_t execute_read( std::size_t idx );
+	std::size_t execute_write( std::size_t idx );
+	std::size_t execute_erase( std::size_t idx );
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_SCHEDULEDMEMORYINTERFACE_H_ */
@@ -0,0 +1,134 @@
+/*
+ * SHA-256 (FIPS 180-4), for verifying images written to flash.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "Sha256.h"
+#include <bit>
+#include <string.h>
+
+namespace stm32_internal_flash {
+
+namespace {
+
+constexpr std::array<uint32_t,64> K = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+} // namespace
+
+void Sha256::reset()
+{
+	state = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	block_len = 0;
+	total_len = 0;
+}
+
+void Sha256::transform( const uint8_t *data )
+{
+	std::array<uint32_t,64> w;
+
+	for( std::size_t i = 0; i < 16; i++ ) {
+		w[i] = (uint32_t(data[i*4]) << 24) | (uint32_t(data[i*4+1]) << 16) | (uint32_t(data[i*4+2]) << 8) | data[i*4+3];
+	}
+
+	for( std::size_t i = 16; i < 64; i++ ) {
+		const uint32_t s0 = std::rotr( w[i-15], 7 ) ^ std::rotr( w[i-15], 18 ) ^ (w[i-15] >> 3);
+		const uint32_t s1 = std::rotr( w[i-2], 17 ) ^ std::rotr( w[i-2], 19 ) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+	for( std::size_t i = 0; i < 64; i++ ) {
+		const uint32_t s1 = std::rotr( e, 6 ) ^ std::rotr( e, 11 ) ^ std::rotr( e, 25 );
+		const uint32_t ch = (e & f) ^ (~e & g);
+		const uint32_t t1 = h + s1 + ch + K[i] + w[i];
+		const uint32_t s0 = std::rotr( a, 2 ) ^ std::rotr( a, 13 ) ^ std::rotr( a, 22 );
+		const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+		const uint32_t t2 = s0 + maj;
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void Sha256::update( const std::span<const std::byte> & data )
+{
+	const uint8_t *p = reinterpret_cast<const uint8_t*>( data.data() );
+	std::size_t len = data.size();
+
+	total_len += len;
+
+	while( len > 0 ) {
+		// full blocks directly from the input
+		if( block_len == 0 && len >= block.size() ) {
+			transform( p );
+			p += block.size();
+			len -= block.size();
+			continue;
+		}
+
+		const std::size_t n = std::min( len, block.size() - block_len );
+		memcpy( block.data() + block_len, p, n );
+		block_len += n;
+		p += n;
+		len -= n;
+
+		if( block_len == block.size() ) {
+			transform( block.data() );
+			block_len = 0;
+		}
+	}
+}
+
+Sha256::digest_t Sha256::finish()
+{
+	const uint64_t bit_len = total_len * 8;
+
+	block[block_len++] = 0x80;
+
+	if( block_len > 56 ) {
+		memset( block.data() + block_len, 0, block.size() - block_len );
+		transform( block.data() );
+		block_len = 0;
+	}
+
+	memset( block.data() + block_len, 0, 56 - block_len );
+
+	for( std::size_t i = 0; i < 8; i++ ) {
+		block[56 + i] = static_cast<uint8_t>( bit_len >> (56 - i * 8) );
+	}
+
+	transform( block.data() );
+
+	digest_t digest;
+
+	for( std::size_t i = 0; i < 8; i++ ) {
+		digest[i*4]   = static_cast<uint8_t>( state[i] >> 24 );
+		digest[i*4+1] = static_cast<uint8_t>( state[i] >> 16 );
+		digest[i*4+2] = static_cast<uint8_t>( state[i] >> 8 );
+		digest[i*4+3] = static_cast<uint8_t>( state[i] );
+	}
+
+	return digest;
+}
+
+} // namespace stm32_internal_flash
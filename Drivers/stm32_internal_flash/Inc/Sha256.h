@@ -0,0 +1,54 @@
+/*
+ * SHA-256 (FIPS 180-4), for verifying images written to flash.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_SHA256_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_SHA256_H_
+
+#include <array>
+#include <span>
+#include <cstddef>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+class Sha256
+{
+public:
+	using digest_t = std::array<uint8_t,32>;
+
+private:
+	std::array<uint32_t,8> state;
+	std::array<uint8_t,64> block;
+	std::size_t block_len = 0;
+	uint64_t total_len = 0;
+
+public:
+	Sha256() {
+		reset();
+	}
+
+	void reset();
+
+	void update( const std::span<const std::byte> & data );
+
+	/**
+	 * returns the hash, after that reset() has to be called, for a new one
+	 */
+	digest_t finish();
+
+	static digest_t hash( const std::span<const std::byte> & data ) {
+		Sha256 sha;
+		sha.update( data );
+		return sha.finish();
+	}
+
+private:
+	void transform( const uint8_t *data );
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_SHA256_H_ */
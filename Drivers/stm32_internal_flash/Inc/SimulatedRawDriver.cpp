@@ -0,0 +1,141 @@
+/*
+ * Raw driver that simulates a NOR flash in RAM.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "SimulatedRawDriver.h"
+#include <string.h>
+
+namespace stm32_internal_flash {
+
+SimulatedRawDriver::SimulatedRawDriver( std::span<std::byte> memory_, std::span<const std::size_t> page_sizes_ )
+: memory( memory_ ),
+  page_starts(),
+  page_sizes( page_sizes_.begin(), page_sizes_.end() ),
+  erase_counts( page_sizes_.size() )
+{
+	std::size_t start = 0;
+
+	for( std::size_t size : page_sizes ) {
+		page_starts.push_back( start );
+		start += size;
+		max_page_size = std::max( max_page_size, size );
+	}
+
+	if( start < memory.size() ) {
+		memory = memory.subspan( 0, start );
+	}
+}
+
+std::size_t SimulatedRawDriver::get_page_index( std::size_t address )
+{
+	auto it = std::upper_bound( page_starts.begin(), page_starts.end(), address );
+	return std::distance( page_starts.begin(), it ) - 1;
+}
+
+std::size_t SimulatedRawDriver::get_page_size_at( std::size_t address )
+{
+	const std::size_t idx = get_page_index( address );
+
+	if( idx >= page_sizes.size() ) {
+		return max_page_size;
+	}
+
+	return page_sizes[idx];
+}
+
+std::size_t SimulatedRawDriver::get_page_start_address( std::size_t address )
+{
+	const std::size_t idx = get_page_index( address );
+
+	if( idx >= page_sizes.size() ) {
+		return address;
+	}
+
+	return page_starts[idx];
+}
+
+bool SimulatedRawDriver::erase_page( std::size_t address, std::size_t size )
+{
+	if( address >= memory.size() ) {
+		return false;
+	}
+
+	std::size_t idx = get_page_index( address );
+
+	if( page_starts[idx] != address ) {
+		return false;
+	}
+
+	statistic.erase_operations++;
+
+	// same as the hardware: at least one page, and only complete pages
+	std::size_t erased_size = 0;
+
+	do {
+		memset( memory.data() + page_starts[idx], 0xFF, page_sizes[idx] );
+
+		erase_counts[idx]++;
+		statistic.erased_pages++;
+		now_us += timing.erase_base_us + timing.erase_per_kb_us * (page_sizes[idx] / 1024);
+
+		erased_size += page_sizes[idx];
+		idx++;
+
+	} while( idx < page_sizes.size() && erased_size + page_sizes[idx] <= size );
+
+	return true;
+}
+
+std::size_t SimulatedRawDriver::write_page( std::size_t address, const std::span<const std::byte> & buffer )
+{
+	if( address > memory.size() ) {
+		return 0;
+	}
+
+	const std::size_t len = std::min( buffer.size(), memory.size() - address );
+	std::byte *target = memory.data() + address;
+
+	for( std::size_t i = 0; i < len; i++ ) {
+		if( (~target[i] & buffer[i]) != std::byte(0) ) {
+			statistic.program_violations++;
+		}
+
+		// flash can only clear bits
+		target[i] &= buffer[i];
+	}
+
+	statistic.program_operations++;
+	statistic.bytes_programmed += len;
+	now_us += timing.program_word_us * ((len + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+
+	return len;
+}
+
+std::size_t SimulatedRawDriver::read_page( std::size_t address, std::span<std::byte> & buffer )
+{
+	if( address > memory.size() ) {
+		return 0;
+	}
+
+	const std::size_t len = std::min( buffer.size(), memory.size() - address );
+
+	memcpy( buffer.data(), memory.data() + address, len );
+	statistic.read_operations++;
+	statistic.bytes_read += len;
+	now_us += timing.read_access_us + timing.read_per_kb_us * len / 1024;
+
+	return len;
+}
+
+bool SimulatedRawDriver::is_blank( std::size_t address, std::size_t size )
+{
+	if( address > memory.size() || size > memory.size() - address ) {
+		return false;
+	}
+
+	return stm32_internal_flash::is_blank( memory.subspan( address, size ) );
+}
+
+} // namespace stm32_internal_flash
+
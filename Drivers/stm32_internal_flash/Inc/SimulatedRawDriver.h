@@ -0,0 +1,146 @@
+/*
+ * Raw driver that simulates a NOR flash in RAM.
+ *
+ * Erasing sets all bytes to 0xFF, programming can only clear bits.
+ * Every operation advances a simulated clock, so timing of
+ * higher layers can be tested on the host without hardware.
+ *
+ * Host only: SimulatedRawDriver.cpp is excluded from the firmware
+ * build in .cproject, it's compiled with the programs in tools/.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_SIMULATEDRAWDRIVER_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_SIMULATEDRAWDRIVER_H_
+
+#include "RawDriverInterface.h"
+#include <vector>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+class SimulatedRawDriver : public RawDriverInterface
+{
+public:
+	/**
+	 * Default values are the typical values of the STM32F4 datasheet
+	 * at 2.7V-3.6V: 16K sector 250ms, 128K sector 1s, 16us per word.
+	 *
+	 * Reading the internal flash costs nothing, for simulating an
+	 * external device the read times can be set.
+	 */
+	struct Timing
+	{
+		uint32_t program_word_us = 16;
+		uint32_t erase_base_us   = 120000;
+		uint32_t erase_per_kb_us = 7000;
+		uint32_t read_access_us  = 0;  // each call of read_page()
+		uint32_t read_per_kb_us  = 0;
+	};
+
+	struct Statistic
+	{
+		std::size_t erase_operations   = 0; // calls to erase_page()
+		std::size_t erased_pages       = 0;
+		std::size_t program_operations = 0; // calls to write_page()
+		std::size_t bytes_programmed   = 0;
+		std::size_t read_operations    = 0; // calls to read_page()
+		std::size_t bytes_read         = 0;
+
+		// programming tried to set a bit from 0 to 1
+		std::size_t program_violations = 0;
+	};
+
+	Timing timing;
+
+	/**
+	 * false simulates an external device, that can only be read with read_page()
+	 */
+	bool memory_mapped = true;
+
+protected:
+	std::span<std::byte> memory;
+	std::vector<std::size_t> page_starts;
+	std::vector<std::size_t> page_sizes;
+	std::vector<std::size_t> erase_counts;
+	std::size_t max_page_size = 0;
+
+	uint64_t now_us = 0;
+	Statistic statistic;
+
+public:
+	/**
+	 * memory: has to be the sum of all page sizes large
+	 * page_sizes: size of each page, pages can have different sizes
+	 */
+	SimulatedRawDriver( std::span<std::byte> memory, std::span<const std::size_t> page_sizes );
+
+	std::size_t get_size() override {
+		return memory.size();
+	}
+
+	std::size_t get_page_size() override {
+		return max_page_size;
+	}
+
+	std::size_t get_page_size_at( std::size_t address ) override;
+	std::size_t get_page_start_address( std::size_t address ) override;
+	std::size_t get_page_index( std::size_t address ) override;
+
+	bool erase_page( std::size_t address, std::size_t size ) override;
+
+	std::size_t write_page( std::size_t address, const std::span<const std::byte> & buffer ) override;
+
+	std::size_t read_page( std::size_t address, std::span<std::byte> & buffer ) override;
+
+	bool is_blank( std::size_t address, std::size_t size ) override;
+
+	const std::byte* get_mapped_address( std::size_t address ) override {
+		return memory_mapped && address < memory.size() ? memory.data() + address : nullptr;
+	}
+
+	std::size_t get_page_count() const {
+		return page_sizes.size();
+	}
+
+	/**
+	 * how often the page has been erased
+	 */
+	std::size_t get_erase_count( std::size_t page_idx ) const {
+		return erase_counts.at( page_idx );
+	}
+
+	const Statistic & get_statistic() const {
+		return statistic;
+	}
+
+	void clear_statistic() {
+		statistic = {};
+	}
+
+	/**
+	 * simulated clock
+	 */
+	uint64_t get_microseconds() const {
+		return now_us;
+	}
+
+	/**
+	 * let time pass, eg. for simulating the work of the application
+	 */
+	void advance_time( uint64_t us ) {
+		now_us += us;
+	}
+
+	/**
+	 * direct access to the simulated memory, like memory mapped flash
+	 */
+	std::span<std::byte> get_memory() {
+		return memory;
+	}
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_SIMULATEDRAWDRIVER_H_ */
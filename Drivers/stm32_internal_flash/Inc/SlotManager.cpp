@@ -0,0 +1,457 @@
+/*
+ * A/B firmware slots with a resumable, power fail safe update.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "SlotManager.h"
+#include <bit>
+#include <algorithm>
+#include <cstddef>
+#include <string.h>
+
+namespace stm32_internal_flash {
+
+namespace {
+
+constexpr std::size_t VERIFY_CHUNK_SIZE = 256;
+
+} // namespace
+
+uint32_t SlotManager::Header::calc_check() const
+{
+	// FNV-1a over all fields before check
+	const uint8_t *p = reinterpret_cast<const uint8_t*>( this );
+	uint32_t hash = 0x811C9DC5;
+
+	for( std::size_t i = 0; i < offsetof( Header, check ); i++ ) {
+		hash = (hash ^ p[i]) * 0x01000193;
+	}
+
+	return hash;
+}
+
+SlotManager::SlotManager( RawDriverInterface & raw_driver_,
+		std::size_t journal_a_address,
+		std::size_t journal_b_address,
+		MemoryInterface & slot_a,
+		MemoryInterface & slot_b,
+		std::size_t chunk_size_ )
+: raw_driver( raw_driver_ ),
+  journal_addresses{ journal_a_address, journal_b_address },
+  slots{ &slot_a, &slot_b },
+  chunk_size( chunk_size_ )
+{
+}
+
+std::size_t SlotManager::get_max_chunks( std::size_t page ) const
+{
+	const std::size_t page_size = raw_driver.get_page_size_at( journal_addresses[page] );
+
+	return (page_size - PROGRESS_OFFSET) / sizeof(uint32_t) * 32;
+}
+
+bool SlotManager::read_word( std::size_t address, uint32_t & word )
+{
+	if( const std::byte *mapped = raw_driver.get_mapped_address( address ); mapped ) {
+		memcpy( &word, mapped, sizeof(word) );
+		return true;
+	}
+
+	std::span<std::byte> buffer( reinterpret_cast<std::byte*>(&word), sizeof(word) );
+
+	return raw_driver.read_page( address, buffer ) == sizeof(word);
+}
+
+bool SlotManager::program_word( std::size_t address, uint32_t word )
+{
+	auto data = std::span<const std::byte>( reinterpret_cast<const std::byte*>(&word), sizeof(word) );
+
+	return raw_driver.write_page( address, data ) == data.size();
+}
+
+bool SlotManager::read_header( std::size_t page, Header & h )
+{
+	std::span<std::byte> buffer( reinterpret_cast<std::byte*>(&h), sizeof(h) );
+
+	if( raw_driver.read_page( journal_addresses[page], buffer ) != sizeof(h) ) {
+		return false;
+	}
+
+	return h.is_valid();
+}
+
+bool SlotManager::count_markers( std::size_t & count )
+{
+	const std::size_t markers_address = get_flags_address( journal ) + offsetof( Flags, markers );
+
+	// used markers are never blank again, a torn one included
+	std::size_t lo = 0;
+	std::size_t hi = MAX_MARKERS;
+
+	while( lo < hi ) {
+		const std::size_t mid = lo + (hi - lo) / 2;
+		uint32_t word = 0;
+
+		if( !read_word( markers_address + mid * sizeof(uint32_t), word ) ) {
+			return false;
+		}
+
+		if( word != 0xFFFFFFFF ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	count = lo;
+
+	active_slot = header.active_slot;
+
+	// the last complete marker wins
+	for( std::size_t idx = count; idx > 0; idx-- ) {
+		uint32_t word = 0;
+
+		if( !read_word( markers_address + (idx - 1) * sizeof(uint32_t), word ) ) {
+			return false;
+		}
+
+		if( word == (MARKER | 0) || word == (MARKER | 1) ) {
+			active_slot = word & 1;
+			break;
+		}
+	}
+
+	return true;
+}
+
+bool SlotManager::count_chunks_done( std::size_t & count )
+{
+	const std::size_t words = get_max_chunks( journal ) / 32;
+	const std::size_t progress_address = get_progress_address( journal );
+
+	// all words before the first one with bits left are 0
+	std::size_t lo = 0;
+	std::size_t hi = words;
+
+	while( lo < hi ) {
+		const std::size_t mid = lo + (hi - lo) / 2;
+		uint32_t word = 0;
+
+		if( !read_word( progress_address + mid * sizeof(uint32_t), word ) ) {
+			return false;
+		}
+
+		if( word == 0 ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if( lo == words ) {
+		count = words * 32;
+		return true;
+	}
+
+	uint32_t word = 0;
+
+	if( !read_word( progress_address + lo * sizeof(uint32_t), word ) ) {
+		return false;
+	}
+
+	count = lo * 32 + std::countl_zero( word );
+
+	return true;
+}
+
+bool SlotManager::load_state()
+{
+	const std::size_t flags_address = get_flags_address( journal );
+	uint32_t word = 0;
+
+	if( !read_word( flags_address + offsetof( Flags, erased ), word ) ) {
+		return false;
+	}
+
+	erased = word == FLAG_SET;
+
+	if( !read_word( flags_address + offsetof( Flags, verified ), word ) ) {
+		return false;
+	}
+
+	verified = word == FLAG_SET;
+
+	if( !count_markers( used_markers ) ) {
+		return false;
+	}
+
+	return count_chunks_done( chunks_done );
+}
+
+bool SlotManager::start_journal( Header h )
+{
+	const std::size_t page = initialized ? 1 - journal : 0;
+	const std::size_t address = journal_addresses[page];
+
+	if( !raw_driver.is_blank( address, raw_driver.get_page_size_at( address ) ) ) {
+		if( !raw_driver.erase_page( address, raw_driver.get_page_size_at( address ) ) ) {
+			return false;
+		}
+	}
+
+	h.magic = MAGIC;
+	h.sequence = initialized ? header.sequence + 1 : 1;
+	h.reserved = 0xFFFFFFFF;
+	h.check = h.calc_check();
+
+	auto data = std::span<const std::byte>( reinterpret_cast<const std::byte*>(&h), sizeof(h) );
+
+	// until the header is complete, the old page stays the current one
+	if( raw_driver.write_page( address, data ) != data.size() ) {
+		return false;
+	}
+
+	journal = page;
+	header = h;
+	erased = false;
+	verified = false;
+	used_markers = 0;
+	active_slot = h.active_slot;
+	chunks_done = 0;
+
+	return true;
+}
+
+bool SlotManager::init()
+{
+	initialized = false;
+
+	std::array<Header,2> headers;
+	std::array<bool,2> valid;
+
+	for( std::size_t page = 0; page < 2; page++ ) {
+		valid[page] = read_header( page, headers[page] );
+	}
+
+	if( !valid[0] && !valid[1] ) {
+		Header h {};
+		h.active_slot = 0;
+		h.target_slot = NO_SLOT;
+		h.image_size = 0;
+		h.chunk_size = chunk_size;
+		h.hash.fill( 0xFF );
+
+		if( !start_journal( h ) ) {
+			return false;
+		}
+
+		initialized = true;
+		return true;
+	}
+
+	if( valid[0] && valid[1] ) {
+		journal = headers[1].sequence > headers[0].sequence ? 1 : 0;
+	} else {
+		journal = valid[0] ? 0 : 1;
+	}
+
+	header = headers[journal];
+
+	if( !load_state() ) {
+		return false;
+	}
+
+	initialized = true;
+
+	return true;
+}
+
+bool SlotManager::erase_target()
+{
+	MemoryInterface & slot = *slots[header.target_slot];
+
+	// only pages completely inside the range are erased
+	const std::size_t last = header.image_size - 1;
+	const std::size_t end = slot.get_page_start_address( last ) + slot.get_page_size_at( last );
+
+	if( !slot.erase( 0, end ) ) {
+		return false;
+	}
+
+	if( !program_word( get_flags_address( journal ) + offsetof( Flags, erased ), FLAG_SET ) ) {
+		return false;
+	}
+
+	erased = true;
+
+	return true;
+}
+
+bool SlotManager::begin( std::size_t image_size, const Sha256::digest_t & hash, std::size_t & resume_offset )
+{
+	if( !initialized ) {
+		return false;
+	}
+
+	const std::size_t target = get_inactive_slot();
+
+	if( image_size == 0 || image_size > slots[target]->get_size() ) {
+		return false;
+	}
+
+	if( (image_size + chunk_size - 1) / chunk_size > get_max_chunks( 1 - journal ) ) {
+		return false;
+	}
+
+	const bool same_session = header.target_slot == target &&
+			header.image_size == image_size &&
+			header.chunk_size == chunk_size &&
+			header.hash == hash;
+
+	if( !same_session ) {
+		Header h {};
+		h.active_slot = active_slot;
+		h.target_slot = target;
+		h.image_size = image_size;
+		h.chunk_size = chunk_size;
+		h.hash = hash;
+
+		if( !start_journal( h ) ) {
+			return false;
+		}
+	}
+
+	// power was lost, while erasing
+	if( !erased ) {
+		if( !erase_target() ) {
+			return false;
+		}
+	}
+
+	resume_offset = std::min<std::size_t>( chunks_done * chunk_size, image_size );
+
+	return true;
+}
+
+bool SlotManager::write_chunk( std::size_t offset, const std::span<const std::byte> & data )
+{
+	if( !initialized || !is_update_pending() || !erased ) {
+		return false;
+	}
+
+	if( offset != chunks_done * chunk_size || offset >= header.image_size ) {
+		return false;
+	}
+
+	const std::size_t expected = std::min<std::size_t>( chunk_size, header.image_size - offset );
+
+	if( data.size() != expected ) {
+		return false;
+	}
+
+	// a chunk, torn by a power loss, is programmed again with the same
+	// data, which only clears the bits, that are left
+	if( slots[header.target_slot]->program( offset, data ) != data.size() ) {
+		return false;
+	}
+
+	const std::size_t done = chunks_done + 1;
+	const std::size_t word_idx = chunks_done / 32;
+	const std::size_t bits_in_word = done - word_idx * 32;
+	const uint32_t word = bits_in_word >= 32 ? 0 : 0xFFFFFFFF >> bits_in_word;
+
+	if( !program_word( get_progress_address( journal ) + word_idx * sizeof(uint32_t), word ) ) {
+		return false;
+	}
+
+	chunks_done = done;
+
+	return true;
+}
+
+bool SlotManager::verify_image()
+{
+	MemoryInterface & slot = *slots[header.target_slot];
+	Sha256 sha;
+	std::array<std::byte,VERIFY_CHUNK_SIZE> buffer;
+
+	for( std::size_t pos = 0; pos < header.image_size; ) {
+		const std::size_t len = std::min<std::size_t>( buffer.size(), header.image_size - pos );
+		const std::byte *mapped = slot.get_mapped_address( pos );
+
+		// JBOD: the chunk can cross the border between two drivers
+		if( mapped && slot.get_mapped_address( pos + len - 1 ) == mapped + len - 1 ) {
+			sha.update( std::span<const std::byte>( mapped, len ) );
+		} else {
+			std::span<std::byte> chunk( buffer.data(), len );
+
+			if( slot.read( pos, chunk ) != len ) {
+				return false;
+			}
+
+			sha.update( chunk );
+		}
+
+		pos += len;
+	}
+
+	return sha.finish() == header.hash;
+}
+
+bool SlotManager::finish()
+{
+	if( !initialized || !is_update_pending() || !erased ) {
+		return false;
+	}
+
+	if( chunks_done * chunk_size < header.image_size ) {
+		return false;
+	}
+
+	if( !verified ) {
+		if( !verify_image() ) {
+			return false;
+		}
+
+		if( !program_word( get_flags_address( journal ) + offsetof( Flags, verified ), FLAG_SET ) ) {
+			return false;
+		}
+
+		verified = true;
+	}
+
+	return activate( header.target_slot );
+}
+
+bool SlotManager::activate( std::size_t slot )
+{
+	if( !initialized || slot > 1 ) {
+		return false;
+	}
+
+	if( slot == active_slot ) {
+		return true;
+	}
+
+	if( used_markers >= MAX_MARKERS ) {
+		// the only case, where switching erases a journal page
+		Header h = header;
+		h.active_slot = slot;
+		h.target_slot = NO_SLOT;
+
+		return start_journal( h );
+	}
+
+	const std::size_t markers_address = get_flags_address( journal ) + offsetof( Flags, markers );
+	const std::size_t idx = used_markers++;
+
+	if( !program_word( markers_address + idx * sizeof(uint32_t), MARKER | static_cast<uint32_t>(slot) ) ) {
+		return false;
+	}
+
+	active_slot = slot;
+
+	return true;
+}
+
+} // namespace stm32_internal_flash
@@ -0,0 +1,216 @@
+/*
+ * A/B firmware slots with a resumable, power fail safe update.
+ *
+ * The image is streamed in chunks into the inactive slot. After each
+ * chunk one bit of the progress journal is cleared, so an interrupted
+ * update continues with the first chunk, that is not marked as done,
+ * instead of transferring the whole image again:
+ *
+ *   SlotManager slots( raw_driver, journal_a, journal_b, slot_a, slot_b );
+ *   slots.init();
+ *
+ *   std::size_t offset = 0;
+ *   slots.begin( image_size, sha256, offset ); // offset: where the sender has to continue
+ *   while( offset < image_size ) {
+ *     slots.write_chunk( offset, receive( offset ) );
+ *     offset += slots.get_chunk_size();
+ *   }
+ *   slots.finish(); // verifies the hash and activates the slot
+ *
+ * The journal uses two pages of the raw driver alternately. Each page
+ * has a header with the update session, followed by flag words,
+ * the active slot markers and the progress bits. Flags, markers and
+ * progress bits only clear bits, so they are single program operations.
+ * Only starting a new update session erases a journal page.
+ *
+ * Switching the active slot programs the next marker word. A power loss
+ * during any step leaves either the old, or the new state.
+ *
+ * The slots can be any MemoryInterface. The test in main_app.cc uses
+ * a GenericFlashDriver over sector 4 and one over sector 7 of the
+ * STM32F401, the journal pages are the sectors 2 and 3.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_SLOTMANAGER_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_SLOTMANAGER_H_
+
+#include "RawDriverInterface.h"
+#include "MemoryInterface.h"
+#include "Sha256.h"
+#include <array>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+class SlotManager
+{
+public:
+	static constexpr uint32_t MAGIC = 0x534C5431; // "SLT1"
+	static constexpr uint32_t NO_SLOT = 0xFFFFFFFF;
+	static constexpr uint32_t MARKER = 0x4D4B0000; // "MK" | slot
+	static constexpr uint32_t FLAG_SET = 0;
+	static constexpr std::size_t MAX_MARKERS = 32;
+	static constexpr std::size_t DEFAULT_CHUNK_SIZE = 1024;
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t sequence;     // the page with the larger sequence is the current one
+		uint32_t active_slot;  // when the page was started
+		uint32_t target_slot;  // NO_SLOT, if there is no update session
+		uint32_t image_size;
+		uint32_t chunk_size;
+		Sha256::digest_t hash;
+		uint32_t reserved;
+		uint32_t check;
+
+		uint32_t calc_check() const;
+
+		bool is_valid() const {
+			return magic == MAGIC && check == calc_check();
+		}
+	};
+
+	/**
+	 * layout of a journal page, after the header
+	 */
+	struct Flags
+	{
+		uint32_t erased;    // FLAG_SET, when the target slot has been erased
+		uint32_t verified;  // FLAG_SET, when the hash of the image has been verified
+		uint32_t markers[MAX_MARKERS];
+	};
+
+	static constexpr std::size_t PROGRESS_OFFSET = sizeof(Header) + sizeof(Flags);
+
+protected:
+	RawDriverInterface & raw_driver;
+	std::array<std::size_t,2> journal_addresses;
+	std::array<MemoryInterface*,2> slots;
+	const std::size_t chunk_size;
+
+	bool initialized = false;
+	std::size_t journal = 0;       // index into journal_addresses
+	Header header {};              // of the current journal page
+	bool erased = false;
+	bool verified = false;
+	std::size_t used_markers = 0;
+	std::size_t active_slot = 0;
+	std::size_t chunks_done = 0;
+
+public:
+	/**
+	 * journal_a_address, journal_b_address: start of two different pages of the raw driver
+	 * chunk_size: has to be a multiple of 4
+	 */
+	SlotManager( RawDriverInterface & raw_driver_,
+			std::size_t journal_a_address,
+			std::size_t journal_b_address,
+			MemoryInterface & slot_a,
+			MemoryInterface & slot_b,
+			std::size_t chunk_size_ = DEFAULT_CHUNK_SIZE );
+
+	/**
+	 * Reads the journal. If there is none yet, slot 0 is the active one.
+	 */
+	bool init();
+
+	std::size_t get_active_slot() const {
+		return active_slot;
+	}
+
+	std::size_t get_inactive_slot() const {
+		return 1 - active_slot;
+	}
+
+	MemoryInterface & get_slot( std::size_t slot ) {
+		return *slots[slot];
+	}
+
+	std::size_t get_chunk_size() const {
+		return chunk_size;
+	}
+
+	/**
+	 * true, if an update session exists, that has not been activated
+	 */
+	bool is_update_pending() const {
+		return header.target_slot != NO_SLOT && header.target_slot != active_slot;
+	}
+
+	/**
+	 * Starts an update of the inactive slot. If the journal contains an
+	 * unfinished session of the same image, it is resumed.
+	 * resume_offset: the first byte of the image, that has to be sent.
+	 */
+	bool begin( std::size_t image_size, const Sha256::digest_t & hash, std::size_t & resume_offset );
+
+	/**
+	 * Programs the chunk at offset. Chunks have to be written in order,
+	 * only the last one can be shorter than get_chunk_size().
+	 */
+	bool write_chunk( std::size_t offset, const std::span<const std::byte> & data );
+
+	/**
+	 * Verifies the hash of the written image and activates the slot.
+	 */
+	bool finish();
+
+	/**
+	 * Makes slot the active one, eg. for a rollback.
+	 * This is a single program operation, unless all markers of the
+	 * journal page are used. Then a new journal page is started, which
+	 * drops a pending update session.
+	 */
+	bool activate( std::size_t slot );
+
+	/**
+	 * number of chunks, that can be tracked in one journal page
+	 */
+	std::size_t get_max_chunks( std::size_t page ) const;
+
+protected:
+	std::size_t get_flags_address( std::size_t page ) const {
+		return journal_addresses[page] + sizeof(Header);
+	}
+
+	std::size_t get_progress_address( std::size_t page ) const {
+		return journal_addresses[page] + PROGRESS_OFFSET;
+	}
+
+	bool read_header( std::size_t page, Header & h );
+
+	bool read_word( std::size_t address, uint32_t & word );
+
+	bool program_word( std::size_t address, uint32_t word );
+
+	/**
+	 * reads flags, markers and progress of the current journal page
+	 */
+	bool load_state();
+
+	/**
+	 * binary search for the first unused marker, sets active_slot
+	 */
+	bool count_markers( std::size_t & count );
+
+	/**
+	 * binary search for the first progress word with bits left
+	 */
+	bool count_chunks_done( std::size_t & count );
+
+	/**
+	 * erases the other journal page and starts it with h
+	 */
+	bool start_journal( Header h );
+
+	bool erase_target();
+
+	bool verify_image();
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_SLOTMANAGER_H_ */
@@ -0,0 +1,114 @@
+/*
+ * AsyncCopyEngine for host builds, copies with a background thread.
+ *
+ * The stand-in for the DMA engine of the target, together with
+ * SimulatedRawDriver. Header only, since the target has no threads.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_THREADCOPYENGINE_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_THREADCOPYENGINE_H_
+
+#include "AsyncCopyEngine.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+namespace stm32_internal_flash {
+
+class ThreadCopyEngine : public AsyncCopyEngine
+{
+	std::mutex mutex;
+	std::condition_variable cond;
+
+	std::byte *target = nullptr;
+	const std::byte *source = nullptr;
+	std::size_t size = 0;
+
+	bool busy = false;     // a copy is started, and not reported by poll() yet
+	bool pending = false;  // a copy is waiting for the thread
+	bool stop = false;
+
+	std::size_t max_transfer_size;
+
+	std::thread thread;
+
+public:
+	/**
+	 * max_transfer_size: splits large copies, like the 65535 items of a DMA stream
+	 */
+	explicit ThreadCopyEngine( std::size_t max_transfer_size_ = 65535 )
+	: max_transfer_size( max_transfer_size_ ),
+	  thread( [this]() { run(); } )
+	{}
+
+	ThreadCopyEngine( const ThreadCopyEngine & other ) = delete;
+	ThreadCopyEngine & operator=( const ThreadCopyEngine & other ) = delete;
+
+	~ThreadCopyEngine() {
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			stop = true;
+		}
+
+		cond.notify_all();
+		thread.join();
+	}
+
+	std::size_t start( std::byte *target_, const std::byte *source_, std::size_t size_ ) override {
+		std::lock_guard<std::mutex> lock( mutex );
+
+		if( busy || size_ == 0 ) {
+			return 0;
+		}
+
+		target = target_;
+		source = source_;
+		size = std::min( size_, max_transfer_size );
+		busy = true;
+		pending = true;
+
+		cond.notify_all();
+
+		return size;
+	}
+
+	Status poll() override {
+		std::lock_guard<std::mutex> lock( mutex );
+
+		if( !busy || pending ) {
+			return busy ? Status::Busy : Status::Error;
+		}
+
+		busy = false;
+
+		return Status::Done;
+	}
+
+private:
+	void run() {
+		std::unique_lock<std::mutex> lock( mutex );
+
+		while( true ) {
+			cond.wait( lock, [this]() { return pending || stop; } );
+
+			if( stop ) {
+				return;
+			}
+
+			// the caller doesn't touch the buffers until poll() returned Done
+			lock.unlock();
+			memcpy( target, source, size );
+			lock.lock();
+
+			pending = false;
+		}
+	}
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_THREADCOPYENGINE_H_ */
@@ -0,0 +1,116 @@
+/*
+ * Records the accesses to a MemoryInterface.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "TracingMemoryInterface.h"
+
+namespace stm32_internal_flash {
+
+TracingMemoryInterface::TracingMemoryInterface( MemoryInterface & driver_,
+		std::span<TraceRecord> ring_,
+		get_time_us_func_t get_time_us_ )
+: driver( driver_ ),
+  ring( ring_ ),
+  get_time_us( get_time_us_ )
+{
+	// take over the settings of the driver, properties_changed() passes them back
+	MemoryInterface::properties = driver.properties;
+}
+
+void TracingMemoryInterface::add( uint32_t time_us, Op op, std::size_t address, std::size_t size, bool ok )
+{
+	if( ring.empty() ) {
+		return;
+	}
+
+	TraceRecord & record = ring[next];
+	record.time_us = time_us;
+	record.address = static_cast<uint32_t>( address );
+	record.size_op = static_cast<uint32_t>( size << 8 ) | (ok ? 0 : FAILED) | static_cast<uint32_t>( op );
+
+	next = (next + 1) % ring.size();
+
+	if( count < ring.size() ) {
+		count++;
+	}
+
+	statistic.recorded++;
+
+	if( log ) {
+		if( unflushed == ring.size() ) {
+			statistic.lost++;
+		} else {
+			unflushed++;
+		}
+	}
+}
+
+std::size_t TracingMemoryInterface::write( std::size_t address, const std::span<const std::byte> & data )
+{
+	const uint32_t start = now_us();
+	const std::size_t ret = driver.write( address, data );
+	add( start, Op::Write, address, data.size(), ret == data.size() );
+	return ret;
+}
+
+std::size_t TracingMemoryInterface::read( std::size_t address, std::span<std::byte> & data )
+{
+	const uint32_t start = now_us();
+	const std::size_t ret = driver.read( address, data );
+	add( start, Op::Read, address, data.size(), ret == data.size() );
+	return ret;
+}
+
+bool TracingMemoryInterface::erase( std::size_t address, std::size_t size )
+{
+	const uint32_t start = now_us();
+	const bool ret = driver.erase( address, size );
+	add( start, Op::Erase, address, size, ret );
+	return ret;
+}
+
+std::size_t TracingMemoryInterface::program( std::size_t address, const std::span<const std::byte> & data )
+{
+	const uint32_t start = now_us();
+	const std::size_t ret = driver.program( address, data );
+	add( start, Op::Program, address, data.size(), ret == data.size() );
+	return ret;
+}
+
+bool TracingMemoryInterface::copy( std::size_t dst, std::size_t src, std::size_t len )
+{
+	const uint32_t start = now_us();
+	const bool ret = driver.copy( dst, src, len );
+	add( start, Op::Copy, dst, len, ret );
+	add( start, Op::CopySource, src, len, ret );
+	return ret;
+}
+
+bool TracingMemoryInterface::flush( bool partial )
+{
+	if( !log || log->get_record_size() != LOG_RECORD_SIZE ) {
+		return false;
+	}
+
+	while( unflushed >= LOG_BATCH || (partial && unflushed > 0) ) {
+		std::array<TraceRecord,LOG_BATCH> batch{};
+		const std::size_t len = std::min( unflushed, LOG_BATCH );
+		const std::size_t first = (next + ring.size() - unflushed) % ring.size();
+
+		for( std::size_t i = 0; i < len; i++ ) {
+			batch[i] = ring[(first + i) % ring.size()];
+		}
+
+		if( !log->append( std::span<const std::byte>( reinterpret_cast<const std::byte*>( batch.data() ), sizeof(batch) ) ) ) {
+			return false;
+		}
+
+		unflushed -= len;
+		statistic.flushed += len;
+	}
+
+	return true;
+}
+
+} // namespace stm32_internal_flash
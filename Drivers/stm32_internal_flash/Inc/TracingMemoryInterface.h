@@ -0,0 +1,186 @@
+/*
+ * Records the accesses to a MemoryInterface, for tuning the storage layout.
+ *
+ * Each read, write, erase, program and copy is stored as a TraceRecord
+ * of 12 bytes in a ring in RAM. Nothing else is done in the access path,
+ * so the overhead is one call of the clock and a few stores.
+ *
+ * Optionally flush() appends the records to a CircularLog, eg. from the
+ * superloop. The log has to be on another memory, than the traced one.
+ * Records, that are overwritten in the ring before they have been flushed,
+ * are counted as lost.
+ *
+ * Reads through get_mapped_address() are not recorded, since the
+ * pointer is used without asking the driver again.
+ *
+ * tools/trace_replay.cpp replays a trace on the host with different
+ * driver stacks.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_INC_TRACINGMEMORYINTERFACE_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_INC_TRACINGMEMORYINTERFACE_H_
+
+#include "MemoryInterface.h"
+#include "CircularLog.h"
+#include <array>
+#include <functional>
+#include <stdint.h>
+
+namespace stm32_internal_flash {
+
+class TracingMemoryInterface : public MemoryInterface
+{
+public:
+	using get_time_us_func_t = std::function<uint32_t()>;
+
+	enum class Op : uint8_t
+	{
+		None = 0,       // padding of a log record
+		Read = 1,
+		Write = 2,
+		Erase = 3,
+		Program = 4,
+		Copy = 5,       // address is the destination, followed by CopySource
+		CopySource = 6
+	};
+
+	static constexpr uint32_t FAILED = 0x80;  // flag in size_op
+	static constexpr uint32_t OP_MASK = 0x7F;
+
+	struct TraceRecord
+	{
+		uint32_t time_us;  // start of the access, may wrap around
+		uint32_t address;
+		uint32_t size_op;  // size << 8 | FAILED | op
+
+		Op get_op() const {
+			return static_cast<Op>( size_op & OP_MASK );
+		}
+
+		std::size_t get_size() const {
+			return size_op >> 8;
+		}
+
+		bool failed() const {
+			return (size_op & FAILED) != 0;
+		}
+	};
+
+	// records in one record of the CircularLog
+	static constexpr std::size_t LOG_BATCH = 16;
+	static constexpr std::size_t LOG_RECORD_SIZE = LOG_BATCH * sizeof(TraceRecord);
+
+	struct Statistic
+	{
+		std::size_t recorded = 0;
+		std::size_t flushed = 0;  // records appended to the log
+		std::size_t lost = 0;     // overwritten in the ring before being flushed
+	};
+
+protected:
+	MemoryInterface & driver;
+	std::span<TraceRecord> ring;
+	get_time_us_func_t get_time_us;
+	CircularLog *log = nullptr;
+
+	std::size_t next = 0;       // index of the next record in the ring
+	std::size_t count = 0;      // records in the ring
+	std::size_t unflushed = 0;  // newest records in the ring, that are not in the log
+
+	Statistic statistic;
+
+public:
+	/**
+	 * ring: storage for the records, the oldest ones are overwritten
+	 * get_time_us: clock for the time stamps
+	 */
+	TracingMemoryInterface( MemoryInterface & driver_,
+			std::span<TraceRecord> ring_,
+			get_time_us_func_t get_time_us_ = {} );
+
+	/**
+	 * log: record size has to be LOG_RECORD_SIZE, nullptr disables it
+	 */
+	void set_log( CircularLog *log_ ) {
+		log = log_;
+		unflushed = 0;
+	}
+
+	std::size_t get_size() const override {
+		return driver.get_size();
+	}
+
+	std::size_t get_page_size() const override {
+		return driver.get_page_size();
+	}
+
+	std::size_t write( std::size_t address, const std::span<const std::byte> & data ) override;
+	std::size_t read( std::size_t address, std::span<std::byte> & data ) override;
+	bool erase( std::size_t address, std::size_t size ) override;
+	std::size_t program( std::size_t address, const std::span<const std::byte> & data ) override;
+	bool copy( std::size_t dst, std::size_t src, std::size_t len ) override;
+
+	std::size_t get_page_size_at( std::size_t address ) const override {
+		return driver.get_page_size_at( address );
+	}
+
+	std::size_t get_page_start_address( std::size_t address ) const override {
+		return driver.get_page_start_address( address );
+	}
+
+	const std::byte* get_mapped_address( std::size_t address ) const override {
+		return driver.get_mapped_address( address );
+	}
+
+	void properties_changed() override {
+		driver.properties = MemoryInterface::properties;
+	}
+
+	/**
+	 * Appends the records, that are not in the log yet, in batches of LOG_BATCH.
+	 * partial: also the last incomplete batch, padded with Op::None records.
+	 */
+	bool flush( bool partial = false );
+
+	/**
+	 * calls func( const TraceRecord & record ) for each record in the ring, oldest first
+	 */
+	template<class FUNC> void for_each_record( FUNC func ) const {
+		for( std::size_t i = 0; i < count; i++ ) {
+			func( ring[(next + ring.size() - count + i) % ring.size()] );
+		}
+	}
+
+	std::size_t get_record_count() const {
+		return count;
+	}
+
+	/**
+	 * empties the ring, already flushed records stay in the log
+	 */
+	void clear() {
+		count = 0;
+		unflushed = 0;
+	}
+
+	const Statistic & get_statistic() const {
+		return statistic;
+	}
+
+	void clear_statistic() {
+		statistic = Statistic();
+	}
+
+protected:
+	uint32_t now_us() const {
+		return get_time_us ? get_time_us() : 0;
+	}
+
+	void add( uint32_t time_us, Op op, std::size_t address, std::size_t size, bool ok );
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_INC_TRACINGMEMORYINTERFACE_H_ */
@@ -7,12 +7,12 @@ namespace stm32_internal_flash {
 
 bool Configuration::check() const
 {
-	std::optional<std::size_t> size;
-
 	if( used_sectors.empty() ) {
 		return false;
 	}
 
+	const Sector *prev = nullptr;
+
 	for( const Sector & sec : used_sectors ) {
 		if( sec.size == 0 ) {
 			return false;
@@ -22,13 +22,12 @@ bool Configuration::check() const
 			return false;
 		}
 
-		if( !size ) {
-			size = sec.size;
-		} else {
-			if( size.value() != sec.size ) {
-				return false;
-			}
+		// sectors have to follow each other without gaps
+		if( prev && prev->start_address + prev->size != sec.start_address ) {
+			return false;
 		}
+
+		prev = &sec;
 	}
 
 	if( data_ptr == nullptr ) {
@@ -38,6 +37,22 @@ bool Configuration::check() const
 	return true;
 }
 
+std::size_t Configuration::get_sector_index( std::size_t offset ) const
+{
+	if( offset >= size ) {
+		return used_sectors.size();
+	}
+
+	const std::size_t address = used_sectors[0].start_address + offset;
+
+	auto it = std::upper_bound( used_sectors.begin(), used_sectors.end(), address,
+			[]( std::size_t addr, const Sector & sec ) {
+				return addr < sec.start_address;
+			});
+
+	return std::distance( used_sectors.begin(), it ) - 1;
+}
+
 } // namespace smt32_internal_flash
 
 
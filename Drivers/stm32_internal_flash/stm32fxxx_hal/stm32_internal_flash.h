@@ -8,8 +8,10 @@
 #define APP_STM32_INTERNAL_FLASH_STM32FXXX_HAL_STM32_INTERNAL_FLASH_H_
 
 #include <optional>
+#include <algorithm>
 #include <span>
 #include <stdint.h>
+#include "FlashGeometry.h"
 
 #if defined(STM32F407xx) || defined(STM32F401xE)
 #include <stm32f4xx_hal.h>
@@ -23,26 +25,54 @@ namespace stm32_internal_flash {
 
 struct Configuration
 {
-	struct Sector
-	{
-		uint32_t sector{};
-		uint32_t size{};
-		std::size_t start_address = 0;
-	};
-
+	/**
+	 * sector number, size and address, see FlashGeometry.h
+	 * for generating the tables
+	 */
+	using Sector = geometry::Sector;
+
+	/**
+	 * Sectors can have different sizes, but they have to be
+	 * sorted by address and following each other without gaps.
+	 * So the start addresses are also the prefix table for finding
+	 * the sector of an address.
+	 */
 	std::span<const Sector> used_sectors{};
 	std::byte* data_ptr = nullptr; // if null start_addess of forst sector is used.
 
+	/**
+	 * selects the program width, see geometry::get_program_width()
+	 */
 	uint32_t voltage_range = VOLTAGE_RANGE_3;
 	uint32_t banks = FLASH_BANK_1;
 
+	/**
+	 * Use the erase and program routines located in RAM (see stm32_internal_flash_ramfunc.h)
+	 * instead of the HAL functions. So interrupt handlers located in RAM are still
+	 * served while the flash is busy.
+	 */
+	bool execute_from_ram = false;
+
+	/**
+	 * Reads back each programmed range and blank checks each erased sector.
+	 * On a mismatch programming or erasing is repeated up to verify_retries times,
+	 * then the driver reports VerifyProgramFailed or VerifyEraseFailed.
+	 */
+	bool verify = false;
+	uint32_t verify_retries = 1;
+
 	std::size_t size = 0; // full size, calculated
+	std::size_t max_sector_size = 0; // size of the largest sector, calculated
 
 	void init() {
 
+		size = 0;
+		max_sector_size = 0;
+
 		// calc size
 		for( const Sector & sector : used_sectors ) {
 			size += sector.size;
+			max_sector_size = std::max( max_sector_size, static_cast<std::size_t>(sector.size) );
 		}
 
 		if( !data_ptr ) {
@@ -55,6 +85,20 @@ struct Configuration
 	bool operator!() const {
 		return !check();
 	}
+
+	/**
+	 * returns the index of the sector in used_sectors, that contains the offset
+	 * offset is relative to the start of the first sector.
+	 * Binary search, returns used_sectors.size() if the offset is out of range.
+	 */
+	std::size_t get_sector_index( std::size_t offset ) const;
+
+	/**
+	 * offset of the sector, relative to the start of the first sector
+	 */
+	std::size_t get_sector_offset( std::size_t sector_idx ) const {
+		return used_sectors[sector_idx].start_address - used_sectors[0].start_address;
+	}
 };
 
 class Error
@@ -66,7 +110,9 @@ public:
 		InvalidSectorAddress,
 		ErrorUnlockingFlash,
 		ErrorErasingFlash,
-		HAL_Error
+		HAL_Error,
+		VerifyProgramFailed, // hal_error is the offset of the first mismatching byte
+		VerifyEraseFailed    // hal_error is the offset of the first non blank byte
 	};
 
 	ErrorCode driver_error;
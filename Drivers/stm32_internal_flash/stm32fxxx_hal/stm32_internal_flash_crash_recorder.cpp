@@ -0,0 +1,181 @@
+/*
+ * Writes a crash record into a reserved flash area, from the fault path.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "stm32_internal_flash_crash_recorder.h"
+#include "stm32_internal_flash_ramfunc.h"
+#include <stddef.h>
+#include <string.h>
+
+extern "C" {
+	// defined in the linker script
+	extern uint32_t _estack[];
+}
+
+namespace stm32_internal_flash {
+
+namespace {
+
+	constexpr uint32_t BLANK_WORD = 0xFFFFFFFF;
+
+	// EXC_RETURN: the process stack was used
+	constexpr uint32_t EXC_RETURN_PSP = 1 << 2;
+
+	constexpr uint32_t FLASH_ALL_FLAGS = FLASH_FLAG_EOP |
+										 FLASH_FLAG_OPERR |
+										 FLASH_FLAG_WRPERR |
+										 FLASH_FLAG_PGAERR |
+										 FLASH_FLAG_PGPERR |
+										 FLASH_FLAG_PGSERR;
+
+	/**
+	 * programs whole words, size has to be a multiple of 4
+	 */
+	bool program_words( std::size_t address, const void *data, std::size_t size )
+	{
+		return ramfunc::program( address, static_cast<const std::byte*>(data), size / sizeof(uint32_t), FLASH_PSIZE_WORD ) == 0;
+	}
+
+} // namespace
+
+void CrashRecorder::remember_line( const std::string_view & line )
+{
+	auto & target = lines[next_line];
+	const std::size_t len = std::min( line.size(), target.size() - 1 );
+
+	memcpy( target.data(), line.data(), len );
+	memset( target.data() + len, 0, target.size() - len );
+
+	next_line = (next_line + 1) % DEBUG_LINES;
+}
+
+std::size_t CrashRecorder::find_free_slot() const
+{
+	std::size_t slot = 0;
+
+	// the first word after the magic is programmed first
+	for( ; slot < get_slot_count(); slot++ ) {
+		const uint32_t *words = reinterpret_cast<const uint32_t*>( get_slot( slot ) );
+
+		if( words[0] == BLANK_WORD && words[1] == BLANK_WORD ) {
+			break;
+		}
+	}
+
+	return slot;
+}
+
+std::size_t CrashRecorder::get_free_slots() const
+{
+	return get_slot_count() - find_free_slot();
+}
+
+std::size_t CrashRecorder::get_valid_stack_words( const uint32_t *stack )
+{
+	const uintptr_t start = reinterpret_cast<uintptr_t>( stack );
+	const uintptr_t end = reinterpret_cast<uintptr_t>( _estack );
+
+	// a corrupted stack pointer would fault again
+	if( start < SRAM1_BASE || start >= end || start % sizeof(uint32_t) != 0 ) {
+		return 0;
+	}
+
+	return std::min( STACK_WORDS, (end - start) / sizeof(uint32_t) );
+}
+
+bool CrashRecorder::write_record( Header & header, const uint32_t *stack )
+{
+	const std::size_t slot = find_free_slot();
+
+	if( slot >= get_slot_count() ) {
+		return false;
+	}
+
+	header.magic = BLANK_WORD;
+	header.tick = HAL_GetTick();
+	header.cfsr = SCB->CFSR;
+	header.hfsr = SCB->HFSR;
+	header.mmfar = SCB->MMFAR;
+	header.bfar = SCB->BFAR;
+	header.stack_address = reinterpret_cast<uint32_t>( stack );
+	header.stack_words = get_valid_stack_words( stack );
+
+	const uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	const bool locked = (FLASH->CR & FLASH_CR_LOCK) != 0;
+
+	if( locked ) {
+		FLASH->KEYR = FLASH_KEY1;
+		FLASH->KEYR = FLASH_KEY2;
+	}
+
+	// An erase could have been interrupted by the fault,
+	// its flags would let programming fail.
+	while( FLASH->SR & FLASH_SR_BSY ) {}
+	FLASH->CR &= ~(FLASH_CR_SER | FLASH_CR_MER | FLASH_CR_SNB);
+	FLASH->SR = FLASH_ALL_FLAGS;
+
+	const std::size_t target = reinterpret_cast<std::size_t>( get_slot( slot ) );
+	bool ok = program_words( target + sizeof(uint32_t), reinterpret_cast<const uint32_t*>(&header) + 1, sizeof(header) - sizeof(uint32_t) );
+
+	if( ok && header.stack_words > 0 ) {
+		ok = program_words( target + offsetof(Record,stack), stack, header.stack_words * sizeof(uint32_t) );
+	}
+
+	for( std::size_t i = 0; ok && i < DEBUG_LINES; i++ ) {
+		const auto & line = lines[(next_line + i) % DEBUG_LINES];
+		ok = program_words( target + offsetof(Record,lines) + i * LINE_LENGTH, line.data(), line.size() );
+	}
+
+	if( ok ) {
+		ok = program_words( target, &MAGIC, sizeof(MAGIC) );
+	}
+
+	if( locked ) {
+		FLASH->CR |= FLASH_CR_LOCK;
+	}
+
+	ramfunc::flush_caches();
+
+	__set_PRIMASK( primask );
+
+	return ok;
+}
+
+bool CrashRecorder::record_hard_fault( uint32_t exc_return, const uint32_t *msp )
+{
+	Header header{};
+	header.reason = Reason::HardFault;
+	header.exc_return = exc_return;
+
+	const uint32_t *frame = (exc_return & EXC_RETURN_PSP) ? reinterpret_cast<const uint32_t*>( __get_PSP() ) : msp;
+
+	// the snapshot starts with the stacked registers
+	if( get_valid_stack_words( frame ) >= sizeof(ExceptionFrame) / sizeof(uint32_t) ) {
+		memcpy( &header.frame, frame, sizeof(header.frame) );
+	}
+
+	return write_record( header, frame );
+}
+
+bool CrashRecorder::record( Reason reason, const char *file, uint32_t line )
+{
+	Header header{};
+	header.reason = reason;
+	header.line = line;
+
+	if( file ) {
+		// without the directory, it's the end that matters
+		const char *name = strrchr( file, '/' );
+		name = name ? name + 1 : file;
+		strncpy( header.file, name, sizeof(header.file) - 1 );
+	}
+
+	const uint32_t *stack = reinterpret_cast<const uint32_t*>( (__get_CONTROL() & CONTROL_SPSEL_Msk) ? __get_PSP() : __get_MSP() );
+
+	return write_record( header, stack );
+}
+
+} // namespace stm32_internal_flash
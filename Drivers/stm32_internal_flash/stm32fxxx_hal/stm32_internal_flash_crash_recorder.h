@@ -0,0 +1,169 @@
+/*
+ * Writes a crash record from the HardFault handler, or after a failed
+ * assert, into a reserved flash area.
+ *
+ * In the fault path nothing is erased, no heap is used and no HAL function
+ * is called, that could run into a timeout. The record is programmed word by
+ * word with ramfunc::program() into the next blank slot of the area. The magic
+ * word at its start is programmed last, so a record, that was interrupted by
+ * a reset, is ignored.
+ *
+ * A record contains the stacked registers, the fault status registers, a
+ * snapshot of the stack and the last debug lines. The debug lines are kept
+ * in RAM by remember_line().
+ *
+ * After the reboot the records are read directly from the memory mapped
+ * flash. The area has to be erased by the application, after the records
+ * have been reported.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_STM32FXXX_HAL_STM32_INTERNAL_FLASH_CRASH_RECORDER_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_STM32FXXX_HAL_STM32_INTERNAL_FLASH_CRASH_RECORDER_H_
+
+#include "stm32_internal_flash.h"
+#include <array>
+#include <string_view>
+
+namespace stm32_internal_flash {
+
+class CrashRecorder
+{
+public:
+	static constexpr uint32_t MAGIC = 0x48535243; // "CRSH", little endian
+	static constexpr std::size_t STACK_WORDS = 64;
+	static constexpr std::size_t DEBUG_LINES = 8;
+	static constexpr std::size_t LINE_LENGTH = 80;
+	static constexpr std::size_t FILE_LENGTH = 48;
+
+	enum class Reason : uint32_t
+	{
+		HardFault = 1,
+		Assert = 2,
+		Test = 3
+	};
+
+	/**
+	 * registers pushed by the processor on exception entry
+	 */
+	struct ExceptionFrame
+	{
+		uint32_t r0;
+		uint32_t r1;
+		uint32_t r2;
+		uint32_t r3;
+		uint32_t r12;
+		uint32_t lr;
+		uint32_t pc;
+		uint32_t xpsr;
+	};
+
+	struct Header
+	{
+		uint32_t magic;          // programmed last
+		Reason reason;
+		uint32_t tick;           // HAL_GetTick()
+		uint32_t exc_return;     // only of a HardFault
+		ExceptionFrame frame;    // only of a HardFault
+		uint32_t cfsr;
+		uint32_t hfsr;
+		uint32_t mmfar;
+		uint32_t bfar;
+		uint32_t stack_address;  // of the first word of the stack snapshot
+		uint32_t stack_words;    // valid words of the snapshot
+		uint32_t line;           // of the assert
+		char file[FILE_LENGTH];  // of the assert, without the directory
+	};
+
+	struct Record
+	{
+		Header header;
+		uint32_t stack[STACK_WORDS];
+		char lines[DEBUG_LINES][LINE_LENGTH];  // oldest first, zero terminated
+	};
+
+protected:
+	const std::size_t address;
+	const std::size_t size;
+
+	// ring buffer of the last debug lines
+	std::array<std::array<char,LINE_LENGTH>,DEBUG_LINES> lines{};
+	std::size_t next_line = 0;
+
+public:
+	/**
+	 * address, size: the reserved area, it has to be erased before
+	 */
+	constexpr CrashRecorder( std::size_t address_, std::size_t size_ )
+	: address( address_ ),
+	  size( size_ )
+	{}
+
+	/**
+	 * Keeps the line for the next record, longer lines are cut.
+	 * Not for interrupt handlers, the lines aren't locked.
+	 */
+	void remember_line( const std::string_view & line );
+
+	/**
+	 * To be called from the HardFault handler.
+	 * exc_return: the value of LR on entry of the handler
+	 * msp: the main stack pointer on entry of the handler
+	 */
+	bool record_hard_fault( uint32_t exc_return, const uint32_t *msp );
+
+	/**
+	 * Records the current state, eg. of a failed assert.
+	 * file: can be nullptr
+	 */
+	bool record( Reason reason, const char *file = nullptr, uint32_t line = 0 );
+
+	std::size_t get_slot_count() const {
+		return size / sizeof(Record);
+	}
+
+	/**
+	 * slots, that are still blank
+	 */
+	std::size_t get_free_slots() const;
+
+	/**
+	 * calls func( const Record & record ) for each complete record,
+	 * oldest first. The records are not copied.
+	 */
+	template<class FUNC> void for_each_record( FUNC func ) const {
+		for( std::size_t slot = 0; slot < get_slot_count(); slot++ ) {
+			const Record *rec = get_slot( slot );
+
+			if( rec->header.magic == MAGIC ) {
+				func( *rec );
+			}
+		}
+	}
+
+protected:
+	const Record * get_slot( std::size_t slot ) const {
+		return reinterpret_cast<const Record*>( address + slot * sizeof(Record) );
+	}
+
+	/**
+	 * the first slot, that hasn't been started, or get_slot_count()
+	 */
+	std::size_t find_free_slot() const;
+
+	/**
+	 * Programs the header, except the magic, the stack snapshot, the debug lines
+	 * and finally the magic. Interrupts are disabled meanwhile.
+	 */
+	bool write_record( Header & header, const uint32_t *stack );
+
+	/**
+	 * number of words of the stack snapshot, that are located in RAM
+	 */
+	static std::size_t get_valid_stack_words( const uint32_t *stack );
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_STM32FXXX_HAL_STM32_INTERNAL_FLASH_CRASH_RECORDER_H_ */
@@ -0,0 +1,103 @@
+/*
+ * AsyncCopyEngine using a DMA2 stream in memory to memory mode.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "stm32_internal_flash_dma_copy.h"
+#include <algorithm>
+
+namespace stm32_internal_flash {
+
+STM32DmaCopyEngine::STM32DmaCopyEngine( DMA_Stream_TypeDef *stream )
+{
+	hdma.Instance = stream;
+}
+
+bool STM32DmaCopyEngine::init( uint32_t alignment )
+{
+	if( initialized && alignment == data_alignment ) {
+		return true;
+	}
+
+	__HAL_RCC_DMA2_CLK_ENABLE();
+
+	hdma.Init.Channel = DMA_CHANNEL_0;
+	hdma.Init.Direction = DMA_MEMORY_TO_MEMORY;
+	hdma.Init.PeriphInc = DMA_PINC_ENABLE;
+	hdma.Init.MemInc = DMA_MINC_ENABLE;
+	hdma.Init.PeriphDataAlignment = alignment;
+	hdma.Init.MemDataAlignment = alignment == DMA_PDATAALIGN_WORD ? DMA_MDATAALIGN_WORD : DMA_MDATAALIGN_BYTE;
+	hdma.Init.Mode = DMA_NORMAL;
+	hdma.Init.Priority = DMA_PRIORITY_LOW;
+	// the direct mode is not allowed for memory to memory transfers
+	hdma.Init.FIFOMode = DMA_FIFOMODE_ENABLE;
+	hdma.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+	hdma.Init.MemBurst = DMA_MBURST_SINGLE;
+	hdma.Init.PeriphBurst = DMA_PBURST_SINGLE;
+
+	initialized = HAL_DMA_Init( &hdma ) == HAL_OK;
+	data_alignment = alignment;
+
+	return initialized;
+}
+
+std::size_t STM32DmaCopyEngine::start( std::byte *target, const std::byte *source, std::size_t size )
+{
+	if( busy || size == 0 ) {
+		return 0;
+	}
+
+	const uint32_t source_address = reinterpret_cast<uint32_t>( source );
+	const uint32_t target_address = reinterpret_cast<uint32_t>( target );
+
+	uint32_t alignment = DMA_PDATAALIGN_BYTE;
+	std::size_t item_size = 1;
+	std::size_t count = std::min( size, MAX_ITEMS );
+
+	if( (source_address | target_address) % sizeof(uint32_t) == 0 && size >= sizeof(uint32_t) ) {
+		alignment = DMA_PDATAALIGN_WORD;
+		item_size = sizeof(uint32_t);
+		count = std::min( size / sizeof(uint32_t), MAX_ITEMS );
+
+	} else if( (source_address ^ target_address) % sizeof(uint32_t) == 0 && source_address % sizeof(uint32_t) != 0 ) {
+		// up to the word boundary, the next transfer is word wide
+		count = std::min( size, sizeof(uint32_t) - source_address % sizeof(uint32_t) );
+	}
+
+	if( !init( alignment ) ) {
+		return 0;
+	}
+
+	if( HAL_DMA_Start( &hdma, source_address, target_address, count ) != HAL_OK ) {
+		return 0;
+	}
+
+	busy = true;
+
+	return count * item_size;
+}
+
+AsyncCopyEngine::Status STM32DmaCopyEngine::poll()
+{
+	if( !busy ) {
+		return Status::Error;
+	}
+
+	const bool complete = __HAL_DMA_GET_FLAG( &hdma, __HAL_DMA_GET_TC_FLAG_INDEX( &hdma ) ) != RESET;
+	const bool transfer_error = __HAL_DMA_GET_FLAG( &hdma, __HAL_DMA_GET_TE_FLAG_INDEX( &hdma ) ) != RESET;
+
+	if( !complete && !transfer_error ) {
+		return Status::Busy;
+	}
+
+	busy = false;
+
+	// returns immediately now, clears the flags and releases the handle
+	if( HAL_DMA_PollForTransfer( &hdma, HAL_DMA_FULL_TRANSFER, 0 ) != HAL_OK ) {
+		return Status::Error;
+	}
+
+	return Status::Done;
+}
+
+} // namespace stm32_internal_flash
@@ -0,0 +1,62 @@
+/*
+ * AsyncCopyEngine using a DMA2 stream in memory to memory mode.
+ *
+ * Only DMA2 can copy memory to memory on the STM32F4. The stream is
+ * polled, no interrupt is used. A stream transfers at most 65535 items,
+ * so start() copies at most 65535 words, if source, target and size are
+ * word aligned, and 65535 bytes otherwise. If source and target have the
+ * same offset to a word boundary, the bytes up to the boundary are copied
+ * first, so the rest can be copied word wide.
+ *
+ * The DMA reads the flash via the bus matrix, while the CPU keeps running.
+ * While the flash is erased or programmed, the transfer stalls, like
+ * any other flash access.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_STM32FXXX_HAL_STM32_INTERNAL_FLASH_DMA_COPY_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_STM32FXXX_HAL_STM32_INTERNAL_FLASH_DMA_COPY_H_
+
+#include "stm32_internal_flash.h"
+#include "AsyncCopyEngine.h"
+
+namespace stm32_internal_flash {
+
+class STM32DmaCopyEngine : public AsyncCopyEngine
+{
+public:
+	static constexpr std::size_t MAX_ITEMS = 0xFFFF;
+
+private:
+	DMA_HandleTypeDef hdma{};
+
+	// data alignment of the last HAL_DMA_Init()
+	uint32_t data_alignment = 0;
+	bool initialized = false;
+	bool busy = false;
+
+public:
+	/**
+	 * stream: DMA2_Stream0 ... DMA2_Stream7, that is not used otherwise
+	 */
+	explicit STM32DmaCopyEngine( DMA_Stream_TypeDef *stream = DMA2_Stream0 );
+
+	STM32DmaCopyEngine( const STM32DmaCopyEngine & other ) = delete;
+	STM32DmaCopyEngine & operator=( const STM32DmaCopyEngine & other ) = delete;
+
+	std::size_t start( std::byte *target, const std::byte *source, std::size_t size ) override;
+
+	Status poll() override;
+
+private:
+	/**
+	 * initializes the stream for items of the given alignment,
+	 * DMA_PDATAALIGN_WORD or DMA_PDATAALIGN_BYTE
+	 */
+	bool init( uint32_t alignment );
+};
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_STM32FXXX_HAL_STM32_INTERNAL_FLASH_DMA_COPY_H_ */
@@ -0,0 +1,195 @@
+/*
+ * Flash erase and program routines, that are executed from RAM.
+ *
+ * Functions marked with STM32_INTERNAL_FLASH_RAMFUNC must not call
+ * anything located in flash while the flash is busy. So only
+ * register accesses and inline functions are used here.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "stm32_internal_flash_ramfunc.h"
+#include <algorithm>
+
+extern "C" {
+	// defined in the linker script
+	extern uint32_t _sisr_vector[];
+	extern uint32_t _eisr_vector[];
+	extern uint32_t _sram_vector[];
+	extern uint32_t _eram_vector[];
+}
+
+namespace stm32_internal_flash {
+
+namespace ramfunc {
+
+namespace {
+
+	constexpr uint32_t FLASH_ERROR_FLAGS = FLASH_FLAG_OPERR |
+										   FLASH_FLAG_WRPERR |
+										   FLASH_FLAG_PGAERR |
+										   FLASH_FLAG_PGPERR |
+#ifdef FLASH_SR_RDERR
+										   FLASH_SR_RDERR |
+#endif
+										   FLASH_FLAG_PGSERR;
+
+	/**
+	 * waits until the flash is not busy any more and returns the error flags
+	 */
+	inline __attribute__((always_inline)) uint32_t wait_for_last_operation()
+	{
+		while( FLASH->SR & FLASH_SR_BSY ) {}
+
+		const uint32_t errors = FLASH->SR & FLASH_ERROR_FLAGS;
+
+		// clear flags by writing 1
+		FLASH->SR = errors | FLASH_FLAG_EOP;
+
+		return errors;
+	}
+
+	inline __attribute__((always_inline)) uint32_t psize_from_voltage_range( uint32_t voltage_range )
+	{
+		switch( voltage_range )
+		{
+		case FLASH_VOLTAGE_RANGE_1: return FLASH_PSIZE_BYTE;
+		case FLASH_VOLTAGE_RANGE_2: return FLASH_PSIZE_HALF_WORD;
+		case FLASH_VOLTAGE_RANGE_3: return FLASH_PSIZE_WORD;
+		default:                    return FLASH_PSIZE_DOUBLE_WORD;
+		}
+	}
+
+} // namespace
+
+STM32_INTERNAL_FLASH_RAMFUNC uint32_t erase_sectors( uint32_t sector, uint32_t nb_sectors, uint32_t voltage_range )
+{
+	const uint32_t psize = psize_from_voltage_range( voltage_range );
+
+	if( const uint32_t errors = wait_for_last_operation(); errors != 0 ) {
+		return errors;
+	}
+
+	for( uint32_t s = sector; s < sector + nb_sectors; s++ ) {
+		uint32_t snb = s;
+
+#ifdef FLASH_SECTOR_12
+		// Need to add offset of 4 when sector higher than FLASH_SECTOR_11
+		if( snb > FLASH_SECTOR_11 ) {
+			snb += 4U;
+		}
+#endif
+
+		FLASH->CR &= CR_PSIZE_MASK;
+		FLASH->CR |= psize;
+		FLASH->CR &= ~FLASH_CR_SNB;
+		FLASH->CR |= FLASH_CR_SER | (snb << FLASH_CR_SNB_Pos);
+		FLASH->CR |= FLASH_CR_STRT;
+
+		const uint32_t errors = wait_for_last_operation();
+
+		FLASH->CR &= ~(FLASH_CR_SER | FLASH_CR_SNB);
+
+		if( errors != 0 ) {
+			return errors;
+		}
+	}
+
+	return 0;
+}
+
+STM32_INTERNAL_FLASH_RAMFUNC uint32_t program( uint32_t target_address, const std::byte *source, std::size_t count, uint32_t psize )
+{
+	if( const uint32_t errors = wait_for_last_operation(); errors != 0 ) {
+		return errors;
+	}
+
+	FLASH->CR &= CR_PSIZE_MASK;
+	FLASH->CR |= psize;
+
+	for( std::size_t i = 0; i < count; i++ ) {
+
+		FLASH->CR |= FLASH_CR_PG;
+
+		switch( psize )
+		{
+		case FLASH_PSIZE_BYTE:
+			*reinterpret_cast<volatile uint8_t*>(target_address) = static_cast<uint8_t>(*source);
+			target_address += sizeof(uint8_t);
+			source += sizeof(uint8_t);
+			break;
+
+		case FLASH_PSIZE_HALF_WORD:
+			*reinterpret_cast<volatile uint16_t*>(target_address) = __UNALIGNED_UINT16_READ(source);
+			target_address += sizeof(uint16_t);
+			source += sizeof(uint16_t);
+			break;
+
+		default:
+			*reinterpret_cast<volatile uint32_t*>(target_address) = __UNALIGNED_UINT32_READ(source);
+			target_address += sizeof(uint32_t);
+			source += sizeof(uint32_t);
+			break;
+		}
+
+		const uint32_t errors = wait_for_last_operation();
+
+		FLASH->CR &= ~FLASH_CR_PG;
+
+		if( errors != 0 ) {
+			return errors;
+		}
+	}
+
+	return 0;
+}
+
+void flush_caches()
+{
+	FLASH_FlushCaches();
+}
+
+void relocate_vector_table()
+{
+	if( SCB->VTOR == reinterpret_cast<uint32_t>(_sram_vector) ) {
+		return;
+	}
+
+	const std::size_t count = std::min( _eisr_vector - _sisr_vector, _eram_vector - _sram_vector );
+
+	const uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	std::copy( _sisr_vector, _sisr_vector + count, _sram_vector );
+
+	__DSB();
+	SCB->VTOR = reinterpret_cast<uint32_t>(_sram_vector);
+	__DSB();
+	__ISB();
+
+	__set_PRIMASK( primask );
+}
+
+bool set_irq_handler( IRQn_Type irq, void (*handler)() )
+{
+	// the first 16 entries are the stack pointer and the system exceptions,
+	// which have negative numbers
+	const std::ptrdiff_t idx = 16 + static_cast<std::ptrdiff_t>( irq );
+	const std::ptrdiff_t count = std::min( _eisr_vector - _sisr_vector, _eram_vector - _sram_vector );
+
+	// entry 0 is the initial stack pointer, not a handler
+	if( idx < 1 || idx >= count ) {
+		return false;
+	}
+
+	relocate_vector_table();
+
+	_sram_vector[idx] = reinterpret_cast<uint32_t>(handler);
+	__DSB();
+
+	return true;
+}
+
+} // namespace ramfunc
+
+} // namespace stm32_internal_flash
+
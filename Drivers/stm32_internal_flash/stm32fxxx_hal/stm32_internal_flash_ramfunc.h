@@ -0,0 +1,72 @@
+/*
+ * Flash erase and program routines, that are executed from RAM.
+ *
+ * While the flash is busy, every fetch from flash stalls the bus.
+ * If the waiting loop is executed from RAM, interrupts are
+ * still served, as long as the vector table and the interrupt
+ * handlers are located in RAM too.
+ *
+ * Requires the .RamFunc and .ram_vector sections in the linker script.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+
+#ifndef DRIVERS_STM32_INTERNAL_FLASH_STM32FXXX_HAL_STM32_INTERNAL_FLASH_RAMFUNC_H_
+#define DRIVERS_STM32_INTERNAL_FLASH_STM32FXXX_HAL_STM32_INTERNAL_FLASH_RAMFUNC_H_
+
+#include "stm32_internal_flash.h"
+
+/**
+ * Places a function into RAM. Use it for interrupt handlers that
+ * have to run while the flash is busy. Such handlers must not call
+ * any function located in flash.
+ *
+ * long_call is required, since RAM is out of range of a relative branch from flash.
+ */
+#define STM32_INTERNAL_FLASH_RAMFUNC __attribute__((section(".RamFunc"), noinline, long_call))
+
+namespace stm32_internal_flash {
+
+namespace ramfunc {
+
+/**
+ * erases nb_sectors consecutive sectors, starting with sector.
+ * The flash has to be unlocked.
+ *
+ * returns the error flags of the FLASH->SR register, 0 on success
+ */
+uint32_t erase_sectors( uint32_t sector, uint32_t nb_sectors, uint32_t voltage_range ) STM32_INTERNAL_FLASH_RAMFUNC;
+
+/**
+ * programs count items of the given width to target_address.
+ * psize: FLASH_PSIZE_BYTE, FLASH_PSIZE_HALF_WORD or FLASH_PSIZE_WORD
+ * The flash has to be unlocked.
+ *
+ * returns the error flags of the FLASH->SR register, 0 on success
+ */
+uint32_t program( uint32_t target_address, const std::byte *source, std::size_t count, uint32_t psize ) STM32_INTERNAL_FLASH_RAMFUNC;
+
+/**
+ * Flushes instruction and data cache, has to be called after erasing.
+ */
+void flush_caches();
+
+/**
+ * Copies the vector table into RAM and moves VTOR there.
+ * Can be called more than once, the table is copied only once.
+ */
+void relocate_vector_table();
+
+/**
+ * Sets the handler of an interrupt in the RAM vector table.
+ * relocate_vector_table() is called if not done before.
+ * The handler should be marked with STM32_INTERNAL_FLASH_RAMFUNC.
+ * Returns false, if irq is outside of the relocated table.
+ */
+bool set_irq_handler( IRQn_Type irq, void (*handler)() );
+
+} // namespace ramfunc
+
+} // namespace stm32_internal_flash
+
+#endif /* DRIVERS_STM32_INTERNAL_FLASH_STM32FXXX_HAL_STM32_INTERNAL_FLASH_RAMFUNC_H_ */
@@ -7,6 +7,7 @@
  * @author Copyright (c) 2024 Martin Oberzalek
  */
 #include "stm32_internal_flash_raw.h"
+#include "stm32_internal_flash_ramfunc.h"
 #include <string.h>
 
 namespace stm32_internal_flash {
@@ -34,28 +35,25 @@ STM32InternalFlashHalRaw::STM32InternalFlashHalRaw( Configuration & conf_ )
 
 bool STM32InternalFlashHalRaw::erase_page_by_page_startaddress( std::size_t address, std::size_t size )
 {
-	auto sector = get_sector_from_address( address );
+	auto sector_idx = get_sector_index_from_address( address );
 
-	if( !sector ) {
+	if( !sector_idx ) {
 		error = Error::InvalidSectorAddress;
 		return false;
 	}
 
-	FLASH_EraseInitTypeDef EraseInitStruct {};
-	uint32_t PAGEError = 0;
+	const auto & sectors = conf.used_sectors;
 
-	EraseInitStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
-	EraseInitStruct.Banks     = conf.banks;
-	EraseInitStruct.Sector	  = sector->sector;
-	EraseInitStruct.NbSectors = size / sector->size;
+	// sectors can have different sizes, count the sectors covered by size, at least one
+	const std::size_t first_idx = sector_idx.value();
+	std::size_t end_idx = first_idx + 1;
+	std::size_t covered_size = sectors[first_idx].size;
 
-	if( EraseInitStruct.NbSectors == 0 ) {
-		 EraseInitStruct.NbSectors = 1;
+	while( end_idx < sectors.size() && covered_size + sectors[end_idx].size <= size ) {
+		covered_size += sectors[end_idx].size;
+		end_idx++;
 	}
 
-	EraseInitStruct.VoltageRange = conf.voltage_range;
-
-
 	if( HAL_FLASH_Unlock() != HAL_OK) {
 		error = Error(Error::ErrorUnlockingFlash);
 		return false;
@@ -65,9 +63,68 @@ bool STM32InternalFlashHalRaw::erase_page_by_page_startaddress( std::size_t addr
 
 	clear_flags();
 
-	if (HAL_FLASHEx_Erase(&EraseInitStruct, &PAGEError) != HAL_OK) {
-		error = Error(Error::ErrorErasingFlash);
-		return false;
+	for( uint32_t retry = 0; ; retry++ ) {
+		if( !erase_sectors( first_idx, end_idx ) ) {
+			return false;
+		}
+
+		if( !conf.verify ) {
+			return true;
+		}
+
+		const std::size_t blank_size = find_first_non_blank( std::span<const std::byte>( reinterpret_cast<const std::byte*>( address ), covered_size ) );
+		verify_statistic.erased_bytes += covered_size;
+
+		if( blank_size == covered_size ) {
+			return true;
+		}
+
+		if( retry >= conf.verify_retries ) {
+			error = Error(Error::VerifyEraseFailed, blank_size);
+			return false;
+		}
+
+		verify_statistic.erase_retries++;
+	}
+}
+
+bool STM32InternalFlashHalRaw::erase_sectors( std::size_t first_idx, std::size_t end_idx )
+{
+	const auto & sectors = conf.used_sectors;
+
+	FLASH_EraseInitTypeDef EraseInitStruct {};
+	uint32_t PAGEError = 0;
+
+	EraseInitStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
+	EraseInitStruct.Banks     = conf.banks;
+	EraseInitStruct.VoltageRange = conf.voltage_range;
+
+	// HAL can erase consecutive sector numbers with one call
+	for( std::size_t idx = first_idx; idx < end_idx; ) {
+		std::size_t run_end_idx = idx + 1;
+
+		while( run_end_idx < end_idx && sectors[run_end_idx].sector == sectors[run_end_idx-1].sector + 1 ) {
+			run_end_idx++;
+		}
+
+		EraseInitStruct.Sector	  = sectors[idx].sector;
+		EraseInitStruct.NbSectors = run_end_idx - idx;
+
+		if( conf.execute_from_ram ) {
+			const uint32_t flash_errors = ramfunc::erase_sectors( EraseInitStruct.Sector, EraseInitStruct.NbSectors, EraseInitStruct.VoltageRange );
+			ramfunc::flush_caches();
+
+			if( flash_errors != 0 ) {
+				error = Error(Error::ErrorErasingFlash, flash_errors);
+				return false;
+			}
+
+		} else if (HAL_FLASHEx_Erase(&EraseInitStruct, &PAGEError) != HAL_OK) {
+			error = Error(Error::ErrorErasingFlash);
+			return false;
+		}
+
+		idx = run_end_idx;
 	}
 
 	return true;
@@ -87,15 +144,32 @@ void STM32InternalFlashHalRaw::clear_flags()
 						   FLASH_SR_BSY );
 }
 
-std::optional<Configuration::Sector> STM32InternalFlashHalRaw::get_sector_from_address( std::size_t address ) const
+std::optional<std::size_t> STM32InternalFlashHalRaw::get_sector_index_from_address( std::size_t address ) const
 {
-	for( const Configuration::Sector & sec : conf.used_sectors ) {
-		if( address == sec.start_address ) {
-			return sec;
-		}
+	const std::size_t first_sector_address = conf.used_sectors[0].start_address;
+
+	if( address < first_sector_address ) {
+		return {};
 	}
 
-	return {};
+	const std::size_t idx = conf.get_sector_index( address - first_sector_address );
+
+	if( idx >= conf.used_sectors.size() || conf.used_sectors[idx].start_address != address ) {
+		return {};
+	}
+
+	return idx;
+}
+
+void STM32InternalFlashHalRaw::reset_data_cache()
+{
+	if( (FLASH->ACR & FLASH_ACR_DCEN) == 0 ) {
+		return;
+	}
+
+	__HAL_FLASH_DATA_CACHE_DISABLE();
+	__HAL_FLASH_DATA_CACHE_RESET();
+	__HAL_FLASH_DATA_CACHE_ENABLE();
 }
 
 std::size_t STM32InternalFlashHalRaw::write_page( std::size_t address, const std::span<const std::byte> & buffer )
@@ -109,13 +183,69 @@ std::size_t STM32InternalFlashHalRaw::write_page( std::size_t address, const std
 
 	clear_flags();
 
+	const std::size_t size_written = program( address, buffer );
+
+	if( !conf.verify || size_written != buffer.size() ) {
+		return size_written;
+	}
+
+	for( uint32_t retry = 0; ; retry++ ) {
+		reset_data_cache();
+
+		const std::byte *flash = conf.data_ptr + address;
+		const std::size_t matching = find_first_mismatch( flash, buffer );
+		verify_statistic.programmed_bytes += buffer.size();
+
+		if( matching == buffer.size() ) {
+			return size_written;
+		}
+
+		// bits that are already cleared too much can't be fixed without an erase
+		const std::span<const std::byte> rest = buffer.subspan( matching );
+
+		if( retry >= conf.verify_retries || !is_reprogrammable( flash + matching, rest ) ) {
+			error = Error(Error::VerifyProgramFailed, matching);
+			return matching;
+		}
+
+		verify_statistic.program_retries++;
+
+		// the matching words are programmed with the same value again, that's harmless
+		if( program( address + matching, rest ) != rest.size() ) {
+			return matching;
+		}
+	}
+}
+
+std::size_t STM32InternalFlashHalRaw::program( std::size_t address, const std::span<const std::byte> & buffer )
+{
 	auto do_write = [this]( uint32_t TypeProgram, auto data_type, std::size_t address, const std::span<const std::byte> & buffer ) {
 		using data_t = decltype(data_type);
 		constexpr uint32_t data_step_size = sizeof(data_t);
 		std::size_t size_written = 0;
 		const uint32_t start_offset = reinterpret_cast<uint32_t>(conf.data_ptr);
 
-		for( uint32_t offset = 0; offset <= buffer.size() - data_step_size; offset += data_step_size ) {
+		if( conf.execute_from_ram ) {
+			uint32_t psize = FLASH_PSIZE_BYTE;
+
+			if( data_step_size == sizeof(uint32_t) ) {
+				psize = FLASH_PSIZE_WORD;
+			} else if( data_step_size == sizeof(uint16_t) ) {
+				psize = FLASH_PSIZE_HALF_WORD;
+			}
+
+			const std::size_t count = buffer.size() / data_step_size;
+
+			// the whole loop runs from RAM
+			if( const uint32_t flash_errors = ramfunc::program( start_offset + address, buffer.data(), count, psize ); flash_errors != 0 ) {
+				error = Error(Error::HAL_Error, flash_errors);
+				return size_written;
+			}
+
+			return count * data_step_size;
+		}
+
+		for( uint32_t offset = 0; offset + data_step_size <= buffer.size(); offset += data_step_size ) {
 
 			std::size_t target_address = start_offset + address + offset;
 			const data_t *source = reinterpret_cast<const data_t*>(buffer.data() + offset);
@@ -136,28 +266,55 @@ std::size_t STM32InternalFlashHalRaw::write_page( std::size_t address, const std
 		return size_written;
 	};
 
-	std::size_t size_written = 0;
+	/*
+	 * The program width depends on the voltage range: bytes at 1.8V-2.1V,
+	 * half words at 2.1V-2.7V, words above.
+	 * Double word programming requires an external power supply of 9V,
+	 * so words are used in this case too.
+	 */
+	const std::size_t width = std::min( geometry::get_program_width( conf.voltage_range ), sizeof(uint32_t) );
+
+	/*
+	 * The program width has to match the alignment of the target address,
+	 * so unaligned head and tail bytes are programmed byte wise
+	 * and everything in between with the full width.
+	 */
+	const std::size_t head_size = std::min( buffer.size(), (width - address % width) % width );
+	const std::size_t body_size = (buffer.size() - head_size) - (buffer.size() - head_size) % width;
+	const std::size_t tail_size = buffer.size() - head_size - body_size;
+
+	std::size_t size_written = do_write( FLASH_TYPEPROGRAM_BYTE, (uint8_t)1, address, buffer.subspan( 0, head_size ) );
+
+	if( size_written != head_size ) {
+		return size_written;
+	}
 
-	// Double word programming requires an external power supply of 9V
-/*
-	if( buffer.size() % sizeof(uint64_t) == 0 ) {
-		size_written = do_write( FLASH_TYPEPROGRAM_DOUBLEWORD, (uint64_t)1, address, buffer );
-	}
-*/
-	if( buffer.size() % sizeof(uint32_t) == 0 ) {
-		size_written = do_write( FLASH_TYPEPROGRAM_WORD,       (uint32_t)1, address, buffer );
-	} else if( buffer.size() % sizeof(uint16_t) == 0 ) {
-		size_written = do_write( FLASH_TYPEPROGRAM_HALFWORD,   (uint16_t)1, address, buffer );
+	const std::span<const std::byte> body = buffer.subspan( head_size, body_size );
+
+	if( width == sizeof(uint32_t) ) {
+		size_written += do_write( FLASH_TYPEPROGRAM_WORD, (uint32_t)1, address + head_size, body );
+	} else if( width == sizeof(uint16_t) ) {
+		size_written += do_write( FLASH_TYPEPROGRAM_HALFWORD, (uint16_t)1, address + head_size, body );
 	} else {
-		size_written = do_write( FLASH_TYPEPROGRAM_BYTE,       (uint16_t)1, address, buffer );
+		size_written += do_write( FLASH_TYPEPROGRAM_BYTE, (uint8_t)1, address + head_size, body );
 	}
 
+	if( size_written != head_size + body_size ) {
+		return size_written;
+	}
+
+	size_written += do_write( FLASH_TYPEPROGRAM_BYTE, (uint8_t)1, address + head_size + body_size, buffer.subspan( head_size + body_size, tail_size ) );
+
 	return size_written;
 }
 
 std::size_t STM32InternalFlashHalRaw::read_page( std::size_t address, std::span<std::byte> & buffer )
 {
-	std::size_t data_size = std::min( buffer.size(), conf.size );
+	if( address > conf.size ) {
+		return 0;
+	}
+
+	std::size_t data_size = std::min( buffer.size(), conf.size - address );
 
 	std::byte* source_address = conf.data_ptr + address;
 
@@ -168,7 +325,44 @@ std::size_t STM32InternalFlashHalRaw::read_page( std::size_t address, std::span<
 
 std::size_t STM32InternalFlashHalRaw::get_page_size()
 {
-	return conf.used_sectors.begin()->size;
+	return conf.max_sector_size;
+}
+
+std::size_t STM32InternalFlashHalRaw::get_page_size_at( std::size_t address )
+{
+	const std::size_t idx = conf.get_sector_index( address );
+
+	if( idx >= conf.used_sectors.size() ) {
+		return conf.max_sector_size;
+	}
+
+	return conf.used_sectors[idx].size;
+}
+
+std::size_t STM32InternalFlashHalRaw::get_page_start_address( std::size_t address )
+{
+	const std::size_t idx = conf.get_sector_index( address );
+
+	if( idx >= conf.used_sectors.size() ) {
+		return address;
+	}
+
+	return conf.get_sector_offset( idx );
+}
+
+std::size_t STM32InternalFlashHalRaw::get_page_index( std::size_t address )
+{
+	return conf.get_sector_index( address );
+}
+
+bool STM32InternalFlashHalRaw::is_blank( std::size_t address, std::size_t size )
+{
+	if( address > conf.size || size > conf.size - address ) {
+		return false;
+	}
+
+	// flash is memory mapped, no need to copy anything
+	return stm32_internal_flash::is_blank( std::span<const std::byte>( conf.data_ptr + address, size ) );
 }
 
 bool STM32InternalFlashHalRaw::erase_page( std::size_t address, std::size_t size )
@@ -22,8 +22,19 @@ namespace stm32_internal_flash {
 
 class STM32InternalFlashHalRaw : public RawDriverInterface
 {
+public:
+	struct VerifyStatistic
+	{
+		std::size_t programmed_bytes = 0; // verified after programming
+		std::size_t erased_bytes = 0;     // blank checked after erasing
+		std::size_t program_retries = 0;
+		std::size_t erase_retries = 0;
+	};
+
+private:
 	Configuration & conf;
 	std::optional<Error> error;
+	VerifyStatistic verify_statistic;
 
 public:
 	STM32InternalFlashHalRaw( Configuration & conf );
@@ -38,7 +49,7 @@ public:
 
 	/**
 	 * erases on or more pages
-	 * size has to be page size
+	 * size has to be page size, pages can have different sizes
 	 */
 	bool erase_page_by_page_startaddress( std::size_t page_start_address, std::size_t size );
 
@@ -50,12 +61,23 @@ public:
 		error = {};
 	}
 
+	const VerifyStatistic & get_verify_statistic() const {
+		return verify_statistic;
+	}
+
+	void clear_verify_statistic() {
+		verify_statistic = VerifyStatistic();
+	}
+
 	/*
 	 * Writes a page to flash, the memory has to be erased before.
 	 * The function is not doing this automatically.
 	 * After a write operation HAL driver is flushing the caches, of course there can be program code located.
 	 *
 	 * Buffer: can be smaller then page size.
+	 *
+	 * With conf.verify the written range is compared with the buffer,
+	 * on a failed verify the number of matching bytes is returned.
 	 */
 	std::size_t write_page( std::size_t address, const std::span<const std::byte> & buffer ) override;
 
@@ -66,16 +88,54 @@ public:
 	 */
 	std::size_t read_page( std::size_t address, std::span<std::byte> & buffer )  override;
 
+	/**
+	 * size of the largest sector
+	 */
 	std::size_t get_page_size() override;
 
+	std::size_t get_page_size_at( std::size_t address ) override;
+	std::size_t get_page_start_address( std::size_t address ) override;
+	std::size_t get_page_index( std::size_t address ) override;
+
 	/**
-	 * Erases at least one page. size has to be a multiple of PAGE_SIZE
+	 * checks the memory mapped flash directly, word wide with early exit
+	 */
+	bool is_blank( std::size_t address, std::size_t size ) override;
+
+	/**
+	 * flash is memory mapped
+	 */
+	const std::byte* get_mapped_address( std::size_t address ) override {
+		return address < conf.size ? conf.data_ptr + address : nullptr;
+	}
+
+	/**
+	 * Erases at least one page. size has to be the sum of the sizes of the erased pages.
 	 */
 	bool erase_page( std::size_t address, std::size_t size ) override;
 
 private:
-	std::optional<Configuration::Sector> get_sector_from_address( std::size_t address ) const;
+	/**
+	 * returns the index of the sector, starting exactly at the address
+	 */
+	std::optional<std::size_t> get_sector_index_from_address( std::size_t address ) const;
 	void clear_flags();
+
+	/**
+	 * erases the sectors used_sectors[first_idx] ... used_sectors[end_idx-1]
+	 * The flash has to be unlocked.
+	 */
+	bool erase_sectors( std::size_t first_idx, std::size_t end_idx );
+
+	/**
+	 * programs the buffer without verifying, the flash has to be unlocked.
+	 */
+	std::size_t program( std::size_t address, const std::span<const std::byte> & buffer );
+
+	/**
+	 * The data cache could still hold the content from before programming.
+	 */
+	void reset_data_cache();
 };
 
 } // namespace smt32_internal_flash
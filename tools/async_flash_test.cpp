@@ -0,0 +1,336 @@
+/*
+ * Host test of the AsyncFlashDriver and the Executor.
+ *
+ * The simulated FLASH_FS sectors (16K, 16K, 16K, 64K) advance their clock
+ * with the typical STM32F4 erase and program times. The Executor runs a
+ * flash task next to a task that only yields, like the rest of the
+ * superloop would. The time each run_once() takes is taken from the
+ * simulated clock, so the longest stall of the superloop is known:
+ *
+ * - a program step may exceed step_budget_us by one chunk of words
+ * - an erase step takes one page erase, blank pages are not erased at all
+ *
+ * Also checked: the written data, restoring the rest of a partly written
+ * page from the page buffer, reading, two flash tasks at the same time
+ * and errors for ranges outside of the flash.
+ *
+ * Build on the host:
+ *   g++ -std=c++20 -O2 -I../Drivers/stm32_internal_flash/Inc -o async_flash_test async_flash_test.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/AsyncFlashDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/Executor.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/IncrementalWriter.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/SimulatedRawDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/BlankCheck.cpp
+ *
+ * Usage:
+ *   async_flash_test
+ *
+ * Returns 1 if one of the checks fails.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "AsyncFlashDriver.h"
+#include "SimulatedRawDriver.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <vector>
+
+using namespace stm32_internal_flash;
+
+namespace {
+
+using bytes_t = std::vector<std::byte>;
+
+constexpr std::size_t SECTOR_SIZES[] = { 16*1024, 16*1024, 16*1024, 64*1024 };
+constexpr std::size_t FLASH_SIZE = 112*1024;
+
+// time the rest of the superloop needs for each run_once()
+constexpr uint64_t SUPERLOOP_US = 20;
+
+struct Setup
+{
+	bytes_t memory;
+	SimulatedRawDriver raw_driver;
+	Executor executor;
+	AsyncFlashDriver flash;
+
+	Setup( uint32_t step_budget_us )
+	: memory( FLASH_SIZE, std::byte(0xFF) ),
+	  raw_driver( memory, SECTOR_SIZES ),
+	  flash( raw_driver, executor, [this]() {
+		  return static_cast<uint32_t>( raw_driver.get_microseconds() );
+	  })
+	{
+		flash.step_budget_us = step_budget_us;
+	}
+};
+
+struct StepStatistic
+{
+	unsigned steps = 0;
+	unsigned erase_steps = 0;
+	uint64_t max_program_step_us = 0;
+	uint64_t max_erase_step_us = 0;
+	uint64_t total_us = 0;
+};
+
+/**
+ * runs the executor like a superloop, until all tasks are done
+ */
+StepStatistic run( Setup & setup )
+{
+	StepStatistic statistic;
+	const uint64_t start = setup.raw_driver.get_microseconds();
+
+	while( true ) {
+		const uint64_t step_start = setup.raw_driver.get_microseconds();
+		const std::size_t erases_before = setup.raw_driver.get_statistic().erase_operations;
+
+		if( !setup.executor.run_once() ) {
+			break;
+		}
+
+		const uint64_t step_us = setup.raw_driver.get_microseconds() - step_start;
+
+		statistic.steps++;
+
+		if( setup.raw_driver.get_statistic().erase_operations != erases_before ) {
+			statistic.erase_steps++;
+			statistic.max_erase_step_us = std::max( statistic.max_erase_step_us, step_us );
+		} else {
+			statistic.max_program_step_us = std::max( statistic.max_program_step_us, step_us );
+		}
+
+		setup.raw_driver.advance_time( SUPERLOOP_US );
+	}
+
+	statistic.total_us = setup.raw_driver.get_microseconds() - start;
+
+	return statistic;
+}
+
+void fill( bytes_t & data, unsigned seed )
+{
+	for( std::size_t i = 0; i < data.size(); i++ ) {
+		data[i] = static_cast<std::byte>( i * 7 + seed + (i >> 8) );
+	}
+}
+
+Task<void> erase_and_write( AsyncFlashDriver & flash, std::size_t address, std::span<const std::byte> data,
+		std::span<std::byte> *page_buffer, bool & ok )
+{
+	const bool erased = co_await flash.erase( address, data.size() );
+
+	if( !erased ) {
+		co_return;
+	}
+
+	const std::size_t written = co_await flash.write( address, data, page_buffer );
+
+	ok = written == data.size();
+}
+
+Task<void> write_only( AsyncFlashDriver & flash, std::size_t address, std::span<const std::byte> data,
+		std::span<std::byte> *page_buffer, bool & ok )
+{
+	const std::size_t written = co_await flash.write( address, data, page_buffer );
+
+	ok = written == data.size();
+}
+
+Task<void> read_back( AsyncFlashDriver & flash, std::size_t address, std::span<const std::byte> expected, bool & ok )
+{
+	bytes_t buffer( expected.size() );
+	std::span<std::byte> data( buffer );
+
+	const std::size_t len = co_await flash.read( address, data );
+
+	ok = len == expected.size() && std::equal( buffer.begin(), buffer.end(), expected.begin() );
+}
+
+/**
+ * the rest of the superloop, counts how often it got the CPU
+ */
+Task<void> superloop_task( Executor & executor, const bool & flash_done, unsigned & turns )
+{
+	while( !flash_done ) {
+		co_await executor_yield( executor );
+		turns++;
+	}
+}
+
+Task<void> until_done( Task<void> task, bool & done )
+{
+	co_await std::move( task );
+	done = true;
+}
+
+Task<void> out_of_range( AsyncFlashDriver & flash, bool & erase_failed, bool & write_failed )
+{
+	std::array<std::byte,16> data {};
+
+	const bool erased = co_await flash.erase( FLASH_SIZE - 8*1024, 16*1024 );
+	erase_failed = !erased;
+
+	const std::size_t written = co_await flash.write( FLASH_SIZE - 8, data );
+	write_failed = written < data.size();
+}
+
+bool check( const char *name, bool ok )
+{
+	printf( "%-60s %s\n", name, ok ? "Ok" : "ERROR" );
+	return ok;
+}
+
+/**
+ * writes the three 16K sectors with different step budgets
+ */
+bool test_step_budgets()
+{
+	bool ok = true;
+
+	printf( "%10s %8s %12s %14s %14s %12s %10s\n",
+			"budget us", "steps", "erase steps", "max prog us", "max erase us", "total ms", "turns" );
+
+	for( uint32_t budget_us : { 200u, 500u, 2000u } ) {
+		Setup setup( budget_us );
+
+		// something to erase
+		std::fill( setup.memory.begin(), setup.memory.begin() + 48*1024, std::byte(0x00) );
+
+		bytes_t data( 48*1024 );
+		fill( data, budget_us );
+
+		bool write_ok = false;
+		bool flash_done = false;
+		unsigned turns = 0;
+
+		setup.executor.spawn( until_done( erase_and_write( setup.flash, 0, data, nullptr, write_ok ), flash_done ) );
+		setup.executor.spawn( superloop_task( setup.executor, flash_done, turns ) );
+
+		const StepStatistic statistic = run( setup );
+
+		printf( "%10u %8u %12u %14llu %14llu %12.1f %10u\n",
+				budget_us, statistic.steps, statistic.erase_steps,
+				static_cast<unsigned long long>( statistic.max_program_step_us ),
+				static_cast<unsigned long long>( statistic.max_erase_step_us ),
+				statistic.total_us / 1000.0, turns );
+
+		const SimulatedRawDriver::Timing & timing = setup.raw_driver.timing;
+		const uint64_t max_program_us = budget_us + IncrementalWriter::CHUNK_WORDS * timing.program_word_us;
+		const uint64_t max_erase_us = timing.erase_base_us + 16 * timing.erase_per_kb_us;
+
+		ok &= write_ok;
+		ok &= std::equal( data.begin(), data.end(), setup.memory.begin() );
+		ok &= statistic.erase_steps == 3;
+		ok &= statistic.max_program_step_us <= max_program_us;
+		ok &= statistic.max_erase_step_us <= max_erase_us;
+
+		// the superloop got the CPU between the steps
+		ok &= turns + 1 >= statistic.steps;
+	}
+
+	return check( "program steps stay in the budget, one erase per step", ok );
+}
+
+bool test_blank_pages_not_erased()
+{
+	Setup setup( 500 );
+
+	bytes_t data( 20*1024 );
+	fill( data, 1 );
+
+	bool write_ok = false;
+	setup.executor.spawn( erase_and_write( setup.flash, 16*1024, data, nullptr, write_ok ) );
+	run( setup );
+
+	return check( "erase skips blank pages",
+			write_ok &&
+			setup.raw_driver.get_statistic().erase_operations == 0 &&
+			std::equal( data.begin(), data.end(), setup.memory.begin() + 16*1024 ) );
+}
+
+bool test_page_buffer_restores_page()
+{
+	Setup setup( 500 );
+
+	bytes_t old_data( 16*1024 );
+	fill( old_data, 2 );
+	std::copy( old_data.begin(), old_data.end(), setup.memory.begin() + 32*1024 );
+
+	bytes_t data( 100 );
+	fill( data, 3 );
+
+	bytes_t page_memory( 64*1024 );
+	std::span<std::byte> page_buffer( page_memory );
+
+	bool write_ok = false;
+	setup.executor.spawn( write_only( setup.flash, 32*1024 + 1000, data, &page_buffer, write_ok ) );
+	run( setup );
+
+	bytes_t expected = old_data;
+	std::copy( data.begin(), data.end(), expected.begin() + 1000 );
+
+	return check( "the rest of a partly written page is restored",
+			write_ok &&
+			setup.raw_driver.get_statistic().erase_operations == 1 &&
+			std::equal( expected.begin(), expected.end(), setup.memory.begin() + 32*1024 ) );
+}
+
+bool test_two_writers()
+{
+	Setup setup( 500 );
+
+	bytes_t data_a( 10*1024 );
+	bytes_t data_b( 30*1024 );
+	fill( data_a, 4 );
+	fill( data_b, 5 );
+
+	bool ok_a = false;
+	bool ok_b = false;
+	bool read_ok = false;
+
+	setup.executor.spawn( erase_and_write( setup.flash, 0, data_a, nullptr, ok_a ) );
+	setup.executor.spawn( erase_and_write( setup.flash, 48*1024, data_b, nullptr, ok_b ) );
+	run( setup );
+
+	setup.executor.spawn( read_back( setup.flash, 48*1024, data_b, read_ok ) );
+	run( setup );
+
+	return check( "two tasks write at the same time, and read back",
+			ok_a && ok_b && read_ok &&
+			std::equal( data_a.begin(), data_a.end(), setup.memory.begin() ) &&
+			std::equal( data_b.begin(), data_b.end(), setup.memory.begin() + 48*1024 ) );
+}
+
+bool test_out_of_range()
+{
+	Setup setup( 500 );
+
+	bool erase_failed = false;
+	bool write_failed = false;
+
+	setup.executor.spawn( out_of_range( setup.flash, erase_failed, write_failed ) );
+	run( setup );
+
+	return check( "ranges outside of the flash fail",
+			erase_failed && write_failed &&
+			setup.raw_driver.get_statistic().erase_operations == 0 &&
+			setup.raw_driver.get_statistic().program_operations == 0 );
+}
+
+} // namespace
+
+int main()
+{
+	bool ok = true;
+
+	ok &= test_step_budgets();
+	ok &= test_blank_pages_not_erased();
+	ok &= test_page_buffer_restores_page();
+	ok &= test_two_writers();
+	ok &= test_out_of_range();
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,324 @@
+/*
+ * Benchmarks the CachedMemoryInterface in front of a slow JBOD member.
+ *
+ * The JBOD consists of the simulated internal FLASH_FS sectors and a
+ * simulated external 1MB NOR flash with 4K pages, that is not memory
+ * mapped and costs a fixed latency per access plus transfer time.
+ * Each read pattern runs against the uncached and the cached setups,
+ * the read time is taken from the simulated clock of the external device.
+ *
+ * Build on the host:
+ *   g++ -std=c++20 -O2 -I../Drivers/stm32_internal_flash/Inc -o cache_benchmark cache_benchmark.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/CachedMemoryInterface.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/JBODGenericFlashDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/GenericFlashDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/SimulatedRawDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/BlankCheck.cpp
+ *
+ * Usage:
+ *   cache_benchmark [--latency us] [--per-kb us] [--ops count]
+ *
+ *   --latency  time of each access to the external device, default 40us
+ *   --per-kb   transfer time per KB, default 80us (about 100MBit/s SPI)
+ *   --ops      reads per pattern, default 20000
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "CachedMemoryInterface.h"
+#include "JBODGenericFlashDriver.h"
+#include "GenericFlashDriver.h"
+#include "SimulatedRawDriver.h"
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace stm32_internal_flash;
+
+namespace {
+
+using bytes_t = std::vector<std::byte>;
+
+constexpr std::size_t INTERNAL_SECTOR_SIZES[] = { 16*1024, 16*1024, 16*1024, 64*1024 };
+constexpr std::size_t INTERNAL_SIZE = 112*1024;
+
+constexpr std::size_t EXTERNAL_PAGE_SIZE = 4*1024;
+constexpr std::size_t EXTERNAL_SIZE = 1024*1024;
+
+struct Options
+{
+	uint32_t latency_us = 40;
+	uint32_t per_kb_us = 80;
+	unsigned ops = 20000;
+};
+
+struct CacheConfig
+{
+	const char *name;
+	std::size_t block_size;   // 0: no cache
+	std::size_t budget;
+	std::size_t read_ahead;
+};
+
+constexpr CacheConfig CACHE_CONFIGS[] = {
+	{ "uncached",       0,         0, 0 },
+	{ "256B x 16",    256,  4*1024, 0 },
+	{ "256B x 16 ra2", 256,  4*1024, 2 },
+	{ "512B x 32",    512, 16*1024, 1 },
+	{ "1K x 16 ra2",  1024, 16*1024, 2 },
+};
+
+/**
+ * internal flash and external device in a JBOD, optionally the external one cached
+ */
+struct Storage
+{
+	bytes_t internal_memory;
+	bytes_t external_memory;
+	std::vector<std::size_t> external_pages;
+
+	SimulatedRawDriver internal_raw;
+	SimulatedRawDriver external_raw;
+	GenericFlashDriver internal;
+	GenericFlashDriver external;
+
+	bytes_t cache_memory;
+	std::optional<CachedMemoryInterface> cached;
+
+	std::array<MemoryInterface*,2> members;
+	JBODGenericFlashDriver jbod;
+
+	Storage( const Options & options, const CacheConfig & config )
+	: internal_memory( INTERNAL_SIZE ),
+	  external_memory( EXTERNAL_SIZE ),
+	  external_pages( EXTERNAL_SIZE / EXTERNAL_PAGE_SIZE, EXTERNAL_PAGE_SIZE ),
+	  internal_raw( internal_memory, INTERNAL_SECTOR_SIZES ),
+	  external_raw( external_memory, external_pages ),
+	  internal( internal_raw ),
+	  external( external_raw ),
+	  cache_memory( config.budget ),
+	  members{ &internal, &external },
+	  jbod( members )
+	{
+		for( std::size_t i = 0; i < internal_memory.size(); i++ ) {
+			internal_memory[i] = static_cast<std::byte>( i * 13 + 1 );
+		}
+
+		for( std::size_t i = 0; i < external_memory.size(); i++ ) {
+			external_memory[i] = static_cast<std::byte>( (i * 7) ^ (i >> 9) );
+		}
+
+		external_raw.memory_mapped = false;
+		external_raw.timing.read_access_us = options.latency_us;
+		external_raw.timing.read_per_kb_us = options.per_kb_us;
+		// a SPI NOR flash: 4K sector erase about 45ms, page program about 1us per word
+		external_raw.timing.erase_base_us = 45000;
+		external_raw.timing.erase_per_kb_us = 0;
+		external_raw.timing.program_word_us = 1;
+
+		if( config.block_size > 0 ) {
+			cached.emplace( external, cache_memory, config.block_size );
+			cached->read_ahead = config.read_ahead;
+			members[1] = &*cached;
+		}
+	}
+};
+
+struct Result
+{
+	uint64_t us = 0;
+	std::size_t accesses = 0;
+	std::size_t errors = 0;
+};
+
+/**
+ * reads and compares with the simulated memory
+ */
+void read_and_check( Storage & storage, std::size_t address, std::size_t size, Result & result )
+{
+	std::array<std::byte,256> buffer;
+	std::span<std::byte> data( buffer.data(), size );
+
+	const uint64_t start = storage.external_raw.get_microseconds();
+	const std::size_t len = storage.jbod.read( address, data );
+
+	result.us += storage.external_raw.get_microseconds() - start;
+
+	if( len != size ) {
+		result.errors++;
+		return;
+	}
+
+	const std::byte *expected = address < INTERNAL_SIZE ?
+			storage.internal_memory.data() + address :
+			storage.external_memory.data() + address - INTERNAL_SIZE;
+
+	if( memcmp( data.data(), expected, size ) != 0 ) {
+		result.errors++;
+	}
+}
+
+/**
+ * 32 byte records of a 64K table, 90% of the reads go to 4K of it
+ */
+void pattern_records( Storage & storage, const Options & options, Result & result )
+{
+	std::mt19937 rng( 1 );
+
+	for( unsigned op = 0; op < options.ops; op++ ) {
+		const bool hot = rng() % 10 != 0;
+		const std::size_t record = rng() % (hot ? 4*1024 / 32 : 64*1024 / 32);
+		read_and_check( storage, INTERNAL_SIZE + 128*1024 + record * 32, 32, result );
+	}
+}
+
+/**
+ * 64 byte reads straight through the device, like a parser reading a file
+ */
+void pattern_stream( Storage & storage, const Options & options, Result & result )
+{
+	for( unsigned op = 0; op < options.ops; op++ ) {
+		read_and_check( storage, INTERNAL_SIZE + (op * 64) % EXTERNAL_SIZE, 64, result );
+	}
+}
+
+/**
+ * 16 byte reads anywhere on the device, no cache can help here
+ */
+void pattern_uniform( Storage & storage, const Options & options, Result & result )
+{
+	std::mt19937 rng( 2 );
+
+	for( unsigned op = 0; op < options.ops; op++ ) {
+		read_and_check( storage, INTERNAL_SIZE + rng() % (EXTERNAL_SIZE - 16), 16, result );
+	}
+}
+
+/**
+ * records of the internal and the external member, every 100th read
+ * an external record is rewritten, which invalidates its page
+ */
+void pattern_mixed( Storage & storage, const Options & options, Result & result )
+{
+	std::mt19937 rng( 3 );
+	bytes_t record( 32 );
+
+	for( unsigned op = 0; op < options.ops; op++ ) {
+		const std::size_t idx = rng() % (4*1024 / 32);
+
+		if( op % 100 == 99 ) {
+			for( std::size_t i = 0; i < record.size(); i++ ) {
+				record[i] = static_cast<std::byte>( op + i );
+			}
+
+			if( storage.jbod.write( INTERNAL_SIZE + idx * 32, record ) != record.size() ) {
+				result.errors++;
+			}
+
+			continue;
+		}
+
+		if( op % 2 ) {
+			read_and_check( storage, idx * 32, 32, result );
+		} else {
+			read_and_check( storage, INTERNAL_SIZE + idx * 32, 32, result );
+		}
+	}
+}
+
+struct Pattern
+{
+	const char *name;
+	void (*run)( Storage & storage, const Options & options, Result & result );
+};
+
+constexpr Pattern PATTERNS[] = {
+	{ "records", pattern_records },
+	{ "stream",  pattern_stream },
+	{ "uniform", pattern_uniform },
+	{ "mixed",   pattern_mixed },
+};
+
+bool parse_args( int argc, char **argv, Options & options )
+{
+	for( int i = 1; i < argc; i++ ) {
+		const std::string arg = argv[i];
+
+		if( i + 1 >= argc ) {
+			return false;
+		}
+
+		const unsigned long value = std::strtoul( argv[++i], nullptr, 10 );
+
+		if( arg == "--latency" ) {
+			options.latency_us = value;
+		} else if( arg == "--per-kb" ) {
+			options.per_kb_us = value;
+		} else if( arg == "--ops" ) {
+			options.ops = value;
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+} // namespace
+
+int main( int argc, char **argv )
+{
+	Options options;
+
+	if( !parse_args( argc, argv, options ) ) {
+		std::printf( "usage: %s [--latency us] [--per-kb us] [--ops count]\n", argv[0] );
+		return 1;
+	}
+
+	std::printf( "external device: %uus per access, %uus per KB, %u reads per pattern\n",
+			options.latency_us, options.per_kb_us, options.ops );
+
+	bool ok = true;
+
+	for( const Pattern & pattern : PATTERNS ) {
+		std::printf( "\n%s:\n", pattern.name );
+
+		uint64_t uncached_us = 0;
+
+		for( const CacheConfig & config : CACHE_CONFIGS ) {
+			Storage storage( options, config );
+			Result result;
+
+			pattern.run( storage, options, result );
+
+			result.accesses = storage.external_raw.get_statistic().read_operations;
+
+			if( config.block_size == 0 ) {
+				uncached_us = result.us;
+			}
+
+			double hit_rate = 0;
+
+			if( storage.cached ) {
+				const auto & statistic = storage.cached->get_statistic();
+				const std::size_t lookups = statistic.hits + statistic.misses;
+				hit_rate = lookups ? 100.0 * statistic.hits / lookups : 0.0;
+			}
+
+			std::printf( "  %-14s %9.1f ms %7zu device reads  hit rate %5.1f%%  speedup %5.2f%s\n",
+					config.name,
+					static_cast<double>( result.us ) / 1000.0,
+					result.accesses,
+					hit_rate,
+					result.us ? static_cast<double>( uncached_us ) / result.us : 0.0,
+					result.errors ? "  ERROR" : "" );
+
+			ok = ok && result.errors == 0;
+		}
+	}
+
+	return ok ? 0 : 1;
+}
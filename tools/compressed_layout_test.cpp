@@ -0,0 +1,315 @@
+/*
+ * Checks CompressedMemoryInterface on pages of different sizes.
+ *
+ * The backing memory are the simulated FLASH_FS sectors of the
+ * STM32F401 (16K, 16K, 16K, 64K). Random incompressible writes go to
+ * the compressed memory and to a reference image in RAM. After each
+ * write both have to be equal, also after a remount. Writes may fail,
+ * when the log is full, but the data has to stay consistent and
+ * mountable.
+ *
+ * Then, with half of the writes compressible, the power is cut after
+ * a random number of erase and program operations, mostly while the
+ * head moves on and segments are collected. After each cut the memory
+ * has to mount again, and every chunk has to contain the data from
+ * before or after the interrupted write.
+ *
+ * Build on the host:
+ *   g++ -std=c++20 -O2 -I../Drivers/stm32_internal_flash/Inc -o compressed_layout_test compressed_layout_test.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/CompressedMemoryInterface.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/GenericFlashDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/SimulatedRawDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/BlankCheck.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/LzCodec.cpp
+ *
+ * Usage:
+ *   compressed_layout_test [--size kbytes] [--ops count] [--cuts count]
+ *
+ *   --size  logical size, default 40K
+ *   --ops   random writes, default 2000
+ *   --cuts  power cuts, default 500
+ *
+ * Returns 1 if mounting fails, or the data differs from the reference.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "CompressedMemoryInterface.h"
+#include "GenericFlashDriver.h"
+#include "SimulatedRawDriver.h"
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace stm32_internal_flash;
+
+namespace {
+
+using bytes_t = std::vector<std::byte>;
+
+constexpr std::size_t SECTOR_SIZES[] = { 16*1024, 16*1024, 16*1024, 64*1024 };
+constexpr std::size_t FLASH_SIZE = 112*1024;
+constexpr std::size_t CHUNK_SIZE = CompressedMemoryInterface::CHUNK_SIZE;
+
+/**
+ * refuses every erase and program, after operations_left of them
+ */
+class PowerCutRawDriver : public SimulatedRawDriver
+{
+public:
+	std::size_t operations_left = std::numeric_limits<std::size_t>::max();
+
+	using SimulatedRawDriver::SimulatedRawDriver;
+
+	bool erase_page( std::size_t address, std::size_t size ) override {
+		return !cut() && SimulatedRawDriver::erase_page( address, size );
+	}
+
+	std::size_t write_page( std::size_t address, const std::span<const std::byte> & buffer ) override {
+		return cut() ? 0 : SimulatedRawDriver::write_page( address, buffer );
+	}
+
+private:
+	bool cut() {
+		if( operations_left == 0 ) {
+			return true;
+		}
+
+		operations_left--;
+		return false;
+	}
+};
+
+/**
+ * the drivers of one boot, over the same flash memory
+ */
+struct Boot
+{
+	PowerCutRawDriver raw;
+	GenericFlashDriver driver;
+	CompressedMemoryInterface compressed;
+
+	Boot( bytes_t & memory, std::size_t size )
+	: raw( memory, SECTOR_SIZES ),
+	  driver( raw ),
+	  compressed( driver, size )
+	{}
+};
+
+struct Counts
+{
+	unsigned writes = 0;
+	unsigned failed_writes = 0;
+	unsigned mount_errors = 0;
+	unsigned differences = 0;
+};
+
+bytes_t make_data( std::mt19937 & rng, std::size_t len, bool incompressible )
+{
+	bytes_t data( len );
+	const uint8_t pattern = static_cast<uint8_t>( rng() );
+
+	for( std::size_t i = 0; i < len; i++ ) {
+		data[i] = static_cast<std::byte>( incompressible ? rng() : pattern + i / 64 );
+	}
+
+	return data;
+}
+
+bool equals( CompressedMemoryInterface & compressed, const bytes_t & reference )
+{
+	bytes_t content( reference.size() );
+	std::span<std::byte> span( content );
+
+	return compressed.read( 0, span ) == content.size() && content == reference;
+}
+
+/**
+ * every chunk has the content of before or after the interrupted write
+ */
+bool equals_before_or_after( CompressedMemoryInterface & compressed, const bytes_t & before, const bytes_t & after )
+{
+	bytes_t content( before.size() );
+	std::span<std::byte> span( content );
+
+	if( compressed.read( 0, span ) != content.size() ) {
+		return false;
+	}
+
+	for( std::size_t pos = 0; pos < content.size(); pos += CHUNK_SIZE ) {
+		auto chunk = [pos]( const bytes_t & data ) {
+			return std::span<const std::byte>( data.data() + pos, CHUNK_SIZE );
+		};
+
+		if( !std::ranges::equal( chunk( content ), chunk( before ) ) &&
+			!std::ranges::equal( chunk( content ), chunk( after ) ) ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * writes random data, returns the bytes written
+ */
+std::size_t write_random( CompressedMemoryInterface & compressed, bytes_t & reference, std::mt19937 & rng, bool incompressible )
+{
+	const std::size_t len = 1 + rng() % 3000;
+	const std::size_t address = rng() % (reference.size() - len);
+	const bytes_t data = make_data( rng, len, incompressible );
+
+	const std::size_t written = compressed.write( address, data );
+	std::copy( data.begin(), data.begin() + written, reference.begin() + address );
+
+	return written == len ? written : 0;
+}
+
+bool run_writes( std::size_t size, unsigned ops, Counts & counts )
+{
+	bytes_t memory( FLASH_SIZE, std::byte(0xFF) );
+	bytes_t reference( size, std::byte(0xFF) );
+	std::mt19937 rng( 1 );
+
+	auto boot = std::make_unique<Boot>( memory, size );
+
+	if( !boot->compressed.mount() ) {
+		counts.mount_errors++;
+		return false;
+	}
+
+	for( unsigned op = 0; op < ops; op++ ) {
+		counts.writes++;
+
+		if( write_random( boot->compressed, reference, rng, true ) == 0 ) {
+			counts.failed_writes++;
+		}
+
+		if( !equals( boot->compressed, reference ) ) {
+			counts.differences++;
+		}
+
+		if( op % 50 == 49 ) {
+			boot = std::make_unique<Boot>( memory, size );
+
+			if( !boot->compressed.mount() ) {
+				counts.mount_errors++;
+				return false;
+			}
+
+			if( !equals( boot->compressed, reference ) ) {
+				counts.differences++;
+			}
+		}
+	}
+
+	return counts.mount_errors == 0 && counts.differences == 0;
+}
+
+bool run_power_cuts( std::size_t size, unsigned cuts, Counts & counts )
+{
+	bytes_t memory( FLASH_SIZE, std::byte(0xFF) );
+	bytes_t reference( size, std::byte(0xFF) );
+	std::mt19937 rng( 2 );
+
+	for( unsigned cut = 0; cut < cuts; cut++ ) {
+		Boot boot( memory, size );
+
+		if( !boot.compressed.mount() ) {
+			counts.mount_errors++;
+			return false;
+		}
+
+		if( !equals( boot.compressed, reference ) ) {
+			counts.differences++;
+			return false;
+		}
+
+		// some complete writes, then one that is cut
+		for( unsigned i = rng() % 20; i > 0; i-- ) {
+			counts.writes++;
+
+			if( write_random( boot.compressed, reference, rng, rng() % 2 == 0 ) == 0 ) {
+				counts.failed_writes++;
+			}
+		}
+
+		const bytes_t before = reference;
+
+		boot.raw.operations_left = rng() % 40;
+		write_random( boot.compressed, reference, rng, rng() % 2 == 0 );
+
+		Boot reboot( memory, size );
+
+		if( !reboot.compressed.mount() ) {
+			counts.mount_errors++;
+			return false;
+		}
+
+		if( !equals_before_or_after( reboot.compressed, before, reference ) ) {
+			counts.differences++;
+			return false;
+		}
+
+		// continue with the content, that survived
+		std::span<std::byte> span( reference );
+		reboot.compressed.read( 0, span );
+	}
+
+	return counts.mount_errors == 0 && counts.differences == 0;
+}
+
+bool parse_args( int argc, char **argv, std::size_t & size, unsigned & ops, unsigned & cuts )
+{
+	for( int i = 1; i < argc; i++ ) {
+		const std::string arg = argv[i];
+
+		if( arg == "--size" && i + 1 < argc ) {
+			size = std::strtoul( argv[++i], nullptr, 10 ) * 1024;
+		} else if( arg == "--ops" && i + 1 < argc ) {
+			ops = std::strtoul( argv[++i], nullptr, 10 );
+		} else if( arg == "--cuts" && i + 1 < argc ) {
+			cuts = std::strtoul( argv[++i], nullptr, 10 );
+		} else {
+			return false;
+		}
+	}
+
+	return size >= 4*1024 && size <= CompressedMemoryInterface::MAX_CHUNKS * CHUNK_SIZE;
+}
+
+void print( const char *name, const Counts & counts, bool ok )
+{
+	printf( "%-12s %u writes, %u failed, %u mount errors, %u differences => %s\n",
+			name, counts.writes, counts.failed_writes, counts.mount_errors, counts.differences,
+			ok ? "Ok" : "ERROR" );
+}
+
+} // namespace
+
+int main( int argc, char **argv )
+{
+	std::size_t size = 40*1024;
+	unsigned ops = 2000;
+	unsigned cuts = 500;
+
+	if( !parse_args( argc, argv, size, ops, cuts ) ) {
+		printf( "usage: %s [--size kbytes] [--ops count] [--cuts count]\n", argv[0] );
+		return 2;
+	}
+
+	printf( "%zuK logical on 16K, 16K, 16K, 64K\n", size / 1024 );
+
+	Counts write_counts;
+	const bool writes_ok = run_writes( size, ops, write_counts );
+	print( "writes", write_counts, writes_ok );
+
+	Counts cut_counts;
+	const bool cuts_ok = run_power_cuts( size, cuts, cut_counts );
+	print( "power cuts", cut_counts, cuts_ok );
+
+	return writes_ok && cuts_ok ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+/*
+ * Measures ratio and speed of lz_codec on the host, in the chunk size
+ * of CompressedMemoryInterface.
+ *
+ * Build on the host:
+ *   g++ -std=c++20 -O2 -I../Drivers/stm32_internal_flash/Inc -o compression_benchmark \
+ *       compression_benchmark.cpp ../Drivers/stm32_internal_flash/Inc/LzCodec.cpp
+ *
+ * Usage:
+ *   compression_benchmark [data.bin ...]
+ *
+ * Without files, generated calibration tables are used (the same as
+ * test_compressed_memory_interface() in main_app.cc). The cycles per
+ * byte on the target are printed by that test.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "CompressedMemoryInterface.h"
+#include "LzCodec.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace stm32_internal_flash;
+
+namespace {
+
+constexpr std::size_t CHUNK_SIZE = CompressedMemoryInterface::CHUNK_SIZE;
+
+using bytes_t = std::vector<std::byte>;
+
+bool read_file( const char *name, bytes_t & data )
+{
+	std::ifstream in( name, std::ios::binary );
+
+	if( !in ) {
+		return false;
+	}
+
+	std::vector<char> buffer( (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>() );
+	data.resize( buffer.size() );
+	memcpy( data.data(), buffer.data(), buffer.size() );
+
+	return true;
+}
+
+/**
+ * 16 bit lookup tables, like our calibration data: sensor curves with
+ * the resolution of the ADC, so values repeat, and unused entries at
+ * the end of each table
+ */
+bytes_t make_calibration_tables()
+{
+	bytes_t data;
+
+	for( unsigned table = 0; table < 24; table++ ) {
+		const unsigned used = 600 + table * 16;
+
+		for( unsigned i = 0; i < 1024; i++ ) {
+			uint16_t value = 0xFFFF;
+
+			if( i < used ) {
+				value = static_cast<uint16_t>( 1000 + table * 100 + (i * i / 2600) * 64 );
+			}
+
+			data.push_back( static_cast<std::byte>( value & 0xFF ) );
+			data.push_back( static_cast<std::byte>( value >> 8 ) );
+		}
+	}
+
+	return data;
+}
+
+void benchmark( const std::string & name, const bytes_t & data )
+{
+	const std::size_t chunks = data.size() / CHUNK_SIZE;
+
+	if( chunks == 0 ) {
+		std::printf( "%s: smaller than one chunk\n", name.c_str() );
+		return;
+	}
+
+	// stored as CompressedMemoryInterface::store_chunk() does
+	std::vector<bytes_t> compressed( chunks, bytes_t( CHUNK_SIZE - 4 ) );
+	std::size_t stored = 0;
+	const unsigned rounds = 200;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for( unsigned round = 0; round < rounds; round++ ) {
+		stored = 0;
+
+		for( std::size_t chunk = 0; chunk < chunks; chunk++ ) {
+			auto src = std::span<const std::byte>( data.data() + chunk * CHUNK_SIZE, CHUNK_SIZE );
+			const std::size_t len = lz_codec::compress( src, compressed[chunk] );
+			stored += len ? len : CHUNK_SIZE;
+
+			if( round == rounds - 1 ) {
+				compressed[chunk].resize( len );
+			}
+		}
+	}
+
+	const double compress_s = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+	std::array<std::byte,CHUNK_SIZE> output;
+	bool ok = true;
+
+	start = std::chrono::steady_clock::now();
+
+	for( unsigned round = 0; round < rounds; round++ ) {
+		for( std::size_t chunk = 0; chunk < chunks; chunk++ ) {
+			if( compressed[chunk].empty() ) {
+				// stored uncompressed, read zero copy
+				continue;
+			}
+
+			if( lz_codec::decompress( compressed[chunk], output ) != CHUNK_SIZE ) {
+				ok = false;
+			}
+
+			if( round == 0 && memcmp( output.data(), data.data() + chunk * CHUNK_SIZE, CHUNK_SIZE ) != 0 ) {
+				ok = false;
+			}
+		}
+	}
+
+	const double decompress_s = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	const double mbytes = static_cast<double>( chunks * CHUNK_SIZE ) * rounds / 1e6;
+
+	std::printf( "%s: %zu bytes => %zu bytes, ratio %.2f, compress %.1f MB/s, decompress %.1f MB/s%s\n",
+			name.c_str(),
+			chunks * CHUNK_SIZE,
+			stored,
+			static_cast<double>( chunks * CHUNK_SIZE ) / stored,
+			mbytes / compress_s,
+			mbytes / decompress_s,
+			ok ? "" : " ERROR" );
+}
+
+} // namespace
+
+int main( int argc, char **argv )
+{
+	if( argc < 2 ) {
+		benchmark( "calibration tables", make_calibration_tables() );
+		return 0;
+	}
+
+	for( int i = 1; i < argc; i++ ) {
+		bytes_t data;
+
+		if( !read_file( argv[i], data ) ) {
+			std::fprintf( stderr, "cannot read %s\n", argv[i] );
+			return 1;
+		}
+
+		benchmark( argv[i], data );
+	}
+
+	return 0;
+}
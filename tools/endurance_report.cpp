@@ -0,0 +1,625 @@
+/*
+ * Projects the lifetime of the flash sectors for a workload and a driver stack.
+ *
+ * The workload is repeated period by period on SimulatedRawDriver. After a
+ * warm up, the erases per sector are counted over a window of periods, that
+ * is long enough for the pattern to repeat (eg. a log has wrapped around a
+ * few times). The erase rates of this window are extrapolated to months and
+ * years, so no byte of these months is emulated.
+ *
+ * Build on the host:
+ *   g++ -std=c++20 -O2 -I../Drivers/stm32_internal_flash/Inc -o endurance_report endurance_report.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/TracingMemoryInterface.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/CircularLog.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/GenericFlashDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/SimulatedRawDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/BlankCheck.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/CompressedMemoryInterface.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/LzCodec.cpp
+ *
+ * Usage:
+ *   endurance_report [options]
+ *
+ *   --sectors flash_fs|flash_fs_16k|flash_fs_64k|16,16,64   sector sizes in KB
+ *   --workload file     workload description, see below
+ *   --trace ring.bin    TraceRecords of TracingMemoryInterface, one period
+ *   --period seconds    length of one period of the trace
+ *   --stack plain|compressed|all
+ *   --cycles 10000      rated erase cycles of a sector
+ *   --days 180          also prints the erases after that many days
+ *
+ * Workload description, one command per line, # starts a comment:
+ *   period <seconds>                        length of one period
+ *   write <address> <size> <count>          rewrites the range count times per period
+ *   append <start> <size> <entry> <count>   appends count entries per period to a
+ *                                           ring buffer, that wraps around at size
+ *
+ * Without a workload or trace, a configuration of 256 bytes, that is written
+ * 6 times an hour, and a log of 64 byte entries, written every minute, are used.
+ *
+ * The sector presets are the ones of Core/app/stm32f401_flash_config.h.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "TracingMemoryInterface.h"
+#include "CompressedMemoryInterface.h"
+#include "FlashGeometry.h"
+#include "GenericFlashDriver.h"
+#include "SimulatedRawDriver.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace stm32_internal_flash;
+
+namespace {
+
+using bytes_t = std::vector<std::byte>;
+using TraceRecord = TracingMemoryInterface::TraceRecord;
+using Op = TracingMemoryInterface::Op;
+
+constexpr double SECONDS_PER_DAY = 24.0 * 3600.0;
+constexpr double DAYS_PER_YEAR = 365.25;
+
+// periods, that are simulated before counting, at least until the rings have wrapped around
+constexpr std::size_t WARM_UP_PERIODS = 2;
+
+// the window covers the rings once, and ends, when each sector has been erased that often on average ...
+constexpr std::size_t WINDOW_ERASES_PER_SECTOR = 20;
+
+// ... or after that many periods
+constexpr std::size_t MAX_WINDOW_PERIODS = 2000;
+
+/**
+ * one access of a period
+ */
+struct Event
+{
+	double time_s;     // in the period
+	Op op;
+	std::size_t address;
+	std::size_t size;
+	std::size_t source;  // of a copy
+
+	// of an append, address is the start of the ring
+	std::size_t ring_entries;
+};
+
+struct Workload
+{
+	double period_s = 3600;
+	std::vector<Event> events;  // sorted by time
+
+	std::size_t get_extent() const {
+		std::size_t extent = 0;
+
+		for( const Event & event : events ) {
+			extent = std::max( extent, event.address + event.size * std::max( event.ring_entries, std::size_t(1) ) );
+		}
+
+		return extent;
+	}
+
+	/**
+	 * periods, until every append ring has wrapped around
+	 */
+	std::size_t get_ring_periods() const {
+		std::map<std::size_t,std::size_t> appends_per_period;
+		std::map<std::size_t,std::size_t> entries;
+
+		for( const Event & event : events ) {
+			if( event.ring_entries > 0 ) {
+				appends_per_period[event.address]++;
+				entries[event.address] = event.ring_entries;
+			}
+		}
+
+		std::size_t periods = 1;
+
+		for( const auto & [start, count] : appends_per_period ) {
+			periods = std::max( periods, (entries[start] + count - 1) / count );
+		}
+
+		return periods;
+	}
+};
+
+template<std::size_t START_ADDRESS, std::size_t SIZE>
+std::vector<std::size_t> get_sector_sizes()
+{
+	std::vector<std::size_t> sizes;
+
+	for( const geometry::Sector & sector : geometry::make_sectors<geometry::Device::F401xE, START_ADDRESS, SIZE>() ) {
+		sizes.push_back( sector.size );
+	}
+
+	return sizes;
+}
+
+bool parse_sectors( const std::string & arg, std::vector<std::size_t> & sizes )
+{
+	// sector 1 ... 4 of the STM32F401
+	if( arg == "flash_fs" ) {
+		sizes = get_sector_sizes<0x08004000, 112*1024>();
+		return true;
+	}
+
+	if( arg == "flash_fs_16k" ) {
+		sizes = get_sector_sizes<0x08004000, 48*1024>();
+		return true;
+	}
+
+	if( arg == "flash_fs_64k" ) {
+		sizes = get_sector_sizes<0x08010000, 64*1024>();
+		return true;
+	}
+
+	sizes.clear();
+	std::stringstream in( arg );
+	std::string item;
+
+	while( std::getline( in, item, ',' ) ) {
+		const std::size_t kb = std::strtoul( item.c_str(), nullptr, 10 );
+
+		if( kb == 0 ) {
+			return false;
+		}
+
+		sizes.push_back( kb * 1024 );
+	}
+
+	return !sizes.empty();
+}
+
+/**
+ * count events evenly spread over the period
+ */
+void add_events( Workload & workload, const Event & event, std::size_t count )
+{
+	for( std::size_t i = 0; i < count; i++ ) {
+		Event e = event;
+		e.time_s = (i + 0.5) * workload.period_s / count;
+		workload.events.push_back( e );
+	}
+}
+
+/**
+ * the events of append are added after the period is known
+ */
+struct Append
+{
+	std::size_t start;
+	std::size_t size;
+	std::size_t entry;
+	std::size_t count;
+};
+
+bool parse_workload( std::istream & in, Workload & workload )
+{
+	std::vector<std::pair<Event,std::size_t>> writes;
+	std::vector<Append> appends;
+	std::string line;
+
+	while( std::getline( in, line ) ) {
+		line = line.substr( 0, line.find( '#' ) );
+
+		std::stringstream words( line );
+		std::string command;
+
+		if( !(words >> command) ) {
+			continue;
+		}
+
+		auto number = [&words]( std::size_t & value ) {
+			std::string word;
+			words >> word;
+			char *end = nullptr;
+			value = std::strtoul( word.c_str(), &end, 0 );
+			return !word.empty() && *end == 0;
+		};
+
+		if( command == "period" ) {
+			std::size_t seconds;
+
+			if( !number( seconds ) || seconds == 0 ) {
+				return false;
+			}
+
+			workload.period_s = seconds;
+
+		} else if( command == "write" ) {
+			Event event{ 0, Op::Write, 0, 0, 0, 0 };
+			std::size_t count;
+
+			if( !number( event.address ) || !number( event.size ) || !number( count ) ) {
+				return false;
+			}
+
+			writes.emplace_back( event, count );
+
+		} else if( command == "append" ) {
+			Append append;
+
+			if( !number( append.start ) || !number( append.size ) || !number( append.entry ) || !number( append.count ) ||
+				append.entry == 0 || append.entry > append.size ) {
+				return false;
+			}
+
+			appends.push_back( append );
+
+		} else {
+			return false;
+		}
+	}
+
+	for( const auto & [event, count] : writes ) {
+		add_events( workload, event, count );
+	}
+
+	// the position in the ring goes on from period to period, it's kept by the Stack
+	for( const Append & append : appends ) {
+		Event event{ 0, Op::Write, append.start, append.entry, 0, append.size / append.entry };
+		add_events( workload, event, append.count );
+	}
+
+	std::stable_sort( workload.events.begin(), workload.events.end(), []( const Event & a, const Event & b ) {
+		return a.time_s < b.time_s;
+	});
+
+	return !workload.events.empty();
+}
+
+bool read_trace( const char *name, double period_s, Workload & workload )
+{
+	std::ifstream in( name, std::ios::binary );
+
+	if( !in ) {
+		return false;
+	}
+
+	std::vector<char> data( (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>() );
+	std::vector<TraceRecord> records;
+
+	for( std::size_t pos = 0; pos + sizeof(TraceRecord) <= data.size(); pos += sizeof(TraceRecord) ) {
+		TraceRecord record;
+		memcpy( &record, data.data() + pos, sizeof(record) );
+
+		if( record.get_op() != Op::None ) {
+			records.push_back( record );
+		}
+	}
+
+	if( records.empty() ) {
+		return false;
+	}
+
+	const uint32_t first_us = records.front().time_us;
+	const double traced_s = (records.back().time_us - first_us) / 1e6;
+
+	workload.period_s = period_s > 0 ? period_s : std::max( traced_s, 1.0 );
+
+	for( std::size_t i = 0; i < records.size(); i++ ) {
+		const TraceRecord & record = records[i];
+
+		if( record.get_op() == Op::CopySource || record.get_op() == Op::Read ) {
+			// reads don't wear the flash
+			continue;
+		}
+
+		Event event{ (record.time_us - first_us) / 1e6, record.get_op(), record.address, record.get_size(), 0, 0 };
+
+		if( record.get_op() == Op::Copy ) {
+			if( i + 1 >= records.size() || records[i+1].get_op() != Op::CopySource ) {
+				continue;
+			}
+
+			event.source = records[i+1].address;
+		}
+
+		workload.events.push_back( event );
+	}
+
+	return !workload.events.empty();
+}
+
+Workload make_default_workload()
+{
+	std::stringstream in(
+			"period 3600\n"
+			"write 0x100 256 6\n"           // configuration
+			"append 0x4000 0x8000 64 60\n"  // log in the 2nd and 3rd 16K sector
+			);
+
+	Workload workload;
+	parse_workload( in, workload );
+
+	return workload;
+}
+
+/**
+ * a simulated flash with a driver stack on top
+ */
+class Stack
+{
+public:
+	bytes_t memory;
+	SimulatedRawDriver raw;
+	GenericFlashDriver driver;
+	std::unique_ptr<CompressedMemoryInterface> compressed;
+	MemoryInterface *top = nullptr;
+	std::size_t failed = 0;
+	std::size_t sequence = 0;
+
+	// next entry of each append ring, by its start address
+	std::map<std::size_t,std::size_t> ring_positions;
+
+	Stack( const std::vector<std::size_t> & sizes, std::size_t total_size )
+	: memory( total_size, std::byte(0xFF) ),
+	  raw( memory, sizes ),
+	  driver( raw ),
+	  top( &driver )
+	{}
+
+	bool use_compressed( std::size_t logical_size ) {
+		const std::size_t chunk_size = CompressedMemoryInterface::CHUNK_SIZE;
+		logical_size = (logical_size + chunk_size - 1) / chunk_size * chunk_size;
+
+		if( logical_size > CompressedMemoryInterface::MAX_CHUNKS * chunk_size ) {
+			return false;
+		}
+
+		compressed = std::make_unique<CompressedMemoryInterface>( driver, logical_size );
+		top = compressed.get();
+
+		return compressed->format();
+	}
+
+	void execute( const Event & event ) {
+		bool ok = true;
+		std::size_t address = event.address;
+
+		if( event.ring_entries > 0 ) {
+			std::size_t & position = ring_positions[event.address];
+			address += position * event.size;
+			position = (position + 1) % event.ring_entries;
+		}
+
+		switch( event.op )
+		{
+		case Op::Write:
+		case Op::Program: {
+			// programs are replayed as writes, the data of the stack is unknown
+			bytes_t data( event.size );
+			sequence++;
+
+			for( std::size_t i = 0; i < data.size(); i++ ) {
+				data[i] = static_cast<std::byte>( ((address + i) / 8) ^ sequence );
+			}
+
+			ok = top->write( address, data ) == data.size();
+			break;
+		}
+
+		case Op::Erase:
+			ok = top->erase( address, event.size );
+			break;
+
+		case Op::Copy:
+			ok = top->copy( address, event.source, event.size );
+			break;
+
+		default:
+			break;
+		}
+
+		if( !ok ) {
+			failed++;
+		}
+	}
+
+	void run_period( const Workload & workload ) {
+		for( const Event & event : workload.events ) {
+			execute( event );
+		}
+	}
+
+	std::vector<std::size_t> get_erase_counts() const {
+		std::vector<std::size_t> counts( raw.get_page_count() );
+
+		for( std::size_t page = 0; page < counts.size(); page++ ) {
+			counts[page] = raw.get_erase_count( page );
+		}
+
+		return counts;
+	}
+};
+
+struct Options
+{
+	std::vector<std::size_t> sizes = { 16*1024, 16*1024, 16*1024, 64*1024 };
+	std::size_t cycles = 10000;
+	std::size_t days = 0;
+};
+
+void report( const char *stack_name, const Workload & workload, const Options & options )
+{
+	std::size_t total_size = 0;
+
+	for( std::size_t size : options.sizes ) {
+		total_size += size;
+	}
+
+	Stack stack( options.sizes, total_size );
+
+	if( std::string( stack_name ) == "compressed" && !stack.use_compressed( workload.get_extent() ) ) {
+		std::printf( "%s: the workload doesn't fit\n\n", stack_name );
+		return;
+	}
+
+	if( workload.get_extent() > stack.top->get_size() ) {
+		std::printf( "%s: the workload doesn't fit\n\n", stack_name );
+		return;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+
+	const std::size_t ring_periods = workload.get_ring_periods();
+
+	for( std::size_t period = 0; period < std::max( WARM_UP_PERIODS, ring_periods ); period++ ) {
+		stack.run_period( workload );
+	}
+
+	const std::vector<std::size_t> before = stack.get_erase_counts();
+	const std::size_t failed_before = stack.failed;
+	std::size_t periods = 0;
+	std::size_t window_erases = 0;
+
+	while( periods < ring_periods ||
+		   (periods < MAX_WINDOW_PERIODS && window_erases < WINDOW_ERASES_PER_SECTOR * options.sizes.size()) ) {
+		stack.run_period( workload );
+		periods++;
+
+		const std::vector<std::size_t> counts = stack.get_erase_counts();
+		window_erases = 0;
+
+		for( std::size_t i = 0; i < counts.size(); i++ ) {
+			window_erases += counts[i] - before[i];
+		}
+	}
+
+	const double host_s = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	const double window_days = periods * workload.period_s / SECONDS_PER_DAY;
+	const std::vector<std::size_t> after = stack.get_erase_counts();
+
+	std::printf( "%s: %zu periods of %.0fs (%.1f days) simulated in %.2fs, %zu failed accesses\n",
+			stack_name,
+			periods,
+			workload.period_s,
+			window_days,
+			host_s,
+			stack.failed - failed_before );
+
+	std::printf( "  sector   size  erases/day  years to %zu cycles", options.cycles );
+
+	if( options.days ) {
+		std::printf( "  erases after %zu days", options.days );
+	}
+
+	std::printf( "\n" );
+
+	double min_years = -1;
+	std::size_t worst = 0;
+
+	for( std::size_t i = 0; i < after.size(); i++ ) {
+		const double per_day = (after[i] - before[i]) / window_days;
+
+		std::printf( "  %6zu %5zuK  %10.2f", i, options.sizes[i] / 1024, per_day );
+
+		if( per_day > 0 ) {
+			const double years = options.cycles / per_day / DAYS_PER_YEAR;
+			std::printf( "  %21.2f", years );
+
+			if( min_years < 0 || years < min_years ) {
+				min_years = years;
+				worst = i;
+			}
+		} else {
+			std::printf( "  %21s", "-" );
+		}
+
+		if( options.days ) {
+			std::printf( "  %21.0f", per_day * options.days );
+		}
+
+		std::printf( "\n" );
+	}
+
+	if( min_years < 0 ) {
+		std::printf( "  no erases in the window\n\n" );
+	} else {
+		std::printf( "  worn out first: sector %zu after %.2f years\n\n", worst, min_years );
+	}
+}
+
+} // namespace
+
+int main( int argc, char **argv )
+{
+	Options options;
+	Workload workload;
+	std::string stack = "all";
+	const char *workload_file = nullptr;
+	const char *trace_file = nullptr;
+	double period_s = 0;
+
+	for( int i = 1; i < argc; i++ ) {
+		const std::string arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i+1] : nullptr;
+
+		if( !value ) {
+			std::fprintf( stderr, "missing value of %s\n", argv[i] );
+			return 1;
+		}
+
+		i++;
+
+		if( arg == "--sectors" ) {
+			if( !parse_sectors( value, options.sizes ) ) {
+				std::fprintf( stderr, "invalid sectors %s\n", value );
+				return 1;
+			}
+		} else if( arg == "--workload" ) {
+			workload_file = value;
+		} else if( arg == "--trace" ) {
+			trace_file = value;
+		} else if( arg == "--period" ) {
+			period_s = std::strtod( value, nullptr );
+		} else if( arg == "--stack" ) {
+			stack = value;
+		} else if( arg == "--cycles" ) {
+			options.cycles = std::strtoul( value, nullptr, 10 );
+		} else if( arg == "--days" ) {
+			options.days = std::strtoul( value, nullptr, 10 );
+		} else {
+			std::fprintf( stderr, "unknown option %s\n", argv[i-1] );
+			return 1;
+		}
+	}
+
+	if( workload_file ) {
+		std::ifstream in( workload_file );
+
+		if( !in || !parse_workload( in, workload ) ) {
+			std::fprintf( stderr, "cannot read the workload %s\n", workload_file );
+			return 1;
+		}
+	} else if( trace_file ) {
+		if( !read_trace( trace_file, period_s, workload ) ) {
+			std::fprintf( stderr, "cannot read the trace %s\n", trace_file );
+			return 1;
+		}
+	} else {
+		workload = make_default_workload();
+	}
+
+	std::printf( "%zu accesses per period of %.0fs\n\n", workload.events.size(), workload.period_s );
+
+	if( stack == "plain" || stack == "all" ) {
+		report( "plain", workload, options );
+	}
+
+	if( stack == "compressed" || stack == "all" ) {
+		report( "compressed", workload, options );
+	}
+
+	return 0;
+}
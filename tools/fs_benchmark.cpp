@@ -0,0 +1,226 @@
+/*
+ * Compares FlashFs with raw GenericFlashDriver writes on the simulated
+ * FLASH_FS sectors (16K, 16K, 16K, 64K).
+ *
+ * Build on the host:
+ *   g++ -std=c++20 -O2 -I../Drivers/stm32_internal_flash/Inc -o fs_benchmark fs_benchmark.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/FlashFs.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/GenericFlashDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/SimulatedRawDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/BlankCheck.cpp
+ *
+ * Usage:
+ *   fs_benchmark
+ *
+ * Times of writing are taken from the simulated clock of SimulatedRawDriver
+ * (typical STM32F4 erase and program times). Mount time is measured on the
+ * host, as reading memory mapped flash doesn't advance the simulated clock.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "FlashFs.h"
+#include "GenericFlashDriver.h"
+#include "SimulatedRawDriver.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+using namespace stm32_internal_flash;
+
+namespace {
+
+using bytes_t = std::vector<std::byte>;
+
+constexpr std::size_t SECTOR_SIZES[] = { 16*1024, 16*1024, 16*1024, 64*1024 };
+constexpr std::size_t FLASH_SIZE = 112*1024;
+
+// the size of the configuration, rewritten again and again
+constexpr std::size_t CONFIG_SIZE = 1024;
+constexpr unsigned CONFIG_UPDATES = 200;
+
+// a file written once, eg. a log or recorded data
+constexpr std::size_t STREAM_SIZE = 32*1024;
+
+struct Flash
+{
+	bytes_t memory;
+	SimulatedRawDriver raw;
+	GenericFlashDriver driver;
+
+	Flash()
+	: memory( FLASH_SIZE, std::byte(0xFF) ),
+	  raw( memory, SECTOR_SIZES ),
+	  driver( raw )
+	{}
+
+	std::size_t get_max_erase_count() const {
+		std::size_t count = 0;
+
+		for( std::size_t page = 0; page < raw.get_page_count(); page++ ) {
+			count = std::max( count, raw.get_erase_count( page ) );
+		}
+
+		return count;
+	}
+};
+
+bytes_t make_data( std::size_t size, unsigned seed )
+{
+	bytes_t data( size );
+
+	for( std::size_t i = 0; i < size; i++ ) {
+		data[i] = static_cast<std::byte>( (i * 7 + seed * 13) ^ (i >> 8) );
+	}
+
+	return data;
+}
+
+double kbytes_per_s( std::size_t bytes, uint64_t us )
+{
+	return us ? static_cast<double>( bytes ) / 1024.0 / (static_cast<double>( us ) / 1e6) : 0.0;
+}
+
+void print( const char *name, const Flash & flash, std::size_t bytes, uint64_t us )
+{
+	std::printf( "  %-10s %8.1f KB/s, %7.1f ms, %3zu erases, most erased sector %3zu, %zu bytes programmed\n",
+			name,
+			kbytes_per_s( bytes, us ),
+			static_cast<double>( us ) / 1000.0,
+			flash.raw.get_statistic().erased_pages,
+			flash.get_max_erase_count(),
+			flash.raw.get_statistic().bytes_programmed );
+}
+
+/**
+ * the configuration at a fixed offset, like MESSAGE2_OFFSET in main_app.cc
+ */
+void config_raw()
+{
+	Flash flash;
+
+	for( unsigned update = 0; update < CONFIG_UPDATES; update++ ) {
+		flash.driver.write( 0, make_data( CONFIG_SIZE, update ) );
+	}
+
+	print( "raw", flash, CONFIG_SIZE * CONFIG_UPDATES, flash.raw.get_microseconds() );
+}
+
+/**
+ * the configuration written to a temporary file, and renamed
+ */
+bool config_fs()
+{
+	Flash flash;
+	FlashFs fs( flash.driver );
+
+	if( !fs.format() ) {
+		return false;
+	}
+
+	flash.raw.clear_statistic();
+	const uint64_t start = flash.raw.get_microseconds();
+
+	for( unsigned update = 0; update < CONFIG_UPDATES; update++ ) {
+		FlashFs::File file;
+
+		if( !fs.open( file, "config.tmp", FlashFs::Write | FlashFs::Create | FlashFs::Truncate ) ||
+			file.write( make_data( CONFIG_SIZE, update ) ) != CONFIG_SIZE ||
+			!file.close() ||
+			!fs.rename( "config.tmp", "config" ) ) {
+			return false;
+		}
+	}
+
+	print( "FlashFs", flash, CONFIG_SIZE * CONFIG_UPDATES, flash.raw.get_microseconds() - start );
+
+	FlashFs mounted( flash.driver );
+
+	const auto mount_start = std::chrono::steady_clock::now();
+	const bool ok = mounted.mount();
+	const double mount_us = std::chrono::duration<double,std::micro>( std::chrono::steady_clock::now() - mount_start ).count();
+
+	FlashFs::File file;
+	bytes_t data( CONFIG_SIZE );
+
+	if( !ok || !mounted.open( file, "config", FlashFs::Read ) || file.read( data ) != CONFIG_SIZE ||
+		data != make_data( CONFIG_SIZE, CONFIG_UPDATES - 1 ) ) {
+		return false;
+	}
+
+	std::printf( "  mount      %8.1f us on the host\n", mount_us );
+
+	return true;
+}
+
+void stream_raw()
+{
+	Flash flash;
+	const bytes_t data = make_data( STREAM_SIZE, 1 );
+
+	for( std::size_t pos = 0; pos < STREAM_SIZE; pos += FlashFs::PAGE_SIZE ) {
+		flash.driver.write( pos, std::span<const std::byte>( data ).subspan( pos, FlashFs::PAGE_SIZE ) );
+	}
+
+	print( "raw", flash, STREAM_SIZE, flash.raw.get_microseconds() );
+}
+
+bool stream_fs()
+{
+	Flash flash;
+	FlashFs fs( flash.driver );
+	const bytes_t data = make_data( STREAM_SIZE, 1 );
+
+	if( !fs.format() ) {
+		return false;
+	}
+
+	flash.raw.clear_statistic();
+	const uint64_t start = flash.raw.get_microseconds();
+
+	FlashFs::File file;
+
+	if( !fs.open( file, "stream", FlashFs::Write | FlashFs::Create | FlashFs::Append ) ) {
+		return false;
+	}
+
+	for( std::size_t pos = 0; pos < STREAM_SIZE; pos += FlashFs::PAGE_SIZE ) {
+		if( file.write( std::span<const std::byte>( data ).subspan( pos, FlashFs::PAGE_SIZE ) ) != FlashFs::PAGE_SIZE ) {
+			return false;
+		}
+	}
+
+	if( !file.close() ) {
+		return false;
+	}
+
+	print( "FlashFs", flash, STREAM_SIZE, flash.raw.get_microseconds() - start );
+
+	std::printf( "  overhead   %zu bytes stored for %zu bytes written\n",
+			fs.get_statistic().bytes_stored,
+			fs.get_statistic().bytes_written );
+
+	return true;
+}
+
+} // namespace
+
+int main()
+{
+	bool ok = true;
+
+	std::printf( "config, %u updates of %zu bytes:\n", CONFIG_UPDATES, CONFIG_SIZE );
+	config_raw();
+	ok = config_fs() && ok;
+
+	std::printf( "stream, %zu bytes in pages of %zu bytes:\n", STREAM_SIZE, FlashFs::PAGE_SIZE );
+	stream_raw();
+	ok = stream_fs() && ok;
+
+	if( !ok ) {
+		std::printf( "ERROR\n" );
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,332 @@
+/*
+ * Host test of the IncrementalWriter.
+ *
+ * The simulated FLASH_FS sectors (16K, 16K, 16K, 64K) advance their clock
+ * with the erase and program times of SimulatedRawDriver::Timing, which
+ * is also the clock of the writer. Every step is measured:
+ *
+ * - step_words() programs at most max_words words
+ * - step_microseconds() exceeds its budget by one chunk of words at most,
+ *   also if a word takes longer than the writer expects at first
+ * - an erase is always a step of its own
+ *
+ * Also checked: the written data with unaligned start and end, restoring
+ * the rest of partly written pages from the page buffer, the progress,
+ * and ranges outside of the flash.
+ *
+ * Build on the host:
+ *   g++ -std=c++20 -O2 -I../Drivers/stm32_internal_flash/Inc -o incremental_writer_test incremental_writer_test.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/IncrementalWriter.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/SimulatedRawDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/BlankCheck.cpp
+ *
+ * Usage:
+ *   incremental_writer_test
+ *
+ * Returns 1 if one of the checks fails.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "IncrementalWriter.h"
+#include "SimulatedRawDriver.h"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+using namespace stm32_internal_flash;
+
+namespace {
+
+using bytes_t = std::vector<std::byte>;
+
+constexpr std::size_t SECTOR_SIZES[] = { 16*1024, 16*1024, 16*1024, 64*1024 };
+constexpr std::size_t FLASH_SIZE = 112*1024;
+
+struct Setup
+{
+	bytes_t memory;
+	SimulatedRawDriver raw_driver;
+	IncrementalWriter writer;
+
+	Setup( uint32_t program_word_us = 16 )
+	: memory( FLASH_SIZE, std::byte(0xFF) ),
+	  raw_driver( memory, SECTOR_SIZES ),
+	  writer( raw_driver, [this]() {
+		  return static_cast<uint32_t>( raw_driver.get_microseconds() );
+	  })
+	{
+		raw_driver.timing.program_word_us = program_word_us;
+	}
+};
+
+struct StepStatistic
+{
+	unsigned steps = 0;
+	unsigned erase_steps = 0;
+	uint64_t max_program_step_us = 0;
+	std::size_t max_program_step_bytes = 0;
+
+	// an erase step, that also programmed, or erased twice
+	unsigned mixed_steps = 0;
+
+	// bytes_done went backwards, or the erased flag was wrong
+	unsigned progress_errors = 0;
+};
+
+/**
+ * calls step() until the writer is done, like a superloop
+ */
+template<class Step> StepStatistic run( Setup & setup, Step step )
+{
+	StepStatistic statistic;
+	std::size_t bytes_done = 0;
+
+	while( !setup.writer.done() ) {
+		const SimulatedRawDriver::Statistic before = setup.raw_driver.get_statistic();
+		const uint64_t start = setup.raw_driver.get_microseconds();
+
+		const IncrementalWriter::Progress progress = step();
+
+		const SimulatedRawDriver::Statistic & after = setup.raw_driver.get_statistic();
+		const uint64_t step_us = setup.raw_driver.get_microseconds() - start;
+		const std::size_t erases = after.erase_operations - before.erase_operations;
+		const std::size_t bytes = after.bytes_programmed - before.bytes_programmed;
+
+		statistic.steps++;
+
+		if( erases > 0 ) {
+			statistic.erase_steps++;
+
+			if( erases > 1 || bytes > 0 ) {
+				statistic.mixed_steps++;
+			}
+		} else {
+			statistic.max_program_step_us = std::max( statistic.max_program_step_us, step_us );
+			statistic.max_program_step_bytes = std::max( statistic.max_program_step_bytes, bytes );
+		}
+
+		if( progress.bytes_done < bytes_done || progress.erased != (erases > 0) ) {
+			statistic.progress_errors++;
+		}
+
+		bytes_done = progress.bytes_done;
+
+		// the rest of the superloop
+		setup.raw_driver.advance_time( 50 );
+	}
+
+	return statistic;
+}
+
+void fill( bytes_t & data, unsigned seed )
+{
+	for( std::size_t i = 0; i < data.size(); i++ ) {
+		data[i] = static_cast<std::byte>( i * 7 + seed + (i >> 8) );
+	}
+}
+
+bool is_done( const Setup & setup, std::size_t size )
+{
+	const IncrementalWriter::Progress & progress = setup.writer.get_progress();
+
+	return progress.status == IncrementalWriter::Status::Done &&
+		progress.bytes_done == size &&
+		progress.bytes_total == size;
+}
+
+bool check( const char *name, bool ok )
+{
+	printf( "%-72s %s\n", name, ok ? "Ok" : "ERROR" );
+	return ok;
+}
+
+bool test_step_words()
+{
+	bool ok = true;
+
+	printf( "%10s %8s %12s %16s\n", "max words", "steps", "erase steps", "max step bytes" );
+
+	for( std::size_t max_words : { 1u, 8u, 64u } ) {
+		Setup setup;
+
+		// something to erase
+		std::fill( setup.memory.begin(), setup.memory.begin() + 32*1024, std::byte(0x00) );
+
+		bytes_t data( 32*1024 );
+		fill( data, max_words );
+
+		setup.writer.start( 0, data );
+
+		const StepStatistic statistic = run( setup, [&]() {
+			return setup.writer.step_words( max_words );
+		});
+
+		printf( "%10zu %8u %12u %16zu\n", max_words, statistic.steps, statistic.erase_steps, statistic.max_program_step_bytes );
+
+		ok &= is_done( setup, data.size() );
+		ok &= std::equal( data.begin(), data.end(), setup.memory.begin() );
+		ok &= statistic.erase_steps == 2;
+		ok &= statistic.mixed_steps == 0;
+		ok &= statistic.progress_errors == 0;
+		ok &= statistic.max_program_step_bytes <= max_words * sizeof(uint32_t);
+	}
+
+	return check( "step_words() programs at most max_words, erases in steps of their own", ok );
+}
+
+bool test_step_microseconds()
+{
+	bool ok = true;
+
+	printf( "\n%10s %10s %8s %12s %14s %14s\n", "budget us", "word us", "steps", "erase steps", "max prog us", "allowed us" );
+
+	// the writer expects 16us per word at first, the slow flash has to be learned
+	for( uint32_t program_word_us : { 16u, 40u } ) {
+		for( uint32_t budget_us : { 100u, 500u, 2000u } ) {
+			Setup setup( program_word_us );
+
+			std::fill( setup.memory.begin() + 16*1024, setup.memory.begin() + 48*1024, std::byte(0x00) );
+
+			bytes_t data( 32*1024 );
+			fill( data, budget_us );
+
+			setup.writer.start( 16*1024, data );
+
+			const StepStatistic statistic = run( setup, [&]() {
+				return setup.writer.step_microseconds( budget_us );
+			});
+
+			const uint64_t allowed_us = budget_us + IncrementalWriter::CHUNK_WORDS * program_word_us;
+
+			printf( "%10u %10u %8u %12u %14llu %14llu\n", budget_us, program_word_us,
+					statistic.steps, statistic.erase_steps,
+					static_cast<unsigned long long>( statistic.max_program_step_us ),
+					static_cast<unsigned long long>( allowed_us ) );
+
+			ok &= is_done( setup, data.size() );
+			ok &= std::equal( data.begin(), data.end(), setup.memory.begin() + 16*1024 );
+			ok &= statistic.erase_steps == 2;
+			ok &= statistic.mixed_steps == 0;
+			ok &= statistic.progress_errors == 0;
+			ok &= statistic.max_program_step_us <= allowed_us;
+		}
+	}
+
+	printf( "\n" );
+
+	return check( "step_microseconds() exceeds its budget by one chunk at most", ok );
+}
+
+bool test_without_clock()
+{
+	bytes_t memory( FLASH_SIZE, std::byte(0xFF) );
+	SimulatedRawDriver raw_driver( memory, SECTOR_SIZES );
+	IncrementalWriter writer( raw_driver );
+
+	bytes_t data( 4*1024 );
+	fill( data, 1 );
+
+	writer.start( 100, data );
+
+	unsigned steps = 0;
+	std::size_t max_step_bytes = 0;
+
+	while( !writer.done() ) {
+		const std::size_t before = raw_driver.get_statistic().bytes_programmed;
+		writer.step_microseconds( 160 );
+		max_step_bytes = std::max( max_step_bytes, raw_driver.get_statistic().bytes_programmed - before );
+		steps++;
+	}
+
+	// 160us are 10 words of the typical 16us
+	return check( "without a clock, step_microseconds() uses the typical word time",
+			writer.get_progress().status == IncrementalWriter::Status::Done &&
+			max_step_bytes <= 10 * sizeof(uint32_t) &&
+			std::equal( data.begin(), data.end(), memory.begin() + 100 ) );
+}
+
+bool test_page_buffer()
+{
+	Setup setup;
+
+	bytes_t old_data( 48*1024 );
+	fill( old_data, 2 );
+	std::copy( old_data.begin(), old_data.end(), setup.memory.begin() );
+
+	// unaligned start and end, covers the end of sector 0, all of 1, and the start of 2
+	bytes_t data( 16*1024 + 2000 + 1 );
+	fill( data, 3 );
+	const std::size_t address = 16*1024 - 999;
+
+	bytes_t page_memory( 64*1024 );
+	std::span<std::byte> page_buffer( page_memory );
+
+	setup.writer.start( address, data, &page_buffer );
+
+	const StepStatistic statistic = run( setup, [&]() {
+		return setup.writer.step_microseconds( 500 );
+	});
+
+	bytes_t expected = old_data;
+	std::copy( data.begin(), data.end(), expected.begin() + address );
+
+	return check( "partly written pages are restored from the page buffer",
+			is_done( setup, data.size() ) &&
+			statistic.erase_steps == 3 &&
+			statistic.progress_errors == 0 &&
+			std::equal( expected.begin(), expected.end(), setup.memory.begin() ) );
+}
+
+bool test_without_page_buffer()
+{
+	Setup setup;
+
+	std::fill( setup.memory.begin(), setup.memory.begin() + 16*1024, std::byte(0x00) );
+
+	bytes_t data( 100 );
+	fill( data, 4 );
+
+	setup.writer.start( 1001, data );
+
+	run( setup, [&]() {
+		return setup.writer.step_words( 16 );
+	});
+
+	// the rest of the page is lost, like with RestoreDataOnUnaligendWrites = false
+	return check( "without page buffer, the rest of the page is erased",
+			is_done( setup, data.size() ) &&
+			std::equal( data.begin(), data.end(), setup.memory.begin() + 1001 ) &&
+			setup.memory[0] == std::byte(0xFF) &&
+			setup.memory[1001 + data.size()] == std::byte(0xFF) );
+}
+
+bool test_out_of_range()
+{
+	Setup setup;
+
+	bytes_t data( 100 );
+
+	const bool started = setup.writer.start( FLASH_SIZE - 50, data );
+
+	return check( "a range outside of the flash fails",
+			!started &&
+			setup.writer.done() &&
+			setup.writer.get_progress().status == IncrementalWriter::Status::Error &&
+			setup.raw_driver.get_statistic().program_operations == 0 );
+}
+
+} // namespace
+
+int main()
+{
+	bool ok = true;
+
+	ok &= test_step_words();
+	ok &= test_step_microseconds();
+	ok &= test_without_clock();
+	ok &= test_page_buffer();
+	ok &= test_without_page_buffer();
+	ok &= test_out_of_range();
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,319 @@
+/*
+ * Compares JBODGenericFlashDriver::copy() with memmove().
+ *
+ * The JBOD consists of the simulated internal FLASH_FS sectors
+ * (16K, 16K, 16K, 64K), which are memory mapped, and a simulated external
+ * 256K NOR flash with 4K pages, which is not. A reference image in RAM
+ * gets the same writes, and every copy is done with memmove() there.
+ * After each copy both have to be equal. Copies are inside one disc,
+ * from one disc to the other, spanning both discs and overlapping.
+ * This runs with and without a PageBuffer for the JBOD.
+ *
+ * Then whole pages and partly written pages are copied between the
+ * discs, with copy() and with the chunk wise MemoryInterface::copy(),
+ * to compare the erases and the simulated time. copy() runs with
+ * a PageBuffer and without.
+ *
+ * Build on the host:
+ *   g++ -std=c++20 -O2 -I../Drivers/stm32_internal_flash/Inc -o jbod_copy_test jbod_copy_test.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/JBODGenericFlashDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/GenericFlashDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/SimulatedRawDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/BlankCheck.cpp
+ *
+ * Usage:
+ *   jbod_copy_test [--ops count]
+ *
+ *   --ops  random copies, default 2000
+ *
+ * Returns 1 if the JBOD and the reference differ.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "JBODGenericFlashDriver.h"
+#include "GenericFlashDriver.h"
+#include "SimulatedRawDriver.h"
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace stm32_internal_flash;
+
+namespace {
+
+using bytes_t = std::vector<std::byte>;
+
+constexpr std::size_t INTERNAL_SECTOR_SIZES[] = { 16*1024, 16*1024, 16*1024, 64*1024 };
+constexpr std::size_t INTERNAL_SIZE = 112*1024;
+
+constexpr std::size_t EXTERNAL_PAGE_SIZE = 4*1024;
+constexpr std::size_t EXTERNAL_SIZE = 256*1024;
+
+constexpr std::size_t JBOD_SIZE = INTERNAL_SIZE + EXTERNAL_SIZE;
+
+struct Storage
+{
+	bytes_t internal_memory;
+	bytes_t external_memory;
+	std::vector<std::size_t> external_pages;
+
+	SimulatedRawDriver internal_raw;
+	SimulatedRawDriver external_raw;
+	GenericFlashDriver internal;
+	GenericFlashDriver external;
+
+	std::array<MemoryInterface*,2> members;
+	JBODGenericFlashDriver jbod;
+
+	bytes_t page_buffer;
+	std::span<std::byte> page_buffer_span;
+
+	Storage( bool with_page_buffer = false )
+	: internal_memory( INTERNAL_SIZE, std::byte(0xFF) ),
+	  external_memory( EXTERNAL_SIZE, std::byte(0xFF) ),
+	  external_pages( EXTERNAL_SIZE / EXTERNAL_PAGE_SIZE, EXTERNAL_PAGE_SIZE ),
+	  internal_raw( internal_memory, INTERNAL_SECTOR_SIZES ),
+	  external_raw( external_memory, external_pages ),
+	  internal( internal_raw ),
+	  external( external_raw ),
+	  members{ &internal, &external },
+	  jbod( members ),
+	  page_buffer( 64*1024 ),
+	  page_buffer_span( page_buffer )
+	{
+		if( with_page_buffer ) {
+			jbod.properties.PageBuffer = &page_buffer_span;
+		}
+
+		// a SPI NOR flash: 4K sector erase about 45ms, page program about 1us per word
+		external_raw.memory_mapped = false;
+		external_raw.timing.erase_base_us = 45000;
+		external_raw.timing.erase_per_kb_us = 0;
+		external_raw.timing.program_word_us = 1;
+		external_raw.timing.read_access_us = 40;
+		external_raw.timing.read_per_kb_us = 80;
+	}
+
+	bool equals( const bytes_t & reference ) const {
+		return std::equal( internal_memory.begin(), internal_memory.end(), reference.begin() ) &&
+			std::equal( external_memory.begin(), external_memory.end(), reference.begin() + INTERNAL_SIZE );
+	}
+
+	std::size_t get_erases() const {
+		return internal_raw.get_statistic().erase_operations + external_raw.get_statistic().erase_operations;
+	}
+
+	uint64_t get_microseconds() const {
+		return internal_raw.get_microseconds() + external_raw.get_microseconds();
+	}
+};
+
+struct Counts
+{
+	unsigned same_disc = 0;
+	unsigned cross_disc = 0;
+	unsigned spanning = 0;
+	unsigned overlapping = 0;
+	unsigned errors = 0;
+};
+
+bool is_internal( std::size_t address, std::size_t len )
+{
+	return address + len <= INTERNAL_SIZE;
+}
+
+bool is_external( std::size_t address )
+{
+	return address >= INTERNAL_SIZE;
+}
+
+void write_random( Storage & storage, bytes_t & reference, std::mt19937 & rng )
+{
+	const std::size_t len = 1 + rng() % 3000;
+	const std::size_t address = rng() % (JBOD_SIZE - len);
+
+	bytes_t data( len );
+
+	for( std::byte & b : data ) {
+		b = static_cast<std::byte>( rng() );
+	}
+
+	storage.jbod.write( address, data );
+	std::copy( data.begin(), data.end(), reference.begin() + address );
+}
+
+void copy_random( Storage & storage, bytes_t & reference, std::mt19937 & rng, Counts & counts )
+{
+	const std::size_t len = 1 + rng() % (rng() % 4 == 0 ? 40*1024 : 2000);
+	std::size_t src = rng() % (JBOD_SIZE - len);
+	std::size_t dst = rng() % (JBOD_SIZE - len);
+
+	// overlapping copies, up and down
+	if( rng() % 4 == 0 ) {
+		const std::size_t distance = 1 + rng() % len;
+
+		dst = rng() % 2 ? src + distance : src - std::min( src, distance );
+		dst = std::min( dst, JBOD_SIZE - len );
+	}
+
+	const bool src_internal = is_internal( src, len );
+	const bool dst_internal = is_internal( dst, len );
+
+	if( (src_internal && dst_internal) || (is_external( src ) && is_external( dst )) ) {
+		counts.same_disc++;
+	} else if( (src_internal || is_external( src )) && (dst_internal || is_external( dst )) ) {
+		counts.cross_disc++;
+	} else {
+		counts.spanning++;
+	}
+
+	if( src < dst + len && dst < src + len ) {
+		counts.overlapping++;
+	}
+
+	if( !storage.jbod.copy( dst, src, len ) ) {
+		counts.errors++;
+	}
+
+	memmove( reference.data() + dst, reference.data() + src, len );
+}
+
+struct Cost
+{
+	std::size_t erases = 0;
+	uint64_t us = 0;
+	bool ok = false;
+};
+
+/**
+ * copies from one disc to the other, with copy() or the chunk wise default
+ */
+template<class Copy> Cost measure( std::size_t dst, std::size_t src, std::size_t len, bool with_page_buffer, Copy copy )
+{
+	Storage storage( with_page_buffer );
+	bytes_t reference( JBOD_SIZE, std::byte(0xFF) );
+	std::mt19937 rng( 7 );
+
+	// the whole JBOD has data
+	for( std::size_t i = 0; i < JBOD_SIZE; i++ ) {
+		reference[i] = static_cast<std::byte>( rng() );
+	}
+
+	std::copy( reference.begin(), reference.begin() + INTERNAL_SIZE, storage.internal_memory.begin() );
+	std::copy( reference.begin() + INTERNAL_SIZE, reference.end(), storage.external_memory.begin() );
+
+	const std::size_t erases = storage.get_erases();
+	const uint64_t start = storage.get_microseconds();
+
+	Cost cost;
+	cost.ok = copy( storage.jbod, dst, src, len );
+	cost.erases = storage.get_erases() - erases;
+	cost.us = storage.get_microseconds() - start;
+
+	memmove( reference.data() + dst, reference.data() + src, len );
+
+	cost.ok = cost.ok && storage.equals( reference );
+
+	return cost;
+}
+
+bool compare_with_chunks( const char *name, std::size_t dst, std::size_t src, std::size_t len )
+{
+	auto paged_copy = []( JBODGenericFlashDriver & jbod, std::size_t d, std::size_t s, std::size_t l ) {
+		return jbod.copy( d, s, l );
+	};
+
+	const Cost paged = measure( dst, src, len, true, paged_copy );
+	const Cost unbuffered = measure( dst, src, len, false, paged_copy );
+
+	const Cost chunked = measure( dst, src, len, false, []( JBODGenericFlashDriver & jbod, std::size_t d, std::size_t s, std::size_t l ) {
+		return jbod.MemoryInterface::copy( d, s, l );
+	});
+
+	const bool ok = paged.ok && unbuffered.ok && chunked.ok;
+
+	printf( "%-40s %10zu %12.1f %10zu %12.1f %10zu %12.1f %s\n", name,
+			paged.erases, paged.us / 1000.0,
+			unbuffered.erases, unbuffered.us / 1000.0,
+			chunked.erases, chunked.us / 1000.0,
+			ok ? "Ok" : "ERROR" );
+
+	return ok && paged.erases <= unbuffered.erases && unbuffered.erases <= chunked.erases;
+}
+
+/**
+ * random writes and copies, compared with memmove()
+ */
+bool run_random( unsigned ops, bool with_page_buffer )
+{
+	Storage storage( with_page_buffer );
+	bytes_t reference( JBOD_SIZE, std::byte(0xFF) );
+	std::mt19937 rng( 1 );
+	Counts counts;
+	unsigned first_difference = 0;
+
+	for( unsigned op = 0; op < ops; op++ ) {
+		write_random( storage, reference, rng );
+		copy_random( storage, reference, rng, counts );
+
+		if( first_difference == 0 && !storage.equals( reference ) ) {
+			first_difference = op + 1;
+		}
+	}
+
+	const bool ok = counts.errors == 0 && first_difference == 0;
+
+	printf( "%u random copies %s page buffer: %u on one disc, %u between the discs, %u spanning both, %u overlapping, %u failed => %s\n",
+			ops, with_page_buffer ? "with" : "without",
+			counts.same_disc, counts.cross_disc, counts.spanning, counts.overlapping, counts.errors,
+			ok ? "Ok" : "ERROR" );
+
+	if( first_difference ) {
+		printf( "first difference to memmove() after copy %u\n", first_difference );
+	}
+
+	return ok;
+}
+
+bool parse_args( int argc, char **argv, unsigned & ops )
+{
+	for( int i = 1; i < argc; i++ ) {
+		const std::string arg = argv[i];
+
+		if( arg == "--ops" && i + 1 < argc ) {
+			ops = std::strtoul( argv[++i], nullptr, 10 );
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+} // namespace
+
+int main( int argc, char **argv )
+{
+	unsigned ops = 2000;
+
+	if( !parse_args( argc, argv, ops ) ) {
+		printf( "usage: %s [--ops count]\n", argv[0] );
+		return 2;
+	}
+
+	bool ok = run_random( ops, true );
+	ok &= run_random( ops, false );
+
+	printf( "\n%-40s %10s %12s %10s %12s %10s %12s\n", "copy between the discs",
+			"erases", "ms", "no buffer", "no buf. ms", "chunked", "chunked ms" );
+
+	ok &= compare_with_chunks( "64K external => internal sector 4", 48*1024, INTERNAL_SIZE + 64*1024, 64*1024 );
+	ok &= compare_with_chunks( "64K internal sector 4 => external", INTERNAL_SIZE + 64*1024, 48*1024, 64*1024 );
+	ok &= compare_with_chunks( "40K internal => external, unaligned", INTERNAL_SIZE + 1000, 100, 40*1024 );
+	ok &= compare_with_chunks( "10K external => internal, unaligned", 5000, INTERNAL_SIZE + 3, 10*1024 );
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,235 @@
+/*
+ * Generates a delta patch for DeltaPatchApplier (see DeltaPatch.h).
+ *
+ * Build on the host:
+ *   g++ -std=c++20 -O2 -I../Drivers/stm32_internal_flash/Inc -o make_delta_patch \
+ *       make_delta_patch.cpp ../Drivers/stm32_internal_flash/Inc/Sha256.cpp
+ *
+ * Usage:
+ *   make_delta_patch old.bin new.bin patch.bin
+ *
+ * Greedy matcher: every 8 byte window of the old image is indexed.
+ * For each position of the new image, the longest match is copied.
+ * The positions directly after the last copy are tried first, because
+ * in a minor release most code is unchanged or only moved a bit, so
+ * the copy offsets stay small.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "DeltaPatch.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
+
+using namespace stm32_internal_flash;
+
+namespace {
+
+constexpr std::size_t KEY_SIZE = 8;
+constexpr std::size_t MAX_CANDIDATES = 32;
+
+// a copy command costs 3 bytes, if the offset is near the last copy
+constexpr std::size_t MIN_COPY_NEAR = 4;
+constexpr std::size_t MIN_COPY_FAR = 12;
+
+using bytes_t = std::vector<std::byte>;
+
+bool read_file( const char *name, bytes_t & data )
+{
+	std::ifstream in( name, std::ios::binary );
+
+	if( !in ) {
+		return false;
+	}
+
+	std::vector<char> buffer( (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>() );
+	data.resize( buffer.size() );
+	memcpy( data.data(), buffer.data(), buffer.size() );
+
+	return true;
+}
+
+uint64_t get_key( const bytes_t & data, std::size_t pos )
+{
+	uint64_t key = 0;
+	memcpy( &key, data.data() + pos, KEY_SIZE );
+	return key;
+}
+
+void put_varint( bytes_t & out, uint32_t value )
+{
+	while( value >= 0x80 ) {
+		out.push_back( static_cast<std::byte>( (value & 0x7F) | 0x80 ) );
+		value >>= 7;
+	}
+
+	out.push_back( static_cast<std::byte>( value ) );
+}
+
+class PatchWriter
+{
+	bytes_t & out;
+	std::size_t last_copy_end = 0;
+
+public:
+	std::size_t copies = 0;
+	std::size_t literals = 0;
+
+	PatchWriter( bytes_t & out_ )
+	: out( out_ )
+	{}
+
+	std::size_t get_last_copy_end() const {
+		return last_copy_end;
+	}
+
+	void literal( const bytes_t & data, std::size_t pos, std::size_t len ) {
+		if( len == 0 ) {
+			return;
+		}
+
+		out.push_back( static_cast<std::byte>( delta_patch::Command::Literal ) );
+		put_varint( out, len );
+		out.insert( out.end(), data.begin() + pos, data.begin() + pos + len );
+		literals++;
+	}
+
+	void copy( std::size_t offset, std::size_t len ) {
+		out.push_back( static_cast<std::byte>( delta_patch::Command::Copy ) );
+		put_varint( out, len );
+		put_varint( out, delta_patch::zigzag_encode( static_cast<int32_t>( offset - last_copy_end ) ) );
+		last_copy_end = offset + len;
+		copies++;
+	}
+};
+
+} // namespace
+
+int main( int argc, char **argv )
+{
+	if( argc != 4 ) {
+		std::cerr << "usage: " << argv[0] << " old.bin new.bin patch.bin\n";
+		return 1;
+	}
+
+	bytes_t old_image;
+	bytes_t new_image;
+
+	if( !read_file( argv[1], old_image ) ) {
+		std::cerr << "cannot read " << argv[1] << "\n";
+		return 1;
+	}
+
+	if( !read_file( argv[2], new_image ) ) {
+		std::cerr << "cannot read " << argv[2] << "\n";
+		return 1;
+	}
+
+	std::unordered_map<uint64_t,std::vector<uint32_t>> index;
+
+	for( std::size_t pos = 0; pos + KEY_SIZE <= old_image.size(); pos++ ) {
+		auto & candidates = index[get_key( old_image, pos )];
+
+		if( candidates.size() < MAX_CANDIDATES ) {
+			candidates.push_back( pos );
+		}
+	}
+
+	auto match_length = [&]( std::size_t old_pos, std::size_t new_pos ) {
+		std::size_t len = 0;
+
+		while( old_pos + len < old_image.size() &&
+				new_pos + len < new_image.size() &&
+				old_image[old_pos + len] == new_image[new_pos + len] ) {
+			len++;
+		}
+
+		return len;
+	};
+
+	delta_patch::Header header {};
+	header.magic = delta_patch::MAGIC;
+	header.old_size = old_image.size();
+	header.new_size = new_image.size();
+	header.reserved = 0xFFFFFFFF;
+	header.old_hash = Sha256::hash( old_image );
+	header.new_hash = Sha256::hash( new_image );
+
+	bytes_t patch( sizeof(header) );
+	memcpy( patch.data(), &header, sizeof(header) );
+
+	PatchWriter writer( patch );
+
+	std::size_t literal_start = 0;
+	std::size_t pos = 0;
+
+	while( pos < new_image.size() ) {
+		std::size_t best_offset = 0;
+		std::size_t best_len = 0;
+
+		// unchanged code, or a few bytes replaced since the last copy
+		const std::size_t near[] = {
+			writer.get_last_copy_end(),
+			writer.get_last_copy_end() + (pos - literal_start)
+		};
+
+		for( std::size_t offset : near ) {
+			if( offset < old_image.size() ) {
+				const std::size_t len = match_length( offset, pos );
+
+				if( len >= MIN_COPY_NEAR && len > best_len ) {
+					best_offset = offset;
+					best_len = len;
+				}
+			}
+		}
+
+		if( pos + KEY_SIZE <= new_image.size() ) {
+			if( auto it = index.find( get_key( new_image, pos ) ); it != index.end() ) {
+				for( uint32_t offset : it->second ) {
+					const std::size_t len = match_length( offset, pos );
+
+					if( len >= MIN_COPY_FAR && len > best_len ) {
+						best_offset = offset;
+						best_len = len;
+					}
+				}
+			}
+		}
+
+		if( best_len == 0 ) {
+			pos++;
+			continue;
+		}
+
+		writer.literal( new_image, literal_start, pos - literal_start );
+		writer.copy( best_offset, best_len );
+
+		pos += best_len;
+		literal_start = pos;
+	}
+
+	writer.literal( new_image, literal_start, pos - literal_start );
+
+	std::ofstream out( argv[3], std::ios::binary );
+	out.write( reinterpret_cast<const char*>( patch.data() ), patch.size() );
+
+	if( !out ) {
+		std::cerr << "cannot write " << argv[3] << "\n";
+		return 1;
+	}
+
+	std::printf( "old: %zu bytes, new: %zu bytes, patch: %zu bytes (%zu copies, %zu literals), %.1fx smaller\n",
+			old_image.size(),
+			new_image.size(),
+			patch.size(),
+			writer.copies,
+			writer.literals,
+			static_cast<double>( new_image.size() ) / patch.size() );
+
+	return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Writes the partition block of the linker script from Core/app/flash_partitions.h.
+ *
+ * The block sits between the BEGIN and END PARTITIONS comments at the
+ * top of STM32F401RETX_FLASH.ld. It defines the symbols
+ *
+ *   _flash_partitions_start, _flash_partitions_size
+ *   _partition_<name>_start, _partition_<name>_size
+ *
+ * and the FLASH_FS region is built from the first two. So the region,
+ * the sector tables and the partition views can't drift apart.
+ *
+ * Build on the host:
+ *   g++ -std=c++20 -O2 -I../Drivers/stm32_internal_flash/Inc -I../Core/app -o partition_ld partition_ld.cpp
+ *
+ * Usage:
+ *   partition_ld                    prints the block
+ *   partition_ld --update file.ld   replaces the block in the linker script
+ *   partition_ld --check file.ld    fails, if the block of the linker script is outdated
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "flash_partitions.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace stm32_internal_flash;
+
+namespace {
+
+const std::string BEGIN_MARKER = "/* BEGIN PARTITIONS";
+const std::string END_MARKER = "/* END PARTITIONS */";
+
+std::string format_symbol( const std::string & name, std::size_t value )
+{
+	char buffer[128];
+	std::snprintf( buffer, sizeof(buffer), "%-36s = 0x%08zX;\n", name.c_str(), value );
+	return buffer;
+}
+
+std::string make_block()
+{
+	std::string block = BEGIN_MARKER + ", generated by tools/partition_ld from Core/app/flash_partitions.h, don't edit */\n";
+
+	block += format_symbol( "_flash_partitions_start", flash_partitions.get_start_address() );
+	block += format_symbol( "_flash_partitions_size", flash_partitions.get_size() );
+
+	for( const Partition & partition : flash_partitions ) {
+		const std::string prefix = std::string( "_partition_" ) + partition.name;
+
+		block += format_symbol( prefix + "_start", partition.start_address );
+		block += format_symbol( prefix + "_size", partition.size );
+	}
+
+	block += END_MARKER;
+
+	return block;
+}
+
+bool read_file( const std::string & name, std::string & content )
+{
+	std::ifstream in( name, std::ios::binary );
+
+	if( !in ) {
+		return false;
+	}
+
+	std::stringstream buffer;
+	buffer << in.rdbuf();
+	content = buffer.str();
+
+	return true;
+}
+
+/**
+ * replaces the block, returns false if the markers are missing
+ */
+bool replace_block( std::string & content, const std::string & block )
+{
+	const std::size_t begin = content.find( BEGIN_MARKER );
+
+	if( begin == std::string::npos ) {
+		return false;
+	}
+
+	const std::size_t end = content.find( END_MARKER, begin );
+
+	if( end == std::string::npos ) {
+		return false;
+	}
+
+	content.replace( begin, end + END_MARKER.size() - begin, block );
+
+	return true;
+}
+
+} // namespace
+
+int main( int argc, char **argv )
+{
+	const std::string block = make_block();
+
+	if( argc == 1 ) {
+		std::printf( "%s\n", block.c_str() );
+		return 0;
+	}
+
+	const std::string mode = argv[1];
+
+	if( argc != 3 || (mode != "--update" && mode != "--check") ) {
+		std::printf( "usage: %s [--update|--check file.ld]\n", argv[0] );
+		return 1;
+	}
+
+	std::string content;
+
+	if( !read_file( argv[2], content ) ) {
+		std::fprintf( stderr, "cannot read %s\n", argv[2] );
+		return 1;
+	}
+
+	std::string updated = content;
+
+	if( !replace_block( updated, block ) ) {
+		std::fprintf( stderr, "%s has no BEGIN and END PARTITIONS comments\n", argv[2] );
+		return 1;
+	}
+
+	if( updated == content ) {
+		std::printf( "%s is up to date\n", argv[2] );
+		return 0;
+	}
+
+	if( mode == "--check" ) {
+		std::fprintf( stderr, "%s is outdated, run %s --update %s\n", argv[2], argv[0], argv[2] );
+		return 1;
+	}
+
+	std::ofstream out( argv[2], std::ios::binary );
+
+	if( !(out << updated) ) {
+		std::fprintf( stderr, "cannot write %s\n", argv[2] );
+		return 1;
+	}
+
+	std::printf( "%s updated\n", argv[2] );
+
+	return 0;
+}
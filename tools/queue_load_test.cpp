@@ -0,0 +1,323 @@
+/*
+ * Multi producer load test of the QueuedMemoryInterface.
+ *
+ * Several producer threads share the simulated FLASH_FS sectors
+ * (16K, 16K, 16K, 64K). Each one owns a slot, and slots of different
+ * threads are placed in the same pages. So an unaligned write of one
+ * thread erases and restores the page, while the others are reading
+ * their slots from mapped memory at the same time.
+ *
+ * Every producer writes generations of a pattern into its slot and
+ * reads them back with read() and read_async(). Since only the owner
+ * writes a slot, each read has to return the last written generation.
+ * Scanner threads read the whole flash, which takes long enough, that
+ * writes can start while the data is copied, and check that every slot
+ * holds a complete pattern. A torn read from mapped memory, eg. the 0xFF
+ * of the erased page, shows up as an error.
+ *
+ * SimulatedRawDriver takes no real time, so the erase is followed by
+ * a real sleep, which keeps the page blank long enough for the race.
+ *
+ * Build on the host:
+ *   g++ -std=c++20 -O2 -pthread -I../Drivers/stm32_internal_flash/Inc -o queue_load_test queue_load_test.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/QueuedMemoryInterface.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/GenericFlashDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/SimulatedRawDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/BlankCheck.cpp
+ *
+ * Usage:
+ *   queue_load_test [--threads count] [--scanners count] [--ops count] [--erase-sleep us]
+ *
+ *   --threads      producer threads, default 6
+ *   --scanners     threads reading the whole flash, default 2
+ *   --ops          requests of each producer, default 2000
+ *   --erase-sleep  real time a page stays blank after erasing, default 50us
+ *
+ * Returns 1 if any read returned wrong data.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "QueuedMemoryInterface.h"
+#include "GenericFlashDriver.h"
+#include "SimulatedRawDriver.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace stm32_internal_flash;
+
+namespace {
+
+using bytes_t = std::vector<std::byte>;
+
+constexpr std::size_t SECTOR_SIZES[] = { 16*1024, 16*1024, 16*1024, 64*1024 };
+constexpr std::size_t FLASH_SIZE = 112*1024;
+
+constexpr std::size_t SLOT_SIZE = 256;
+
+struct Options
+{
+	unsigned threads = 6;
+	unsigned scanners = 2;
+	unsigned ops = 2000;
+	unsigned erase_sleep_us = 50;
+};
+
+/**
+ * keeps an erased page blank for a while in real time
+ */
+class SlowEraseRawDriver : public SimulatedRawDriver
+{
+	unsigned erase_sleep_us;
+
+public:
+	SlowEraseRawDriver( std::span<std::byte> memory, std::span<const std::size_t> page_sizes, unsigned erase_sleep_us_ )
+	: SimulatedRawDriver( memory, page_sizes ),
+	  erase_sleep_us( erase_sleep_us_ )
+	{}
+
+	bool erase_page( std::size_t address, std::size_t size ) override {
+		const bool ok = SimulatedRawDriver::erase_page( address, size );
+		std::this_thread::sleep_for( std::chrono::microseconds( erase_sleep_us ) );
+		return ok;
+	}
+};
+
+struct ProducerResult
+{
+	std::size_t writes = 0;
+	std::size_t reads = 0;
+	std::size_t async_reads = 0;
+	std::size_t scans = 0;
+	std::size_t errors = 0;
+};
+
+/**
+ * slots of neighbour threads are in the same 16K sector
+ */
+std::size_t get_slot_address( unsigned thread_idx )
+{
+	return (thread_idx % 3) * 16*1024 + (thread_idx / 3) * 1024 + 100;
+}
+
+void fill_pattern( bytes_t & data, unsigned thread_idx, unsigned generation )
+{
+	for( std::size_t i = 0; i < data.size(); i++ ) {
+		data[i] = static_cast<std::byte>( thread_idx * 31 + generation * 7 + i );
+	}
+}
+
+/**
+ * the slot holds the pattern of any generation
+ */
+bool is_pattern( const std::byte *data )
+{
+	for( std::size_t i = 1; i < SLOT_SIZE; i++ ) {
+		if( static_cast<uint8_t>( static_cast<uint8_t>(data[i]) - static_cast<uint8_t>(data[0]) ) != static_cast<uint8_t>(i) ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void run_producer( QueuedMemoryInterface & queue, unsigned thread_idx, const Options & options, ProducerResult & result )
+{
+	std::mt19937 rng( thread_idx + 1 );
+	const std::size_t address = get_slot_address( thread_idx );
+
+	bytes_t expected( SLOT_SIZE );
+	bytes_t buffer( SLOT_SIZE );
+	unsigned generation = 0;
+
+	// generation 0 has been written by main()
+	fill_pattern( expected, thread_idx, generation );
+
+	for( unsigned op = 0; op < options.ops; op++ ) {
+		std::span<std::byte> data( buffer );
+		std::size_t len = 0;
+
+		switch( rng() % 4 )
+		{
+		case 0:
+			fill_pattern( expected, thread_idx, ++generation );
+
+			if( queue.write( address, expected ) != SLOT_SIZE ) {
+				result.errors++;
+			}
+
+			result.writes++;
+			continue;
+
+		case 1:
+		{
+			QueuedMemoryInterface::Completion completion;
+
+			while( !queue.read_async( address, data, &completion ) ) {
+				std::this_thread::yield();
+			}
+
+			while( !completion.is_done() ) {
+				std::this_thread::yield();
+			}
+
+			len = completion.get_result();
+			result.async_reads++;
+			break;
+		}
+
+		default:
+			len = queue.read( address, data );
+			result.reads++;
+			break;
+		}
+
+		if( len != SLOT_SIZE || memcmp( buffer.data(), expected.data(), SLOT_SIZE ) != 0 ) {
+			result.errors++;
+		}
+	}
+}
+
+void run_scanner( QueuedMemoryInterface & queue, const Options & options, ProducerResult & result )
+{
+	bytes_t buffer( FLASH_SIZE );
+
+	for( unsigned op = 0; op < options.ops; op++ ) {
+		std::span<std::byte> data( buffer );
+
+		if( queue.read( 0, data ) != buffer.size() ) {
+			result.errors++;
+			continue;
+		}
+
+		result.scans++;
+
+		for( unsigned thread_idx = 0; thread_idx < options.threads; thread_idx++ ) {
+			if( !is_pattern( buffer.data() + get_slot_address( thread_idx ) ) ) {
+				result.errors++;
+			}
+		}
+	}
+}
+
+bool parse_args( int argc, char **argv, Options & options )
+{
+	for( int i = 1; i < argc; i++ ) {
+		const std::string arg = argv[i];
+
+		if( i + 1 >= argc ) {
+			return false;
+		}
+
+		const unsigned value = std::strtoul( argv[++i], nullptr, 10 );
+
+		if( arg == "--threads" ) {
+			options.threads = value;
+		} else if( arg == "--scanners" ) {
+			options.scanners = value;
+		} else if( arg == "--ops" ) {
+			options.ops = value;
+		} else if( arg == "--erase-sleep" ) {
+			options.erase_sleep_us = value;
+		} else {
+			return false;
+		}
+	}
+
+	return options.threads > 0 && options.threads <= 3 * 16;
+}
+
+} // namespace
+
+int main( int argc, char **argv )
+{
+	Options options;
+
+	if( !parse_args( argc, argv, options ) ) {
+		printf( "usage: %s [--threads count] [--scanners count] [--ops count] [--erase-sleep us]\n", argv[0] );
+		return 2;
+	}
+
+	bytes_t memory( FLASH_SIZE, std::byte(0xFF) );
+	SlowEraseRawDriver raw_driver( memory, SECTOR_SIZES, options.erase_sleep_us );
+	GenericFlashDriver driver( raw_driver );
+	QueuedMemoryInterface queue( driver );
+
+	queue.wait_func = []() {
+		std::this_thread::yield();
+	};
+
+	std::atomic<bool> stop_worker { false };
+
+	std::thread worker( [&]() {
+		while( !stop_worker.load() ) {
+			if( queue.process() == 0 ) {
+				std::this_thread::yield();
+			}
+		}
+
+		// finish what is left
+		queue.process();
+	});
+
+	std::vector<ProducerResult> results( options.threads + options.scanners );
+	std::vector<std::thread> producers;
+
+	// all slots are written once, before the scanners start
+	for( unsigned i = 0; i < options.threads; i++ ) {
+		bytes_t data( SLOT_SIZE );
+		fill_pattern( data, i, 0 );
+		queue.write( get_slot_address( i ), data );
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+
+	for( unsigned i = 0; i < options.threads; i++ ) {
+		producers.emplace_back( run_producer, std::ref( queue ), i, std::cref( options ), std::ref( results[i] ) );
+	}
+
+	for( unsigned i = 0; i < options.scanners; i++ ) {
+		producers.emplace_back( run_scanner, std::ref( queue ), std::cref( options ), std::ref( results[options.threads + i] ) );
+	}
+
+	for( std::thread & producer : producers ) {
+		producer.join();
+	}
+
+	stop_worker = true;
+	worker.join();
+
+	const auto duration = std::chrono::steady_clock::now() - start;
+
+	ProducerResult total;
+
+	printf( "%-8s %8s %8s %12s %8s %8s\n", "thread", "writes", "reads", "async reads", "scans", "errors" );
+
+	for( unsigned i = 0; i < results.size(); i++ ) {
+		const ProducerResult & result = results[i];
+
+		printf( "%-8u %8zu %8zu %12zu %8zu %8zu\n", i, result.writes, result.reads, result.async_reads, result.scans, result.errors );
+
+		total.writes      += result.writes;
+		total.reads       += result.reads;
+		total.async_reads += result.async_reads;
+		total.scans       += result.scans;
+		total.errors      += result.errors;
+	}
+
+	printf( "%-8s %8zu %8zu %12zu %8zu %8zu\n", "total", total.writes, total.reads, total.async_reads, total.scans, total.errors );
+
+	printf( "\nerases: %zu, simulated flash time: %.3fs, real time: %.3fs\n",
+			raw_driver.get_statistic().erase_operations,
+			raw_driver.get_microseconds() / 1e6,
+			std::chrono::duration<double>( duration ).count() );
+
+	printf( "%s\n", total.errors == 0 ? "Ok" : "ERROR" );
+
+	return total.errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,400 @@
+/*
+ * Multi threaded load generator for the ScheduledMemoryInterface.
+ *
+ * The simulated FLASH_FS sectors (16K, 16K, 16K, 64K) are not memory
+ * mapped here, so every read goes through the queue. Each operation
+ * of the raw driver also takes real time, so the backlog fills up.
+ * The threads:
+ *
+ * - readers read sector 0 and measure how long they wait.
+ *   Nothing writes there, so their reads may pass all writes and erases.
+ * - writers append 16 byte records to their own half of sector 1, with
+ *   several writes in flight. Adjacent records are merged.
+ * - an eraser writes a marker into sector 2 and erases the sector twice
+ *   in a row. The second erase is covered by the first one, without a
+ *   write in between, so it's dropped.
+ *
+ * At the end the records are read back, and the metrics of the scheduler
+ * are compared with what the threads did:
+ *
+ * - reads wait less than writes and erases (read priority)
+ * - writes have been merged, erases have been dropped
+ * - the sum of process() is the number of completed requests
+ *
+ * Build on the host:
+ *   g++ -std=c++20 -O2 -pthread -I../Drivers/stm32_internal_flash/Inc -o scheduler_load_test scheduler_load_test.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/ScheduledMemoryInterface.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/QueuedMemoryInterface.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/GenericFlashDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/SimulatedRawDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/BlankCheck.cpp
+ *
+ * Usage:
+ *   scheduler_load_test [--readers count] [--writers count] [--ops count]
+ *
+ *   --readers  reading threads, default 2
+ *   --writers  writing threads, 1 or 2, default 2
+ *   --ops      requests of each thread, default 300
+ *
+ * Returns 1 if data is wrong or one of the checks fails.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "ScheduledMemoryInterface.h"
+#include "GenericFlashDriver.h"
+#include "SimulatedRawDriver.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace stm32_internal_flash;
+
+namespace {
+
+using bytes_t = std::vector<std::byte>;
+
+constexpr std::size_t SECTOR_SIZES[] = { 16*1024, 16*1024, 16*1024, 64*1024 };
+constexpr std::size_t FLASH_SIZE = 112*1024;
+
+constexpr std::size_t READ_SECTOR = 0;
+constexpr std::size_t WRITE_SECTOR = 16*1024;
+constexpr std::size_t ERASE_SECTOR = 32*1024;
+
+constexpr std::size_t RECORD_SIZE = 16;
+constexpr std::size_t WRITES_IN_FLIGHT = 4;
+
+struct Options
+{
+	unsigned readers = 2;
+	unsigned writers = 2;
+	unsigned ops = 300;
+};
+
+/**
+ * each operation of the raw driver takes some real time, so the backlog fills up
+ */
+class SlowRawDriver : public SimulatedRawDriver
+{
+public:
+	using SimulatedRawDriver::SimulatedRawDriver;
+
+	bool erase_page( std::size_t address, std::size_t size ) override {
+		std::this_thread::sleep_for( std::chrono::microseconds( 2000 ) );
+		return SimulatedRawDriver::erase_page( address, size );
+	}
+
+	std::size_t write_page( std::size_t address, const std::span<const std::byte> & buffer ) override {
+		std::this_thread::sleep_for( std::chrono::microseconds( 200 ) );
+		return SimulatedRawDriver::write_page( address, buffer );
+	}
+
+	std::size_t read_page( std::size_t address, std::span<std::byte> & buffer ) override {
+		std::this_thread::sleep_for( std::chrono::microseconds( 20 ) );
+		return SimulatedRawDriver::read_page( address, buffer );
+	}
+};
+
+uint32_t get_microseconds()
+{
+	static const auto start = std::chrono::steady_clock::now();
+	return static_cast<uint32_t>( std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - start ).count() );
+}
+
+std::byte get_read_pattern( std::size_t address )
+{
+	return static_cast<std::byte>( address * 13 + 1 );
+}
+
+std::byte get_record_pattern( unsigned writer_idx, std::size_t record, std::size_t i )
+{
+	return static_cast<std::byte>( writer_idx * 101 + record * 7 + i );
+}
+
+std::size_t get_record_address( unsigned writer_idx, std::size_t record )
+{
+	return WRITE_SECTOR + writer_idx * 8*1024 + record * RECORD_SIZE;
+}
+
+void run_reader( ScheduledMemoryInterface & scheduler, unsigned reader_idx, const Options & options, std::size_t & errors )
+{
+	std::mt19937 rng( reader_idx + 1 );
+	std::array<std::byte,64> buffer;
+
+	for( unsigned op = 0; op < options.ops; op++ ) {
+		const std::size_t address = READ_SECTOR + rng() % (16*1024 - buffer.size());
+		std::span<std::byte> data( buffer );
+
+		if( scheduler.read( address, data ) != buffer.size() ) {
+			errors++;
+			continue;
+		}
+
+		for( std::size_t i = 0; i < buffer.size(); i++ ) {
+			if( buffer[i] != get_read_pattern( address + i ) ) {
+				errors++;
+				break;
+			}
+		}
+	}
+}
+
+void run_writer( ScheduledMemoryInterface & scheduler, unsigned writer_idx, const Options & options, std::size_t & errors )
+{
+	const std::size_t records = std::min<std::size_t>( options.ops, 8*1024 / RECORD_SIZE );
+
+	// has to be valid until the writes are done
+	bytes_t data( records * RECORD_SIZE );
+	std::vector<QueuedMemoryInterface::Completion> completions( records );
+
+	for( std::size_t record = 0; record < records; record++ ) {
+		for( std::size_t i = 0; i < RECORD_SIZE; i++ ) {
+			data[record * RECORD_SIZE + i] = get_record_pattern( writer_idx, record, i );
+		}
+
+		// keep WRITES_IN_FLIGHT writes queued
+		if( record >= WRITES_IN_FLIGHT ) {
+			while( !completions[record - WRITES_IN_FLIGHT].is_done() ) {
+				std::this_thread::yield();
+			}
+		}
+
+		const std::span<const std::byte> record_data( data.data() + record * RECORD_SIZE, RECORD_SIZE );
+
+		while( !scheduler.write_async( get_record_address( writer_idx, record ), record_data, &completions[record] ) ) {
+			std::this_thread::yield();
+		}
+	}
+
+	for( const auto & completion : completions ) {
+		while( !completion.is_done() ) {
+			std::this_thread::yield();
+		}
+
+		if( completion.get_result() != RECORD_SIZE ) {
+			errors++;
+		}
+	}
+}
+
+void run_eraser( ScheduledMemoryInterface & scheduler, const Options & options, std::size_t & errors )
+{
+	const std::array<std::byte,RECORD_SIZE> marker {};
+
+	for( unsigned op = 0; op < options.ops / 10; op++ ) {
+		QueuedMemoryInterface::Completion first;
+		QueuedMemoryInterface::Completion second;
+
+		if( scheduler.write( ERASE_SECTOR + (op % 64) * RECORD_SIZE, marker ) != marker.size() ) {
+			errors++;
+		}
+
+		while( !scheduler.erase_async( ERASE_SECTOR, 16*1024, &first ) ) {
+			std::this_thread::yield();
+		}
+
+		while( !scheduler.erase_async( ERASE_SECTOR, 16*1024, &second ) ) {
+			std::this_thread::yield();
+		}
+
+		while( !first.is_done() || !second.is_done() ) {
+			std::this_thread::yield();
+		}
+
+		if( first.get_result() != 16*1024 || second.get_result() != 16*1024 ) {
+			errors++;
+		}
+
+		std::array<std::byte,RECORD_SIZE> buffer;
+		std::span<std::byte> data( buffer );
+
+		if( scheduler.read( ERASE_SECTOR + (op % 64) * RECORD_SIZE, data ) != buffer.size() ||
+			std::any_of( buffer.begin(), buffer.end(), []( std::byte b ) { return b != std::byte(0xFF); } ) ) {
+			errors++;
+		}
+	}
+}
+
+/**
+ * reads the records back, after all threads are done
+ */
+std::size_t check_records( ScheduledMemoryInterface & scheduler, const Options & options )
+{
+	const std::size_t records = std::min<std::size_t>( options.ops, 8*1024 / RECORD_SIZE );
+	std::size_t errors = 0;
+
+	for( unsigned writer_idx = 0; writer_idx < options.writers; writer_idx++ ) {
+		for( std::size_t record = 0; record < records; record++ ) {
+			std::array<std::byte,RECORD_SIZE> buffer;
+			std::span<std::byte> data( buffer );
+
+			if( scheduler.read( get_record_address( writer_idx, record ), data ) != RECORD_SIZE ) {
+				errors++;
+				continue;
+			}
+
+			for( std::size_t i = 0; i < RECORD_SIZE; i++ ) {
+				if( buffer[i] != get_record_pattern( writer_idx, record, i ) ) {
+					errors++;
+					break;
+				}
+			}
+		}
+	}
+
+	return errors;
+}
+
+void print_metric( const char *name, const ScheduledMemoryInterface::ClassMetric & metric )
+{
+	printf( "%-8s %10u %10u %14u %14u\n", name,
+			metric.completed.load(),
+			metric.max_depth.load(),
+			metric.get_average_latency_us(),
+			metric.max_latency_us.load() );
+}
+
+bool check( const char *name, bool ok )
+{
+	printf( "%-50s %s\n", name, ok ? "Ok" : "ERROR" );
+	return ok;
+}
+
+bool parse_args( int argc, char **argv, Options & options )
+{
+	for( int i = 1; i < argc; i++ ) {
+		const std::string arg = argv[i];
+
+		if( i + 1 >= argc ) {
+			return false;
+		}
+
+		const unsigned value = std::strtoul( argv[++i], nullptr, 10 );
+
+		if( arg == "--readers" ) {
+			options.readers = value;
+		} else if( arg == "--writers" ) {
+			options.writers = value;
+		} else if( arg == "--ops" ) {
+			options.ops = value;
+		} else {
+			return false;
+		}
+	}
+
+	return options.readers > 0 && options.writers > 0 && options.writers <= 2 && options.ops >= 10;
+}
+
+} // namespace
+
+int main( int argc, char **argv )
+{
+	Options options;
+
+	if( !parse_args( argc, argv, options ) ) {
+		printf( "usage: %s [--readers count] [--writers count] [--ops count]\n", argv[0] );
+		return 2;
+	}
+
+	bytes_t memory( FLASH_SIZE, std::byte(0xFF) );
+
+	for( std::size_t address = READ_SECTOR; address < READ_SECTOR + 16*1024; address++ ) {
+		memory[address] = get_read_pattern( address );
+	}
+
+	SlowRawDriver raw_driver( memory, SECTOR_SIZES );
+	raw_driver.memory_mapped = false;
+
+	GenericFlashDriver driver( raw_driver );
+
+	bytes_t merge_buffer( 1024 );
+	ScheduledMemoryInterface scheduler( driver, merge_buffer, get_microseconds );
+
+	scheduler.wait_func = []() {
+		std::this_thread::yield();
+	};
+
+	std::atomic<bool> stop_worker { false };
+	std::size_t processed = 0;
+
+	std::thread worker( [&]() {
+		while( !stop_worker.load() ) {
+			const std::size_t count = scheduler.process();
+			processed += count;
+
+			if( count == 0 ) {
+				std::this_thread::yield();
+			}
+		}
+
+		// finish what is left
+		processed += scheduler.process();
+	});
+
+	std::vector<std::size_t> errors( options.readers + options.writers + 1 );
+	std::vector<std::thread> threads;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	for( unsigned i = 0; i < options.readers; i++ ) {
+		threads.emplace_back( run_reader, std::ref( scheduler ), i, std::cref( options ), std::ref( errors[i] ) );
+	}
+
+	for( unsigned i = 0; i < options.writers; i++ ) {
+		threads.emplace_back( run_writer, std::ref( scheduler ), i, std::cref( options ), std::ref( errors[options.readers + i] ) );
+	}
+
+	threads.emplace_back( run_eraser, std::ref( scheduler ), std::cref( options ), std::ref( errors.back() ) );
+
+	for( std::thread & thread : threads ) {
+		thread.join();
+	}
+
+	// the worker is still needed for reading
+	const std::size_t record_errors = check_records( scheduler, options );
+
+	stop_worker = true;
+	worker.join();
+
+	const auto duration = std::chrono::steady_clock::now() - start;
+
+	const ScheduledMemoryInterface::Metrics & metrics = scheduler.get_metrics();
+
+	const std::size_t completed = metrics.read.completed + metrics.write.completed + metrics.erase.completed;
+
+	std::size_t thread_errors = 0;
+
+	for( std::size_t count : errors ) {
+		thread_errors += count;
+	}
+
+	printf( "%-8s %10s %10s %14s %14s\n", "class", "completed", "max depth", "avg latency us", "max latency us" );
+	print_metric( "read",  metrics.read );
+	print_metric( "write", metrics.write );
+	print_metric( "erase", metrics.erase );
+
+	printf( "\nmerged writes: %u, dropped erases: %u, processed: %zu, erases: %zu, real time: %.3fs\n\n",
+			metrics.merged_writes.load(),
+			metrics.dropped_erases.load(),
+			processed,
+			raw_driver.get_statistic().erase_operations,
+			std::chrono::duration<double>( duration ).count() );
+
+	bool ok = true;
+
+	ok &= check( "threads got the expected data", thread_errors == 0 );
+	ok &= check( "records are written", record_errors == 0 );
+	ok &= check( "reads wait less than writes", metrics.read.get_average_latency_us() < metrics.write.get_average_latency_us() );
+	ok &= check( "reads wait less than erases", metrics.read.get_average_latency_us() < metrics.erase.get_average_latency_us() );
+	ok &= check( "writes are merged", metrics.merged_writes > 0 );
+	ok &= check( "erases are dropped", metrics.dropped_erases > 0 );
+	ok &= check( "process() counts completed requests", processed == completed );
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,271 @@
+/*
+ * Host test of the ThreadCopyEngine and the BulkReader.
+ *
+ * ThreadCopyEngine.h is header only and not part of the firmware, so
+ * this is where it gets compiled. The engine has to split copies at
+ * max_transfer_size, refuse a second start() while busy, and report
+ * each transfer exactly once.
+ *
+ * The BulkReader chains reads from the simulated FLASH_FS sectors
+ * (16K, 16K, 16K, 64K) across sector borders. Memory mapped, they are
+ * copied by the engine in several transfers; not memory mapped, poll()
+ * reads them with read_page(). Both are also awaited by a coroutine.
+ *
+ * Build on the host:
+ *   g++ -std=c++20 -O2 -pthread -I../Drivers/stm32_internal_flash/Inc -o thread_copy_engine_test thread_copy_engine_test.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/BulkReader.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/Executor.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/SimulatedRawDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/BlankCheck.cpp
+ *
+ * Usage:
+ *   thread_copy_engine_test
+ *
+ * Returns 1 if one of the checks fails.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "BulkReader.h"
+#include "ThreadCopyEngine.h"
+#include "SimulatedRawDriver.h"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+using namespace stm32_internal_flash;
+
+namespace {
+
+using bytes_t = std::vector<std::byte>;
+
+constexpr std::size_t SECTOR_SIZES[] = { 16*1024, 16*1024, 16*1024, 64*1024 };
+constexpr std::size_t FLASH_SIZE = 112*1024;
+
+// smaller than the reads, so each read takes several transfers
+constexpr std::size_t MAX_TRANSFER_SIZE = 5000;
+
+/**
+ * counts the transfers of the engine
+ */
+class CountingCopyEngine : public ThreadCopyEngine
+{
+public:
+	unsigned transfers = 0;
+
+	using ThreadCopyEngine::ThreadCopyEngine;
+
+	std::size_t start( std::byte *target, const std::byte *source, std::size_t size ) override {
+		const std::size_t started = ThreadCopyEngine::start( target, source, size );
+
+		if( started > 0 ) {
+			transfers++;
+		}
+
+		return started;
+	}
+};
+
+struct Setup
+{
+	bytes_t memory;
+	SimulatedRawDriver raw_driver;
+	CountingCopyEngine engine;
+	BulkReader reader;
+
+	// across the border of sector 1 and 2, and into the 64K sector
+	bytes_t table1;
+	bytes_t table2;
+	bytes_t table3;
+
+	static constexpr std::size_t TABLE1_OFFSET = 100;
+	static constexpr std::size_t TABLE2_OFFSET = 30*1024;
+	static constexpr std::size_t TABLE3_OFFSET = 47*1024;
+
+	explicit Setup( bool memory_mapped )
+	: memory( FLASH_SIZE ),
+	  raw_driver( memory, SECTOR_SIZES ),
+	  engine( MAX_TRANSFER_SIZE ),
+	  reader( raw_driver, engine ),
+	  table1( 3000 ),
+	  table2( 4*1024 ),
+	  table3( 20*1024 )
+	{
+		for( std::size_t i = 0; i < memory.size(); i++ ) {
+			memory[i] = static_cast<std::byte>( i * 7 + i / 251 );
+		}
+
+		raw_driver.memory_mapped = memory_mapped;
+
+		reader.add( TABLE1_OFFSET, table1 );
+		reader.add( TABLE2_OFFSET, table2 );
+		reader.add( TABLE3_OFFSET, table3 );
+	}
+
+	bool equals( std::size_t offset, const bytes_t & table ) const {
+		return std::equal( table.begin(), table.end(), memory.begin() + offset );
+	}
+
+	bool tables_loaded() const {
+		return equals( TABLE1_OFFSET, table1 ) &&
+			   equals( TABLE2_OFFSET, table2 ) &&
+			   equals( TABLE3_OFFSET, table3 );
+	}
+
+	std::size_t tables_size() const {
+		return table1.size() + table2.size() + table3.size();
+	}
+};
+
+bool check( const char *name, bool ok )
+{
+	printf( "%-60s %s\n", name, ok ? "Ok" : "ERROR" );
+	return ok;
+}
+
+AsyncCopyEngine::Status wait_for( AsyncCopyEngine & engine )
+{
+	AsyncCopyEngine::Status status;
+
+	while( (status = engine.poll()) == AsyncCopyEngine::Status::Busy ) {
+		std::this_thread::yield();
+	}
+
+	return status;
+}
+
+bool test_engine()
+{
+	ThreadCopyEngine engine( MAX_TRANSFER_SIZE );
+	bytes_t source( 12000 );
+	bytes_t target( source.size() );
+
+	for( std::size_t i = 0; i < source.size(); i++ ) {
+		source[i] = static_cast<std::byte>( i % 253 );
+	}
+
+	bool ok = engine.poll() == AsyncCopyEngine::Status::Error;
+
+	// the caller starts the rest, like BulkReader does
+	unsigned transfers = 0;
+	bool refused_while_busy = true;
+
+	for( std::size_t done = 0; done < source.size(); transfers++ ) {
+		const std::size_t size = engine.start( target.data() + done, source.data() + done, source.size() - done );
+
+		ok = ok && size == std::min( source.size() - done, MAX_TRANSFER_SIZE );
+
+		if( size == 0 ) {
+			break;
+		}
+
+		refused_while_busy = refused_while_busy && engine.start( target.data(), source.data(), 1 ) == 0;
+
+		ok = ok && wait_for( engine ) == AsyncCopyEngine::Status::Done;
+		done += size;
+	}
+
+	// reported once, then the engine is idle again
+	ok = ok && engine.poll() == AsyncCopyEngine::Status::Error;
+	ok = ok && engine.start( target.data(), source.data(), 0 ) == 0;
+
+	return check( "engine splits copies at max_transfer_size, reports each once",
+			ok && refused_while_busy && transfers == 3 && target == source );
+}
+
+bool test_read( bool memory_mapped )
+{
+	Setup setup( memory_mapped );
+
+	unsigned done_calls = 0;
+	bool done_ok = false;
+	std::size_t done_bytes = 0;
+
+	bool ok = setup.reader.start( [&]( bool ok_, std::size_t bytes ) {
+		done_calls++;
+		done_ok = ok_;
+		done_bytes = bytes;
+	});
+
+	while( !setup.reader.poll() ) {
+		std::this_thread::yield();
+	}
+
+	const auto & statistic = setup.raw_driver.get_statistic();
+
+	// 3000 + 4096 + 20480 bytes, at most 5000 each
+	const bool transfers_ok = memory_mapped ?
+			setup.engine.transfers == 1 + 1 + 5 && statistic.read_operations == 0 :
+			setup.engine.transfers == 0 && statistic.bytes_read == setup.tables_size();
+
+	ok = ok && done_calls == 1 && done_ok && done_bytes == setup.tables_size() &&
+		 !setup.reader.failed() && setup.reader.get_bytes_done() == setup.tables_size();
+
+	return check( memory_mapped ?
+			"mapped: chained reads are copied by the engine" :
+			"not mapped: chained reads are read by poll()",
+			ok && transfers_ok && setup.tables_loaded() );
+}
+
+Task<void> load( BulkReader & reader, Executor & executor, bool & loaded )
+{
+	reader.start();
+	loaded = co_await reader.wait( executor );
+}
+
+bool test_wait( bool memory_mapped )
+{
+	Setup setup( memory_mapped );
+	Executor executor;
+	bool loaded = false;
+
+	executor.spawn( load( setup.reader, executor, loaded ) );
+	executor.run();
+
+	return check( memory_mapped ?
+			"mapped: a coroutine awaits the reader" :
+			"not mapped: a coroutine awaits the reader",
+			loaded && setup.tables_loaded() );
+}
+
+bool test_invalid_reads()
+{
+	Setup setup( true );
+	bytes_t target( 16 );
+
+	bool ok = !setup.reader.add( FLASH_SIZE - 8, target );
+	ok = ok && !setup.reader.add( FLASH_SIZE + 1, std::span<std::byte>() );
+
+	// MAX_READS, three are added by Setup
+	for( std::size_t i = 3; i < BulkReader::MAX_READS; i++ ) {
+		ok = ok && setup.reader.add( 0, target );
+	}
+
+	ok = ok && !setup.reader.add( 0, target );
+
+	setup.reader.start();
+	ok = ok && !setup.reader.add( 0, target ) && !setup.reader.clear();
+
+	while( !setup.reader.poll() ) {
+		std::this_thread::yield();
+	}
+
+	ok = ok && !setup.reader.failed() && setup.reader.clear();
+
+	return check( "reads outside of the flash, too many, or while running fail", ok );
+}
+
+} // namespace
+
+int main()
+{
+	bool ok = true;
+
+	ok &= test_engine();
+	ok &= test_read( true );
+	ok &= test_read( false );
+	ok &= test_wait( true );
+	ok &= test_wait( false );
+	ok &= test_invalid_reads();
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,489 @@
+/*
+ * Replays a trace of TracingMemoryInterface on the simulated FLASH_FS
+ * sectors (16K, 16K, 16K, 64K) with different driver stacks, and compares
+ * erases, bytes programmed and the projected time.
+ *
+ * Build on the host:
+ *   g++ -std=c++20 -O2 -I../Drivers/stm32_internal_flash/Inc -o trace_replay trace_replay.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/TracingMemoryInterface.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/CircularLog.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/GenericFlashDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/SimulatedRawDriver.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/BlankCheck.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/CachedMemoryInterface.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/QueuedMemoryInterface.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/ScheduledMemoryInterface.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/CompressedMemoryInterface.cpp \
+ *       ../Drivers/stm32_internal_flash/Inc/LzCodec.cpp
+ *
+ * Usage:
+ *   trace_replay                        a generated trace
+ *   trace_replay --raw ring.bin         TraceRecords, eg. the ring dumped by the debugger
+ *   trace_replay --log log.bin 16       image of the CircularLog written by flush(),
+ *                                       with its sector size in KB
+ *
+ * The stacks:
+ *   plain       GenericFlashDriver
+ *   scheduled   ScheduledMemoryInterface, writes are deferred and merged
+ *   compressed  CompressedMemoryInterface, a log over all sectors, so the
+ *               erases are distributed (programs are replayed as writes)
+ *   cached      CachedMemoryInterface, 4K in 256 byte blocks; reads of the
+ *               simulated internal flash cost no time, so the hits show,
+ *               what the cache saves in front of an external flash
+ *
+ * The trace has no data, so writes are replayed with generated data.
+ * Times are taken from the simulated clock of SimulatedRawDriver.
+ *
+ * @author Copyright (c) 2024 Martin Oberzalek
+ */
+#include "TracingMemoryInterface.h"
+#include "CachedMemoryInterface.h"
+#include "CircularLog.h"
+#include "CompressedMemoryInterface.h"
+#include "GenericFlashDriver.h"
+#include "ScheduledMemoryInterface.h"
+#include "SimulatedRawDriver.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+using namespace stm32_internal_flash;
+
+namespace {
+
+using bytes_t = std::vector<std::byte>;
+using TraceRecord = TracingMemoryInterface::TraceRecord;
+using Op = TracingMemoryInterface::Op;
+using trace_t = std::vector<TraceRecord>;
+
+constexpr std::size_t SECTOR_SIZES[] = { 16*1024, 16*1024, 16*1024, 64*1024 };
+constexpr std::size_t FLASH_SIZE = 112*1024;
+
+struct Flash
+{
+	bytes_t memory;
+	SimulatedRawDriver raw;
+	GenericFlashDriver driver;
+
+	Flash()
+	: memory( FLASH_SIZE, std::byte(0xFF) ),
+	  raw( memory, SECTOR_SIZES ),
+	  driver( raw )
+	{}
+};
+
+struct Result
+{
+	std::size_t failed = 0;
+	std::size_t erases = 0;
+	std::size_t max_erases = 0;  // of one sector
+	std::size_t bytes_programmed = 0;
+	uint64_t time_us = 0;
+};
+
+bool read_file( const char *name, bytes_t & data )
+{
+	std::ifstream in( name, std::ios::binary );
+
+	if( !in ) {
+		return false;
+	}
+
+	std::vector<char> buffer( (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>() );
+	data.resize( buffer.size() );
+	memcpy( data.data(), buffer.data(), buffer.size() );
+
+	return true;
+}
+
+void append_records( trace_t & trace, const std::span<const std::byte> & data )
+{
+	for( std::size_t pos = 0; pos + sizeof(TraceRecord) <= data.size(); pos += sizeof(TraceRecord) ) {
+		TraceRecord record;
+		memcpy( &record, data.data() + pos, sizeof(record) );
+
+		if( record.get_op() != Op::None ) {
+			trace.push_back( record );
+		}
+	}
+}
+
+bool read_log( const char *name, std::size_t sector_size, trace_t & trace )
+{
+	bytes_t image;
+
+	if( !read_file( name, image ) || sector_size == 0 || image.size() % sector_size != 0 ) {
+		return false;
+	}
+
+	std::vector<std::size_t> sizes( image.size() / sector_size, sector_size );
+	SimulatedRawDriver raw( image, sizes );
+	GenericFlashDriver driver( raw );
+	CircularLog log( driver, TracingMemoryInterface::LOG_RECORD_SIZE );
+
+	if( !log.mount() ) {
+		return false;
+	}
+
+	for( const CircularLog::Record & record : log ) {
+		append_records( trace, record.data );
+	}
+
+	return true;
+}
+
+/**
+ * a configuration, that is rewritten, and a log, that is appended
+ */
+trace_t generate_trace()
+{
+	Flash flash;
+	std::vector<TraceRecord> ring( 4096 );
+	TracingMemoryInterface tracing( flash.driver, ring, [&flash]() {
+		return static_cast<uint32_t>( flash.raw.get_microseconds() );
+	});
+
+	bytes_t config( 256 );
+	bytes_t entry( 64 );
+	std::size_t log_offset = 16*1024;
+
+	for( unsigned update = 0; update < 600; update++ ) {
+		if( update % 10 == 0 ) {
+			std::span<std::byte> read_span( config );
+			tracing.read( 100, read_span );
+		}
+
+		std::fill( config.begin(), config.end(), static_cast<std::byte>( update ) );
+		tracing.write( 100, config );
+
+		if( log_offset + entry.size() > 48*1024 ) {
+			tracing.erase( 16*1024, 32*1024 );
+			log_offset = 16*1024;
+		}
+
+		tracing.write( log_offset, entry );
+		log_offset += entry.size();
+
+		flash.raw.advance_time( 10000 );
+	}
+
+	trace_t trace;
+	tracing.for_each_record( [&trace]( const TraceRecord & record ) {
+		trace.push_back( record );
+	});
+
+	return trace;
+}
+
+/**
+ * data for a write, compressible like most of our structures
+ */
+bytes_t make_data( std::size_t address, std::size_t size, std::size_t seq )
+{
+	bytes_t data( size );
+
+	for( std::size_t i = 0; i < size; i++ ) {
+		data[i] = static_cast<std::byte>( ((address + i) / 8) ^ seq );
+	}
+
+	return data;
+}
+
+/**
+ * largest address + 1 of the trace
+ */
+std::size_t get_extent( const trace_t & trace )
+{
+	std::size_t extent = 0;
+
+	for( const TraceRecord & record : trace ) {
+		extent = std::max( extent, static_cast<std::size_t>( record.address ) + record.get_size() );
+	}
+
+	return extent;
+}
+
+/**
+ * replays one record, a copy is done at its CopySource record
+ */
+template<class EXECUTE> void replay( const trace_t & trace, EXECUTE execute )
+{
+	for( std::size_t i = 0; i < trace.size(); i++ ) {
+		const TraceRecord & record = trace[i];
+
+		if( record.get_op() == Op::Copy ) {
+			continue;
+		}
+
+		if( record.get_op() == Op::CopySource ) {
+			if( i > 0 && trace[i-1].get_op() == Op::Copy ) {
+				execute( trace[i-1], record.address, i );
+			}
+			continue;
+		}
+
+		execute( record, 0, i );
+	}
+}
+
+/**
+ * executes a record synchronously on memory
+ * returns false if it failed
+ */
+bool execute_on( MemoryInterface & memory, const TraceRecord & record, std::size_t source, std::size_t seq, bool program_as_write )
+{
+	const std::size_t size = record.get_size();
+
+	switch( record.get_op() )
+	{
+	case Op::Read: {
+		bytes_t data( size );
+		std::span<std::byte> read_span( data );
+		return memory.read( record.address, read_span ) == size;
+	}
+
+	case Op::Write:
+		return memory.write( record.address, make_data( record.address, size, seq ) ) == size;
+
+	case Op::Erase:
+		return memory.erase( record.address, size );
+
+	case Op::Program: {
+		// clearing all bits is valid for any previous content
+		const bytes_t data( size, std::byte(0) );
+
+		if( program_as_write ) {
+			return memory.write( record.address, data ) == size;
+		}
+
+		return memory.program( record.address, data ) == size;
+	}
+
+	case Op::Copy:
+		return memory.copy( record.address, source, size );
+
+	default:
+		return true;
+	}
+}
+
+void finish( Result & result, const Flash & flash )
+{
+	for( std::size_t page = 0; page < flash.raw.get_page_count(); page++ ) {
+		result.erases += flash.raw.get_erase_count( page );
+		result.max_erases = std::max( result.max_erases, flash.raw.get_erase_count( page ) );
+	}
+
+	result.bytes_programmed = flash.raw.get_statistic().bytes_programmed;
+	result.time_us = flash.raw.get_microseconds();
+}
+
+Result replay_plain( const trace_t & trace )
+{
+	Flash flash;
+	Result result;
+
+	replay( trace, [&]( const TraceRecord & record, std::size_t source, std::size_t seq ) {
+		if( !execute_on( flash.driver, record, source, seq, false ) ) {
+			result.failed++;
+		}
+	});
+
+	finish( result, flash );
+	return result;
+}
+
+Result replay_scheduled( const trace_t & trace )
+{
+	Flash flash;
+	Result result;
+	bytes_t merge_buffer( flash.driver.get_page_size() );
+
+	ScheduledMemoryInterface scheduled( flash.driver, merge_buffer, [&flash]() {
+		return static_cast<uint32_t>( flash.raw.get_microseconds() );
+	});
+
+	// no worker thread, the waiting caller does the work
+	scheduled.wait_func = [&scheduled]() {
+		scheduled.process();
+	};
+
+	// data of the queued writes
+	std::deque<bytes_t> pending;
+
+	auto drain = [&]() {
+		scheduled.process();
+		pending.clear();
+	};
+
+	replay( trace, [&]( const TraceRecord & record, std::size_t source, std::size_t seq ) {
+		switch( record.get_op() )
+		{
+		case Op::Write:
+			pending.push_back( make_data( record.address, record.get_size(), seq ) );
+
+			while( !scheduled.write_async( record.address, pending.back(), nullptr ) ) {
+				scheduled.process();
+				pending.erase( pending.begin(), pending.end() - 1 );
+			}
+			return;
+
+		case Op::Program:
+		case Op::Copy:
+			// not queued, done directly after the queued requests
+			drain();
+
+			if( !execute_on( flash.driver, record, source, seq, false ) ) {
+				result.failed++;
+			}
+			return;
+
+		default:
+			if( !execute_on( scheduled, record, source, seq, false ) ) {
+				result.failed++;
+			}
+
+			// a synchronous call waits until everything before is done
+			pending.clear();
+			return;
+		}
+	});
+
+	drain();
+
+	finish( result, flash );
+	return result;
+}
+
+Result replay_compressed( const trace_t & trace )
+{
+	Flash flash;
+	Result result;
+
+	const std::size_t chunk_size = CompressedMemoryInterface::CHUNK_SIZE;
+	const std::size_t size = std::min( (get_extent( trace ) + chunk_size - 1) / chunk_size * chunk_size,
+									   CompressedMemoryInterface::MAX_CHUNKS * chunk_size );
+
+	CompressedMemoryInterface compressed( flash.driver, size );
+
+	if( !compressed.format() ) {
+		result.failed = trace.size();
+		return result;
+	}
+
+	flash.raw.clear_statistic();
+
+	replay( trace, [&]( const TraceRecord & record, std::size_t source, std::size_t seq ) {
+		if( !execute_on( compressed, record, source, seq, true ) ) {
+			result.failed++;
+		}
+	});
+
+	finish( result, flash );
+	return result;
+}
+
+Result replay_cached( const trace_t & trace, CachedMemoryInterface::Statistic & statistic )
+{
+	Flash flash;
+	Result result;
+	bytes_t cache_memory( 4*1024 );
+
+	CachedMemoryInterface cached( flash.driver, cache_memory, 256 );
+
+	replay( trace, [&]( const TraceRecord & record, std::size_t source, std::size_t seq ) {
+		if( !execute_on( cached, record, source, seq, false ) ) {
+			result.failed++;
+		}
+	});
+
+	statistic = cached.get_statistic();
+
+	finish( result, flash );
+	return result;
+}
+
+void print( const char *name, const Result & result )
+{
+	std::printf( "%-12s %8zu %8zu %10zu %12zu %12.1f\n",
+			name,
+			result.failed,
+			result.erases,
+			result.max_erases,
+			result.bytes_programmed,
+			static_cast<double>( result.time_us ) / 1000.0 );
+}
+
+} // namespace
+
+int main( int argc, char **argv )
+{
+	trace_t trace;
+
+	if( argc == 1 ) {
+		trace = generate_trace();
+	} else if( argc == 3 && strcmp( argv[1], "--raw" ) == 0 ) {
+		bytes_t data;
+
+		if( !read_file( argv[2], data ) ) {
+			std::fprintf( stderr, "cannot read %s\n", argv[2] );
+			return 1;
+		}
+
+		append_records( trace, data );
+	} else if( argc == 4 && strcmp( argv[1], "--log" ) == 0 ) {
+		if( !read_log( argv[2], std::strtoul( argv[3], nullptr, 10 ) * 1024, trace ) ) {
+			std::fprintf( stderr, "cannot read the log %s\n", argv[2] );
+			return 1;
+		}
+	} else {
+		std::fprintf( stderr, "usage: %s [--raw ring.bin | --log log.bin sector_kb]\n", argv[0] );
+		return 1;
+	}
+
+	if( get_extent( trace ) > FLASH_SIZE ) {
+		std::fprintf( stderr, "the trace is larger than the simulated flash\n" );
+		return 1;
+	}
+
+	std::size_t counts[8] = {};
+
+	for( const TraceRecord & record : trace ) {
+		counts[static_cast<std::size_t>( record.get_op() )]++;
+	}
+
+	const uint32_t duration_us = trace.empty() ? 0 : trace.back().time_us - trace.front().time_us;
+
+	std::printf( "%zu records: %zu reads, %zu writes, %zu erases, %zu programs, %zu copies, traced %.1f ms\n\n",
+			trace.size(),
+			counts[static_cast<std::size_t>( Op::Read )],
+			counts[static_cast<std::size_t>( Op::Write )],
+			counts[static_cast<std::size_t>( Op::Erase )],
+			counts[static_cast<std::size_t>( Op::Program )],
+			counts[static_cast<std::size_t>( Op::Copy )],
+			duration_us / 1000.0 );
+
+	std::printf( "%-12s %8s %8s %10s %12s %12s\n", "stack", "failed", "erases", "max/sector", "programmed", "time ms" );
+
+	print( "plain", replay_plain( trace ) );
+	print( "scheduled", replay_scheduled( trace ) );
+	print( "compressed", replay_compressed( trace ) );
+
+	CachedMemoryInterface::Statistic cache_statistic;
+	print( "cached", replay_cached( trace, cache_statistic ) );
+
+	std::printf( "\ncache: %zu hits, %zu misses, %zu read ahead, %zu bypassed, %zu backend reads, %zu invalidated\n",
+			cache_statistic.hits,
+			cache_statistic.misses,
+			cache_statistic.read_ahead,
+			cache_statistic.bypassed,
+			cache_statistic.backend_reads,
+			cache_statistic.invalidated );
+
+	return 0;
+}